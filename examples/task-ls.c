@@ -1,8 +1,5 @@
 #include <iris/iris.h>
 
-static GMutex *mutex;
-static GCond  *cond;
-
 void
 worker (IrisTask *task,
         gpointer  user_data)
@@ -11,12 +8,21 @@ worker (IrisTask *task,
 	GDir        *dir;
 	const gchar *name;
 
+	/* Reading the directory can block on the disk, so let the scheduler
+	 * carry on with other work meanwhile.
+	 */
+	iris_thread_enter_blocking ();
+
 	dir = g_dir_open ((gchar*)user_data, 0, NULL);
 
 	while ((name = g_dir_read_name (dir)) != NULL) {
 		list = g_list_prepend (list, g_strdup (name));
 	}
 
+	g_dir_close (dir);
+
+	iris_thread_leave_blocking ();
+
 	IRIS_TASK_RETURN_VALUE (task, G_TYPE_POINTER, list);
 }
 
@@ -35,10 +41,6 @@ callback (IrisTask *task,
 		g_print ("%s\n", (gchar*)iter->data);
 		g_free (iter->data);
 	}
-
-	g_mutex_lock (mutex);
-	g_cond_signal (cond);
-	g_mutex_unlock (mutex);
 }
 
 gint
@@ -53,16 +55,13 @@ main (gint   argc,
 
 	iris_init ();
 
-	mutex = g_mutex_new ();
-	cond = g_cond_new ();
-
-	g_mutex_lock (mutex);
 	task = iris_task_new (worker, dir, NULL);
+	g_object_ref (task);
 	iris_task_add_callback (task, callback, NULL, NULL);
 	iris_task_run (task);
 
-	g_cond_wait (cond, mutex);
-	g_mutex_unlock (mutex);
+	iris_task_wait (task);
+	g_object_unref (task);
 
 	g_free (dir);
 
@@ -22,6 +22,7 @@
 #include "iris-arbiter-private.h"
 #include "iris-port.h"
 #include "iris-receiver-private.h"
+#include "iris-trace-private.h"
 
 /**
  * SECTION:iris-arbiter
@@ -95,10 +96,16 @@ IrisReceiveDecision
 iris_arbiter_can_receive (IrisArbiter  *arbiter,
                           IrisReceiver *receiver)
 {
+	IrisReceiveDecision decision = IRIS_RECEIVE_NOW;
+
 	g_return_val_if_fail (IRIS_IS_ARBITER (arbiter), IRIS_RECEIVE_NEVER);
+
 	if (IRIS_ARBITER_GET_CLASS (arbiter)->can_receive)
-		return IRIS_ARBITER_GET_CLASS (arbiter)->can_receive (arbiter, receiver);
-	return IRIS_RECEIVE_NOW;
+		decision = IRIS_ARBITER_GET_CLASS (arbiter)->can_receive (arbiter, receiver);
+
+	IRIS_TRACE (IRIS_TRACE_ARBITER_DECISION, arbiter, receiver, decision);
+
+	return decision;
 }
 
 /**
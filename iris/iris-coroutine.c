@@ -0,0 +1,500 @@
+/* iris-coroutine.c
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "iris-coroutine.h"
+#include "iris-receiver-private.h"
+#include "iris-task-private.h"
+
+/**
+ * SECTION:iris-coroutine
+ * @title: IrisCoroutine
+ * @short_description: A task that can wait without blocking its thread
+ * @see_also: #IrisTask
+ *
+ * #IrisCoroutine is an #IrisTask whose work function runs on a stack of its
+ * own. Inside it, iris_coroutine_await() waits for another task to finish
+ * and iris_coroutine_await_port() waits for a message on an #IrisPort, but
+ * instead of blocking the thread they suspend the coroutine. The thread
+ * goes on to other work, and when the wait is over the coroutine is queued
+ * on its work scheduler again and carries on from where it left off,
+ * possibly on a different thread.
+ *
+ * A suspended coroutine costs no more than its stack, so hundreds of
+ * thousands of them can be waiting at once on a handful of threads, where
+ * the same number of #IrisTask<!-- -->s calling iris_task_wait() would need
+ * a thread each. Apart from that a coroutine behaves like any other task:
+ * it can have callbacks, be a dependency, or be cancelled, although a
+ * suspended coroutine only notices a cancel once it resumes.
+ *
+ * Each coroutine gets a stack of 64KiB, so it should not recurse deeply or
+ * keep large buffers on the stack. Overflowing it hits a guard page and
+ * crashes rather than corrupting memory. Stacks are only held while the
+ * coroutine is running or suspended, and finished ones are kept for reuse.
+ * Since the coroutine can come back on a different thread, it should not
+ * rely on thread-local data across an await, or hold a lock over one.
+ *
+ * |[
+ * static void
+ * fetch_both (IrisCoroutine *coroutine,
+ *             gpointer       user_data)
+ * {
+ *   IrisTask *first = iris_task_new (fetch_first, NULL, NULL),
+ *            *second = iris_task_new (fetch_second, NULL, NULL);
+ *
+ *   g_object_ref (first);
+ *   g_object_ref (second);
+ *   iris_task_run (first);
+ *   iris_task_run (second);
+ *
+ *   iris_coroutine_await (first);
+ *   iris_coroutine_await (second);
+ *
+ *   ...
+ * }
+ * ]|
+ */
+
+#define STACK_SIZE      (64 * 1024)
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS   MAP_ANON
+#endif
+
+/* Finished stacks kept for reuse; any more than this are freed */
+#define STACK_POOL_MAX  256
+
+#define IRIS_COROUTINE_GET_PRIVATE(object)      \
+	(G_TYPE_INSTANCE_GET_PRIVATE((object),      \
+	 IRIS_TYPE_COROUTINE, IrisCoroutinePrivate))
+
+struct _IrisCoroutinePrivate
+{
+	ucontext_t     context;       /* Where the body is up to.          */
+	ucontext_t     caller;        /* The thread that switched us in,   *
+	                               * which we go back to on suspend.   */
+	gpointer       stack;         /* Our stack, while the body runs.   */
+	gboolean       done;          /* The body has returned.            */
+
+	volatile gint  wake_pending;  /* Set to 2 before suspending. The   *
+	                               * wake and the suspend each take    *
+	                               * one off, and whichever is second  *
+	                               * resumes the coroutine.            */
+
+	IrisMessage   *message;       /* Message for await_port()          */
+};
+
+G_DEFINE_TYPE (IrisCoroutine, iris_coroutine, IRIS_TYPE_TASK);
+
+/* The coroutine running on this thread, or NULL */
+static GStaticPrivate current_coroutine = G_STATIC_PRIVATE_INIT;
+
+G_LOCK_DEFINE_STATIC (stack_pool);
+static GTrashStack *stack_pool = NULL;
+static guint        stack_pool_size = 0;
+
+/**************************************************************************
+ *                             Stack pool                                 *
+ *************************************************************************/
+
+/* Size of the inaccessible page below each stack */
+static gsize
+iris_coroutine_guard_size (void)
+{
+	static gsize guard_size = 0;
+
+	if (G_UNLIKELY (guard_size == 0))
+		guard_size = sysconf (_SC_PAGESIZE);
+
+	return guard_size;
+}
+
+static gpointer
+iris_coroutine_stack_new (void)
+{
+	gpointer stack;
+	gsize    guard_size;
+
+	G_LOCK (stack_pool);
+	stack = g_trash_stack_pop (&stack_pool);
+	if (stack != NULL)
+		stack_pool_size --;
+	G_UNLOCK (stack_pool);
+
+	if (stack != NULL)
+		return stack;
+
+	/* Stacks grow down, so the guard page goes at the bottom where an
+	 * overflow faults instead of running into someone else's memory.
+	 * Pages the coroutine never touches are not committed, so most of the
+	 * stack costs address space only.
+	 */
+	guard_size = iris_coroutine_guard_size ();
+	stack = mmap (NULL, guard_size + STACK_SIZE, PROT_READ | PROT_WRITE,
+	              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (stack == MAP_FAILED)
+		g_error ("Could not allocate a coroutine stack");
+
+	if (mprotect (stack, guard_size, PROT_NONE) != 0)
+		g_error ("Could not protect a coroutine stack");
+
+	return (gchar*)stack + guard_size;
+}
+
+static void
+iris_coroutine_stack_free (gpointer stack)
+{
+	gsize guard_size;
+
+	G_LOCK (stack_pool);
+	if (stack_pool_size < STACK_POOL_MAX) {
+		g_trash_stack_push (&stack_pool, stack);
+		stack_pool_size ++;
+		stack = NULL;
+	}
+	G_UNLOCK (stack_pool);
+
+	if (stack != NULL) {
+		guard_size = iris_coroutine_guard_size ();
+		munmap ((gchar*)stack - guard_size, guard_size + STACK_SIZE);
+	}
+}
+
+/**************************************************************************
+ *                          Switching stacks                              *
+ *************************************************************************/
+
+static void
+iris_coroutine_entry (void)
+{
+	IrisCoroutine *coroutine;
+
+	coroutine = g_static_private_get (&current_coroutine);
+
+	/* Run the body, and post the task's finish messages */
+	IRIS_TASK_CLASS (iris_coroutine_parent_class)->execute (IRIS_TASK (coroutine));
+
+	coroutine->priv->done = TRUE;
+	setcontext (&coroutine->priv->caller);
+}
+
+/* Runs @coroutine on the calling thread until the body suspends itself or
+ * returns. Called from the work scheduler, both to start the coroutine and
+ * to resume it.
+ */
+static void
+iris_coroutine_switch_in (IrisCoroutine *coroutine)
+{
+	IrisCoroutinePrivate *priv;
+	gpointer              previous;
+
+	priv = coroutine->priv;
+
+	/* Could be another coroutine, if it is waiting with
+	 * iris_scheduler_run_until() and ran us meanwhile.
+	 */
+	previous = g_static_private_get (&current_coroutine);
+
+	do {
+		g_static_private_set (&current_coroutine, coroutine, NULL);
+		swapcontext (&priv->caller, &priv->context);
+		g_static_private_set (&current_coroutine, previous, NULL);
+
+		if (priv->done) {
+			iris_coroutine_stack_free (priv->stack);
+			priv->stack = NULL;
+
+			/* Taken in iris_coroutine_execute_real() */
+			g_object_unref (coroutine);
+			return;
+		}
+
+		/* Suspended; if the wake came first we carry on here */
+	} while (g_atomic_int_dec_and_test (&priv->wake_pending));
+}
+
+static void
+iris_coroutine_suspend (IrisCoroutine *coroutine)
+{
+	swapcontext (&coroutine->priv->context, &coroutine->priv->caller);
+}
+
+/* Ends a wait started by setting 'wake_pending'. */
+static void
+iris_coroutine_wake (gpointer data)
+{
+	IrisCoroutine *coroutine = data;
+	IrisScheduler *scheduler;
+
+	if (!g_atomic_int_dec_and_test (&coroutine->priv->wake_pending))
+		/* Not suspended yet; iris_coroutine_switch_in() will carry on */
+		return;
+
+	scheduler = g_atomic_pointer_get (&IRIS_TASK (coroutine)->priv->work_scheduler);
+	iris_scheduler_queue (scheduler,
+	                      (IrisCallback)iris_coroutine_switch_in,
+	                      coroutine,
+	                      NULL);
+}
+
+/**************************************************************************
+ *                         IrisCoroutine Public API                       *
+ *************************************************************************/
+
+/**
+ * iris_coroutine_new:
+ * @func: An #IrisCoroutineFunc to execute
+ * @user_data: user data for @func
+ * @notify: An optional #GDestroyNotify or %NULL
+ *
+ * Creates a new #IrisCoroutine, which runs @func on its own stack when it
+ * is run with iris_task_run().
+ *
+ * Return value: the newly created #IrisCoroutine instance
+ */
+IrisCoroutine*
+iris_coroutine_new (IrisCoroutineFunc func,
+                    gpointer          user_data,
+                    GDestroyNotify    notify)
+{
+	return iris_coroutine_new_full (func, user_data, notify, NULL, NULL, NULL);
+}
+
+/**
+ * iris_coroutine_new_full:
+ * @func: An #IrisCoroutineFunc to execute
+ * @user_data: user data for @func
+ * @notify: An optional #GDestroyNotify or %NULL
+ * @control_scheduler: An #IrisScheduler, or %NULL to use the default
+ * @work_scheduler: An #IrisScheduler, or %NULL to use the default
+ * @context: A #GMainContext for the callbacks, or %NULL
+ *
+ * Like iris_coroutine_new(), but with the same options as
+ * iris_task_new_full(). @func runs on the threads of @work_scheduler, and
+ * is queued on it again each time it resumes.
+ *
+ * Return value: the newly created #IrisCoroutine instance
+ */
+IrisCoroutine*
+iris_coroutine_new_full (IrisCoroutineFunc  func,
+                         gpointer           user_data,
+                         GDestroyNotify     notify,
+                         IrisScheduler     *control_scheduler,
+                         IrisScheduler     *work_scheduler,
+                         GMainContext      *context)
+{
+	IrisCoroutine *coroutine;
+	GClosure      *closure;
+
+	g_return_val_if_fail (func != NULL, NULL);
+
+	coroutine = g_object_new (IRIS_TYPE_COROUTINE,
+	                          "control-scheduler", control_scheduler,
+	                          "work-scheduler", work_scheduler,
+	                          NULL);
+
+	closure = g_cclosure_new (G_CALLBACK (func),
+	                          user_data,
+	                          (GClosureNotify)notify);
+	g_closure_set_marshal (closure, g_cclosure_marshal_VOID__VOID);
+
+	g_closure_unref (IRIS_TASK (coroutine)->priv->closure);
+	IRIS_TASK (coroutine)->priv->closure = closure;
+
+	if (context)
+		iris_task_set_main_context (IRIS_TASK (coroutine), context);
+
+	return coroutine;
+}
+
+/**
+ * iris_coroutine_get_current:
+ *
+ * Returns the coroutine whose body is running on the calling thread.
+ *
+ * Return value: An #IrisCoroutine, or %NULL if not called from one.
+ */
+IrisCoroutine*
+iris_coroutine_get_current (void)
+{
+	return g_static_private_get (&current_coroutine);
+}
+
+/**
+ * iris_coroutine_await:
+ * @task: An #IrisTask
+ *
+ * Suspends the calling coroutine until @task has finished, including
+ * running its callbacks or errbacks, and returns once it has been resumed.
+ * The coroutine's thread runs other work meanwhile.
+ *
+ * The caller must hold a reference on @task, and @task must have been run,
+ * or be a dependency of a task that has, or this will never return. If
+ * called from outside a coroutine, this is the same as iris_task_wait().
+ */
+void
+iris_coroutine_await (IrisTask *task)
+{
+	IrisCoroutine *coroutine;
+
+	g_return_if_fail (IRIS_IS_TASK (task));
+
+	coroutine = g_static_private_get (&current_coroutine);
+
+	if (coroutine == NULL) {
+		iris_task_wait (task);
+		return;
+	}
+
+	g_return_if_fail (task != IRIS_TASK (coroutine));
+
+	g_atomic_int_set (&coroutine->priv->wake_pending, 2);
+
+	if (!iris_task_add_waiter (task, iris_coroutine_wake, coroutine))
+		/* Finished already */
+		return;
+
+	iris_coroutine_suspend (coroutine);
+}
+
+static void
+iris_coroutine_port_cb (IrisMessage *message,
+                        gpointer     user_data)
+{
+	IrisCoroutine *coroutine = user_data;
+
+	coroutine->priv->message = iris_message_ref (message);
+	iris_coroutine_wake (coroutine);
+}
+
+/**
+ * iris_coroutine_await_port:
+ * @port: An #IrisPort
+ *
+ * Suspends the calling coroutine until a message arrives on @port, and
+ * returns it. If messages are queued on @port already, the first of them is
+ * returned straight away.
+ *
+ * This attaches a receiver to @port that takes a single message, so @port
+ * must not have a receiver of its own, and only one coroutine can wait on it
+ * at a time. Must be called from the body of a coroutine.
+ *
+ * Return value: the #IrisMessage, which should be freed with
+ *   iris_message_unref().
+ */
+IrisMessage*
+iris_coroutine_await_port (IrisPort *port)
+{
+	IrisCoroutine *coroutine;
+	IrisReceiver  *receiver;
+	IrisMessage   *message;
+
+	g_return_val_if_fail (IRIS_IS_PORT (port), NULL);
+
+	coroutine = g_static_private_get (&current_coroutine);
+	g_return_val_if_fail (coroutine != NULL, NULL);
+
+	receiver = g_object_new (IRIS_TYPE_RECEIVER,
+	                         "scheduler", IRIS_TASK (coroutine)->priv->work_scheduler,
+	                         NULL);
+	receiver->priv->callback = iris_coroutine_port_cb;
+	receiver->priv->data = coroutine;
+	receiver->priv->port = g_object_ref (port);
+	receiver->priv->persistent = FALSE;
+
+	g_atomic_int_set (&coroutine->priv->wake_pending, 2);
+
+	/* Our reference keeps the receiver alive until the message handler has
+	 * taken its own, since the port lets go of it as soon as it accepts the
+	 * message.
+	 */
+	iris_port_set_receiver (port, receiver);
+
+	iris_coroutine_suspend (coroutine);
+
+	message = coroutine->priv->message;
+	coroutine->priv->message = NULL;
+
+	g_object_unref (receiver->priv->port);
+	receiver->priv->port = NULL;
+	g_object_unref (receiver);
+
+	return message;
+}
+
+/**************************************************************************
+ *                 IrisCoroutine Class VTable Implementations             *
+ *************************************************************************/
+
+static void
+iris_coroutine_execute_real (IrisTask *task)
+{
+	IrisCoroutine        *coroutine;
+	IrisCoroutinePrivate *priv;
+
+	coroutine = IRIS_COROUTINE (task);
+	priv = coroutine->priv;
+
+	g_return_if_fail (priv->stack == NULL);
+
+	/* The task can finish, and lose its execution reference, before the
+	 * body has switched back off its stack.
+	 */
+	g_object_ref (coroutine);
+
+	priv->stack = iris_coroutine_stack_new ();
+	priv->done = FALSE;
+
+	getcontext (&priv->context);
+	priv->context.uc_stack.ss_sp = priv->stack;
+	priv->context.uc_stack.ss_size = STACK_SIZE;
+	priv->context.uc_link = NULL;
+	makecontext (&priv->context, iris_coroutine_entry, 0);
+
+	iris_coroutine_switch_in (coroutine);
+}
+
+static void
+iris_coroutine_class_init (IrisCoroutineClass *coroutine_class)
+{
+	IrisTaskClass *task_class;
+	GObjectClass  *object_class;
+
+	task_class = IRIS_TASK_CLASS (coroutine_class);
+	task_class->execute = iris_coroutine_execute_real;
+
+	object_class = G_OBJECT_CLASS (coroutine_class);
+	g_type_class_add_private (object_class, sizeof (IrisCoroutinePrivate));
+}
+
+static void
+iris_coroutine_init (IrisCoroutine *coroutine)
+{
+	coroutine->priv = IRIS_COROUTINE_GET_PRIVATE (coroutine);
+
+	coroutine->priv->stack = NULL;
+	coroutine->priv->done = FALSE;
+	coroutine->priv->wake_pending = 0;
+	coroutine->priv->message = NULL;
+}
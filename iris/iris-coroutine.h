@@ -0,0 +1,91 @@
+/* iris-coroutine.h
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __IRIS_COROUTINE_H__
+#define __IRIS_COROUTINE_H__
+
+#include <glib-object.h>
+
+#include "iris-message.h"
+#include "iris-port.h"
+#include "iris-task.h"
+
+G_BEGIN_DECLS
+
+#define IRIS_TYPE_COROUTINE            (iris_coroutine_get_type ())
+#define IRIS_COROUTINE(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), IRIS_TYPE_COROUTINE, IrisCoroutine))
+#define IRIS_COROUTINE_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), IRIS_TYPE_COROUTINE, IrisCoroutine const))
+#define IRIS_COROUTINE_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  IRIS_TYPE_COROUTINE, IrisCoroutineClass))
+#define IRIS_IS_COROUTINE(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), IRIS_TYPE_COROUTINE))
+#define IRIS_IS_COROUTINE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  IRIS_TYPE_COROUTINE))
+#define IRIS_COROUTINE_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  IRIS_TYPE_COROUTINE, IrisCoroutineClass))
+
+typedef struct _IrisCoroutine        IrisCoroutine;
+typedef struct _IrisCoroutineClass   IrisCoroutineClass;
+typedef struct _IrisCoroutinePrivate IrisCoroutinePrivate;
+
+/**
+ * IrisCoroutineFunc:
+ * @coroutine: An #IrisCoroutine
+ * @user_data: user specified data
+ *
+ * The body of a coroutine. It runs on its own stack, and can suspend itself
+ * with iris_coroutine_await() and iris_coroutine_await_port().
+ */
+typedef void (*IrisCoroutineFunc) (IrisCoroutine *coroutine, gpointer user_data);
+
+struct _IrisCoroutine
+{
+	IrisTask parent;
+
+	/*< private >*/
+	IrisCoroutinePrivate *priv;
+};
+
+struct _IrisCoroutineClass
+{
+	IrisTaskClass parent_class;
+
+	void     (*reserved1)           (void);
+	void     (*reserved2)           (void);
+	void     (*reserved3)           (void);
+	void     (*reserved4)           (void);
+};
+
+GType          iris_coroutine_get_type    (void) G_GNUC_CONST;
+
+IrisCoroutine* iris_coroutine_new         (IrisCoroutineFunc  func,
+                                           gpointer           user_data,
+                                           GDestroyNotify     notify);
+IrisCoroutine* iris_coroutine_new_full    (IrisCoroutineFunc  func,
+                                           gpointer           user_data,
+                                           GDestroyNotify     notify,
+                                           IrisScheduler     *control_scheduler,
+                                           IrisScheduler     *work_scheduler,
+                                           GMainContext      *context);
+
+IrisCoroutine* iris_coroutine_get_current (void);
+
+void           iris_coroutine_await       (IrisTask          *task);
+IrisMessage*   iris_coroutine_await_port  (IrisPort          *port);
+
+G_END_DECLS
+
+#endif /* __IRIS_COROUTINE_H__ */
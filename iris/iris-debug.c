@@ -22,6 +22,7 @@
 
 #include "iris-debug.h"
 #include "iris-scheduler.h"
+#include "iris-trace-private.h"
 
 #ifdef ENABLE_PROFILING
 __thread GTimer  *timer = NULL;
@@ -62,6 +63,7 @@ iris_debug_init (void)
 			debug |= IRIS_DEBUG_SECTION_RROBIN;
 	}
 
+	iris_trace_init ();
 	iris_debug_init_thread ();
 }
 
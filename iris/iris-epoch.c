@@ -0,0 +1,311 @@
+/* iris-epoch.c
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#include "iris-epoch.h"
+
+/* Epoch-based reclamation for the lock-free structures. A thread brackets
+ * any code that follows pointers into a shared structure with
+ * iris_epoch_enter() and iris_epoch_leave(). Memory unlinked from a
+ * structure is handed to iris_epoch_retire() instead of being reused
+ * straight away, and its function is only called once every thread that
+ * might still have been looking at it has left.
+ *
+ * There is a global epoch counter. Entering records the current epoch in
+ * the thread's record and marks it active. The counter can only move on
+ * when every active thread has seen its current value, so once it has
+ * moved on twice from the value read when something was retired, nobody
+ * can still be inside a section that began before it was unlinked.
+ *
+ * Each thread keeps what it retires in bags, one per epoch, and empties
+ * the bags that are old enough every ADVANCE_INTERVAL retires. Records
+ * are never freed: when a thread exits its record is marked unused, and
+ * the next new thread takes it over along with anything still waiting.
+ *
+ * Entering costs one compare-and-swap, which doubles as the barrier that
+ * stops the thread's loads from being seen before it is marked active.
+ * Sections nest, and only the outermost one touches the record.
+ */
+
+/* A power of two, so an epoch maps to the same bag when the counter
+ * wraps. Anything above 2 would do.
+ */
+#define N_LIMBO           4
+#define ADVANCE_INTERVAL  64
+
+typedef struct
+{
+	gpointer data;
+	GFunc    func;
+	gpointer user_data;
+} IrisEpochEntry;
+
+typedef struct _IrisEpochRecord IrisEpochRecord;
+
+struct _IrisEpochRecord
+{
+	IrisEpochRecord *next;               /* In 'records'                 */
+	gboolean         in_use;             /* Protected by the records lock */
+
+	/* Only the owner writes these, others read them to advance */
+	volatile gint    active;
+	volatile gint    epoch;
+
+	guint            nesting;
+	guint            n_retired;          /* Since we last tried advancing */
+	GArray          *limbo[N_LIMBO];
+	guint            limbo_epoch[N_LIMBO];
+};
+
+static volatile gint global_epoch = 0;
+
+G_LOCK_DEFINE_STATIC (records);
+static IrisEpochRecord * volatile records = NULL;
+
+#ifdef LINUX
+static __thread IrisEpochRecord *my_record = NULL;
+#endif
+
+/* Only used to hear about the thread exiting on Linux */
+static GStaticPrivate my_record_key = G_STATIC_PRIVATE_INIT;
+
+static void
+iris_epoch_reclaim (GArray *limbo)
+{
+	IrisEpochEntry *entry;
+	guint           i;
+
+	for (i = 0; i < limbo->len; i++) {
+		entry = &g_array_index (limbo, IrisEpochEntry, i);
+		entry->func (entry->data, entry->user_data);
+	}
+
+	g_array_set_size (limbo, 0);
+}
+
+/* Moves the global epoch on if every active thread has caught up with it */
+static void
+iris_epoch_try_advance (void)
+{
+	IrisEpochRecord *record;
+	gint             epoch;
+
+	epoch = g_atomic_int_get (&global_epoch);
+
+	for (record = g_atomic_pointer_get ((gpointer *)&records);
+	     record != NULL;
+	     record = record->next) {
+		if (g_atomic_int_get (&record->active) &&
+		    g_atomic_int_get (&record->epoch) != epoch)
+			return;
+	}
+
+	g_atomic_int_compare_and_exchange (&global_epoch, epoch,
+	                                   (gint)((guint)epoch + 1));
+}
+
+/* Empties the bags nobody can still be looking into */
+static void
+iris_epoch_collect (IrisEpochRecord *record)
+{
+	guint epoch;
+	gint  i;
+
+	epoch = (guint)g_atomic_int_get (&global_epoch);
+
+	for (i = 0; i < N_LIMBO; i++)
+		if (record->limbo[i]->len > 0 &&
+		    (gint)(epoch - record->limbo_epoch[i]) >= 2)
+			iris_epoch_reclaim (record->limbo[i]);
+}
+
+static void
+iris_epoch_release_record (gpointer data)
+{
+	IrisEpochRecord *record = data;
+
+	iris_epoch_try_advance ();
+	iris_epoch_try_advance ();
+	iris_epoch_collect (record);
+
+	record->nesting = 0;
+	record->n_retired = 0;
+	g_atomic_int_set (&record->active, FALSE);
+
+	/* Whatever is still in the bags waits for the next owner */
+	G_LOCK (records);
+	record->in_use = FALSE;
+	G_UNLOCK (records);
+}
+
+static IrisEpochRecord*
+iris_epoch_get_record (void)
+{
+	IrisEpochRecord *record;
+	gint             i;
+
+#ifdef LINUX
+	record = my_record;
+#else
+	record = g_static_private_get (&my_record_key);
+#endif
+
+	if (G_LIKELY (record != NULL))
+		return record;
+
+	G_LOCK (records);
+
+	for (record = records; record != NULL; record = record->next)
+		if (!record->in_use)
+			break;
+
+	if (record == NULL) {
+		record = g_slice_new0 (IrisEpochRecord);
+		for (i = 0; i < N_LIMBO; i++)
+			record->limbo[i] = g_array_new (FALSE, FALSE,
+			                                sizeof (IrisEpochEntry));
+
+		/* Fully set up before iris_epoch_try_advance() can see it */
+		record->next = records;
+		g_atomic_pointer_set ((gpointer *)&records, record);
+	}
+
+	record->in_use = TRUE;
+
+	G_UNLOCK (records);
+
+#ifdef LINUX
+	my_record = record;
+#endif
+	g_static_private_set (&my_record_key, record,
+	                      iris_epoch_release_record);
+
+	return record;
+}
+
+/*
+ * iris_epoch_enter:
+ *
+ * Marks the start of a section that may load pointers to memory which other
+ * threads retire with iris_epoch_retire(). Nothing retired after the
+ * section begins is reclaimed until iris_epoch_leave() is called. Sections
+ * may be nested.
+ */
+void
+iris_epoch_enter (void)
+{
+	IrisEpochRecord *record;
+
+	record = iris_epoch_get_record ();
+
+	if (record->nesting++ > 0)
+		return;
+
+	g_atomic_int_set (&record->epoch, g_atomic_int_get (&global_epoch));
+
+	/* Only we write 'active', so this always succeeds, but unlike a plain
+	 * store it keeps our following loads from being done before it.
+	 */
+	g_atomic_int_compare_and_exchange (&record->active, FALSE, TRUE);
+}
+
+/*
+ * iris_epoch_leave:
+ *
+ * Ends the section started by the matching iris_epoch_enter().
+ */
+void
+iris_epoch_leave (void)
+{
+	IrisEpochRecord *record;
+
+	record = iris_epoch_get_record ();
+
+	g_return_if_fail (record->nesting > 0);
+
+	if (--record->nesting > 0)
+		return;
+
+	g_atomic_int_set (&record->active, FALSE);
+}
+
+/*
+ * iris_epoch_retire:
+ * @data: memory that has been unlinked from a shared structure
+ * @func: called with @data and @user_data once no thread can see @data
+ * @user_data: passed to @func
+ *
+ * Defers reusing @data until every thread that was inside an epoch section
+ * when it was unlinked has left that section. @func is called later on the
+ * calling thread, or on another thread if this one exits first, and must
+ * not retire anything itself.
+ */
+void
+iris_epoch_retire (gpointer data,
+                   GFunc    func,
+                   gpointer user_data)
+{
+	IrisEpochRecord *record;
+	IrisEpochEntry   entry;
+	guint            epoch,
+	                 slot;
+
+	g_return_if_fail (func != NULL);
+
+	record = iris_epoch_get_record ();
+
+	epoch = (guint)g_atomic_int_get (&global_epoch);
+	slot = epoch & (N_LIMBO - 1);
+
+	/* The bag last held an epoch at least N_LIMBO ago, so it is safe */
+	if (record->limbo_epoch[slot] != epoch) {
+		iris_epoch_reclaim (record->limbo[slot]);
+		record->limbo_epoch[slot] = epoch;
+	}
+
+	entry.data = data;
+	entry.func = func;
+	entry.user_data = user_data;
+	g_array_append_val (record->limbo[slot], entry);
+
+	if (++record->n_retired >= ADVANCE_INTERVAL) {
+		record->n_retired = 0;
+		iris_epoch_try_advance ();
+		iris_epoch_collect (record);
+	}
+}
+
+/*
+ * iris_epoch_flush:
+ *
+ * Reclaims everything the calling thread has retired that no thread can
+ * still see. This is never needed for correctness, but lets a thread that
+ * is about to go quiet give back what it is holding.
+ */
+void
+iris_epoch_flush (void)
+{
+	IrisEpochRecord *record;
+
+	record = iris_epoch_get_record ();
+
+	iris_epoch_try_advance ();
+	iris_epoch_try_advance ();
+	iris_epoch_collect (record);
+}
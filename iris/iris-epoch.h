@@ -0,0 +1,37 @@
+/* iris-epoch.h
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __IRIS_EPOCH_H__
+#define __IRIS_EPOCH_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void iris_epoch_enter  (void);
+void iris_epoch_leave  (void);
+void iris_epoch_retire (gpointer data,
+                        GFunc    func,
+                        gpointer user_data);
+void iris_epoch_flush  (void);
+
+G_END_DECLS
+
+#endif /* __IRIS_EPOCH_H__ */
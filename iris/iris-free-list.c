@@ -19,20 +19,12 @@
  */
 
 #include "iris-free-list.h"
-#include "gstamppointer.h"
+#include "iris-epoch.h"
 
 /**
  * SECTION:iris-free-list
  * @short_description: A lock-free free-list data structure
  *
- * IMPORTANT NOTE
- *
- * The #IrisFreeList is only for use by pointers that have the bottom
- * two bits free. This means that for 32bit architectures the pointer
- * must be aligned to sizeof(void*).  GSlice allocations provide this.
- *
- * END IMPORTANT NOTE
- *
  * #IrisFreeList is a basic free-list used by algorithms wishing to
  * control their own basic memory management. This can be very useful
  * in a couple situations. It helps get around the problem of not having
@@ -40,13 +32,189 @@
  * in the process, it helps deal with allocator contention at the same
  * time, but only after decent use.
  *
- * Technically, using a free-list is like leaking memory. So occasionally
- * it will be a good idea to clean up the memory if it is relatively
- * precious to your user. However, this feature is not yet supported.
+ * Links given back with iris_free_list_put() are not reused straight
+ * away. They are retired through the epoch reclamation in iris-epoch.c and
+ * only become free once no thread can still be looking at them from
+ * inside a lock-free structure that took the link from this list. This is
+ * what keeps a compare-and-swap on a link from succeeding against a link
+ * that has since been reused, the ABA problem. Each thread gathers the
+ * links it puts back into a magazine and retires them a magazine at a
+ * time, so the list is only referenced once per magazine.
+ *
+ * Free links are cached in <firstterm>magazines</firstterm> of
+ * %IRIS_FREE_LIST_MAGAZINE_SIZE links. Each thread has two magazines of
+ * its own, which iris_free_list_get() and iris_free_list_put() work on
+ * without touching anything shared. Only when both of a thread's
+ * magazines are empty, or both full, does it take a full one from the
+ * list's <firstterm>depot</firstterm> or hand one over, so a producer that
+ * only gets links and a consumer that only puts them back meet once per
+ * magazine rather than once per link. The magazines belong to the thread
+ * rather than to a particular list, since one #IrisLink is as good as
+ * another.
+ *
+ * The depot keeps no more than iris_free_list_get_max_free() links. Any
+ * more are given back with g_slice_free(), so memory used during a burst
+ * is returned once the burst is over. The depot is freed along with the
+ * list, and a thread's own magazines when the thread exits.
  *
  * #IrisFreeList is safe to use from multiple threads.
  */
 
+/* A thread's magazines. The one we take from and put to is 'loaded'.
+ * 'previous' is always either full or empty, so when 'loaded' runs out or
+ * fills up, swapping the two gives us a whole magazine's worth of room or
+ * links before we need the depot.
+ */
+typedef struct
+{
+	IrisFreeListMagazine *loaded;
+	IrisFreeListMagazine *previous;
+
+	/* Links put back to 'retire_list' and not yet retired. We hold one
+	 * reference on 'retire_list' for all of them.
+	 */
+	IrisFreeList         *retire_list;
+	IrisFreeListMagazine *retiring;
+} IrisFreeListCache;
+
+#ifdef LINUX
+static __thread IrisFreeListCache *my_cache = NULL;
+#endif
+
+/* Only used to hear about the thread exiting on Linux */
+static GStaticPrivate my_cache_key = G_STATIC_PRIVATE_INIT;
+
+/* Links still to be retired when their thread exited, with the reference
+ * on their list, waiting for another thread to retire them.
+ */
+G_LOCK_DEFINE_STATIC (orphans);
+static IrisFreeListMagazine * volatile orphans = NULL;
+
+static void iris_free_list_retire_orphans (void);
+static void iris_free_list_flush_retiring (IrisFreeListCache *cache);
+
+static void
+iris_free_list_magazine_free (IrisFreeListMagazine *magazine)
+{
+	guint i;
+
+	for (i = 0; i < magazine->n_links; i++)
+		g_slice_free (IrisLink, magazine->links[i]);
+
+	g_slice_free (IrisFreeListMagazine, magazine);
+}
+
+static void
+iris_free_list_release_cache (gpointer data)
+{
+	IrisFreeListCache *cache = data;
+
+#ifdef LINUX
+	/* Anything reclaimed after this is freed rather than cached */
+	my_cache = NULL;
+#endif
+
+	iris_free_list_magazine_free (cache->loaded);
+	iris_free_list_magazine_free (cache->previous);
+
+	/* The epoch code may already have let go of this thread, so the links
+	 * we have not retired yet are left for whichever thread next retires
+	 * a magazine.
+	 */
+	if (cache->retire_list != NULL) {
+		cache->retiring->free_list = cache->retire_list;
+
+		G_LOCK (orphans);
+		cache->retiring->next = orphans;
+		g_atomic_pointer_set ((gpointer *)&orphans, cache->retiring);
+		G_UNLOCK (orphans);
+	}
+	else
+		g_slice_free (IrisFreeListMagazine, cache->retiring);
+
+	g_slice_free (IrisFreeListCache, cache);
+}
+
+/* Returns the calling thread's magazines, creating them if @create is
+ * %TRUE. While the thread is exiting this may return %NULL even so, and
+ * it must not be called with @create from anything run while it exits.
+ */
+static IrisFreeListCache*
+iris_free_list_get_cache (gboolean create)
+{
+	IrisFreeListCache *cache;
+
+#ifdef LINUX
+	cache = my_cache;
+#else
+	cache = g_static_private_get (&my_cache_key);
+#endif
+
+	if (G_LIKELY (cache != NULL) || !create)
+		return cache;
+
+	cache = g_slice_new (IrisFreeListCache);
+	cache->loaded = g_slice_new0 (IrisFreeListMagazine);
+	cache->previous = g_slice_new0 (IrisFreeListMagazine);
+	cache->retire_list = NULL;
+	cache->retiring = g_slice_new0 (IrisFreeListMagazine);
+
+#ifdef LINUX
+	my_cache = cache;
+#endif
+	g_static_private_set (&my_cache_key, cache,
+	                      iris_free_list_release_cache);
+
+	return cache;
+}
+
+/* Takes a full magazine from the depot, or returns %NULL if it is empty */
+static IrisFreeListMagazine*
+iris_free_list_depot_take (IrisFreeList *free_list)
+{
+	IrisFreeListMagazine *magazine;
+
+	/* An unlocked peek, so a thread that only ever allocates does not take
+	 * the lock for nothing. Seeing a stale NULL just means allocating.
+	 */
+	if (g_atomic_pointer_get ((gpointer *)&free_list->depot) == NULL)
+		return NULL;
+
+	g_static_mutex_lock (&free_list->depot_lock);
+
+	magazine = free_list->depot;
+	if (magazine != NULL) {
+		free_list->depot = magazine->next;
+		free_list->depot_size--;
+	}
+
+	g_static_mutex_unlock (&free_list->depot_lock);
+
+	return magazine;
+}
+
+/* Hands a full magazine to the depot, or frees it if the depot already
+ * holds as many links as it is allowed.
+ */
+static void
+iris_free_list_depot_give (IrisFreeList         *free_list,
+                           IrisFreeListMagazine *magazine)
+{
+	g_static_mutex_lock (&free_list->depot_lock);
+
+	if ((free_list->depot_size + 1) * IRIS_FREE_LIST_MAGAZINE_SIZE <= free_list->max_free) {
+		magazine->next = free_list->depot;
+		g_atomic_pointer_set ((gpointer *)&free_list->depot, magazine);
+		free_list->depot_size++;
+		magazine = NULL;
+	}
+
+	g_static_mutex_unlock (&free_list->depot_lock);
+
+	if (magazine != NULL)
+		iris_free_list_magazine_free (magazine);
+}
+
 /**
  * iris_free_list_new:
  *
@@ -60,11 +228,32 @@ iris_free_list_new (void)
 	IrisFreeList *free_list;
 	
 	free_list = g_slice_new0 (IrisFreeList);
-	free_list->head = g_slice_new0 (IrisLink);
+	free_list->depot = NULL;
+	free_list->depot_size = 0;
+	free_list->max_free = IRIS_FREE_LIST_DEFAULT_MAX_FREE;
+	g_static_mutex_init (&free_list->depot_lock);
+	free_list->ref_count = 1;
 	
 	return free_list;
 }
 
+static void
+iris_free_list_destroy (IrisFreeList *free_list)
+{
+	IrisFreeListMagazine *magazine, *tmp;
+
+	magazine = free_list->depot;
+
+	while (magazine) {
+		tmp = magazine->next;
+		iris_free_list_magazine_free (magazine);
+		magazine = tmp;
+	}
+
+	g_static_mutex_free (&free_list->depot_lock);
+	g_slice_free (IrisFreeList, free_list);
+}
+
 /**
  * iris_free_list_free:
  * @free_list: An #IrisFreeList
@@ -72,28 +261,27 @@ iris_free_list_new (void)
  * Frees the data associated with @free_list.  Unlike the other methods
  * of this data structure, this method is not always going to be thread
  * safe. Obviously you don't want to be accessing it while free'ing the
- * structure.
+ * structure. Links that were put back but not yet reclaimed keep the list
+ * alive until they are.
  */
 void
 iris_free_list_free (IrisFreeList *free_list)
 {
-	IrisLink *link, *tmp;
-	
+	IrisFreeListCache *cache;
+
 	g_return_if_fail (free_list != NULL);
-	
-_try_swap:
-	link = free_list->head;
-	if (!g_atomic_pointer_compare_and_exchange ((gpointer*)&free_list->head, link, NULL))
-		goto _try_swap;
-	
-	while (link) {
-		tmp = G_STAMP_POINTER_GET_LINK (link)->next;
-		if (link)
-			g_slice_free (IrisLink, G_STAMP_POINTER_GET_LINK (link));
-		link = tmp;
-	}
-	
-	g_slice_free (IrisFreeList, free_list);
+
+	/* Otherwise links put back by this thread would wait until it puts
+	 * one back to another list, or exits.
+	 */
+	cache = iris_free_list_get_cache (FALSE);
+	if (cache != NULL && cache->retire_list == free_list)
+		iris_free_list_flush_retiring (cache);
+	else
+		iris_free_list_retire_orphans ();
+
+	if (g_atomic_int_dec_and_test (&free_list->ref_count))
+		iris_free_list_destroy (free_list);
 }
 
 /**
@@ -108,45 +296,264 @@ _try_swap:
 IrisLink*
 iris_free_list_get (IrisFreeList *free_list)
 {
-	IrisLink *link;
+	IrisFreeListCache    *cache;
+	IrisFreeListMagazine *magazine;
+	IrisLink             *link;
 	
 	g_return_val_if_fail (free_list != NULL, NULL);
-	
-	do {
-		link = G_STAMP_POINTER_GET_LINK (free_list->head)->next;
-		if (link == NULL)
+
+	cache = iris_free_list_get_cache (TRUE);
+
+	if (G_UNLIKELY (cache->loaded->n_links == 0)) {
+		if (cache->previous->n_links > 0) {
+			magazine = cache->previous;
+			cache->previous = cache->loaded;
+			cache->loaded = magazine;
+		}
+		else if ((magazine = iris_free_list_depot_take (free_list)) != NULL) {
+			g_slice_free (IrisFreeListMagazine, cache->loaded);
+			cache->loaded = magazine;
+		}
+		else
 			return g_slice_new0 (IrisLink);
-	} while (!g_atomic_pointer_compare_and_exchange (
-				(gpointer*)&free_list->head->next,
-				link,
-				G_STAMP_POINTER_GET_LINK (link)->next));
-	
-	G_STAMP_POINTER_GET_LINK (link)->next = NULL;
-	
+	}
+
+	/* Links were cleared when they were reclaimed */
+	magazine = cache->loaded;
+	link = magazine->links[--magazine->n_links];
+
 	return link;
 }
 
+/* Adds a reclaimed @link to the calling thread's magazines */
+static void
+iris_free_list_cache_link (IrisFreeListCache *cache,
+                           IrisFreeList      *free_list,
+                           IrisLink          *link)
+{
+	IrisFreeListMagazine *magazine;
+
+	if (G_UNLIKELY (cache->loaded->n_links == IRIS_FREE_LIST_MAGAZINE_SIZE)) {
+		if (cache->previous->n_links == 0) {
+			magazine = cache->previous;
+			cache->previous = cache->loaded;
+			cache->loaded = magazine;
+		}
+		else {
+			iris_free_list_depot_give (free_list, cache->previous);
+			cache->previous = cache->loaded;
+			cache->loaded = g_slice_new0 (IrisFreeListMagazine);
+		}
+	}
+
+	magazine = cache->loaded;
+	magazine->links[magazine->n_links++] = link;
+}
+
+/* Called by the epoch code once nobody can see the links in @data any
+ * more. This may be on a thread that is exiting, which has no magazines to
+ * put them in, so they are freed instead.
+ */
+static void
+iris_free_list_reclaim (gpointer data,
+                        gpointer user_data)
+{
+	IrisFreeList         *free_list = user_data;
+	IrisFreeListMagazine *magazine = data;
+	IrisFreeListCache    *cache;
+	guint                 i;
+
+	for (i = 0; i < magazine->n_links; i++) {
+		magazine->links[i]->data = NULL;
+		magazine->links[i]->next = NULL;
+	}
+
+	cache = iris_free_list_get_cache (FALSE);
+
+	if (G_UNLIKELY (cache == NULL))
+		iris_free_list_magazine_free (magazine);
+	else if (magazine->n_links == IRIS_FREE_LIST_MAGAZINE_SIZE) {
+		/* A full magazine can be used as it is */
+		if (cache->previous->n_links == 0) {
+			g_slice_free (IrisFreeListMagazine, cache->previous);
+			cache->previous = magazine;
+		}
+		else
+			iris_free_list_depot_give (free_list, magazine);
+	}
+	else {
+		for (i = 0; i < magazine->n_links; i++)
+			iris_free_list_cache_link (cache, free_list, magazine->links[i]);
+		g_slice_free (IrisFreeListMagazine, magazine);
+	}
+
+	if (g_atomic_int_dec_and_test (&free_list->ref_count))
+		iris_free_list_destroy (free_list);
+}
+
+/* Retires whatever exiting threads left behind. Each of these magazines
+ * holds a reference on its own list.
+ */
+static void
+iris_free_list_retire_orphans (void)
+{
+	IrisFreeListMagazine *magazine, *next;
+
+	/* An unlocked peek, as in iris_free_list_depot_take() */
+	if (g_atomic_pointer_get ((gpointer *)&orphans) == NULL)
+		return;
+
+	G_LOCK (orphans);
+	magazine = orphans;
+	g_atomic_pointer_set ((gpointer *)&orphans, NULL);
+	G_UNLOCK (orphans);
+
+	for (; magazine != NULL; magazine = next) {
+		next = magazine->next;
+		iris_epoch_retire (magazine, iris_free_list_reclaim,
+		                   magazine->free_list);
+	}
+}
+
+/* Retires the links the calling thread has put back, and hands the
+ * reference it took on their list over to them.
+ */
+static void
+iris_free_list_flush_retiring (IrisFreeListCache *cache)
+{
+	IrisFreeListMagazine *magazine;
+	IrisFreeList         *free_list;
+
+	if (cache->retire_list == NULL)
+		return;
+
+	/* Ours go last: the list may have no other reference left, and could
+	 * be gone as soon as they are reclaimed.
+	 */
+	iris_free_list_retire_orphans ();
+
+	magazine = cache->retiring;
+	free_list = cache->retire_list;
+
+	cache->retiring = g_slice_new0 (IrisFreeListMagazine);
+	cache->retire_list = NULL;
+
+	iris_epoch_retire (magazine, iris_free_list_reclaim, free_list);
+}
+
 /**
  * iris_free_list_put:
  * @free_list: An #IrisFreeList
  * @link: An #IrisLink
  *
  * Puts back an #IrisLink instance back to the #IrisFreeList instance.
+ * The link is not handed out again until every thread that could still
+ * see it has moved on, so it may be put back as soon as it has been
+ * unlinked from a lock-free structure.
  */
 void
 iris_free_list_put (IrisFreeList *free_list,
                     IrisLink     *link)
 {
+	IrisFreeListCache    *cache;
+	IrisFreeListMagazine *magazine;
+
 	g_return_if_fail (free_list != NULL);
 	g_return_if_fail (link != NULL);
-	
-	G_STAMP_POINTER_GET_LINK (link)->data = NULL;
-	
-	do {
-		G_STAMP_POINTER_GET_LINK (link)->next =
-			G_STAMP_POINTER_GET_LINK (free_list->head)->next;
-	} while (!g_atomic_pointer_compare_and_exchange (
-				(gpointer*)&free_list->head->next,
-				G_STAMP_POINTER_GET_LINK (link)->next,
-				link));
+
+	cache = iris_free_list_get_cache (TRUE);
+
+	if (G_UNLIKELY (cache->retire_list != free_list)) {
+		iris_free_list_flush_retiring (cache);
+
+		g_atomic_int_inc (&free_list->ref_count);
+		cache->retire_list = free_list;
+	}
+
+	magazine = cache->retiring;
+	magazine->links[magazine->n_links++] = link;
+
+	if (G_UNLIKELY (magazine->n_links == IRIS_FREE_LIST_MAGAZINE_SIZE))
+		iris_free_list_flush_retiring (cache);
+}
+
+/**
+ * iris_free_list_flush:
+ *
+ * Retires the links the calling thread has put back since it last filled
+ * a magazine, along with any left behind by threads that have exited.
+ * Otherwise a thread that puts back only a few links holds on to them,
+ * and to their list, until it puts back more. Called by #IrisThread<!-- -->s
+ * when they go idle.
+ */
+void
+iris_free_list_flush (void)
+{
+	IrisFreeListCache *cache;
+
+	cache = iris_free_list_get_cache (FALSE);
+	if (cache != NULL && cache->retire_list != NULL)
+		iris_free_list_flush_retiring (cache);
+	else
+		iris_free_list_retire_orphans ();
+}
+
+/**
+ * iris_free_list_set_max_free:
+ * @free_list: An #IrisFreeList
+ * @max_free: the most free links to keep
+ *
+ * Sets how many free links the depot of @free_list may keep for threads to
+ * share. Links beyond this are freed as they come back, and any already
+ * over the new limit are freed straight away. It is rounded down to a
+ * whole number of magazines. The links each thread keeps for itself, at
+ * most two magazines' worth, are not counted.
+ */
+void
+iris_free_list_set_max_free (IrisFreeList *free_list,
+                             guint         max_free)
+{
+	IrisFreeListMagazine *surplus = NULL,
+	                     *magazine;
+
+	g_return_if_fail (free_list != NULL);
+
+	g_static_mutex_lock (&free_list->depot_lock);
+
+	free_list->max_free = max_free;
+
+	while (free_list->depot_size * IRIS_FREE_LIST_MAGAZINE_SIZE > max_free) {
+		magazine = free_list->depot;
+		free_list->depot = magazine->next;
+		free_list->depot_size--;
+
+		magazine->next = surplus;
+		surplus = magazine;
+	}
+
+	g_static_mutex_unlock (&free_list->depot_lock);
+
+	while (surplus != NULL) {
+		magazine = surplus;
+		surplus = magazine->next;
+		iris_free_list_magazine_free (magazine);
+	}
+}
+
+/**
+ * iris_free_list_get_max_free:
+ * @free_list: An #IrisFreeList
+ *
+ * Retrieves the most free links the depot of @free_list keeps, as set
+ * with iris_free_list_set_max_free().
+ *
+ * Return value: the most free links kept, which defaults to
+ *               %IRIS_FREE_LIST_DEFAULT_MAX_FREE
+ */
+guint
+iris_free_list_get_max_free (IrisFreeList *free_list)
+{
+	g_return_val_if_fail (free_list != NULL, 0);
+
+	return free_list->max_free;
 }
@@ -27,17 +27,44 @@
 
 G_BEGIN_DECLS
 
-typedef struct _IrisFreeList IrisFreeList;
+typedef struct _IrisFreeList         IrisFreeList;
+typedef struct _IrisFreeListMagazine IrisFreeListMagazine;
+
+/* Number of links each thread hands to or takes from the depot at once */
+#define IRIS_FREE_LIST_MAGAZINE_SIZE 32
+
+/* Number of links a free list keeps in its depot unless told otherwise */
+#define IRIS_FREE_LIST_DEFAULT_MAX_FREE 1024
+
+struct _IrisFreeListMagazine
+{
+	IrisFreeListMagazine *next;          /* In the depot or orphans     */
+	IrisFreeList         *free_list;     /* Whose links, while orphaned */
+	guint                 n_links;
+	IrisLink             *links[IRIS_FREE_LIST_MAGAZINE_SIZE];
+};
 
 struct _IrisFreeList
 {
-	IrisLink *head;
+	/* Full magazines shared between threads, protected by depot_lock */
+	IrisFreeListMagazine * volatile depot;
+	guint                           depot_size; /* In magazines */
+	guint                           max_free;   /* In links     */
+	GStaticMutex                    depot_lock;
+
+	/* One for the owner, one per magazine of links waiting to be
+	 * reclaimed
+	 */
+	volatile gint                   ref_count;
 };
 
-IrisFreeList* iris_free_list_new  (void);
-void          iris_free_list_free (IrisFreeList *free_list);
-IrisLink*     iris_free_list_get  (IrisFreeList *free_list);
-void          iris_free_list_put  (IrisFreeList *free_list, IrisLink *link);
+IrisFreeList* iris_free_list_new          (void);
+void          iris_free_list_free         (IrisFreeList *free_list);
+IrisLink*     iris_free_list_get          (IrisFreeList *free_list);
+void          iris_free_list_put          (IrisFreeList *free_list, IrisLink *link);
+void          iris_free_list_flush        (void);
+void          iris_free_list_set_max_free (IrisFreeList *free_list, guint max_free);
+guint         iris_free_list_get_max_free (IrisFreeList *free_list);
 
 G_END_DECLS
 
@@ -55,10 +55,11 @@ struct _IrisGMainSchedulerPrivate
 G_DEFINE_TYPE (IrisGMainScheduler, iris_gmainscheduler, IRIS_TYPE_SCHEDULER);
 
 static void
-iris_gmainscheduler_queue_real (IrisScheduler  *scheduler,
-                                IrisCallback    func,
-                                gpointer        data,
-                                GDestroyNotify  destroy_notify)
+iris_gmainscheduler_queue_full_real (IrisScheduler  *scheduler,
+                                     IrisCallback    func,
+                                     gpointer        data,
+                                     GDestroyNotify  destroy_notify,
+                                     IrisPriority    priority)
 {
 	IrisGMainSchedulerPrivate *priv;
 	IrisThreadWork            *thread_work;
@@ -70,64 +71,47 @@ iris_gmainscheduler_queue_real (IrisScheduler  *scheduler,
 
 	g_return_if_fail (priv->source != 0);
 
-	thread_work = iris_thread_work_new (func, data, destroy_notify);
-	iris_queue_push (priv->queue, thread_work);
+	thread_work = iris_scheduler_work_new (scheduler, func, data,
+	                                       destroy_notify, priority);
+	iris_priority_queue_push_full (IRIS_PRIORITY_QUEUE (priv->queue),
+	                               thread_work,
+	                               priority);
 	g_main_context_wakeup (priv->context);
 }
 
-static gboolean
-iris_gmainscheduler_unqueue_real (IrisScheduler *scheduler,
-                                  gpointer       work_item)
+static void
+iris_gmainscheduler_queue_real (IrisScheduler  *scheduler,
+                                IrisCallback    func,
+                                gpointer        data,
+                                GDestroyNotify  destroy_notify)
 {
-	IrisThreadWork            *thread_work = (IrisThreadWork *)work_item;
-
-	g_return_val_if_fail (scheduler != NULL, FALSE);
-	g_return_val_if_fail (thread_work != NULL, FALSE);
-
-	thread_work->remove = TRUE;
-
-	return TRUE;
+	iris_gmainscheduler_queue_full_real (scheduler,
+	                                     func,
+	                                     data,
+	                                     destroy_notify,
+	                                     IRIS_PRIORITY_NORMAL);
 }
 
 static void
-iris_gmainscheduler_foreach_real (IrisScheduler            *scheduler,
-                                  IrisSchedulerForeachFunc  callback,
-                                  gpointer                  user_data)
+iris_gmainscheduler_queue_batch_real (IrisScheduler                *scheduler,
+                                      const IrisSchedulerBatchItem *items,
+                                      guint                         n_items)
 {
-	IrisGMainSchedulerPrivate *priv;
-	gboolean continue_flag;
-	gint     i;
+	IrisGMainSchedulerPrivate  *priv;
+	IrisThreadWork            **works;
 
 	g_return_if_fail (scheduler != NULL);
-	g_return_if_fail (callback != NULL);
 
 	priv = IRIS_GMAINSCHEDULER (scheduler)->priv;
 
-	/* Foreach the queue in a really hacky way. FIXME: don't do it like this! */
-	for (i=0; i<iris_queue_get_length (priv->queue); i++) {
-		IrisThreadWork *thread_work;
-
-		thread_work = iris_queue_try_pop (priv->queue);
-
-		if (!thread_work) break;
-
-		continue_flag = callback (scheduler,
-		                          thread_work,
-		                          thread_work->callback,
-		                          thread_work->data,
-		                          user_data);
-
-		if (thread_work->remove == FALSE)
-			iris_queue_push (priv->queue, thread_work);
-		else {
-			iris_thread_work_free (thread_work);
-		}
+	g_return_if_fail (priv->source != 0);
 
-		if (!continue_flag)
-			return;
-	}
-};
+	works = iris_scheduler_work_new_batch (scheduler, items, n_items);
+	iris_queue_push_many (priv->queue, (gpointer *)works, n_items);
+	g_main_context_wakeup (priv->context);
 
+	g_free (works);
+}
 
 static void
 iris_gmainscheduler_remove_thread_real (IrisScheduler *scheduler,
@@ -179,8 +163,8 @@ iris_gmainscheduler_class_init (IrisGMainSchedulerClass *klass)
 
 	sched_class = IRIS_SCHEDULER_CLASS (klass);
 	sched_class->queue = iris_gmainscheduler_queue_real;
-	sched_class->unqueue = iris_gmainscheduler_unqueue_real;
-	sched_class->foreach = iris_gmainscheduler_foreach_real;
+	sched_class->queue_full = iris_gmainscheduler_queue_full_real;
+	sched_class->queue_batch = iris_gmainscheduler_queue_batch_real;
 	sched_class->add_thread = iris_gmainscheduler_add_thread_real;
 	sched_class->remove_thread = iris_gmainscheduler_remove_thread_real;
 	sched_class->iterate = iris_gmainscheduler_iterate_real;
@@ -196,7 +180,7 @@ iris_gmainscheduler_init (IrisGMainScheduler *gmainscheduler)
 	gmainscheduler->priv = G_TYPE_INSTANCE_GET_PRIVATE (gmainscheduler,
 	                                                     IRIS_TYPE_GMAINSCHEDULER,
 	                                                     IrisGMainSchedulerPrivate);
-	gmainscheduler->priv->queue = iris_queue_new ();
+	gmainscheduler->priv->queue = iris_priority_queue_new ();
 
 	/* Don't add us to the scheduler manager, since we don't need any threads managing */
 	IRIS_SCHEDULER(gmainscheduler)->priv->initialized = TRUE;
@@ -206,17 +190,18 @@ static gboolean
 iris_gmainscheduler_source_cb (gpointer data)
 {
 	IrisGMainSchedulerPrivate *priv;
-	IrisThreadWork            *thread_work;
+	gpointer                   items[16];
+	guint                      n_items,
+	                           i;
 
 	g_return_val_if_fail (data != NULL, FALSE);
 
 	priv = IRIS_GMAINSCHEDULER (data)->priv;
 
-	while ((thread_work = iris_queue_try_pop (priv->queue)) != NULL) {
-		if (!thread_work->remove)
-			iris_thread_work_run (thread_work);
-		iris_thread_work_free (thread_work);
-	}
+	while ((n_items = iris_queue_try_pop_many (priv->queue, items,
+	                                           G_N_ELEMENTS (items))) > 0)
+		for (i = 0; i < n_items; i++)
+			iris_thread_work_execute (items[i]);
 
 	return TRUE;
 }
@@ -0,0 +1,982 @@
+/* iris-ioscheduler.c
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef LINUX
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#include <gio/gio.h>
+
+#include "iris-ioscheduler.h"
+#include "iris-message.h"
+#include "iris-scheduler-private.h"
+#include "iris-task-private.h"
+
+/**
+ * SECTION:iris-ioscheduler
+ * @title: IrisIOScheduler
+ * @short_description: Wait for file descriptors without blocking threads
+ * @see_also: #IrisScheduler, #IrisPort
+ *
+ * #IrisIOScheduler is an #IrisScheduler with a reactor thread of its own,
+ * which waits on an epoll set for any number of file descriptors at once.
+ * Its worker threads run queued work like any other scheduler's.
+ *
+ * iris_io_watch_fd() asks for an %IRIS_IO_MESSAGE_READY message to be
+ * posted to an #IrisPort when a file descriptor becomes readable or
+ * writable. A watch fires once and is then disarmed, so that handlers
+ * running on several threads never read the same descriptor at once;
+ * call iris_io_watch_rearm() once the descriptor has been read or written
+ * until it would block, to hear about it again.
+ *
+ * iris_io_read_task_new() and iris_io_write_task_new() create #IrisTask<!--
+ * -->s that read or write a non-blocking descriptor, waiting on the reactor
+ * whenever it would block. Their result is the number of bytes transferred,
+ * as a #gint64, or a %G_IO_ERROR #GError if the call failed. Cancelling
+ * one that is waiting for its descriptor stops the wait.
+ *
+ * A pipeline can so keep thousands of descriptors busy with a few threads,
+ * instead of a thread blocked in read() for each.
+ *
+ * The reactor is only available on Linux; elsewhere watching a descriptor
+ * fails with a warning.
+ */
+
+/* Events taken from epoll_wait() at once */
+#define MAX_EVENTS 64
+
+struct _IrisIOSchedulerPrivate
+{
+	GMutex   *mutex;        /* Guards everything below, and is held by the
+	                         * reactor while it looks at a batch of events.
+	                         */
+
+	GCond    *cond;         /* Signalled when the reactor stops          */
+	GThread  *reactor;      /* Started with the first watch, and not
+	                         * joinable; NULL again once it has stopped.
+	                         */
+	gint      epoll_fd;
+	gint      wake_fd;      /* An eventfd that interrupts epoll_wait()   */
+	gboolean  quit;
+	gboolean *exited;       /* On the reactor's stack; see finalize()    */
+
+	GList    *watches;      /* Registered IrisIOWatches                  */
+	GList    *dead;         /* Removed watches, which the reactor lets go
+	                         * of once it can no longer be looking at them.
+	                         */
+};
+
+struct _IrisIOWatch
+{
+	volatile gint     ref_count;
+
+	IrisIOScheduler  *scheduler;
+	gint              fd;         /* As given                            */
+	gint              epoll_fd;   /* A dup() of 'fd', so that one
+	                               * descriptor can have several watches
+	                               */
+	guint32           events;
+
+	IrisPort         *port;       /* Posted to when ready, or else       */
+	IrisCallback      callback;   /* queued on the scheduler and the     */
+	gpointer          data;       /* watch removed.                      */
+
+	gboolean          removed;
+	GList            *link;       /* In the scheduler's 'watches'        */
+};
+
+typedef struct
+{
+	IrisTask         *task;
+	IrisScheduler    *scheduler;
+	gint              fd;
+	gpointer          buffer;
+	gsize             count;
+	gsize             done;
+	gboolean          write;
+} IrisIOOp;
+
+/* The task of an IrisIOOp, which stops waiting for its descriptor when it
+ * is cancelled.
+ */
+typedef struct
+{
+	IrisTask          parent;
+	IrisIOOp         *op;
+} IrisIOTask;
+
+typedef struct
+{
+	IrisTaskClass     parent_class;
+} IrisIOTaskClass;
+
+GType iris_io_task_get_type (void) G_GNUC_CONST;
+
+G_DEFINE_TYPE (IrisIOScheduler, iris_ioscheduler, IRIS_TYPE_SCHEDULER)
+G_DEFINE_TYPE (IrisIOTask, iris_io_task, IRIS_TYPE_TASK)
+
+G_LOCK_DEFINE_STATIC (default_io_scheduler);
+static IrisScheduler *default_io_scheduler = NULL;
+
+/**************************************************************************
+ *                               Watches                                  *
+ *************************************************************************/
+
+static GIOCondition
+condition_from_epoll (guint32 events)
+{
+	GIOCondition condition = 0;
+
+#ifdef LINUX
+	if (events & EPOLLIN)
+		condition |= G_IO_IN;
+	if (events & EPOLLOUT)
+		condition |= G_IO_OUT;
+	if (events & EPOLLPRI)
+		condition |= G_IO_PRI;
+	if (events & EPOLLERR)
+		condition |= G_IO_ERR;
+	if (events & EPOLLHUP)
+		condition |= G_IO_HUP;
+#endif
+
+	return condition;
+}
+
+static guint32
+condition_to_epoll (GIOCondition condition)
+{
+	guint32 events = 0;
+
+#ifdef LINUX
+	if (condition & G_IO_IN)
+		events |= EPOLLIN;
+	if (condition & G_IO_OUT)
+		events |= EPOLLOUT;
+	if (condition & G_IO_PRI)
+		events |= EPOLLPRI;
+
+	/* Errors and hangups are always reported */
+	events |= EPOLLONESHOT;
+#endif
+
+	return events;
+}
+
+/**
+ * iris_io_watch_ref:
+ * @watch: An #IrisIOWatch
+ *
+ * Increases the reference count of @watch.
+ *
+ * Return value: @watch
+ */
+IrisIOWatch*
+iris_io_watch_ref (IrisIOWatch *watch)
+{
+	g_return_val_if_fail (watch != NULL, NULL);
+
+	g_atomic_int_inc (&watch->ref_count);
+
+	return watch;
+}
+
+/**
+ * iris_io_watch_unref:
+ * @watch: An #IrisIOWatch
+ *
+ * Decreases the reference count of @watch. Dropping the handle returned by
+ * iris_io_watch_fd() does not remove the watch; use iris_io_watch_remove()
+ * for that.
+ */
+void
+iris_io_watch_unref (IrisIOWatch *watch)
+{
+	g_return_if_fail (watch != NULL);
+
+	if (!g_atomic_int_dec_and_test (&watch->ref_count))
+		return;
+
+	if (watch->port != NULL)
+		g_object_unref (watch->port);
+
+	g_object_unref (watch->scheduler);
+	g_slice_free (IrisIOWatch, watch);
+}
+
+static void
+iris_io_wake_reactor (IrisIOSchedulerPrivate *priv)
+{
+#ifdef LINUX
+	guint64 one = 1;
+
+	while (write (priv->wake_fd, &one, sizeof (one)) < 0 && errno == EINTR);
+#endif
+}
+
+/* Unregisters @watch, and hands it to the reactor to let go of. */
+static void
+iris_io_watch_remove_unlocked (IrisIOWatch *watch)
+{
+	IrisIOSchedulerPrivate *priv;
+
+	priv = watch->scheduler->priv;
+
+	if (watch->removed)
+		return;
+
+	watch->removed = TRUE;
+
+#ifdef LINUX
+	epoll_ctl (priv->epoll_fd, EPOLL_CTL_DEL, watch->epoll_fd, NULL);
+#endif
+	close (watch->epoll_fd);
+
+	priv->watches = g_list_delete_link (priv->watches, watch->link);
+	watch->link = NULL;
+
+	priv->dead = g_list_prepend (priv->dead, watch);
+}
+
+static gpointer
+iris_ioscheduler_reactor (gpointer data)
+{
+	IrisIOSchedulerPrivate *priv = data;
+#ifdef LINUX
+	struct epoll_event      events[MAX_EVENTS];
+	IrisIOWatch            *watch,
+	                       *ready[MAX_EVENTS];
+	GIOCondition            conditions[MAX_EVENTS];
+	IrisMessage            *message;
+	GList                  *dead,
+	                       *node;
+	guint64                 count;
+	gboolean                quit,
+	                        exited = FALSE;
+	gint                    n_events,
+	                        n_ready,
+	                        i;
+
+	priv->exited = &exited;
+
+	for (;;) {
+		n_events = epoll_wait (priv->epoll_fd, events, MAX_EVENTS, -1);
+
+		if (n_events < 0) {
+			if (errno == EINTR)
+				continue;
+
+			g_warning ("epoll_wait: %s", g_strerror (errno));
+			break;
+		}
+
+		n_ready = 0;
+
+		/* A watch removed after epoll_wait() returned is still on the dead
+		 * list, so every pointer in the batch is good until we unlock.
+		 */
+		g_mutex_lock (priv->mutex);
+
+		for (i = 0; i < n_events; i++) {
+			watch = events[i].data.ptr;
+
+			if (watch == NULL) {
+				/* Woken up */
+				while (read (priv->wake_fd, &count, sizeof (count)) < 0 &&
+				       errno == EINTR);
+				continue;
+			}
+
+			if (watch->removed)
+				continue;
+
+			if (watch->port == NULL) {
+				iris_scheduler_queue (IRIS_SCHEDULER (watch->scheduler),
+				                      watch->callback,
+				                      watch->data,
+				                      NULL);
+				iris_io_watch_remove_unlocked (watch);
+				continue;
+			}
+
+			ready[n_ready] = iris_io_watch_ref (watch);
+			conditions[n_ready] = condition_from_epoll (events[i].events);
+			n_ready ++;
+		}
+
+		quit = priv->quit;
+		dead = priv->dead;
+		priv->dead = NULL;
+
+		/* finalize() is waiting for us to let go of 'priv', and there is
+		 * nothing left to watch, so we don't touch it again.
+		 */
+		if (quit) {
+			priv->reactor = NULL;
+			g_cond_signal (priv->cond);
+		}
+
+		g_mutex_unlock (priv->mutex);
+
+		/* Posting can run the receiver straight away, and it could rearm or
+		 * remove the watch, so it is done unlocked.
+		 */
+		for (i = 0; i < n_ready; i++) {
+			message = iris_message_new_items (IRIS_IO_MESSAGE_READY,
+			                                  "fd", G_TYPE_INT, ready[i]->fd,
+			                                  "condition", G_TYPE_INT, conditions[i],
+			                                  NULL);
+			iris_port_post (ready[i]->port, message);
+			iris_io_watch_unref (ready[i]);
+		}
+
+		/* This can drop the last reference on the scheduler, after which
+		 * 'priv' is gone.
+		 */
+		for (node = dead; node; node = node->next)
+			iris_io_watch_unref (node->data);
+		g_list_free (dead);
+
+		if (quit || exited)
+			break;
+	}
+#endif
+
+	return NULL;
+}
+
+static IrisIOWatch*
+iris_io_watch_add (IrisScheduler *scheduler,
+                   gint           fd,
+                   GIOCondition   events,
+                   IrisPort      *port,
+                   IrisCallback   callback,
+                   gpointer       data)
+{
+	IrisIOSchedulerPrivate *priv;
+	IrisIOWatch            *watch;
+#ifdef LINUX
+	struct epoll_event      event;
+#endif
+
+	priv = IRIS_IOSCHEDULER (scheduler)->priv;
+
+#ifndef LINUX
+	g_warning ("%s: watching file descriptors is not supported on this "
+	           "platform", G_STRFUNC);
+	return NULL;
+#else
+	watch = g_slice_new0 (IrisIOWatch);
+	watch->ref_count = 1;
+	watch->scheduler = g_object_ref (scheduler);
+	watch->fd = fd;
+	watch->events = condition_to_epoll (events);
+	watch->port = port != NULL ? g_object_ref (port) : NULL;
+	watch->callback = callback;
+	watch->data = data;
+
+	watch->epoll_fd = dup (fd);
+	if (watch->epoll_fd < 0) {
+		g_warning ("%s: %s", G_STRFUNC, g_strerror (errno));
+		iris_io_watch_unref (watch);
+		return NULL;
+	}
+
+	g_mutex_lock (priv->mutex);
+
+	if (priv->reactor == NULL) {
+		priv->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+		priv->wake_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+		event.events = EPOLLIN;
+		event.data.ptr = NULL;
+		epoll_ctl (priv->epoll_fd, EPOLL_CTL_ADD, priv->wake_fd, &event);
+
+		priv->reactor = g_thread_create (iris_ioscheduler_reactor,
+		                                 priv, FALSE, NULL);
+	}
+
+	/* The registration holds a reference until the reactor lets go of it */
+	iris_io_watch_ref (watch);
+	priv->watches = g_list_prepend (priv->watches, watch);
+	watch->link = priv->watches;
+
+	event.events = watch->events;
+	event.data.ptr = watch;
+
+	if (epoll_ctl (priv->epoll_fd, EPOLL_CTL_ADD, watch->epoll_fd, &event) < 0) {
+		g_warning ("%s: %s", G_STRFUNC, g_strerror (errno));
+		iris_io_watch_remove_unlocked (watch);
+		g_mutex_unlock (priv->mutex);
+
+		iris_io_wake_reactor (priv);
+		iris_io_watch_unref (watch);
+		return NULL;
+	}
+
+	g_mutex_unlock (priv->mutex);
+
+	return watch;
+#endif
+}
+
+/**
+ * iris_io_watch_fd:
+ * @fd: A file descriptor
+ * @events: the #GIOCondition<!-- -->s to watch for, usually %G_IO_IN or
+ *   %G_IO_OUT. %G_IO_ERR and %G_IO_HUP are always watched for.
+ * @port: An #IrisPort
+ *
+ * Watches @fd on the default #IrisIOScheduler. See iris_io_watch_fd_full().
+ *
+ * Return value: An #IrisIOWatch, to be freed with iris_io_watch_unref(), or
+ *   %NULL if @fd could not be watched.
+ */
+IrisIOWatch*
+iris_io_watch_fd (gint          fd,
+                  GIOCondition  events,
+                  IrisPort     *port)
+{
+	return iris_io_watch_fd_full (NULL, fd, events, port);
+}
+
+/**
+ * iris_io_watch_fd_full:
+ * @scheduler: An #IrisIOScheduler, or %NULL for the default one
+ * @fd: A file descriptor
+ * @events: the #GIOCondition<!-- -->s to watch for, usually %G_IO_IN or
+ *   %G_IO_OUT. %G_IO_ERR and %G_IO_HUP are always watched for.
+ * @port: An #IrisPort
+ *
+ * Posts an %IRIS_IO_MESSAGE_READY message to @port from the reactor thread
+ * of @scheduler once @fd is ready for one of @events. The watch is then
+ * disarmed until iris_io_watch_rearm() is called, usually by the receiver
+ * of @port once it has read or written @fd until it would block.
+ *
+ * The watch holds a duplicate of @fd, so closing @fd does not end it; call
+ * iris_io_watch_remove() first.
+ *
+ * Return value: An #IrisIOWatch, to be freed with iris_io_watch_unref(), or
+ *   %NULL if @fd could not be watched.
+ */
+IrisIOWatch*
+iris_io_watch_fd_full (IrisScheduler *scheduler,
+                       gint           fd,
+                       GIOCondition   events,
+                       IrisPort      *port)
+{
+	g_return_val_if_fail (scheduler == NULL || IRIS_IS_IOSCHEDULER (scheduler), NULL);
+	g_return_val_if_fail (fd >= 0, NULL);
+	g_return_val_if_fail (IRIS_IS_PORT (port), NULL);
+
+	if (scheduler == NULL)
+		scheduler = iris_ioscheduler_get_default ();
+
+	return iris_io_watch_add (scheduler, fd, events, port, NULL, NULL);
+}
+
+/**
+ * iris_io_watch_rearm:
+ * @watch: An #IrisIOWatch
+ *
+ * Arms @watch again after it has fired, so another message is posted once
+ * its descriptor is ready. Does nothing if @watch has been removed.
+ */
+void
+iris_io_watch_rearm (IrisIOWatch *watch)
+{
+	IrisIOSchedulerPrivate *priv;
+#ifdef LINUX
+	struct epoll_event      event;
+#endif
+
+	g_return_if_fail (watch != NULL);
+
+	priv = watch->scheduler->priv;
+
+	g_mutex_lock (priv->mutex);
+
+#ifdef LINUX
+	if (!watch->removed) {
+		event.events = watch->events;
+		event.data.ptr = watch;
+		epoll_ctl (priv->epoll_fd, EPOLL_CTL_MOD, watch->epoll_fd, &event);
+	}
+#endif
+
+	g_mutex_unlock (priv->mutex);
+}
+
+/**
+ * iris_io_watch_remove:
+ * @watch: An #IrisIOWatch
+ *
+ * Stops watching the descriptor of @watch. A message that is already
+ * posted is still delivered.
+ */
+void
+iris_io_watch_remove (IrisIOWatch *watch)
+{
+	IrisIOSchedulerPrivate *priv;
+
+	g_return_if_fail (watch != NULL);
+
+	priv = watch->scheduler->priv;
+
+	g_mutex_lock (priv->mutex);
+	iris_io_watch_remove_unlocked (watch);
+	g_mutex_unlock (priv->mutex);
+
+	iris_io_wake_reactor (priv);
+}
+
+/**************************************************************************
+ *                          Read and write tasks                          *
+ *************************************************************************/
+
+static void
+iris_io_op_free (gpointer data)
+{
+	IrisIOOp *op = data;
+
+	g_object_unref (op->scheduler);
+	g_slice_free (IrisIOOp, op);
+}
+
+/* Reads or writes as far as it can without blocking, and then either waits
+ * for the descriptor on the reactor or finishes the task.
+ */
+static void iris_io_op_cancel (IrisIOOp *op);
+
+static void
+iris_io_op_step (gpointer data)
+{
+	IrisIOOp    *op = data;
+	IrisIOWatch *watch;
+	IrisTask    *task;
+	gssize       n;
+	gint         saved_errno;
+
+	if (iris_task_is_cancelled (op->task)) {
+		iris_task_work_finished (op->task);
+		return;
+	}
+
+	for (;;) {
+		if (op->write)
+			n = write (op->fd, (guint8 *)op->buffer + op->done,
+			           op->count - op->done);
+		else
+			n = read (op->fd, op->buffer, op->count);
+
+		if (n >= 0) {
+			op->done += n;
+
+			/* Writes go on until everything is written */
+			if (op->write && op->done < op->count)
+				continue;
+
+			iris_task_set_result_gtype (op->task, G_TYPE_INT64, (gint64)op->done);
+			break;
+		}
+
+		saved_errno = errno;
+
+		if (saved_errno == EINTR)
+			continue;
+
+		if (saved_errno == EAGAIN || saved_errno == EWOULDBLOCK) {
+			/* The reactor removes the watch itself once it has fired, and
+			 * the step it queues can finish the task, and free 'op', at
+			 * once; our reference keeps them until we are done.
+			 */
+			task = g_object_ref (op->task);
+			watch = iris_io_watch_add (op->scheduler, op->fd,
+			                           op->write ? G_IO_OUT : G_IO_IN,
+			                           NULL, iris_io_op_step, op);
+			if (watch != NULL) {
+				iris_io_watch_unref (watch);
+
+				/* A cancel that came in while we were reading or writing
+				 * found nothing to stop.
+				 */
+				if (iris_task_is_cancelled (task))
+					iris_io_op_cancel (op);
+
+				g_object_unref (task);
+				return;
+			}
+
+			g_object_unref (task);
+
+			/* Could not wait; the warning says why */
+			saved_errno = EIO;
+		}
+
+		IRIS_TASK_THROW_NEW (op->task, G_IO_ERROR,
+		                     g_io_error_from_errno (saved_errno),
+		                     "%s", g_strerror (saved_errno));
+		break;
+	}
+
+	iris_task_work_finished (op->task);
+}
+
+static void
+iris_io_op_run (IrisTask *task,
+                gpointer  user_data)
+{
+	IrisIOOp *op = user_data;
+
+	op->task = task;
+	iris_io_op_step (op);
+}
+
+/* Stops @op waiting for its descriptor, and lets it see it was cancelled */
+static void
+iris_io_op_cancel (IrisIOOp *op)
+{
+	IrisIOSchedulerPrivate *priv;
+	IrisIOWatch            *watch;
+	GList                  *node;
+	gboolean                waiting = FALSE;
+
+	priv = IRIS_IOSCHEDULER (op->scheduler)->priv;
+
+	g_mutex_lock (priv->mutex);
+
+	/* A watch that has fired is already gone, and has queued the step */
+	for (node = priv->watches; node; node = node->next) {
+		watch = node->data;
+
+		if (watch->port == NULL && watch->data == op) {
+			iris_io_watch_remove_unlocked (watch);
+			waiting = TRUE;
+			break;
+		}
+	}
+
+	g_mutex_unlock (priv->mutex);
+
+	if (waiting) {
+		iris_io_wake_reactor (priv);
+		iris_scheduler_queue (op->scheduler, iris_io_op_step, op, NULL);
+	}
+}
+
+static void
+iris_io_task_handle_message (IrisTask    *task,
+                             IrisMessage *message)
+{
+	IRIS_TASK_CLASS (iris_io_task_parent_class)->handle_message (task, message);
+
+	if (message->what == IRIS_TASK_MESSAGE_START_CANCEL &&
+	    iris_task_is_cancelled (task))
+		iris_io_op_cancel (((IrisIOTask *)task)->op);
+}
+
+static void
+iris_io_task_class_init (IrisIOTaskClass *klass)
+{
+	IRIS_TASK_CLASS (klass)->handle_message = iris_io_task_handle_message;
+}
+
+static void
+iris_io_task_init (IrisIOTask *task)
+{
+	task->op = NULL;
+}
+
+static IrisTask*
+iris_io_op_task_new (IrisScheduler *scheduler,
+                     gint           fd,
+                     gpointer       buffer,
+                     gsize          count,
+                     gboolean       write)
+{
+	IrisIOOp *op;
+	IrisTask *task;
+	GClosure *closure;
+	gint      flags;
+
+	if (scheduler == NULL)
+		scheduler = iris_ioscheduler_get_default ();
+
+	flags = fcntl (fd, F_GETFL);
+	if (flags >= 0 && !(flags & O_NONBLOCK))
+		fcntl (fd, F_SETFL, flags | O_NONBLOCK);
+
+	op = g_slice_new0 (IrisIOOp);
+	op->scheduler = g_object_ref (scheduler);
+	op->fd = fd;
+	op->buffer = buffer;
+	op->count = count;
+	op->write = write;
+
+	task = g_object_new (iris_io_task_get_type (),
+	                     "control-scheduler", NULL,
+	                     "work-scheduler", scheduler,
+	                     NULL);
+	((IrisIOTask *)task)->op = op;
+
+	closure = g_cclosure_new (G_CALLBACK (iris_io_op_run),
+	                          op,
+	                          (GClosureNotify)iris_io_op_free);
+	g_closure_set_marshal (closure, g_cclosure_marshal_VOID__VOID);
+
+	g_closure_unref (task->priv->closure);
+	task->priv->closure = closure;
+	task->priv->flags |= IRIS_TASK_FLAG_ASYNC;
+
+	return task;
+}
+
+/**
+ * iris_io_read_task_new:
+ * @fd: A file descriptor
+ * @buffer: where to read to
+ * @count: the size of @buffer
+ *
+ * Creates a task that reads up to @count bytes from @fd on the default
+ * #IrisIOScheduler. See iris_io_read_task_new_full().
+ *
+ * Return value: A new #IrisTask, which has not been run yet.
+ */
+IrisTask*
+iris_io_read_task_new (gint     fd,
+                       gpointer buffer,
+                       gsize    count)
+{
+	return iris_io_read_task_new_full (NULL, fd, buffer, count);
+}
+
+/**
+ * iris_io_read_task_new_full:
+ * @scheduler: An #IrisIOScheduler, or %NULL for the default one
+ * @fd: A file descriptor
+ * @buffer: where to read to
+ * @count: the size of @buffer
+ *
+ * Creates a task that does one read of up to @count bytes from @fd once it
+ * is run, waiting on the reactor of @scheduler if there is nothing to read
+ * yet. The result of the task is the number of bytes read as a #gint64,
+ * which is 0 at the end of the file.
+ *
+ * @fd is made non-blocking, and @buffer must stay valid until the task has
+ * finished.
+ *
+ * Return value: A new #IrisTask, which has not been run yet.
+ */
+IrisTask*
+iris_io_read_task_new_full (IrisScheduler *scheduler,
+                            gint           fd,
+                            gpointer       buffer,
+                            gsize          count)
+{
+	g_return_val_if_fail (scheduler == NULL || IRIS_IS_IOSCHEDULER (scheduler), NULL);
+	g_return_val_if_fail (fd >= 0, NULL);
+	g_return_val_if_fail (buffer != NULL || count == 0, NULL);
+
+	return iris_io_op_task_new (scheduler, fd, buffer, count, FALSE);
+}
+
+/**
+ * iris_io_write_task_new:
+ * @fd: A file descriptor
+ * @buffer: the data to write
+ * @count: the number of bytes in @buffer
+ *
+ * Creates a task that writes @buffer to @fd on the default
+ * #IrisIOScheduler. See iris_io_write_task_new_full().
+ *
+ * Return value: A new #IrisTask, which has not been run yet.
+ */
+IrisTask*
+iris_io_write_task_new (gint          fd,
+                        gconstpointer buffer,
+                        gsize         count)
+{
+	return iris_io_write_task_new_full (NULL, fd, buffer, count);
+}
+
+/**
+ * iris_io_write_task_new_full:
+ * @scheduler: An #IrisIOScheduler, or %NULL for the default one
+ * @fd: A file descriptor
+ * @buffer: the data to write
+ * @count: the number of bytes in @buffer
+ *
+ * Creates a task that writes all of @buffer to @fd once it is run, waiting
+ * on the reactor of @scheduler whenever @fd is full. The result of the task
+ * is the number of bytes written as a #gint64.
+ *
+ * @fd is made non-blocking, and @buffer must stay valid until the task has
+ * finished.
+ *
+ * Return value: A new #IrisTask, which has not been run yet.
+ */
+IrisTask*
+iris_io_write_task_new_full (IrisScheduler *scheduler,
+                             gint           fd,
+                             gconstpointer  buffer,
+                             gsize          count)
+{
+	g_return_val_if_fail (scheduler == NULL || IRIS_IS_IOSCHEDULER (scheduler), NULL);
+	g_return_val_if_fail (fd >= 0, NULL);
+	g_return_val_if_fail (buffer != NULL || count == 0, NULL);
+
+	return iris_io_op_task_new (scheduler, fd, (gpointer)buffer, count, TRUE);
+}
+
+/**************************************************************************
+ *                      IrisIOScheduler Implementation                    *
+ *************************************************************************/
+
+static void
+iris_ioscheduler_finalize (GObject *object)
+{
+	IrisIOSchedulerPrivate *priv;
+
+	priv = IRIS_IOSCHEDULER (object)->priv;
+
+	/* Every watch holds a reference on us, so there are none left */
+	g_warn_if_fail (priv->watches == NULL);
+
+	if (priv->reactor == g_thread_self ()) {
+		/* The reactor let go of the last watch, and so of us. It stops
+		 * without touching us again, and cleans up after itself as it
+		 * isn't joinable.
+		 */
+		*priv->exited = TRUE;
+
+		close (priv->wake_fd);
+		close (priv->epoll_fd);
+	}
+	else if (priv->reactor != NULL) {
+		g_mutex_lock (priv->mutex);
+		priv->quit = TRUE;
+		iris_io_wake_reactor (priv);
+
+		while (priv->reactor != NULL)
+			g_cond_wait (priv->cond, priv->mutex);
+		g_mutex_unlock (priv->mutex);
+
+		close (priv->wake_fd);
+		close (priv->epoll_fd);
+	}
+
+	g_cond_free (priv->cond);
+	g_mutex_free (priv->mutex);
+
+	G_OBJECT_CLASS (iris_ioscheduler_parent_class)->finalize (object);
+}
+
+static void
+iris_ioscheduler_class_init (IrisIOSchedulerClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = iris_ioscheduler_finalize;
+
+	g_type_class_add_private (object_class, sizeof (IrisIOSchedulerPrivate));
+}
+
+static void
+iris_ioscheduler_init (IrisIOScheduler *scheduler)
+{
+	scheduler->priv = G_TYPE_INSTANCE_GET_PRIVATE (scheduler,
+	                                               IRIS_TYPE_IOSCHEDULER,
+	                                               IrisIOSchedulerPrivate);
+
+	scheduler->priv->mutex = g_mutex_new ();
+	scheduler->priv->cond = g_cond_new ();
+	scheduler->priv->reactor = NULL;
+	scheduler->priv->epoll_fd = -1;
+	scheduler->priv->wake_fd = -1;
+	scheduler->priv->quit = FALSE;
+	scheduler->priv->exited = NULL;
+	scheduler->priv->watches = NULL;
+	scheduler->priv->dead = NULL;
+}
+
+/**
+ * iris_ioscheduler_new:
+ *
+ * Creates a new instance of #IrisIOScheduler. Its reactor thread is started
+ * when the first descriptor is watched.
+ *
+ * Return value: the newly created #IrisIOScheduler instance.
+ */
+IrisScheduler*
+iris_ioscheduler_new (void)
+{
+	return g_object_new (IRIS_TYPE_IOSCHEDULER, NULL);
+}
+
+/**
+ * iris_ioscheduler_new_full:
+ * @min_threads: A #guint containing the minimum number of threads
+ * @max_threads: A #guint containing the maximum number of threads
+ *
+ * Creates a new instance of #IrisIOScheduler, with the number of worker
+ * threads given. The reactor thread is not counted.
+ *
+ * Return value: the newly created #IrisIOScheduler instance.
+ */
+IrisScheduler*
+iris_ioscheduler_new_full (guint min_threads,
+                           guint max_threads)
+{
+	IrisScheduler *scheduler;
+
+	scheduler = iris_ioscheduler_new ();
+	scheduler->priv->min_threads = min_threads;
+	scheduler->priv->max_threads = max_threads;
+
+	return scheduler;
+}
+
+/**
+ * iris_ioscheduler_get_default:
+ *
+ * Retrieves the #IrisIOScheduler used by iris_io_watch_fd(),
+ * iris_io_read_task_new() and iris_io_write_task_new(), creating it the
+ * first time.
+ *
+ * Return value: An #IrisIOScheduler instance
+ */
+IrisScheduler*
+iris_ioscheduler_get_default (void)
+{
+	if (G_UNLIKELY (g_atomic_pointer_get (&default_io_scheduler) == NULL)) {
+		G_LOCK (default_io_scheduler);
+		if (!g_atomic_pointer_get (&default_io_scheduler))
+			g_atomic_pointer_set (&default_io_scheduler,
+			                      iris_ioscheduler_new_full
+			                        (1, MAX (2, iris_scheduler_get_n_cpu ())));
+		G_UNLOCK (default_io_scheduler);
+	}
+	return g_atomic_pointer_get (&default_io_scheduler);
+}
@@ -0,0 +1,112 @@
+/* iris-ioscheduler.h
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __IRIS_IOSCHEDULER_H__
+#define __IRIS_IOSCHEDULER_H__
+
+#include <glib-object.h>
+
+#include "iris-port.h"
+#include "iris-scheduler.h"
+#include "iris-task.h"
+
+G_BEGIN_DECLS
+
+#define IRIS_TYPE_IOSCHEDULER            (iris_ioscheduler_get_type ())
+#define IRIS_IOSCHEDULER(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), IRIS_TYPE_IOSCHEDULER, IrisIOScheduler))
+#define IRIS_IOSCHEDULER_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), IRIS_TYPE_IOSCHEDULER, IrisIOScheduler const))
+#define IRIS_IOSCHEDULER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  IRIS_TYPE_IOSCHEDULER, IrisIOSchedulerClass))
+#define IRIS_IS_IOSCHEDULER(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), IRIS_TYPE_IOSCHEDULER))
+#define IRIS_IS_IOSCHEDULER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  IRIS_TYPE_IOSCHEDULER))
+#define IRIS_IOSCHEDULER_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  IRIS_TYPE_IOSCHEDULER, IrisIOSchedulerClass))
+
+typedef struct _IrisIOScheduler        IrisIOScheduler;
+typedef struct _IrisIOSchedulerClass   IrisIOSchedulerClass;
+typedef struct _IrisIOSchedulerPrivate IrisIOSchedulerPrivate;
+
+/**
+ * IrisIOWatch:
+ *
+ * An opaque handle on a file descriptor watched with iris_io_watch_fd().
+ */
+typedef struct _IrisIOWatch            IrisIOWatch;
+
+/**
+ * IrisIOMessageType:
+ * @IRIS_IO_MESSAGE_READY: a watched file descriptor is ready. The message
+ *   has integer "fd" and "condition" items, the latter holding the
+ *   #GIOCondition flags that are set.
+ *
+ * Messages posted by an #IrisIOScheduler.
+ */
+typedef enum
+{
+	IRIS_IO_MESSAGE_READY = 1
+} IrisIOMessageType;
+
+struct _IrisIOScheduler
+{
+	IrisScheduler parent;
+
+	/*< private >*/
+	IrisIOSchedulerPrivate *priv;
+};
+
+struct _IrisIOSchedulerClass
+{
+	IrisSchedulerClass parent_class;
+};
+
+GType          iris_ioscheduler_get_type    (void) G_GNUC_CONST;
+IrisScheduler* iris_ioscheduler_new         (void);
+IrisScheduler* iris_ioscheduler_new_full    (guint           min_threads,
+                                             guint           max_threads);
+IrisScheduler* iris_ioscheduler_get_default (void);
+
+IrisIOWatch*   iris_io_watch_fd             (gint            fd,
+                                             GIOCondition    events,
+                                             IrisPort       *port);
+IrisIOWatch*   iris_io_watch_fd_full        (IrisScheduler  *scheduler,
+                                             gint            fd,
+                                             GIOCondition    events,
+                                             IrisPort       *port);
+void           iris_io_watch_rearm          (IrisIOWatch    *watch);
+void           iris_io_watch_remove         (IrisIOWatch    *watch);
+IrisIOWatch*   iris_io_watch_ref            (IrisIOWatch    *watch);
+void           iris_io_watch_unref          (IrisIOWatch    *watch);
+
+IrisTask*      iris_io_read_task_new        (gint            fd,
+                                             gpointer        buffer,
+                                             gsize           count);
+IrisTask*      iris_io_read_task_new_full   (IrisScheduler  *scheduler,
+                                             gint            fd,
+                                             gpointer        buffer,
+                                             gsize           count);
+IrisTask*      iris_io_write_task_new       (gint            fd,
+                                             gconstpointer   buffer,
+                                             gsize           count);
+IrisTask*      iris_io_write_task_new_full  (IrisScheduler  *scheduler,
+                                             gint            fd,
+                                             gconstpointer   buffer,
+                                             gsize           count);
+
+G_END_DECLS
+
+#endif /* __IRIS_IOSCHEDULER_H__ */
@@ -32,6 +32,14 @@ struct _IrisLFQueuePrivate
 	IrisLink     *tail;
 	IrisFreeList *free_list;
 	guint         length;
+
+	/* Eventcount used to put blocking pops to sleep. Pushers only touch
+	 * wake_seq when waiters is non-zero.
+	 */
+	volatile gint waiters;
+	volatile gint wake_seq;
+	GMutex       *wait_mutex;   /* Only used where there is no futex */
+	GCond        *wait_cond;
 };
 
 G_END_DECLS
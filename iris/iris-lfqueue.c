@@ -18,7 +18,7 @@
  * 02110-1301 USA
  */
 
-#include "gstamppointer.h"
+#include "iris-epoch.h"
 #include "iris-lfqueue.h"
 #include "iris-lfqueue-private.h"
 #include "iris-util.h"
@@ -36,6 +36,13 @@
  * Keep in mind that lock-free is not always the fastest implementation
  * for all problem sets.
  *
+ * The blocking iris_queue_pop() and iris_queue_timed_pop() spin for a
+ * short while, then yield, and finally sleep until an item is pushed.
+ * Pushers only pay for a wake-up when somebody is actually sleeping.
+ *
+ * Popped links are only reused once no other push or pop can still be
+ * looking at them, using the epoch reclamation behind #IrisFreeList.
+ *
  * <warning><para>
  * #IrisLFQueue is experimental code and may not run correctly. Do
  * not use it in production!
@@ -47,11 +54,77 @@ static gpointer iris_lfqueue_real_pop        (IrisQueue *queue);
 static gpointer iris_lfqueue_real_timed_pop  (IrisQueue *queue,
                                               GTimeVal  *timeout);
 static gpointer iris_lfqueue_real_try_pop    (IrisQueue *queue);
+static guint    iris_lfqueue_real_try_pop_many (IrisQueue *queue,
+                                                gpointer  *items,
+                                                guint      max_items);
 static gboolean iris_lfqueue_real_push       (IrisQueue *queue,
                                               gpointer   data);
+static guint    iris_lfqueue_real_push_many  (IrisQueue *queue,
+                                              gpointer  *items,
+                                              guint      n_items);
+
+/* Number of times a blocking pop retries before yielding the CPU, and then
+ * the number of times it yields before going to sleep.
+ */
+#define LFQUEUE_SPIN_COUNT  64
+#define LFQUEUE_YIELD_COUNT 4
 
 G_DEFINE_TYPE (IrisLFQueue, iris_lfqueue, IRIS_TYPE_QUEUE)
 
+/* Sleep until wake_seq moves on from @seq, or @usec microseconds pass if
+ * @usec is not negative.
+ */
+static void
+iris_lfqueue_wait (IrisLFQueue *queue,
+                   gint         seq,
+                   glong        usec)
+{
+	IrisLFQueuePrivate *priv = queue->priv;
+
+#ifdef LINUX
+	iris_futex_wait (&priv->wake_seq, seq, usec);
+#else
+	GTimeVal tv;
+
+	g_mutex_lock (priv->wait_mutex);
+
+	if (usec >= 0) {
+		g_get_current_time (&tv);
+		g_time_val_add (&tv, usec);
+	}
+
+	if (g_atomic_int_get (&priv->wake_seq) == seq) {
+		if (usec >= 0)
+			g_cond_timed_wait (priv->wait_cond, priv->wait_mutex, &tv);
+		else
+			g_cond_wait (priv->wait_cond, priv->wait_mutex);
+	}
+
+	g_mutex_unlock (priv->wait_mutex);
+#endif
+}
+
+/* Wake one sleeping popper, or all of them if @all is %TRUE. */
+static void
+iris_lfqueue_wake (IrisLFQueue *queue,
+                   gboolean     all)
+{
+	IrisLFQueuePrivate *priv = queue->priv;
+
+#ifdef LINUX
+	g_atomic_int_inc (&priv->wake_seq);
+	iris_futex_wake (&priv->wake_seq, all ? G_MAXINT : 1);
+#else
+	g_mutex_lock (priv->wait_mutex);
+	g_atomic_int_inc (&priv->wake_seq);
+	if (all)
+		g_cond_broadcast (priv->wait_cond);
+	else
+		g_cond_signal (priv->wait_cond);
+	g_mutex_unlock (priv->wait_mutex);
+#endif
+}
+
 static void
 iris_lfqueue_finalize (GObject *object)
 {
@@ -64,14 +137,18 @@ iris_lfqueue_finalize (GObject *object)
 	priv->tail = NULL;
 
 	while (link) {
-		tmp = G_STAMP_POINTER_GET_LINK (link)->next;
-		if (link)
-			g_slice_free (IrisLink, G_STAMP_POINTER_GET_POINTER (link));
+		tmp = link->next;
+		g_slice_free (IrisLink, link);
 		link = tmp;
 	}
 
 	iris_free_list_free (priv->free_list);
 
+#ifndef LINUX
+	g_mutex_free (priv->wait_mutex);
+	g_cond_free (priv->wait_cond);
+#endif
+
 	G_OBJECT_CLASS (iris_lfqueue_parent_class)->finalize (object);
 }
 
@@ -87,8 +164,10 @@ iris_lfqueue_class_init (IrisLFQueueClass *klass)
 
 	queue_class = IRIS_QUEUE_CLASS (klass);
 	queue_class->push = iris_lfqueue_real_push;
+	queue_class->push_many = iris_lfqueue_real_push_many;
 	queue_class->pop = iris_lfqueue_real_pop;
 	queue_class->try_pop = iris_lfqueue_real_try_pop;
+	queue_class->try_pop_many = iris_lfqueue_real_try_pop_many;
 	queue_class->timed_pop = iris_lfqueue_real_timed_pop;
 	queue_class->get_length = iris_lfqueue_real_get_length;
 }
@@ -103,6 +182,17 @@ iris_lfqueue_init (IrisLFQueue *queue)
 	queue->priv->head = g_slice_new0 (IrisLink);
 	queue->priv->tail = queue->priv->head;
 	queue->priv->free_list = iris_free_list_new ();
+
+	queue->priv->waiters = 0;
+	queue->priv->wake_seq = 0;
+
+#ifdef LINUX
+	queue->priv->wait_mutex = NULL;
+	queue->priv->wait_cond = NULL;
+#else
+	queue->priv->wait_mutex = g_mutex_new ();
+	queue->priv->wait_cond = g_cond_new ();
+#endif
 }
 
 /**
@@ -118,46 +208,130 @@ iris_lfqueue_new ()
 	return g_object_new (IRIS_TYPE_LFQUEUE, NULL);
 }
 
-static gboolean
-iris_lfqueue_real_push (IrisQueue *queue,
-                        gpointer   data)
+/* Splices the @n_links links from @first to @last, which are already
+ * linked to each other, onto the tail of the queue without waking anybody
+ * up. However long the chain is, it goes on with a single compare-and-swap.
+ */
+static void
+iris_lfqueue_append_chain (IrisLFQueuePrivate *priv,
+                           IrisLink           *first,
+                           IrisLink           *last,
+                           guint               n_links)
 {
-	IrisLFQueuePrivate *priv;
-	IrisLink           *old_tail;
-	IrisLink           *old_next;
-	IrisLink           *link;
-	gboolean            success = FALSE;
+	IrisLink *old_tail;
+	IrisLink *old_next;
+	gboolean  success = FALSE;
 
-	g_return_val_if_fail (queue != NULL, FALSE);
-	g_return_val_if_fail (data != NULL, FALSE);
+	last->next = NULL;
 
-	priv = IRIS_LFQUEUE (queue)->priv;
-	link = G_STAMP_POINTER_INCREMENT (iris_free_list_get (priv->free_list));
-	G_STAMP_POINTER_GET_LINK (link)->data = data;
+	/* Counted before anyone can pop them, so the length never wraps */
+	g_atomic_int_add ((gint*)&priv->length, n_links);
+
+	/* The tail we read may be popped and put back meanwhile, but it cannot
+	 * be reused until we leave.
+	 */
+	iris_epoch_enter ();
 
 	while (!success) {
 		old_tail = priv->tail;
-		old_next = G_STAMP_POINTER_GET_LINK (old_tail)->next;
+		old_next = old_tail->next;
 
 		if (priv->tail == old_tail) {
 			if (!old_next) {
 				success = g_atomic_pointer_compare_and_exchange (
-						(gpointer*)&G_STAMP_POINTER_GET_LINK (priv->tail)->next,
-						NULL, link);
+						(gpointer*)&old_tail->next,
+						NULL, first);
+			}
+			else {
+				/* Help a pusher that has not moved the tail on yet */
+				g_atomic_pointer_compare_and_exchange (
+						(gpointer*)&priv->tail, old_tail, old_next);
 			}
-		}
-		else {
-			g_atomic_pointer_compare_and_exchange (
-					(gpointer*)&priv->tail, old_tail, old_next);
 		}
 	}
 
-	g_atomic_pointer_compare_and_exchange ((gpointer*)&priv->tail, old_tail, link);
-	g_atomic_int_inc ((gint*)&priv->length);
+	g_atomic_pointer_compare_and_exchange ((gpointer*)&priv->tail, old_tail, last);
+	iris_epoch_leave ();
+}
+
+/* Links @data onto the tail of the queue without waking anybody up. */
+static void
+iris_lfqueue_append (IrisLFQueuePrivate *priv,
+                     gpointer            data)
+{
+	IrisLink *link;
+
+	link = iris_free_list_get (priv->free_list);
+	link->data = data;
+
+	iris_lfqueue_append_chain (priv, link, link, 1);
+}
+
+static gboolean
+iris_lfqueue_real_push (IrisQueue *queue,
+                        gpointer   data)
+{
+	IrisLFQueuePrivate *priv;
+
+	g_return_val_if_fail (queue != NULL, FALSE);
+	g_return_val_if_fail (data != NULL, FALSE);
+
+	priv = IRIS_LFQUEUE (queue)->priv;
+
+	iris_lfqueue_append (priv, data);
+
+	/* The compare-and-swap that linked the item in is a full barrier, so
+	 * either a waiter sees our item when it rechecks the queue, or we see it
+	 * registered here.
+	 */
+	if (G_UNLIKELY (g_atomic_int_get (&priv->waiters) > 0))
+		iris_lfqueue_wake (IRIS_LFQUEUE (queue), FALSE);
 
 	return TRUE;
 }
 
+static guint
+iris_lfqueue_real_push_many (IrisQueue *queue,
+                             gpointer  *items,
+                             guint      n_items)
+{
+	IrisLFQueuePrivate *priv;
+	IrisLink           *first = NULL,
+	                   *last  = NULL,
+	                   *link;
+	guint               i;
+
+	g_return_val_if_fail (queue != NULL, 0);
+	g_return_val_if_fail (items != NULL || n_items == 0, 0);
+
+	if (n_items == 0)
+		return 0;
+
+	priv = IRIS_LFQUEUE (queue)->priv;
+
+	/* Build the chain privately, so other threads only see it once it is
+	 * spliced on whole.
+	 */
+	for (i = 0; i < n_items; i++) {
+		link = iris_free_list_get (priv->free_list);
+		link->data = items[i];
+
+		if (last)
+			last->next = link;
+		else
+			first = link;
+		last = link;
+	}
+
+	iris_lfqueue_append_chain (priv, first, last, n_items);
+
+	/* One wake-up for the whole batch, and it may as well be for everyone */
+	if (g_atomic_int_get (&priv->waiters) > 0)
+		iris_lfqueue_wake (IRIS_LFQUEUE (queue), TRUE);
+
+	return n_items;
+}
+
 static gpointer
 iris_lfqueue_real_try_pop (IrisQueue *queue)
 {
@@ -172,15 +346,19 @@ iris_lfqueue_real_try_pop (IrisQueue *queue)
 
 	priv = IRIS_LFQUEUE (queue)->priv;
 
+	iris_epoch_enter ();
+
 	while (!success) {
 		old_head = priv->head;
 		old_tail = priv->tail;
-		old_head_next = G_STAMP_POINTER_GET_LINK (old_head)->next;
+		old_head_next = old_head->next;
 
 		if (old_head == priv->head) {
 			if (old_head == old_tail) {
-				if (!old_head_next)
+				if (!old_head_next) {
+					iris_epoch_leave ();
 					return NULL;
+				}
 
 				g_atomic_pointer_compare_and_exchange (
 						(gpointer*)&priv->tail,
@@ -188,7 +366,7 @@ iris_lfqueue_real_try_pop (IrisQueue *queue)
 						old_head_next);
 			}
 			else {
-				result = G_STAMP_POINTER_GET_LINK (old_head_next)->data;
+				result = old_head_next->data;
 				success = g_atomic_pointer_compare_and_exchange (
 						(gpointer*)&priv->head,
 						old_head,
@@ -197,64 +375,158 @@ iris_lfqueue_real_try_pop (IrisQueue *queue)
 		}
 	}
 
+	iris_epoch_leave ();
+
 	iris_free_list_put (priv->free_list, old_head);
 	(void)g_atomic_int_dec_and_test ((gint*)&priv->length);
 
 	return result;
 }
 
+static guint
+iris_lfqueue_real_try_pop_many (IrisQueue *queue,
+                                gpointer  *items,
+                                guint      max_items)
+{
+	IrisLFQueuePrivate *priv;
+	IrisLink           *old_head;
+	IrisLink           *old_tail;
+	IrisLink           *last;
+	IrisLink           *next;
+	guint               n_items;
+	guint               i;
+
+	g_return_val_if_fail (queue != NULL, 0);
+	g_return_val_if_fail (items != NULL || max_items == 0, 0);
+
+	if (max_items == 0)
+		return 0;
+
+	priv = IRIS_LFQUEUE (queue)->priv;
+
+	iris_epoch_enter ();
+
+	while (TRUE) {
+		old_head = priv->head;
+		old_tail = priv->tail;
+		next = old_head->next;
+
+		if (old_head != priv->head)
+			continue;
+
+		if (old_head == old_tail) {
+			if (!next) {
+				iris_epoch_leave ();
+				return 0;
+			}
+
+			g_atomic_pointer_compare_and_exchange (
+					(gpointer*)&priv->tail,
+					old_tail,
+					next);
+			continue;
+		}
+
+		/* The tail is never behind the head, so everything up to the tail
+		 * we read is linked in. If the head moves on meanwhile, the links
+		 * we walk over are only retired, not reused, and the swap fails.
+		 */
+		last = old_head;
+		n_items = 0;
+
+		while (n_items < max_items && last != old_tail &&
+		       (next = last->next) != NULL) {
+			last = next;
+			items[n_items++] = last->data;
+		}
+
+		/* The last link taken becomes the new dummy at the head */
+		if (g_atomic_pointer_compare_and_exchange ((gpointer*)&priv->head,
+		                                           old_head, last))
+			break;
+	}
+
+	iris_epoch_leave ();
+
+	for (i = 0; i < n_items; i++) {
+		next = old_head->next;
+		iris_free_list_put (priv->free_list, old_head);
+		old_head = next;
+	}
+
+	g_atomic_int_add ((gint*)&priv->length, -(gint)n_items);
+
+	return n_items;
+}
+
+/* Pops an item, blocking until @timeout if it is not %NULL, or for ever
+ * otherwise.
+ */
 static gpointer
-iris_lfqueue_real_timed_pop (IrisQueue *queue,
-                             GTimeVal  *timeout)
+iris_lfqueue_blocking_pop (IrisQueue *queue,
+                           GTimeVal  *timeout)
 {
-	gpointer result;
-	gint     spin_count = 0;
-	glong    usec;
+	IrisLFQueuePrivate *priv;
+	gpointer            result;
+	gint                spin_count = 0;
+	gint                seq;
+	glong               usec = -1;
 
-	g_return_val_if_fail (queue != NULL, NULL);
+	priv = IRIS_LFQUEUE (queue)->priv;
 
-retry:
-	if (!(result = iris_lfqueue_real_try_pop (queue))) {
-		/* spin a few times retrying */
-		if (spin_count < 5) {
+	while (!(result = iris_lfqueue_real_try_pop (queue))) {
+		if (timeout != NULL) {
+			/* make sure the timeout hasn't passed */
+			usec = g_time_val_usec_until (timeout);
+			if (usec <= 0)
+				return NULL;
+		}
+
+		/* spin a few times retrying, then give up our time slice a few
+		 * times before going to sleep.
+		 */
+		if (spin_count < LFQUEUE_SPIN_COUNT + LFQUEUE_YIELD_COUNT) {
+			if (spin_count >= LFQUEUE_SPIN_COUNT)
+				g_thread_yield ();
 			spin_count++;
-			goto retry;
+			continue;
 		}
 
-		/* make sure the timeout hasn't passed */
-		usec = g_time_val_usec_until (timeout);
-		if (usec <= 0)
-			return NULL;
+		/* Register as a waiter before the final check of the queue, so a
+		 * concurrent push cannot slip in between the check and the sleep
+		 * without waking us.
+		 */
+		g_atomic_int_inc (&priv->waiters);
+		seq = g_atomic_int_get (&priv->wake_seq);
+
+		if (!(result = iris_lfqueue_real_try_pop (queue)))
+			iris_lfqueue_wait (IRIS_LFQUEUE (queue), seq, usec);
+
+		g_atomic_int_add (&priv->waiters, -1);
 
-		/* sleep 10 milliseconds */
-		g_usleep (10000);
-		goto retry;
+		if (result)
+			break;
 	}
 
 	return result;
 }
 
 static gpointer
-iris_lfqueue_real_pop (IrisQueue *queue)
+iris_lfqueue_real_timed_pop (IrisQueue *queue,
+                             GTimeVal  *timeout)
 {
-	/* since this method must block, we will retry things periodically
-	 * since we cannot add a lock/condition wait.  This should *not*
-	 * be used on power saving devices such as embedded platforms.
-	 */
-
-	gpointer result  = NULL;
-	GTimeVal timeout = {0,0};
+	g_return_val_if_fail (queue != NULL, NULL);
+	g_return_val_if_fail (timeout != NULL, NULL);
 
-	if ((result = iris_lfqueue_real_try_pop (queue)) != NULL)
-		return result;
+	return iris_lfqueue_blocking_pop (queue, timeout);
+}
 
-	do {
-		g_get_current_time (&timeout);
-		g_time_val_add (&timeout, G_USEC_PER_SEC / 5); /* 200ms */
-		result = iris_lfqueue_real_timed_pop (queue, &timeout);
-	} while (!result);
+static gpointer
+iris_lfqueue_real_pop (IrisQueue *queue)
+{
+	g_return_val_if_fail (queue != NULL, NULL);
 
-	return result;
+	return iris_lfqueue_blocking_pop (queue, NULL);
 }
 
 static guint
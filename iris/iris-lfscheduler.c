@@ -64,16 +64,20 @@ iris_lfscheduler_queue_real_cb (gpointer data,
 	queue = data;
 	thread_work = user_data;
 
-	iris_queue_push (queue, thread_work);
-
-	return TRUE;
+	/* If the queue is closed (meaning its thread is leaving) we will return
+	 * FALSE and the rrobin will call again with another queue
+	 */
+	return iris_priority_queue_push_full (IRIS_PRIORITY_QUEUE (queue),
+	                                      thread_work,
+	                                      thread_work->priority);
 }
 
 static void
-iris_lfscheduler_queue_real (IrisScheduler  *scheduler,
-                             IrisCallback    func,
-                             gpointer        data,
-                             GDestroyNotify  destroy_notify)
+iris_lfscheduler_queue_full_real (IrisScheduler  *scheduler,
+                                  IrisCallback    func,
+                                  gpointer        data,
+                                  GDestroyNotify  destroy_notify,
+                                  IrisPriority    priority)
 {
 	IrisLFSchedulerPrivate *priv;
 	IrisThreadWork         *thread_work;
@@ -83,7 +87,8 @@ iris_lfscheduler_queue_real (IrisScheduler  *scheduler,
 
 	priv = IRIS_LFSCHEDULER (scheduler)->priv;
 
-	thread_work = iris_thread_work_new (func, data, destroy_notify);
+	thread_work = iris_scheduler_work_new (scheduler, func, data,
+	                                       destroy_notify, priority);
 
 	/* deliver to next round robin */
 	iris_rrobin_apply (IRIS_LFSCHEDULER (scheduler)->priv->rrobin,
@@ -91,70 +96,45 @@ iris_lfscheduler_queue_real (IrisScheduler  *scheduler,
 	                   thread_work);
 }
 
-typedef struct {
-	IrisScheduler            *scheduler;
-	IrisSchedulerForeachFunc  callback;
-	gpointer                  user_data;
-} IrisSchedulerForeachClosure;
-
-static gboolean
-iris_scheduler_foreach_rrobin_cb (IrisRRobin *rrobin,
-                                  gpointer    data,
-                                  gpointer    user_data)
+static void
+iris_lfscheduler_queue_real (IrisScheduler  *scheduler,
+                             IrisCallback    func,
+                             gpointer        data,
+                             GDestroyNotify  destroy_notify)
 {
-	IrisQueue                    *queue   = data;
-	IrisSchedulerForeachClosure  *closure = user_data;
-	gboolean continue_flag;
-	gint i;
-
-	/* Foreach the queue in a really hacky way. FIXME: be neater! */
-	for (i=0; i<iris_queue_get_length(queue); i++) {
-		IrisThreadWork *thread_work;
-
-		thread_work = iris_queue_try_pop (queue);
-
-		if (!thread_work) break;
-
-		continue_flag = closure->callback (closure->scheduler,
-		                                   thread_work,
-		                                   thread_work->callback,
-		                                   thread_work->data,
-		                                   closure->user_data);
-
-		if (g_atomic_int_get (&thread_work->remove) == FALSE)
-			iris_queue_push (queue, thread_work);
-		else
-			iris_thread_work_free (thread_work);
-
-		if (!continue_flag)
-			break;
-	}
-
-	return continue_flag;
+	iris_lfscheduler_queue_full_real (scheduler,
+	                                  func,
+	                                  data,
+	                                  destroy_notify,
+	                                  IRIS_PRIORITY_NORMAL);
 }
 
 static void
-iris_lfscheduler_foreach_real (IrisScheduler            *scheduler,
-                               IrisSchedulerForeachFunc  callback,
-                               gpointer                  user_data)
+iris_lfscheduler_queue_batch_real (IrisScheduler                *scheduler,
+                                   const IrisSchedulerBatchItem *items,
+                                   guint                         n_items)
 {
-	IrisLFSchedulerPrivate      *priv;
-	IrisSchedulerForeachClosure  closure;
+	IrisLFSchedulerPrivate  *priv;
+	IrisThreadWork         **works;
+	guint                    pushed;
+	guint                    i;
 
 	g_return_if_fail (scheduler != NULL);
-	g_return_if_fail (callback != NULL);
 
 	priv = IRIS_LFSCHEDULER (scheduler)->priv;
 
-	closure.scheduler = scheduler;
-	closure.callback  = callback;
-	closure.user_data = user_data;
+	works = iris_scheduler_work_new_batch (scheduler, items, n_items);
 
-	/* Iterate through each of our queues */
-	iris_rrobin_foreach (priv->rrobin,
-	                     iris_scheduler_foreach_rrobin_cb,
-	                     &closure);
-};
+	/* The queues are unbounded, so this only stops short once every queue
+	 * is closed, which only happens during finalization.
+	 */
+	pushed = iris_scheduler_push_batch (priv->rrobin, works, n_items, NULL);
+
+	for (i = pushed; i < n_items; i++)
+		iris_thread_work_free (works[i]);
+
+	g_free (works);
+}
 
 static void
 iris_lfscheduler_add_thread_real (IrisScheduler  *scheduler,
@@ -169,7 +149,12 @@ iris_lfscheduler_add_thread_real (IrisScheduler  *scheduler,
 
 	priv = IRIS_LFSCHEDULER (scheduler)->priv;
 
-	queue = iris_lfqueue_new ();
+	/* We are called with the scheduler manager locked, so this is safe */
+	if (G_UNLIKELY (!priv->rrobin))
+		priv->rrobin = iris_rrobin_new (iris_scheduler_get_max_threads (scheduler));
+
+	/* Each priority level is its own lock-free queue */
+	queue = iris_priority_queue_new_full (IRIS_TYPE_LFQUEUE);
 	thread->user_data = queue;
 
 	/* add the queue to the round robin */
@@ -196,7 +181,9 @@ iris_lfscheduler_remove_thread_real (IrisScheduler *scheduler,
 {
 	IrisLFSchedulerPrivate *priv;
 	IrisQueue              *queue;
-	gpointer                thread_work;
+	gpointer                items[16];
+	guint                   n_items,
+	                        i;
 
 	g_return_if_fail (IRIS_IS_LFSCHEDULER (scheduler));
 	g_return_if_fail (thread != NULL);
@@ -210,10 +197,12 @@ iris_lfscheduler_remove_thread_real (IrisScheduler *scheduler,
 	iris_rrobin_remove (priv->rrobin, queue);
 
 	/* apply left over items to other queues */
-	while ((thread_work = iris_queue_try_pop (queue)) != NULL) {
-		iris_rrobin_apply (priv->rrobin,
-		                   iris_lfscheduler_queue_real_cb,
-		                   thread_work);
+	while ((n_items = iris_queue_try_pop_many (queue, items,
+	                                           G_N_ELEMENTS (items))) > 0) {
+		for (i = 0; i < n_items; i++)
+			iris_rrobin_apply (priv->rrobin,
+			                   iris_lfscheduler_queue_real_cb,
+			                   items[i]);
 	}
 
 	g_object_unref (queue);
@@ -236,7 +225,8 @@ iris_lfscheduler_class_init (IrisLFSchedulerClass *klass)
 	IrisSchedulerClass *sched_class = IRIS_SCHEDULER_CLASS (klass);
 
 	sched_class->queue = iris_lfscheduler_queue_real;
-	sched_class->foreach = iris_lfscheduler_foreach_real;
+	sched_class->queue_full = iris_lfscheduler_queue_full_real;
+	sched_class->queue_batch = iris_lfscheduler_queue_batch_real;
 	sched_class->add_thread = iris_lfscheduler_add_thread_real;
 	sched_class->remove_thread = iris_lfscheduler_remove_thread_real;
 	object_class->finalize = iris_lfscheduler_finalize;
@@ -247,20 +237,16 @@ iris_lfscheduler_class_init (IrisLFSchedulerClass *klass)
 static void
 iris_lfscheduler_init (IrisLFScheduler *scheduler)
 {
-	guint max_threads;
-
 	scheduler->priv = G_TYPE_INSTANCE_GET_PRIVATE (scheduler,
 	                                               IRIS_TYPE_LFSCHEDULER,
 	                                               IrisLFSchedulerPrivate);
 
 	scheduler->priv->has_leader = FALSE;
 
-	/* FIXME: This is technically broken since it gets modified
-	 *   after we call it.
+	/* The round robin is created along with the first thread, once
+	 * max_threads is known.
 	 */
-
-	max_threads = iris_scheduler_get_max_threads (IRIS_SCHEDULER (scheduler));
-	scheduler->priv->rrobin = iris_rrobin_new (max_threads);
+	scheduler->priv->rrobin = NULL;
 }
 
 /**
@@ -297,3 +283,29 @@ iris_lfscheduler_new_full (guint min_threads,
 
 	return scheduler;
 }
+
+/**
+ * iris_lfscheduler_new_with_cpus:
+ * @min_threads: A #guint containing the minimum number of threads
+ * @max_threads: A #guint containing the maximum number of threads
+ * @cpus: An array of CPU numbers
+ * @n_cpus: The length of @cpus
+ *
+ * Creates a new instance of #IrisLFScheduler whose threads are bound
+ * to the CPUs in @cpus. See iris_scheduler_set_cpus().
+ *
+ * Return value: the newly created #IrisLFScheduler.
+ */
+IrisScheduler*
+iris_lfscheduler_new_with_cpus (guint        min_threads,
+                                guint        max_threads,
+                                const guint *cpus,
+                                guint        n_cpus)
+{
+	IrisScheduler *scheduler;
+
+	scheduler = iris_lfscheduler_new_full (min_threads, max_threads);
+	iris_scheduler_set_cpus (scheduler, cpus, n_cpus);
+
+	return scheduler;
+}
@@ -56,6 +56,11 @@ GType          iris_lfscheduler_get_type (void) G_GNUC_CONST;
 IrisScheduler* iris_lfscheduler_new      (void);
 IrisScheduler* iris_lfscheduler_new_full (guint min_threads,
                                           guint max_threads);
+IrisScheduler* iris_lfscheduler_new_with_cpus
+                                         (guint        min_threads,
+                                          guint        max_threads,
+                                          const guint *cpus,
+                                          guint        n_cpus);
 
 G_END_DECLS
 
@@ -0,0 +1,43 @@
+/* iris-load-controller-private.h
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __IRIS_LOAD_CONTROLLER_PRIVATE_H__
+#define __IRIS_LOAD_CONTROLLER_PRIVATE_H__
+
+#include <glib.h>
+
+#include "iris-load-controller.h"
+
+G_BEGIN_DECLS
+
+struct _IrisLoadControllerPrivate
+{
+	volatile gint  interval;        /* Sampling interval, in msec          */
+	volatile gint  target_latency;  /* Queueing latency to aim for, msec   */
+
+	gulong         latency;         /* Smoothed estimate of the queueing
+	                                 * latency, in usec. Only written by the
+	                                 * scheduler manager's monitor thread.
+	                                 */
+};
+
+G_END_DECLS
+
+#endif /* __IRIS_LOAD_CONTROLLER_PRIVATE_H__ */
@@ -0,0 +1,277 @@
+/* iris-load-controller.c
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#include "iris-load-controller.h"
+#include "iris-load-controller-private.h"
+
+/**
+ * SECTION:iris-load-controller
+ * @title: IrisLoadController
+ * @short_description: Decides how many threads a scheduler needs
+ * @see_also: #IrisScheduler, #IrisSchedulerManager
+ *
+ * Every #IrisScheduler has an #IrisLoadController, which the scheduler
+ * manager consults to grow and shrink the scheduler between its minimum and
+ * maximum number of threads. Once per interval (see
+ * iris_load_controller_set_interval()) the manager looks at all of the
+ * scheduler's queues and passes an #IrisLoadSample to
+ * iris_load_controller_update(), which returns how many threads the
+ * scheduler should have.
+ *
+ * The default implementation tries to keep the time work items spend queued
+ * below a target latency (see iris_load_controller_set_target_latency()).
+ * It estimates the latency from the number of items queued and the rate at
+ * which they are being completed, and adds threads in proportion to how far
+ * over the target it is. Threads are given back one at a time once the
+ * scheduler could lose one and still be comfortably within the target.
+ *
+ * Other policies can be used by subclassing #IrisLoadController and
+ * overriding the update method. It is called from the scheduler manager's
+ * monitor thread with the manager locked, so it must not call back into the
+ * scheduler or the manager.
+ */
+
+#define DEFAULT_INTERVAL       100 /* msec */
+#define DEFAULT_TARGET_LATENCY 100 /* msec */
+
+G_DEFINE_TYPE (IrisLoadController, iris_load_controller, G_TYPE_OBJECT)
+
+static guint
+iris_load_controller_update_real (IrisLoadController   *controller,
+                                  const IrisLoadSample *sample)
+{
+	IrisLoadControllerPrivate *priv;
+	guint64                    estimate;
+	guint64                    target;
+	guint                      n_threads,
+	                           wanted;
+
+	priv = controller->priv;
+
+	/* By Little's law the time spent waiting is the number of items waiting
+	 * over the rate they leave the queue. If nothing has been completed we
+	 * can only say that work has waited for at least as long as nothing
+	 * has happened.
+	 */
+	if (sample->queued == 0)
+		estimate = 0;
+	else if (sample->completed > 0)
+		estimate = (guint64)sample->queued * MAX (sample->interval, 1)
+		           / sample->completed;
+	else
+		estimate = MAX (sample->oldest_age, sample->interval);
+
+	estimate = MAX (estimate, sample->oldest_age);
+
+	/* React to a rise straight away, but let the estimate fall slowly so a
+	 * single quiet interval doesn't start giving threads back.
+	 */
+	if (estimate >= priv->latency)
+		priv->latency = estimate;
+	else
+		priv->latency = (priv->latency + estimate) / 2;
+
+	target = (guint64)g_atomic_int_get (&priv->target_latency) * 1000;
+	n_threads = MAX (sample->n_threads, 1);
+	wanted = n_threads;
+
+	if (priv->latency > target) {
+		/* Latency shrinks roughly in proportion to the number of threads
+		 * while the scheduler is busy, but never more than double at once
+		 * in case the estimate is noisy.
+		 */
+		wanted = (n_threads * priv->latency + target - 1) / MAX (target, 1);
+		wanted = CLAMP (wanted, n_threads + 1, n_threads * 2);
+	}
+	else if (n_threads > 1 &&
+	         priv->latency * n_threads / (n_threads - 1) < target / 2)
+		wanted = n_threads - 1;
+
+	return CLAMP (wanted, sample->min_threads, MAX (sample->max_threads,
+	                                                sample->min_threads));
+}
+
+static void
+iris_load_controller_class_init (IrisLoadControllerClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	klass->update = iris_load_controller_update_real;
+
+	g_type_class_add_private (object_class, sizeof (IrisLoadControllerPrivate));
+}
+
+static void
+iris_load_controller_init (IrisLoadController *controller)
+{
+	controller->priv = G_TYPE_INSTANCE_GET_PRIVATE (controller,
+	                                                IRIS_TYPE_LOAD_CONTROLLER,
+	                                                IrisLoadControllerPrivate);
+
+	controller->priv->interval = DEFAULT_INTERVAL;
+	controller->priv->target_latency = DEFAULT_TARGET_LATENCY;
+	controller->priv->latency = 0;
+}
+
+/**
+ * iris_load_controller_new:
+ *
+ * Creates a new #IrisLoadController with the default interval and target
+ * latency, which are both 100 milliseconds.
+ *
+ * Return value: the newly created #IrisLoadController.
+ */
+IrisLoadController*
+iris_load_controller_new (void)
+{
+	return g_object_new (IRIS_TYPE_LOAD_CONTROLLER, NULL);
+}
+
+/**
+ * iris_load_controller_new_full:
+ * @interval: the sampling interval in milliseconds
+ * @target_latency: the target queueing latency in milliseconds
+ *
+ * Creates a new #IrisLoadController. See
+ * iris_load_controller_set_interval() and
+ * iris_load_controller_set_target_latency().
+ *
+ * Return value: the newly created #IrisLoadController.
+ */
+IrisLoadController*
+iris_load_controller_new_full (guint interval,
+                               guint target_latency)
+{
+	IrisLoadController *controller;
+
+	controller = iris_load_controller_new ();
+	iris_load_controller_set_interval (controller, interval);
+	iris_load_controller_set_target_latency (controller, target_latency);
+
+	return controller;
+}
+
+/**
+ * iris_load_controller_set_interval:
+ * @controller: An #IrisLoadController
+ * @interval: a time in milliseconds
+ *
+ * Sets how often the scheduler manager samples the load on schedulers using
+ * @controller. Shorter intervals react faster to changes in load, at the
+ * cost of waking up more often.
+ */
+void
+iris_load_controller_set_interval (IrisLoadController *controller,
+                                   guint               interval)
+{
+	g_return_if_fail (IRIS_IS_LOAD_CONTROLLER (controller));
+	g_return_if_fail (interval > 0);
+
+	g_atomic_int_set (&controller->priv->interval, interval);
+}
+
+/**
+ * iris_load_controller_get_interval:
+ * @controller: An #IrisLoadController
+ *
+ * Retrieves the interval set with iris_load_controller_set_interval().
+ *
+ * Return value: the sampling interval in milliseconds
+ */
+guint
+iris_load_controller_get_interval (IrisLoadController *controller)
+{
+	g_return_val_if_fail (IRIS_IS_LOAD_CONTROLLER (controller), 0);
+
+	return g_atomic_int_get (&controller->priv->interval);
+}
+
+/**
+ * iris_load_controller_set_target_latency:
+ * @controller: An #IrisLoadController
+ * @target_latency: a time in milliseconds
+ *
+ * Sets how long work items should wait in the queue before a thread starts
+ * running them. Threads are added while the estimated latency is above
+ * @target_latency, and removed while it is well below.
+ */
+void
+iris_load_controller_set_target_latency (IrisLoadController *controller,
+                                         guint               target_latency)
+{
+	g_return_if_fail (IRIS_IS_LOAD_CONTROLLER (controller));
+
+	g_atomic_int_set (&controller->priv->target_latency, target_latency);
+}
+
+/**
+ * iris_load_controller_get_target_latency:
+ * @controller: An #IrisLoadController
+ *
+ * Retrieves the latency set with iris_load_controller_set_target_latency().
+ *
+ * Return value: the target latency in milliseconds
+ */
+guint
+iris_load_controller_get_target_latency (IrisLoadController *controller)
+{
+	g_return_val_if_fail (IRIS_IS_LOAD_CONTROLLER (controller), 0);
+
+	return g_atomic_int_get (&controller->priv->target_latency);
+}
+
+/**
+ * iris_load_controller_get_latency:
+ * @controller: An #IrisLoadController
+ *
+ * Retrieves the queueing latency estimated by the default implementation
+ * from the most recent sample.
+ *
+ * Return value: the estimated latency in microseconds
+ */
+gulong
+iris_load_controller_get_latency (IrisLoadController *controller)
+{
+	g_return_val_if_fail (IRIS_IS_LOAD_CONTROLLER (controller), 0);
+
+	return controller->priv->latency;
+}
+
+/**
+ * iris_load_controller_update:
+ * @controller: An #IrisLoadController
+ * @sample: An #IrisLoadSample
+ *
+ * Works out how many threads a scheduler should have given the load
+ * described by @sample. This is called by the scheduler manager.
+ *
+ * Return value: the number of threads wanted, between @sample's minimum
+ *               and maximum.
+ */
+guint
+iris_load_controller_update (IrisLoadController   *controller,
+                             const IrisLoadSample *sample)
+{
+	g_return_val_if_fail (IRIS_IS_LOAD_CONTROLLER (controller), 0);
+	g_return_val_if_fail (sample != NULL, 0);
+
+	return IRIS_LOAD_CONTROLLER_GET_CLASS (controller)->update (controller,
+	                                                            sample);
+}
@@ -0,0 +1,105 @@
+/* iris-load-controller.h
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __IRIS_LOAD_CONTROLLER_H__
+#define __IRIS_LOAD_CONTROLLER_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define IRIS_TYPE_LOAD_CONTROLLER            (iris_load_controller_get_type ())
+#define IRIS_LOAD_CONTROLLER(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), IRIS_TYPE_LOAD_CONTROLLER, IrisLoadController))
+#define IRIS_LOAD_CONTROLLER_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), IRIS_TYPE_LOAD_CONTROLLER, IrisLoadController const))
+#define IRIS_LOAD_CONTROLLER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  IRIS_TYPE_LOAD_CONTROLLER, IrisLoadControllerClass))
+#define IRIS_IS_LOAD_CONTROLLER(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), IRIS_TYPE_LOAD_CONTROLLER))
+#define IRIS_IS_LOAD_CONTROLLER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  IRIS_TYPE_LOAD_CONTROLLER))
+#define IRIS_LOAD_CONTROLLER_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  IRIS_TYPE_LOAD_CONTROLLER, IrisLoadControllerClass))
+
+typedef struct _IrisLoadController        IrisLoadController;
+typedef struct _IrisLoadControllerClass   IrisLoadControllerClass;
+typedef struct _IrisLoadControllerPrivate IrisLoadControllerPrivate;
+typedef struct _IrisLoadSample            IrisLoadSample;
+
+/**
+ * IrisLoadSample:
+ * @n_threads: the number of threads working for the scheduler
+ * @min_threads: the fewest threads the scheduler may have
+ * @max_threads: the most threads the scheduler may have
+ * @queued: the number of work items waiting in all of the scheduler's queues
+ * @max_queued: the number of items waiting in the longest queue
+ * @completed: the number of work items finished since the last sample
+ * @interval: microseconds since the last sample
+ * @oldest_age: microseconds for which some queue has had work waiting but
+ *              not had any of it run. This is a lower bound on the age of
+ *              the oldest queued item.
+ *
+ * A snapshot of the load on a scheduler, which the scheduler manager passes
+ * to its #IrisLoadController each sampling interval.
+ */
+struct _IrisLoadSample
+{
+	guint  n_threads;
+	guint  min_threads;
+	guint  max_threads;
+
+	guint  queued;
+	guint  max_queued;
+	guint  completed;
+
+	gulong interval;
+	gulong oldest_age;
+};
+
+struct _IrisLoadController
+{
+	GObject parent;
+
+	/*< private >*/
+	IrisLoadControllerPrivate *priv;
+};
+
+struct _IrisLoadControllerClass
+{
+	GObjectClass parent_class;
+
+	guint (*update) (IrisLoadController   *controller,
+	                 const IrisLoadSample *sample);
+};
+
+GType               iris_load_controller_get_type           (void) G_GNUC_CONST;
+IrisLoadController* iris_load_controller_new                (void);
+IrisLoadController* iris_load_controller_new_full           (guint                 interval,
+                                                             guint                 target_latency);
+
+void                iris_load_controller_set_interval       (IrisLoadController   *controller,
+                                                             guint                 interval);
+guint               iris_load_controller_get_interval       (IrisLoadController   *controller);
+void                iris_load_controller_set_target_latency (IrisLoadController   *controller,
+                                                             guint                 target_latency);
+guint               iris_load_controller_get_target_latency (IrisLoadController   *controller);
+gulong              iris_load_controller_get_latency        (IrisLoadController   *controller);
+
+guint               iris_load_controller_update             (IrisLoadController   *controller,
+                                                             const IrisLoadSample *sample);
+
+G_END_DECLS
+
+#endif /* __IRIS_LOAD_CONTROLLER_H__ */
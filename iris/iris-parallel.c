@@ -0,0 +1,316 @@
+/* iris-parallel.c
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#include "iris-parallel.h"
+#include "iris-scheduler-private.h"
+#include "iris-thread-cache.h"
+
+/**
+ * SECTION:iris-parallel
+ * @title: Parallel loops
+ * @short_description: Run a loop over a range on all of a scheduler's threads
+ * @see_also: #IrisScheduler, #IrisWSScheduler
+ *
+ * iris_parallel_for() calls a function on every piece of a range of indexes,
+ * using the threads of an #IrisScheduler, and returns once they are all done.
+ * iris_parallel_reduce() does the same and combines the results of every
+ * piece into one.
+ *
+ * The range is split in half recursively. Each thread keeps working on the
+ * first half and queues the second half, until the pieces are no bigger
+ * than the grain size. On an #IrisWSScheduler the halves go on the thread's
+ * own queue, where idle threads steal the oldest, and so the biggest, of
+ * them. Once the pieces are split, joining them does not need any locks:
+ * whichever piece finishes second combines the two results and passes them
+ * up.
+ *
+ * The calling thread works on the range too. If it is one of the
+ * scheduler's threads, it also runs other work while it waits for the rest
+ * of the range; see iris_scheduler_run_until().
+ */
+
+/* How many pieces per thread the range is split into when no grain size
+ * is given. More than one lets a thread that is slowed down lose some of
+ * its share to the others.
+ */
+#define AUTO_PIECES_PER_THREAD 8
+
+typedef struct _IrisParallelJob   IrisParallelJob;
+typedef struct _IrisParallelJoin  IrisParallelJoin;
+typedef struct _IrisParallelRange IrisParallelRange;
+
+struct _IrisParallelJob
+{
+	IrisScheduler          *scheduler;
+	gint64                  grain;
+	IrisParallelFunc        func;
+	IrisParallelReduceFunc  reduce;
+	IrisParallelJoinFunc    join;
+	gpointer                user_data;
+
+	gpointer                result;
+	volatile gint           done;
+};
+
+/* Where a range was split in two. Whichever half finishes second joins the
+ * two results and passes them on to 'parent'.
+ */
+struct _IrisParallelJoin
+{
+	IrisParallelJoin       *parent;
+	guint                   side;       /* Our side of 'parent' */
+	volatile gint           pending;    /* Halves still running */
+	gpointer                results[2];
+};
+
+/* A queued half */
+struct _IrisParallelRange
+{
+	IrisParallelJob        *job;
+	gint64                  begin;
+	gint64                  end;
+	IrisParallelJoin       *parent;
+	guint                   side;
+};
+
+static void iris_parallel_run (IrisParallelJob  *job,
+                               gint64            begin,
+                               gint64            end,
+                               IrisParallelJoin *parent,
+                               guint             side);
+
+static void
+iris_parallel_range_cb (gpointer data)
+{
+	IrisParallelRange *range = data;
+
+	iris_parallel_run (range->job, range->begin, range->end,
+	                   range->parent, range->side);
+
+	iris_thread_cache_free (range);
+}
+
+static void
+iris_parallel_finish (IrisParallelJob  *job,
+                      IrisParallelJoin *join,
+                      guint             side,
+                      gpointer          result)
+{
+	IrisParallelJoin *parent;
+
+	while (join != NULL) {
+		join->results[side] = result;
+
+		/* The decrement is a full barrier, so whoever gets here second
+		 * sees the other half's result too.
+		 */
+		if (!g_atomic_int_dec_and_test (&join->pending))
+			return;
+
+		if (job->join != NULL)
+			result = job->join (join->results[0], join->results[1],
+			                    job->user_data);
+
+		parent = join->parent;
+		side = join->side;
+		iris_thread_cache_free (join);
+		join = parent;
+	}
+
+	job->result = result;
+	g_atomic_int_set (&job->done, TRUE);
+}
+
+static void
+iris_parallel_run (IrisParallelJob  *job,
+                   gint64            begin,
+                   gint64            end,
+                   IrisParallelJoin *parent,
+                   guint             side)
+{
+	IrisParallelJoin  *join;
+	IrisParallelRange *range;
+	gpointer           result = NULL;
+	gint64             middle;
+
+	/* Queue the second half and carry on with the first, until what is
+	 * left is small enough to do here.
+	 */
+	while (end - begin > job->grain) {
+		middle = begin + (end - begin) / 2;
+
+		join = iris_thread_cache_new (IrisParallelJoin);
+		join->parent = parent;
+		join->side = side;
+		join->pending = 2;
+
+		range = iris_thread_cache_new (IrisParallelRange);
+		range->job = job;
+		range->begin = middle;
+		range->end = end;
+		range->parent = join;
+		range->side = 1;
+
+		iris_scheduler_queue (job->scheduler, iris_parallel_range_cb,
+		                      range, NULL);
+
+		end = middle;
+		parent = join;
+		side = 0;
+	}
+
+	if (job->reduce != NULL)
+		result = job->reduce (begin, end, job->user_data);
+	else
+		job->func (begin, end, job->user_data);
+
+	iris_parallel_finish (job, parent, side, result);
+}
+
+static gboolean
+iris_parallel_is_done (gpointer data)
+{
+	IrisParallelJob *job = data;
+
+	return g_atomic_int_get (&job->done);
+}
+
+static gpointer
+iris_parallel_run_job (IrisParallelJob *job,
+                       gint64           begin,
+                       gint64           end)
+{
+	IrisThread *thread;
+	gint        n_threads;
+
+	if (job->scheduler == NULL)
+		job->scheduler = iris_get_default_work_scheduler ();
+
+	if (job->grain <= 0) {
+		n_threads = MAX (1, iris_scheduler_get_max_threads (job->scheduler));
+		job->grain = MAX (1, (end - begin) / (n_threads * AUTO_PIECES_PER_THREAD));
+	}
+
+	/* The pieces we queue never wait for anything, so only we can hold
+	 * things up. If we are one of the scheduler's threads but are nested
+	 * too deeply to run other work while we wait, the pieces could be
+	 * stuck in our own queue behind us; do the whole range here instead.
+	 */
+	thread = iris_thread_get ();
+	if (thread != NULL &&
+	    thread->scheduler == job->scheduler &&
+	    !iris_scheduler_can_help (job->scheduler))
+		job->grain = end - begin;
+
+	job->result = NULL;
+	job->done = FALSE;
+
+	iris_parallel_run (job, begin, end, NULL, 0);
+	iris_scheduler_run_until (job->scheduler, iris_parallel_is_done, job);
+
+	return job->result;
+}
+
+/**
+ * iris_parallel_for:
+ * @scheduler: An #IrisScheduler, or %NULL for the default work scheduler
+ * @begin: the first index
+ * @end: the index after the last one
+ * @grain: the largest piece of the range @func is called with, or 0 to
+ *   pick one from the number of threads in @scheduler
+ * @func: An #IrisParallelFunc
+ * @user_data: data for @func
+ *
+ * Calls @func on pieces of the range from @begin to @end on the threads of
+ * @scheduler, with every index in exactly one piece. Returns once every
+ * piece is done.
+ *
+ * @grain should be big enough that @func does a reasonable amount of work,
+ * since each piece costs about as much as a work item queued with
+ * iris_scheduler_queue().
+ */
+void
+iris_parallel_for (IrisScheduler    *scheduler,
+                   gint64            begin,
+                   gint64            end,
+                   gint64            grain,
+                   IrisParallelFunc  func,
+                   gpointer          user_data)
+{
+	IrisParallelJob job = {0,};
+
+	g_return_if_fail (scheduler == NULL || IRIS_IS_SCHEDULER (scheduler));
+	g_return_if_fail (func != NULL);
+
+	if (end <= begin)
+		return;
+
+	job.scheduler = scheduler;
+	job.grain = grain;
+	job.func = func;
+	job.user_data = user_data;
+
+	iris_parallel_run_job (&job, begin, end);
+}
+
+/**
+ * iris_parallel_reduce:
+ * @scheduler: An #IrisScheduler, or %NULL for the default work scheduler
+ * @begin: the first index
+ * @end: the index after the last one
+ * @grain: the largest piece of the range @func is called with, or 0 to
+ *   pick one from the number of threads in @scheduler
+ * @func: An #IrisParallelReduceFunc
+ * @join: An #IrisParallelJoinFunc
+ * @user_data: data for @func and @join
+ *
+ * Like iris_parallel_for(), but each call to @func returns a result for its
+ * piece, and the results are combined with @join. @join is always passed
+ * the results of two neighbouring pieces in order, so it does not need to
+ * be commutative, only associative.
+ *
+ * Return value: the result for the whole range, or %NULL if it was empty.
+ */
+gpointer
+iris_parallel_reduce (IrisScheduler          *scheduler,
+                      gint64                  begin,
+                      gint64                  end,
+                      gint64                  grain,
+                      IrisParallelReduceFunc  func,
+                      IrisParallelJoinFunc    join,
+                      gpointer                user_data)
+{
+	IrisParallelJob job = {0,};
+
+	g_return_val_if_fail (scheduler == NULL || IRIS_IS_SCHEDULER (scheduler), NULL);
+	g_return_val_if_fail (func != NULL, NULL);
+	g_return_val_if_fail (join != NULL, NULL);
+
+	if (end <= begin)
+		return NULL;
+
+	job.scheduler = scheduler;
+	job.grain = grain;
+	job.reduce = func;
+	job.join = join;
+	job.user_data = user_data;
+
+	return iris_parallel_run_job (&job, begin, end);
+}
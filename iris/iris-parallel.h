@@ -0,0 +1,87 @@
+/* iris-parallel.h
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __IRIS_PARALLEL_H__
+#define __IRIS_PARALLEL_H__
+
+#include <glib.h>
+
+#include "iris-scheduler.h"
+
+G_BEGIN_DECLS
+
+/**
+ * IrisParallelFunc:
+ * @begin: the first index of the range
+ * @end: the index after the last one in the range
+ * @user_data: user data passed to iris_parallel_for()
+ *
+ * Called by iris_parallel_for() for each piece of the range.
+ */
+typedef void     (*IrisParallelFunc)       (gint64   begin,
+                                            gint64   end,
+                                            gpointer user_data);
+
+/**
+ * IrisParallelReduceFunc:
+ * @begin: the first index of the range
+ * @end: the index after the last one in the range
+ * @user_data: user data passed to iris_parallel_reduce()
+ *
+ * Called by iris_parallel_reduce() for each piece of the range.
+ *
+ * Return value: the result for the indexes from @begin to @end.
+ */
+typedef gpointer (*IrisParallelReduceFunc) (gint64   begin,
+                                            gint64   end,
+                                            gpointer user_data);
+
+/**
+ * IrisParallelJoinFunc:
+ * @left: the result for a range
+ * @right: the result for the range straight after it
+ * @user_data: user data passed to iris_parallel_reduce()
+ *
+ * Combines the results of two neighbouring pieces of the range. It should
+ * free @left and @right if they are no longer needed.
+ *
+ * Return value: the result for both ranges together.
+ */
+typedef gpointer (*IrisParallelJoinFunc)   (gpointer left,
+                                            gpointer right,
+                                            gpointer user_data);
+
+void     iris_parallel_for    (IrisScheduler          *scheduler,
+                               gint64                  begin,
+                               gint64                  end,
+                               gint64                  grain,
+                               IrisParallelFunc        func,
+                               gpointer                user_data);
+gpointer iris_parallel_reduce (IrisScheduler          *scheduler,
+                               gint64                  begin,
+                               gint64                  end,
+                               gint64                  grain,
+                               IrisParallelReduceFunc  func,
+                               IrisParallelJoinFunc    join,
+                               gpointer                user_data);
+
+G_END_DECLS
+
+#endif /* __IRIS_PARALLEL_H__ */
@@ -23,6 +23,7 @@
 #include "iris-port-private.h"
 #include "iris-receiver.h"
 #include "iris-receiver-private.h"
+#include "iris-trace-private.h"
 
 /**
  * SECTION:iris-port
@@ -181,6 +182,18 @@ store_message_at_tail_ul (IrisPort    *port,
 	}
 }
 
+/* A receiver that is not persistent is done once it has accepted a message,
+ * so drop the reference we held on it.
+ */
+static void
+remove_accepted_receiver (IrisPort     *port,
+                          IrisReceiver *receiver)
+{
+	if (g_atomic_pointer_compare_and_exchange ((gpointer *)&port->priv->receiver,
+	                                           receiver, NULL))
+		g_object_unref (receiver);
+}
+
 /* Default way to post a message, inside the port lock so no races can occur
  * with iris_port_resume(). (These are dangerous because when a receiver's
  * last message completes the port must be flushed so it doesn't freeze up).
@@ -212,7 +225,7 @@ post_with_lock_ul (IrisPort     *port,
 			g_atomic_pointer_compare_and_exchange ((gpointer *)&priv->receiver, receiver, NULL);
 			break;
 		case IRIS_DELIVERY_ACCEPTED_REMOVE:
-			g_atomic_pointer_compare_and_exchange ((gpointer *)&priv->receiver, receiver, NULL);
+			remove_accepted_receiver (port, receiver);
 			break;
 		default:
 			g_warn_if_reached ();
@@ -275,6 +288,8 @@ iris_port_post (IrisPort    *port,
 	g_return_if_fail (IRIS_IS_PORT (port));
 	g_return_if_fail (message != NULL);
 
+	IRIS_TRACE (IRIS_TRACE_MESSAGE_POST, message, port, 0);
+
 	priv = port->priv;
 	receiver = g_atomic_pointer_get (&priv->receiver);
 
@@ -335,7 +350,7 @@ iris_port_post (IrisPort    *port,
 			g_mutex_unlock (priv->mutex);
 			break;
 		case IRIS_DELIVERY_ACCEPTED_REMOVE:
-			g_atomic_pointer_compare_and_exchange ((gpointer *)&priv->receiver, receiver, NULL);
+			remove_accepted_receiver (port, receiver);
 			break;
 		default:
 			g_warn_if_reached ();
@@ -507,8 +522,10 @@ iris_port_resume (IrisPort *port)
 		if (delivered == IRIS_DELIVERY_REMOVE)
 			store_message_at_head_ul (port, message);
 
-		if (delivered == IRIS_DELIVERY_REMOVE || delivered == IRIS_DELIVERY_ACCEPTED_REMOVE)
+		if (delivered == IRIS_DELIVERY_REMOVE)
 			g_atomic_pointer_compare_and_exchange ((gpointer *)&priv->receiver, receiver, NULL);
+		else if (delivered == IRIS_DELIVERY_ACCEPTED_REMOVE)
+			remove_accepted_receiver (port, receiver);
 
 		if (delivered == IRIS_DELIVERY_PAUSE) {
 			/* Try again. Pass TRUE so if delivery is deferred, the item goes
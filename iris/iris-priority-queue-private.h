@@ -0,0 +1,64 @@
+/* iris-priority-queue-private.h
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __IRIS_PRIORITY_QUEUE_PRIVATE_H__
+#define __IRIS_PRIORITY_QUEUE_PRIVATE_H__
+
+#include <glib.h>
+
+#include "iris-priority-queue.h"
+
+G_BEGIN_DECLS
+
+struct _IrisPriorityQueuePrivate
+{
+	IrisQueue     *levels[IRIS_N_PRIORITIES];
+	                             /* One FIFO per priority level. They are only
+	                              * ever used through their non-blocking
+	                              * methods; waiting happens on our own
+	                              * condition below.
+	                              */
+
+	volatile gint  lengths[IRIS_N_PRIORITIES];
+	                             /* Items in each level, so empty levels can
+	                              * be skipped without touching them.
+	                              */
+
+	volatile gint  skipped[IRIS_N_PRIORITIES];
+	                             /* Number of pops that went to a higher level
+	                              * while this level had items waiting. Used
+	                              * to age lower levels so they never starve.
+	                              */
+
+	volatile gint  open;         /* FALSE once the queue has been closed */
+	volatile gint  pushers;      /* Pushes in progress, so close can wait
+	                              * for them to land.
+	                              */
+
+	volatile gint  waiters;      /* Threads sleeping in a blocking pop. Pushers
+	                              * only take the mutex when this is non-zero.
+	                              */
+	GMutex        *mutex;
+	GCond         *cond;
+};
+
+G_END_DECLS
+
+#endif /* __IRIS_PRIORITY_QUEUE_PRIVATE_H__ */
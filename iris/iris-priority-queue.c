@@ -0,0 +1,605 @@
+/* iris-priority-queue.c
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#include "iris-priority-queue.h"
+#include "iris-priority-queue-private.h"
+#include "iris-ring-queue.h"
+
+/**
+ * SECTION:iris-priority-queue
+ * @title: IrisPriorityQueue
+ * @short_description: A queue with several priority levels
+ * @see_also: #IrisQueue
+ *
+ * #IrisPriorityQueue is a queue made of one FIFO per #IrisPriority level.
+ * Items pushed with iris_queue_push() go to %IRIS_PRIORITY_NORMAL; use
+ * iris_priority_queue_push_full() to choose another level.
+ *
+ * Pops always take from the most urgent non-empty level, except that a
+ * lower level which has been passed over many times in a row is served
+ * once. This aging means a steady stream of urgent items delays less urgent
+ * ones but can never starve them.
+ *
+ * The levels are ordinary #IrisQueue instances (by default of type
+ * #IrisQueue, see iris_priority_queue_new_full()), and are only accessed
+ * with their non-blocking methods. Blocking pops and closing are handled by
+ * the #IrisPriorityQueue itself, so any queue implementation can be used
+ * for the levels.
+ */
+
+/* How many times a level can be passed over while it has items before it is
+ * served ahead of the more urgent levels.
+ */
+#define AGING_LIMIT 32
+
+G_DEFINE_TYPE (IrisPriorityQueue, iris_priority_queue, IRIS_TYPE_QUEUE)
+
+static gboolean iris_priority_queue_real_push               (IrisQueue *queue,
+                                                             gpointer   data);
+static guint    iris_priority_queue_real_push_many          (IrisQueue *queue,
+                                                             gpointer  *items,
+                                                             guint      n_items);
+static gpointer iris_priority_queue_real_pop                (IrisQueue *queue);
+static gpointer iris_priority_queue_real_try_pop            (IrisQueue *queue);
+static guint    iris_priority_queue_real_try_pop_many       (IrisQueue *queue,
+                                                             gpointer  *items,
+                                                             guint      max_items);
+static gpointer iris_priority_queue_real_timed_pop          (IrisQueue *queue,
+                                                             GTimeVal  *timeout);
+static gpointer iris_priority_queue_real_try_pop_or_close   (IrisQueue *queue);
+static gpointer iris_priority_queue_real_timed_pop_or_close (IrisQueue *queue,
+                                                             GTimeVal  *timeout);
+static void     iris_priority_queue_real_close              (IrisQueue *queue);
+static guint    iris_priority_queue_real_get_length         (IrisQueue *queue);
+static gboolean iris_priority_queue_real_is_closed          (IrisQueue *queue);
+
+static void
+iris_priority_queue_finalize (GObject *object)
+{
+	IrisPriorityQueuePrivate *priv;
+	gint                      level;
+
+	priv = IRIS_PRIORITY_QUEUE (object)->priv;
+
+	for (level = 0; level < IRIS_N_PRIORITIES; level++)
+		g_object_unref (priv->levels[level]);
+
+	g_mutex_free (priv->mutex);
+	g_cond_free (priv->cond);
+
+	G_OBJECT_CLASS (iris_priority_queue_parent_class)->finalize (object);
+}
+
+static void
+iris_priority_queue_class_init (IrisPriorityQueueClass *klass)
+{
+	GObjectClass   *object_class;
+	IrisQueueClass *queue_class;
+
+	object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = iris_priority_queue_finalize;
+	g_type_class_add_private (object_class, sizeof (IrisPriorityQueuePrivate));
+
+	queue_class = IRIS_QUEUE_CLASS (klass);
+	queue_class->push = iris_priority_queue_real_push;
+	queue_class->push_many = iris_priority_queue_real_push_many;
+	queue_class->pop = iris_priority_queue_real_pop;
+	queue_class->try_pop = iris_priority_queue_real_try_pop;
+	queue_class->try_pop_many = iris_priority_queue_real_try_pop_many;
+	queue_class->timed_pop = iris_priority_queue_real_timed_pop;
+	queue_class->try_pop_or_close = iris_priority_queue_real_try_pop_or_close;
+	queue_class->timed_pop_or_close = iris_priority_queue_real_timed_pop_or_close;
+	queue_class->close = iris_priority_queue_real_close;
+	queue_class->get_length = iris_priority_queue_real_get_length;
+	queue_class->is_closed = iris_priority_queue_real_is_closed;
+}
+
+static void
+iris_priority_queue_init (IrisPriorityQueue *queue)
+{
+	IrisPriorityQueuePrivate *priv;
+	gint                      level;
+
+	priv = queue->priv = G_TYPE_INSTANCE_GET_PRIVATE (queue,
+	                                                  IRIS_TYPE_PRIORITY_QUEUE,
+	                                                  IrisPriorityQueuePrivate);
+
+	for (level = 0; level < IRIS_N_PRIORITIES; level++) {
+		priv->levels[level] = NULL;
+		priv->lengths[level] = 0;
+		priv->skipped[level] = 0;
+	}
+
+	priv->open = TRUE;
+	priv->pushers = 0;
+	priv->waiters = 0;
+	priv->mutex = g_mutex_new ();
+	priv->cond = g_cond_new ();
+}
+
+/**
+ * iris_priority_queue_new:
+ *
+ * Creates a new #IrisPriorityQueue whose levels are plain #IrisQueue
+ * instances.
+ *
+ * Return value: the newly created #IrisPriorityQueue.
+ */
+IrisQueue*
+iris_priority_queue_new (void)
+{
+	return iris_priority_queue_new_full (IRIS_TYPE_QUEUE);
+}
+
+/**
+ * iris_priority_queue_new_full:
+ * @level_type: the #GType of #IrisQueue to use for each level
+ *
+ * Creates a new #IrisPriorityQueue using queues of type @level_type for each
+ * priority level. @level_type must be constructible with g_object_new() and
+ * no properties, for example %IRIS_TYPE_QUEUE or %IRIS_TYPE_LFQUEUE.
+ *
+ * Return value: the newly created #IrisPriorityQueue.
+ */
+IrisQueue*
+iris_priority_queue_new_full (GType level_type)
+{
+	IrisPriorityQueue *queue;
+	gint               level;
+
+	g_return_val_if_fail (g_type_is_a (level_type, IRIS_TYPE_QUEUE), NULL);
+
+	queue = g_object_new (IRIS_TYPE_PRIORITY_QUEUE, NULL);
+
+	for (level = 0; level < IRIS_N_PRIORITIES; level++)
+		queue->priv->levels[level] = g_object_new (level_type, NULL);
+
+	return IRIS_QUEUE (queue);
+}
+
+/**
+ * iris_priority_queue_new_bounded:
+ * @capacity: the number of items each level has room for
+ *
+ * Creates a new #IrisPriorityQueue whose levels are #IrisRingQueue
+ * instances with room for @capacity items each. Pushing onto a full level
+ * fails straight away, the same as pushing onto a closed queue, so the
+ * caller can try somewhere else.
+ *
+ * Return value: the newly created #IrisPriorityQueue.
+ */
+IrisQueue*
+iris_priority_queue_new_bounded (guint capacity)
+{
+	IrisPriorityQueue *queue;
+	gint               level;
+
+	g_return_val_if_fail (capacity > 0, NULL);
+
+	queue = g_object_new (IRIS_TYPE_PRIORITY_QUEUE, NULL);
+
+	/* A level that made pushers wait would hold up close() */
+	for (level = 0; level < IRIS_N_PRIORITIES; level++)
+		queue->priv->levels[level] = iris_ring_queue_new_full (capacity,
+		                                                       IRIS_RING_QUEUE_FAIL);
+
+	return IRIS_QUEUE (queue);
+}
+
+/* Wakes sleeping poppers, if there are any. */
+static void
+iris_priority_queue_wake (IrisPriorityQueue *queue,
+                          gboolean           all)
+{
+	IrisPriorityQueuePrivate *priv = queue->priv;
+
+	if (G_LIKELY (g_atomic_int_get (&priv->waiters) == 0))
+		return;
+
+	g_mutex_lock (priv->mutex);
+	if (all)
+		g_cond_broadcast (priv->cond);
+	else
+		g_cond_signal (priv->cond);
+	g_mutex_unlock (priv->mutex);
+}
+
+/**
+ * iris_priority_queue_push_full:
+ * @queue: An #IrisPriorityQueue
+ * @data: a pointer to store that is not %NULL
+ * @priority: the #IrisPriority level to push @data onto
+ *
+ * Pushes @data onto the @priority level of @queue, if it is not closed.
+ *
+ * Return value: %TRUE if @data was pushed successfully, %FALSE if @queue is
+ *               closed or the level is full.
+ */
+gboolean
+iris_priority_queue_push_full (IrisPriorityQueue *queue,
+                               gpointer           data,
+                               IrisPriority       priority)
+{
+	IrisPriorityQueuePrivate *priv;
+	gboolean                  pushed = FALSE;
+
+	g_return_val_if_fail (IRIS_IS_PRIORITY_QUEUE (queue), FALSE);
+	g_return_val_if_fail (data != NULL, FALSE);
+	g_return_val_if_fail (priority >= 0 && priority < IRIS_N_PRIORITIES, FALSE);
+
+	priv = queue->priv;
+
+	/* Registering as a pusher before checking 'open' lets close() wait for
+	 * us to land, so an item can never arrive after a queue closed empty.
+	 */
+	g_atomic_int_inc (&priv->pushers);
+
+	if (G_LIKELY (g_atomic_int_get (&priv->open))) {
+		pushed = iris_queue_push (priv->levels[priority], data);
+		if (pushed)
+			g_atomic_int_inc (&priv->lengths[priority]);
+	}
+
+	g_atomic_int_add (&priv->pushers, -1);
+
+	if (pushed)
+		iris_priority_queue_wake (queue, FALSE);
+
+	return pushed;
+}
+
+static gpointer
+iris_priority_queue_pop_level (IrisPriorityQueuePrivate *priv,
+                               gint                      level)
+{
+	gpointer item;
+
+	if (g_atomic_int_get (&priv->lengths[level]) <= 0)
+		return NULL;
+
+	if ((item = iris_queue_try_pop (priv->levels[level])) != NULL)
+		g_atomic_int_add (&priv->lengths[level], -1);
+
+	return item;
+}
+
+static guint
+iris_priority_queue_pop_level_many (IrisPriorityQueuePrivate *priv,
+                                    gint                      level,
+                                    gpointer                 *items,
+                                    guint                     max_items)
+{
+	guint n_items;
+
+	if (g_atomic_int_get (&priv->lengths[level]) <= 0)
+		return 0;
+
+	n_items = iris_queue_try_pop_many (priv->levels[level], items, max_items);
+	if (n_items > 0)
+		g_atomic_int_add (&priv->lengths[level], -(gint)n_items);
+
+	return n_items;
+}
+
+/**
+ * iris_priority_queue_try_pop_level:
+ * @queue: An #IrisPriorityQueue
+ * @priority: an #IrisPriority
+ *
+ * Tries to pop an item from the @priority level only, ignoring the others.
+ * This is useful for consumers that poll several queues and want to serve
+ * urgent items from all of them first.
+ *
+ * Return value: the next item at @priority, or %NULL if there was none.
+ */
+gpointer
+iris_priority_queue_try_pop_level (IrisPriorityQueue *queue,
+                                   IrisPriority       priority)
+{
+	g_return_val_if_fail (IRIS_IS_PRIORITY_QUEUE (queue), NULL);
+	g_return_val_if_fail (priority >= 0 && priority < IRIS_N_PRIORITIES, NULL);
+
+	return iris_priority_queue_pop_level (queue->priv, priority);
+}
+
+/**
+ * iris_priority_queue_get_level_length:
+ * @queue: An #IrisPriorityQueue
+ * @priority: an #IrisPriority
+ *
+ * Retrieves the number of items waiting at the @priority level.
+ *
+ * Return value: the length of the @priority level.
+ */
+guint
+iris_priority_queue_get_level_length (IrisPriorityQueue *queue,
+                                      IrisPriority       priority)
+{
+	g_return_val_if_fail (IRIS_IS_PRIORITY_QUEUE (queue), 0);
+	g_return_val_if_fail (priority >= 0 && priority < IRIS_N_PRIORITIES, 0);
+
+	return MAX (g_atomic_int_get (&queue->priv->lengths[priority]), 0);
+}
+
+static gboolean
+iris_priority_queue_real_push (IrisQueue *queue,
+                               gpointer   data)
+{
+	return iris_priority_queue_push_full (IRIS_PRIORITY_QUEUE (queue),
+	                                      data,
+	                                      IRIS_PRIORITY_NORMAL);
+}
+
+static guint
+iris_priority_queue_real_push_many (IrisQueue *queue,
+                                    gpointer  *items,
+                                    guint      n_items)
+{
+	IrisPriorityQueuePrivate *priv;
+	guint                     pushed = 0;
+
+	g_return_val_if_fail (items != NULL || n_items == 0, 0);
+
+	priv = IRIS_PRIORITY_QUEUE (queue)->priv;
+
+	g_atomic_int_inc (&priv->pushers);
+
+	if (G_LIKELY (g_atomic_int_get (&priv->open))) {
+		pushed = iris_queue_push_many (priv->levels[IRIS_PRIORITY_NORMAL],
+		                               items, n_items);
+		g_atomic_int_add (&priv->lengths[IRIS_PRIORITY_NORMAL], pushed);
+	}
+
+	g_atomic_int_add (&priv->pushers, -1);
+
+	if (pushed > 0)
+		iris_priority_queue_wake (IRIS_PRIORITY_QUEUE (queue), TRUE);
+
+	return pushed;
+}
+
+static gpointer
+iris_priority_queue_real_try_pop (IrisQueue *queue)
+{
+	IrisPriorityQueuePrivate *priv;
+	gpointer                  item = NULL;
+	gint                      level;
+	gint                      lower;
+
+	priv = IRIS_PRIORITY_QUEUE (queue)->priv;
+
+	/* Serve any level that has been passed over too often first, starting
+	 * with the one most likely to be starved.
+	 */
+	for (level = IRIS_N_PRIORITIES - 1; level > 0; level--) {
+		if (G_UNLIKELY (g_atomic_int_get (&priv->skipped[level]) >= AGING_LIMIT)) {
+			g_atomic_int_set (&priv->skipped[level], 0);
+			if ((item = iris_priority_queue_pop_level (priv, level)) != NULL)
+				return item;
+		}
+	}
+
+	for (level = 0; level < IRIS_N_PRIORITIES; level++)
+		if ((item = iris_priority_queue_pop_level (priv, level)) != NULL)
+			break;
+
+	if (item == NULL)
+		return NULL;
+
+	/* Age the less urgent levels we just passed over */
+	for (lower = level + 1; lower < IRIS_N_PRIORITIES; lower++)
+		if (g_atomic_int_get (&priv->lengths[lower]) > 0)
+			g_atomic_int_inc (&priv->skipped[lower]);
+
+	return item;
+}
+
+/* As iris_priority_queue_real_try_pop(), but the whole batch comes from
+ * the one level, and the levels passed over age once for every item.
+ */
+static guint
+iris_priority_queue_real_try_pop_many (IrisQueue *queue,
+                                       gpointer  *items,
+                                       guint      max_items)
+{
+	IrisPriorityQueuePrivate *priv;
+	guint                     n_items = 0;
+	gint                      level;
+	gint                      lower;
+
+	g_return_val_if_fail (items != NULL || max_items == 0, 0);
+
+	if (max_items == 0)
+		return 0;
+
+	priv = IRIS_PRIORITY_QUEUE (queue)->priv;
+
+	for (level = IRIS_N_PRIORITIES - 1; level > 0; level--) {
+		if (G_UNLIKELY (g_atomic_int_get (&priv->skipped[level]) >= AGING_LIMIT)) {
+			g_atomic_int_set (&priv->skipped[level], 0);
+			n_items = iris_priority_queue_pop_level_many (priv, level,
+			                                              items, max_items);
+			if (n_items > 0)
+				return n_items;
+		}
+	}
+
+	for (level = 0; level < IRIS_N_PRIORITIES; level++)
+		if ((n_items = iris_priority_queue_pop_level_many (priv, level,
+		                                                   items, max_items)) > 0)
+			break;
+
+	if (n_items == 0)
+		return 0;
+
+	for (lower = level + 1; lower < IRIS_N_PRIORITIES; lower++)
+		if (g_atomic_int_get (&priv->lengths[lower]) > 0)
+			g_atomic_int_add (&priv->skipped[lower], n_items);
+
+	return n_items;
+}
+
+/* Pops an item, sleeping until one is pushed, @queue is closed or @timeout
+ * passes. A %NULL @timeout waits forever.
+ */
+static gpointer
+iris_priority_queue_wait_pop (IrisQueue *queue,
+                              GTimeVal  *timeout)
+{
+	IrisPriorityQueuePrivate *priv;
+	gpointer                  item;
+	gboolean                  timed_out = FALSE;
+
+	priv = IRIS_PRIORITY_QUEUE (queue)->priv;
+
+	for (;;) {
+		/* Once closed no more items can arrive, so whatever is left is
+		 * all there is.
+		 */
+		if (!g_atomic_int_get (&priv->open))
+			return iris_priority_queue_real_try_pop (queue);
+
+		if ((item = iris_priority_queue_real_try_pop (queue)) != NULL)
+			return item;
+
+		if (timed_out)
+			return NULL;
+
+		g_mutex_lock (priv->mutex);
+		g_atomic_int_inc (&priv->waiters);
+
+		/* Recheck now we are registered, pushers will see us from here */
+		item = iris_priority_queue_real_try_pop (queue);
+
+		if (item == NULL && g_atomic_int_get (&priv->open)) {
+			if (timeout != NULL)
+				timed_out = !g_cond_timed_wait (priv->cond, priv->mutex, timeout);
+			else
+				g_cond_wait (priv->cond, priv->mutex);
+		}
+
+		g_atomic_int_add (&priv->waiters, -1);
+		g_mutex_unlock (priv->mutex);
+
+		if (item != NULL)
+			return item;
+	}
+}
+
+static gpointer
+iris_priority_queue_real_pop (IrisQueue *queue)
+{
+	return iris_priority_queue_wait_pop (queue, NULL);
+}
+
+static gpointer
+iris_priority_queue_real_timed_pop (IrisQueue *queue,
+                                    GTimeVal  *timeout)
+{
+	g_return_val_if_fail (timeout != NULL, NULL);
+
+	return iris_priority_queue_wait_pop (queue, timeout);
+}
+
+/* Closes the queue if @item is %NULL. Any item that landed while we were
+ * closing is returned, but the queue stays closed: another thread may
+ * already have seen it closed, so reopening it is not safe. Whatever is
+ * still queued can be popped from a closed queue, so nothing is lost.
+ */
+static gpointer
+iris_priority_queue_close_if_empty (IrisQueue *queue,
+                                    gpointer   item)
+{
+	IrisPriorityQueuePrivate *priv;
+
+	if (item != NULL)
+		return item;
+
+	priv = IRIS_PRIORITY_QUEUE (queue)->priv;
+
+	if (!g_atomic_int_compare_and_exchange (&priv->open, TRUE, FALSE))
+		return iris_priority_queue_real_try_pop (queue);
+
+	iris_priority_queue_real_close (queue);
+
+	return iris_priority_queue_real_try_pop (queue);
+}
+
+static gpointer
+iris_priority_queue_real_try_pop_or_close (IrisQueue *queue)
+{
+	gpointer item;
+
+	item = iris_priority_queue_real_try_pop (queue);
+
+	return iris_priority_queue_close_if_empty (queue, item);
+}
+
+static gpointer
+iris_priority_queue_real_timed_pop_or_close (IrisQueue *queue,
+                                             GTimeVal  *timeout)
+{
+	gpointer item;
+
+	g_return_val_if_fail (timeout != NULL, NULL);
+
+	item = iris_priority_queue_wait_pop (queue, timeout);
+
+	return iris_priority_queue_close_if_empty (queue, item);
+}
+
+static void
+iris_priority_queue_real_close (IrisQueue *queue)
+{
+	IrisPriorityQueuePrivate *priv;
+
+	priv = IRIS_PRIORITY_QUEUE (queue)->priv;
+
+	g_atomic_int_compare_and_exchange (&priv->open, TRUE, FALSE);
+
+	/* Let pushes that saw the queue open finish landing */
+	while (g_atomic_int_get (&priv->pushers) > 0)
+		g_thread_yield ();
+
+	g_mutex_lock (priv->mutex);
+	g_cond_broadcast (priv->cond);
+	g_mutex_unlock (priv->mutex);
+}
+
+static guint
+iris_priority_queue_real_get_length (IrisQueue *queue)
+{
+	IrisPriorityQueuePrivate *priv;
+	gint                      length = 0;
+	gint                      level;
+
+	priv = IRIS_PRIORITY_QUEUE (queue)->priv;
+
+	for (level = 0; level < IRIS_N_PRIORITIES; level++)
+		length += g_atomic_int_get (&priv->lengths[level]);
+
+	return MAX (length, 0);
+}
+
+static gboolean
+iris_priority_queue_real_is_closed (IrisQueue *queue)
+{
+	return !g_atomic_int_get (&IRIS_PRIORITY_QUEUE (queue)->priv->open);
+}
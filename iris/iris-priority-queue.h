@@ -0,0 +1,88 @@
+/* iris-priority-queue.h
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __IRIS_PRIORITY_QUEUE_H__
+#define __IRIS_PRIORITY_QUEUE_H__
+
+#include "iris-queue.h"
+
+G_BEGIN_DECLS
+
+#define IRIS_TYPE_PRIORITY_QUEUE            (iris_priority_queue_get_type ())
+#define IRIS_PRIORITY_QUEUE(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), IRIS_TYPE_PRIORITY_QUEUE, IrisPriorityQueue))
+#define IRIS_PRIORITY_QUEUE_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), IRIS_TYPE_PRIORITY_QUEUE, IrisPriorityQueue const))
+#define IRIS_PRIORITY_QUEUE_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  IRIS_TYPE_PRIORITY_QUEUE, IrisPriorityQueueClass))
+#define IRIS_IS_PRIORITY_QUEUE(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), IRIS_TYPE_PRIORITY_QUEUE))
+#define IRIS_IS_PRIORITY_QUEUE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  IRIS_TYPE_PRIORITY_QUEUE))
+#define IRIS_PRIORITY_QUEUE_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  IRIS_TYPE_PRIORITY_QUEUE, IrisPriorityQueueClass))
+
+typedef struct _IrisPriorityQueue        IrisPriorityQueue;
+typedef struct _IrisPriorityQueueClass   IrisPriorityQueueClass;
+typedef struct _IrisPriorityQueuePrivate IrisPriorityQueuePrivate;
+
+/**
+ * IrisPriority:
+ * @IRIS_PRIORITY_HIGH: for control messages and other work that should not
+ *                      wait behind a backlog
+ * @IRIS_PRIORITY_NORMAL: the default priority
+ * @IRIS_PRIORITY_LOW: for background work
+ *
+ * The priority levels of an #IrisPriorityQueue, which are also used when
+ * queueing work with iris_scheduler_queue_full().
+ */
+typedef enum
+{
+	IRIS_PRIORITY_HIGH   = 0,
+	IRIS_PRIORITY_NORMAL = 1,
+	IRIS_PRIORITY_LOW    = 2
+} IrisPriority;
+
+#define IRIS_N_PRIORITIES 3
+
+struct _IrisPriorityQueue
+{
+	IrisQueue parent;
+
+	/*< private >*/
+	IrisPriorityQueuePrivate *priv;
+};
+
+struct _IrisPriorityQueueClass
+{
+	IrisQueueClass parent_class;
+};
+
+GType      iris_priority_queue_get_type       (void) G_GNUC_CONST;
+IrisQueue* iris_priority_queue_new            (void);
+IrisQueue* iris_priority_queue_new_full       (GType              level_type);
+IrisQueue* iris_priority_queue_new_bounded    (guint              capacity);
+
+gboolean   iris_priority_queue_push_full      (IrisPriorityQueue *queue,
+                                               gpointer           data,
+                                               IrisPriority       priority);
+gpointer   iris_priority_queue_try_pop_level  (IrisPriorityQueue *queue,
+                                               IrisPriority       priority);
+guint      iris_priority_queue_get_level_length
+                                              (IrisPriorityQueue *queue,
+                                               IrisPriority       priority);
+
+G_END_DECLS
+
+#endif /* __IRIS_PRIORITY_QUEUE_H__ */
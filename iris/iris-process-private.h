@@ -27,6 +27,7 @@
 #include "iris-port.h"
 #include "iris-receiver.h"
 #include "iris-lfqueue.h"
+#include "iris-spsc-queue.h"
 #include "iris-task-private.h"
 
 #define IRIS_PROCESS_GET_PRIVATE(object)       \
@@ -48,7 +49,8 @@ typedef enum
 	IRIS_PROCESS_MESSAGE_ADD_SINK,
 	IRIS_PROCESS_MESSAGE_CHAIN_CANCEL,
 	IRIS_PROCESS_MESSAGE_ADD_WATCH,
-	IRIS_PROCESS_MESSAGE_CHAIN_ESTIMATE
+	IRIS_PROCESS_MESSAGE_CHAIN_ESTIMATE,
+	IRIS_PROCESS_MESSAGE_POST_ESTIMATE
 } IrisProcessMessageType;
 
 struct _IrisProcessPrivate
@@ -58,6 +60,18 @@ struct _IrisProcessPrivate
 	IrisReceiver *work_receiver;
 	IrisQueue    *work_queue;
 
+	/* Items forwarded by our source, which skip the port and receiver. Our
+	 * source's work function is the only producer and ours the only
+	 * consumer, so this is an #IrisSPSCQueue. NULL unless we have a source.
+	 */
+	IrisQueue    *forward_queue;
+
+	/* TRUE while the work function is queued on the work scheduler or
+	 * running. The work function clears it when it runs out of work, and
+	 * whoever sets it back from FALSE to TRUE must reschedule it.
+	 */
+	volatile gint scheduled;
+
 	/* Connections. These will be set to NULL if we get a DEP_CANCELLED or
 	 * DEP_FINISHED message from them (because we release our reference on them
 	 * at that point)
@@ -72,6 +86,11 @@ struct _IrisProcessPrivate
 	/* Atomically accessed as a pointer ... */
 	volatile gfloat *output_estimate_factor;
 
+	/* TRUE while a timeout is waiting to send the sink our output estimate.
+	 * Whoever sets it back to FALSE must send it.
+	 */
+	volatile gint estimate_pending;
+
 	/* These two are accessed from control message handler only */
 	gint          watch_total_items;      /* the last value of total_items sent
 	                                         to watchers */
@@ -24,6 +24,8 @@
 #include "iris-process.h"
 #include "iris-process-private.h"
 #include "iris-progress.h"
+#include "iris-ring-queue.h"
+#include "iris-trace-private.h"
 
 /**
  * SECTION:iris-process
@@ -85,6 +87,14 @@
  * processes will each run until their source process completes work, so the
  * work will flow down the chain automatically.
  *
+ * Work items forwarded along a chain bypass the sink's work port: since only
+ * the source's work function ever forwards to a given sink, and only the
+ * sink's work function takes them, they are passed through an
+ * #IrisSPSCQueue, which costs no more than a few stores per item. A sink
+ * whose work queue is bounded with iris_process_set_work_queue_capacity()
+ * still gets them through its work port, so that a source which runs ahead
+ * is held back.
+ *
  * Once the chain is running, it is only necessary to hold a reference on the
  * last process in the chain. Callbacks should be added to this process to run
  * when the whole chain has completed processing. iris_process_is_finished()
@@ -103,14 +113,18 @@
  * </refsect2>
  */
 
-/* How frequently the process checks for cancellation between try_pop calls. */
-#define WAKE_UP_INTERVAL  20000
-
 #define FLAG_IS_ON(p,f)  ((IRIS_TASK(p)->priv->flags & f) != 0)
 #define FLAG_IS_OFF(p,f) ((IRIS_TASK(p)->priv->flags & f) == 0)
-#define ENABLE_FLAG(p,f) G_STMT_START{IRIS_TASK(p)->priv->flags|=f;}G_STMT_END
+#define ENABLE_FLAG(p,f) G_STMT_START{IRIS_TASK(p)->priv->flags|=f;          \
+                          IRIS_TRACE (IRIS_TRACE_TASK_STATE, p, NULL, f);}    \
+                         G_STMT_END
 #define DISABLE_FLAG(p,f) G_STMT_START{IRIS_TASK(p)->priv->flags&=~f;}G_STMT_END
 
+/* How long enqueued items are gathered up before the sink is sent a new
+ * output estimate.
+ */
+#define ESTIMATE_INTERVAL 20 /* msec */
+
 G_DEFINE_TYPE (IrisProcess, iris_process, IRIS_TYPE_TASK);
 
 enum {
@@ -120,6 +134,10 @@ enum {
 
 static void             post_output_estimate         (IrisProcess *process);
 
+static void             queue_output_estimate        (IrisProcess *process);
+
+static void             flush_output_estimate        (IrisProcess *process);
+
 static void             post_progress_message        (IrisProcess *process,
                                                       IrisMessage *progress_message);
 
@@ -127,6 +145,16 @@ static void             iris_process_dummy           (IrisProcess *task,
                                                       IrisMessage *work_item,
                                                       gpointer user_data);
 
+static gboolean         iris_process_accept_work_item (IrisProcess *process,
+                                                       IrisMessage *work_item);
+
+static void             iris_process_wake            (IrisProcess *process);
+
+static void             iris_process_execute_real    (IrisTask    *task);
+
+static void             iris_task_post_work_item_real (IrisProcess *process,
+                                                       IrisMessage *work_item);
+
 
 /**************************************************************************
  *                          IrisProcess Public API                       *
@@ -284,6 +312,12 @@ iris_process_connect (IrisProcess *head,
 		return;
 	}
 
+	/* Created now rather than in handle_add_source(), so it is there before
+	 * the head can possibly forward anything.
+	 */
+	g_warn_if_fail (tail->priv->forward_queue == NULL);
+	tail->priv->forward_queue = iris_spsc_queue_new ();
+
 	/* We send separate messages, but because we require connecting to be done
 	 * before the processes are executing, there is no danger of entering an
 	 * inconsistent state.
@@ -324,12 +358,31 @@ iris_process_enqueue (IrisProcess *process,
                       IrisMessage *work_item)
 {
 	IrisProcessPrivate *priv;
-	gint                total_items, estimated_total_items;
 
 	g_return_if_fail (IRIS_IS_PROCESS (process));
 
 	priv = process->priv;
 
+	if (!iris_process_accept_work_item (process, work_item))
+		return;
+
+	iris_port_post (priv->work_port, work_item);
+
+	queue_output_estimate (process);
+};
+
+/* Checks @process is open to @work_item and counts it towards the total,
+ * or frees it and returns %FALSE if it is not wanted.
+ */
+static gboolean
+iris_process_accept_work_item (IrisProcess *process,
+                               IrisMessage *work_item)
+{
+	IrisProcessPrivate *priv;
+	gint                total_items, estimated_total_items;
+
+	priv = process->priv;
+
 	if (FLAG_IS_OFF (process, IRIS_PROCESS_FLAG_OPEN)) {
 		if (FLAG_IS_ON (process, IRIS_PROCESS_FLAG_HAS_SOURCE) &&
 		    FLAG_IS_ON (process, IRIS_TASK_FLAG_CANCELLED));
@@ -339,14 +392,14 @@ iris_process_enqueue (IrisProcess *process,
 		else
 			g_warning ("iris_process_enqueue: process %lx is closed to further "
 			           "work items.", (gulong)process);
-		return;
+		return FALSE;
 	};
 
 	if (FLAG_IS_ON (process, IRIS_TASK_FLAG_CANCELLED)) {
 		/* Don't enqueue more work if the process has been cancelled */
 		iris_message_ref_sink (work_item);
 		iris_message_unref (work_item);
-		return;
+		return FALSE;
 	}
 
 	g_atomic_int_inc (&priv->total_items);
@@ -358,15 +411,8 @@ iris_process_enqueue (IrisProcess *process,
 	if (total_items > estimated_total_items)
 		g_atomic_int_set (&priv->estimated_total_items, total_items);
 
-	iris_port_post (priv->work_port, work_item);
-
-	/* FIXME: it's bad that we call this function on every queued work item.
-	 * The best way I can think of to avoid this is to implement
-	 * iris_scheduler_queue_timeout() and send the message from a timeout. You
-	 * can see why I haven't done that yet :)
-	 */
-	post_output_estimate (process);
-};
+	return TRUE;
+}
 
 
 /**
@@ -391,12 +437,16 @@ iris_process_forward (IrisProcess *process,
 	 * completion or cancelation) until this process has finished.
 	 */
 	IrisProcessPrivate *priv;
+	IrisProcess        *sink;
+	IrisQueue          *forward_queue;
 
 	g_return_if_fail (IRIS_IS_PROCESS (process));
 	g_return_if_fail (FLAG_IS_ON (process, IRIS_PROCESS_FLAG_HAS_SINK));
 	g_return_if_fail (FLAG_IS_ON (process, IRIS_TASK_FLAG_WORK_ACTIVE));
 
 	priv = process->priv;
+	sink = priv->sink;
+	forward_queue = sink->priv->forward_queue;
 
 	if (FLAG_IS_ON (process, IRIS_TASK_FLAG_CANCELLED)) {
 		/* This is possible in a chain of 3 or more processes: the head can be
@@ -408,7 +458,28 @@ iris_process_forward (IrisProcess *process,
 		return;
 	}
 
-	iris_process_enqueue (priv->sink, work_item);
+	/* A bounded sink pushes back through its work port instead, and so
+	 * does one that overrides post_work_item, so the override still sees
+	 * every work item.
+	 */
+	if (forward_queue == NULL || IRIS_IS_RING_QUEUE (sink->priv->work_queue) ||
+	    IRIS_PROCESS_GET_CLASS (sink)->post_work_item != iris_task_post_work_item_real) {
+		iris_process_enqueue (sink, work_item);
+		return;
+	}
+
+	if (!iris_process_accept_work_item (sink, work_item))
+		return;
+
+	iris_message_ref_sink (work_item);
+
+	/* The queue is closed once the sink has finished cancelling */
+	if (!iris_queue_push (forward_queue, work_item))
+		iris_message_unref (work_item);
+
+	iris_process_wake (sink);
+
+	queue_output_estimate (sink);
 }
 
 /**
@@ -454,7 +525,8 @@ iris_process_recurse (IrisProcess *process,
  * Causes @process to stop accepting new work items. It will finish up its
  * remaining work and then destroy itself, unless it was cancelled in which case
  * it will finish immediately. If this function is never called, @process will
- * stay around idling and using a substantial amount of CPU cycles forever.
+ * stay around forever, although it does not use any CPU time while it is
+ * waiting for work.
  *
  * If @process has a sink process connected, closure will be propagated down so
  * that the sink will complete once @process has done so. iris_process_close()
@@ -826,6 +898,53 @@ iris_process_set_title (IrisProcess *process,
 }
 
 
+/**
+ * iris_process_set_work_queue_capacity:
+ * @process: An #IrisProcess
+ * @capacity: the number of work items the queue has room for, or 0
+ *
+ * Bounds the queue of work items waiting for @process, so that a source
+ * which produces them faster than they can be processed is held back
+ * instead of using up all the memory. The queue becomes an #IrisRingQueue
+ * with room for @capacity items; once it is full, work items wait to be
+ * added to it until the work function has made room. When @process is
+ * chained to a source process, the source is held back in the same way.
+ *
+ * The capacity only holds things back once @process is running, since
+ * nothing takes work items off the queue before then. Enqueueing more than
+ * @capacity items before iris_process_run() leaves the thread posting them
+ * waiting until the process is run, with another thread standing in for
+ * it, so run the process first or give it room for the whole of any work
+ * enqueued up front.
+ *
+ * The default capacity of 0 leaves the queue unbounded. This function
+ * cannot be called after iris_process_run() or iris_process_cancel(), or
+ * once work items have been enqueued.
+ */
+void
+iris_process_set_work_queue_capacity (IrisProcess *process,
+                                      guint        capacity)
+{
+	IrisProcessPrivate *priv;
+	IrisQueue          *old_queue;
+
+	g_return_if_fail (IRIS_IS_PROCESS (process));
+	g_return_if_fail (FLAG_IS_OFF (process, IRIS_TASK_FLAG_STARTED));
+
+	priv = process->priv;
+
+	g_return_if_fail (iris_queue_get_length (priv->work_queue) == 0);
+
+	old_queue = priv->work_queue;
+
+	if (capacity > 0)
+		priv->work_queue = iris_ring_queue_new (capacity);
+	else
+		priv->work_queue = iris_queue_new ();
+
+	g_object_unref (old_queue);
+}
+
 /**
  * iris_process_set_output_estimation:
  * @process: An #IrisProcess
@@ -956,6 +1075,47 @@ post_output_estimate (IrisProcess *process)
 	iris_port_post (IRIS_TASK (sink)->priv->port, message);
 }
 
+static void
+post_estimate_timeout (gpointer data)
+{
+	IrisProcess *process = data;
+	IrisMessage *message;
+
+	message = iris_message_new (IRIS_PROCESS_MESSAGE_POST_ESTIMATE);
+	iris_port_post (IRIS_TASK (process)->priv->port, message);
+}
+
+/* Called for every item from iris_process_enqueue(), so rather than send
+ * the sink an estimate each time, set a timeout to send one in a little
+ * while that covers every item enqueued until then. The estimate is sent
+ * from the control message handler, so that it can't overtake a cancel or
+ * finish message on the way to the sink.
+ */
+static void
+queue_output_estimate (IrisProcess *process)
+{
+	IrisTimeout *timeout;
+
+	if (!g_atomic_int_compare_and_exchange (&process->priv->estimate_pending,
+	                                        FALSE, TRUE))
+		return;
+
+	timeout = iris_scheduler_queue_timeout
+	            (IRIS_TASK (process)->priv->control_scheduler,
+	             post_estimate_timeout, g_object_ref (process), g_object_unref,
+	             ESTIMATE_INTERVAL);
+	iris_timeout_unref (timeout);
+}
+
+/* Sends the estimate now if one is waiting on a timeout */
+static void
+flush_output_estimate (IrisProcess *process)
+{
+	if (g_atomic_int_compare_and_exchange (&process->priv->estimate_pending,
+	                                       TRUE, FALSE))
+		post_output_estimate (process);
+}
+
 static void
 post_progress_message (IrisProcess *process,
                        IrisMessage *progress_message)
@@ -1100,6 +1260,8 @@ handle_callbacks_finished (IrisProcess *process,
 	if (FLAG_IS_ON (process, IRIS_TASK_FLAG_FINISHED))
 		return;
 
+	flush_output_estimate (process);
+
 	/* Send 'complete' to any process watchers, now that
 	 * iris_process_is_finished() will return TRUE.
 	 */
@@ -1143,6 +1305,11 @@ handle_start_cancel (IrisProcess *process,
 	ENABLE_FLAG (process, IRIS_TASK_FLAG_CANCELLED);
 	DISABLE_FLAG (process, IRIS_TASK_FLAG_NEED_EXECUTE);
 
+	/* The sink should hear how much we were expecting to output before it
+	 * hears about the cancel.
+	 */
+	flush_output_estimate (process);
+
 	if (FLAG_IS_ON (process, IRIS_TASK_FLAG_CALLBACKS_ACTIVE)) {
 		/* Too late to cancel, callbacks have started */
 		DISABLE_FLAG (process, IRIS_TASK_FLAG_CANCELLED);
@@ -1184,6 +1351,9 @@ handle_start_cancel (IrisProcess *process,
 		iris_port_post (IRIS_TASK (priv->sink)->priv->port, out_message);
 	}
 
+	/* Let a parked work function notice the cancel */
+	iris_process_wake (process);
+
 	iris_task_notify_observers (IRIS_TASK (process));
 }
 
@@ -1192,8 +1362,10 @@ handle_finish_cancel (IrisProcess *process,
                       IrisMessage *in_message)
 {
 	IrisProcessPrivate *priv;
-	IrisMessage        *work_item,
-	                   *out_message;
+	IrisMessage        *out_message;
+	gpointer            work_items[16];
+	guint               n_items,
+	                    i;
 
 	g_return_if_fail (IRIS_IS_PROCESS (process));
 
@@ -1217,6 +1389,11 @@ handle_finish_cancel (IrisProcess *process,
 	g_return_if_fail (priv->work_port != NULL);
 	g_return_if_fail (priv->work_receiver != NULL);
 
+	/* Lets go of a work item handler waiting for room in a bounded queue,
+	 * which the receiver would otherwise wait for.
+	 */
+	iris_queue_close (priv->work_queue);
+
 	if (priv->work_port != NULL) {
 		iris_receiver_destroy (priv->work_receiver, FALSE);
 		g_object_unref (priv->work_port);
@@ -1225,8 +1402,23 @@ handle_finish_cancel (IrisProcess *process,
 		priv->work_port = NULL;
 	}
 
-	while ((work_item = iris_queue_try_pop (priv->work_queue)))
-		iris_message_unref (work_item);
+	while ((n_items = iris_queue_try_pop_many (priv->work_queue, work_items,
+	                                           G_N_ELEMENTS (work_items))) > 0)
+		for (i = 0; i < n_items; i++)
+			iris_message_unref (work_items[i]);
+
+	/* The work function has stopped by now, so we can take its place as the
+	 * one consumer. Closing waits for a forward in progress to land, and
+	 * makes later ones fail.
+	 */
+	if (priv->forward_queue != NULL) {
+		iris_queue_close (priv->forward_queue);
+
+		while ((n_items = iris_queue_try_pop_many (priv->forward_queue, work_items,
+		                                           G_N_ELEMENTS (work_items))) > 0)
+			for (i = 0; i < n_items; i++)
+				iris_message_unref (work_items[i]);
+	}
 
 	ENABLE_FLAG (process, IRIS_TASK_FLAG_FINISHED);
 
@@ -1278,6 +1470,9 @@ handle_dep_finished (IrisProcess *process,
 
 		DISABLE_FLAG (process, IRIS_PROCESS_FLAG_OPEN);
 
+		/* The work function may be parked waiting for more work */
+		iris_process_wake (process);
+
 		if (FLAG_IS_ON (process, IRIS_TASK_FLAG_CANCELLED) &&
 		    FLAG_IS_OFF (process, IRIS_TASK_FLAG_WORK_ACTIVE)) {
 			/* Our work function should send finish-cancel when it finishes and
@@ -1346,6 +1541,9 @@ handle_close (IrisProcess *process,
 
 	DISABLE_FLAG (process, IRIS_PROCESS_FLAG_OPEN);
 
+	/* The work function may be parked waiting for more work */
+	iris_process_wake (process);
+
 	if (FLAG_IS_ON (process, IRIS_TASK_FLAG_CANCELLED)) {
 		if (FLAG_IS_ON (process, IRIS_TASK_FLAG_WORK_ACTIVE));
 			/* Wait until work function notices cancel to free object etc. */
@@ -1527,7 +1725,8 @@ static const char *process_message_name[] =
     "add-sink",
     "chain-cancel",
     "add-watch",
-    "chain-estimate"
+    "chain-estimate",
+    "post-estimate"
   };
 #endif
 
@@ -1544,7 +1743,7 @@ iris_process_handle_message_real (IrisTask    *task,
 
 	#ifdef IRIS_TRACE_TASK
 	if (message->what >= IRIS_PROCESS_MESSAGE_CLOSE &&
-	    message->what <= IRIS_PROCESS_MESSAGE_CHAIN_ESTIMATE)
+	    message->what <= IRIS_PROCESS_MESSAGE_POST_ESTIMATE)
 		g_print ("process %lx: got message %s\n",
 		         (gulong)process, process_message_name [message->what - IRIS_PROCESS_MESSAGE_CLOSE]);
 	#endif
@@ -1602,6 +1801,10 @@ iris_process_handle_message_real (IrisTask    *task,
 		handle_chain_estimate (process, message);
 		break;
 
+	case IRIS_PROCESS_MESSAGE_POST_ESTIMATE:
+		flush_output_estimate (process);
+		break;
+
 	default:
 		IRIS_TASK_CLASS (iris_process_parent_class)->handle_message (IRIS_TASK (process),
 		                                                             message);
@@ -1630,16 +1833,38 @@ iris_process_has_succeeded_real (IrisTask *task) {
 		       task_class->has_succeeded (IRIS_TASK (process));
 }
 
+/* Pushes onto the work queue. When a bounded queue is full we wait for the
+ * work function to make room; if we are on a scheduler thread a stand-in
+ * takes our place meanwhile, so the work function can still get a turn.
+ */
+static gboolean
+iris_process_push_work_item (IrisProcess *process,
+                             IrisMessage *work_item)
+{
+	IrisQueue *queue = process->priv->work_queue;
+	gboolean   pushed;
+
+	if (!IRIS_IS_RING_QUEUE (queue))
+		return iris_queue_push (queue, work_item);
+
+	if (iris_ring_queue_try_push (IRIS_RING_QUEUE (queue), work_item))
+		return TRUE;
+
+	iris_process_wake (process);
+
+	iris_thread_enter_blocking ();
+	pushed = iris_queue_push (queue, work_item);
+	iris_thread_leave_blocking ();
+
+	return pushed;
+}
+
 static void
 iris_task_post_work_item_real (IrisProcess *process,
                                IrisMessage *work_item)
 {
-	IrisProcessPrivate *priv;
-
 	g_return_if_fail (IRIS_IS_TASK (process));
 
-	priv = process->priv;
-
 	/* FIXME: currently the work receiver is exclusive. We could remove the
 	 * arbiter if this queue was MT-safe - but would it be faster having the
 	 * lock on an async queue level rather than the receiver? Or, would it
@@ -1647,7 +1872,12 @@ iris_task_post_work_item_real (IrisProcess *process,
 	 */
 	if (FLAG_IS_OFF (process, IRIS_TASK_FLAG_CANCELLED)) {
 		iris_message_ref (work_item);
-		iris_queue_push (priv->work_queue, work_item);
+
+		/* The queue is closed once the process has finished cancelling */
+		if (!iris_process_push_work_item (process, work_item))
+			iris_message_unref (work_item);
+
+		iris_process_wake (process);
 	}
 
 	/* total_items and estimated_total_items are updated in iris_process_enqueue() */
@@ -1686,6 +1916,44 @@ work_function_can_finish (IrisProcess *process)
 	return TRUE;
 }
 
+/* Checked by the work function after it has cleared priv->scheduled, to close
+ * the race with a wake-up that happened just before the flag was cleared.
+ */
+static gboolean
+work_function_has_work (IrisProcess *process)
+{
+	return iris_queue_get_length (process->priv->work_queue) > 0 ||
+	       (process->priv->forward_queue != NULL &&
+	        iris_queue_get_length (process->priv->forward_queue) > 0) ||
+	       FLAG_IS_ON (process, IRIS_TASK_FLAG_CANCELLED) ||
+	       work_function_can_finish (process);
+}
+
+/* Queue the work function again if it has parked itself. This is called after
+ * a work item is delivered to the work queue and after any state change that
+ * the work function needs to notice (close, cancel and the source finishing).
+ * It does nothing before the work function has run for the first time,
+ * because priv->scheduled starts off as TRUE.
+ */
+static void
+iris_process_wake (IrisProcess *process)
+{
+	IrisProcessPrivate *priv;
+	IrisScheduler      *work_scheduler;
+
+	priv = process->priv;
+
+	if (g_atomic_int_get (&priv->scheduled))
+		return;
+
+	if (!g_atomic_int_compare_and_exchange (&priv->scheduled, FALSE, TRUE))
+		return;
+
+	work_scheduler = g_atomic_pointer_get (&IRIS_TASK (process)->priv->work_scheduler);
+	iris_scheduler_queue (work_scheduler,
+	                      (IrisCallback)iris_process_execute_real,
+	                      process, NULL);
+}
 
 static void
 iris_process_execute_real (IrisTask *task)
@@ -1710,8 +1978,6 @@ iris_process_execute_real (IrisTask *task)
 
 	g_warn_if_fail (task->priv->closure != NULL);
 
-	/* See TODO about why this code is really dumb and how it could be improved */
-
 	timer = g_timer_new ();
 
 	while (1) {
@@ -1729,24 +1995,46 @@ iris_process_execute_real (IrisTask *task)
 		if (cancelled)
 			break;
 
-		if (G_UNLIKELY (g_timer_elapsed(timer, NULL) > 1.0))
-			goto _yield;
+		/* Give other work on the scheduler a turn every so often. We stay
+		 * scheduled, so nobody else will queue us meanwhile.
+		 */
+		if (G_UNLIKELY (g_timer_elapsed(timer, NULL) > 1.0)) {
+			g_value_unset (&params[0]);
+			g_timer_destroy (timer);
+
+			work_scheduler = g_atomic_pointer_get (&IRIS_TASK (process)->priv->work_scheduler);
+			iris_scheduler_queue (work_scheduler,
+			                      (IrisCallback)iris_process_execute_real,
+			                      process, NULL);
+			return;
+		}
 
-		work_item = iris_queue_try_pop (priv->work_queue);
+		work_item = NULL;
+		if (priv->forward_queue != NULL)
+			work_item = iris_queue_try_pop (priv->forward_queue);
+		if (!work_item)
+			work_item = iris_queue_try_pop (priv->work_queue);
 
 		if (!work_item) {
 			if (work_function_can_finish (process))
 				break;
 
-_yield:
+			/* Nothing to do: park until iris_process_wake() is called. Let
+			 * any watchers see how far we got first, since no more status
+			 * updates will be sent until then.
+			 */
+			if (priv->watch_port_list != NULL)
+				update_status (process, FALSE);
+
+			g_atomic_int_set (&priv->scheduled, FALSE);
+
+			if (work_function_has_work (process) &&
+			    g_atomic_int_compare_and_exchange (&priv->scheduled, FALSE, TRUE))
+				/* Raced with a wake-up that saw us still scheduled */
+				continue;
+
 			g_value_unset (&params[0]);
 			g_timer_destroy (timer);
-
-			/* Yield, by reposting this function to the scheduler and returning. */
-			work_scheduler = g_atomic_pointer_get (&IRIS_TASK (process)->priv->work_scheduler);
-			iris_scheduler_queue (work_scheduler,
-			                      (IrisCallback)iris_process_execute_real,
-			                      process, NULL);
 			return;
 		}
 
@@ -1894,6 +2182,11 @@ iris_process_finalize (GObject *object)
 	g_warn_if_fail (iris_queue_get_length (priv->work_queue) == 0);
 	g_object_unref (priv->work_queue);
 
+	if (priv->forward_queue != NULL) {
+		g_warn_if_fail (iris_queue_get_length (priv->forward_queue) == 0);
+		g_object_unref (priv->forward_queue);
+	}
+
 	if (priv->source != NULL)
 		g_object_unref (priv->source);
 
@@ -1957,6 +2250,8 @@ iris_process_init (IrisProcess *process)
 	priv->work_port = NULL;
 	priv->work_receiver = NULL;
 	priv->work_queue = iris_queue_new ();
+	priv->forward_queue = NULL;
+	priv->scheduled = TRUE;
 
 	priv->source = NULL;
 	priv->sink = NULL;
@@ -1971,6 +2266,7 @@ iris_process_init (IrisProcess *process)
 	p_output_estimation_factor = g_slice_new (float);
 	*p_output_estimation_factor = 1.0;
 	priv->output_estimate_factor = p_output_estimation_factor;
+	priv->estimate_pending = FALSE;
 
 	priv->title = NULL;
 
@@ -121,6 +121,9 @@ void          iris_process_set_title             (IrisProcess            *proces
                                                   const gchar            *title);
 void          iris_process_set_output_estimation (IrisProcess            *process,
                                                   gfloat                  factor);
+void          iris_process_set_work_queue_capacity
+                                                 (IrisProcess            *process,
+                                                  guint                   capacity);
 
 void          iris_process_add_watch             (IrisProcess            *process,
                                                   IrisPort               *watch_port);
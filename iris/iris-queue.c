@@ -65,8 +65,14 @@ G_DEFINE_TYPE (IrisQueue, iris_queue, G_TYPE_OBJECT)
 
 static gboolean iris_queue_real_push               (IrisQueue *queue,
                                                     gpointer   data);
+static guint    iris_queue_real_push_many          (IrisQueue *queue,
+                                                    gpointer  *items,
+                                                    guint      n_items);
 static gpointer iris_queue_real_pop                (IrisQueue *queue);
 static gpointer iris_queue_real_try_pop            (IrisQueue *queue);
+static guint    iris_queue_real_try_pop_many       (IrisQueue *queue,
+                                                    gpointer  *items,
+                                                    guint      max_items);
 static gpointer iris_queue_real_timed_pop          (IrisQueue *queue,
                                                     GTimeVal  *timeout);
 static gpointer iris_queue_real_try_pop_or_close   (IrisQueue *queue);
@@ -120,8 +126,10 @@ iris_queue_class_init (IrisQueueClass *klass)
 	g_type_class_add_private (object_class, sizeof (IrisQueuePrivate));
 
 	klass->push = iris_queue_real_push;
+	klass->push_many = iris_queue_real_push_many;
 	klass->pop = iris_queue_real_pop;
 	klass->try_pop = iris_queue_real_try_pop;
+	klass->try_pop_many = iris_queue_real_try_pop_many;
 	klass->timed_pop = iris_queue_real_timed_pop;
 	klass->try_pop_or_close = iris_queue_real_try_pop_or_close;
 	klass->timed_pop_or_close = iris_queue_real_timed_pop_or_close;
@@ -174,6 +182,28 @@ iris_queue_push (IrisQueue *queue,
 	return IRIS_QUEUE_GET_CLASS (queue)->push (queue, data);
 }
 
+/**
+ * iris_queue_push_many:
+ * @queue: An #IrisQueue
+ * @items: an array of non-%NULL pointers
+ * @n_items: the number of pointers in @items
+ *
+ * Pushes @n_items pointers onto the queue, in order. Implementations try to
+ * do this with a single synchronization, which is much cheaper than calling
+ * iris_queue_push() for each item.
+ *
+ * If @queue is closed part way through, the remaining items are not pushed.
+ *
+ * Return value: the number of items that were pushed.
+ */
+guint
+iris_queue_push_many (IrisQueue *queue,
+                      gpointer  *items,
+                      guint      n_items)
+{
+	return IRIS_QUEUE_GET_CLASS (queue)->push_many (queue, items, n_items);
+}
+
 /**
  * iris_queue_pop:
  * @queue: An #IrisQueue
@@ -209,6 +239,29 @@ iris_queue_try_pop (IrisQueue *queue)
 	return IRIS_QUEUE_GET_CLASS (queue)->try_pop (queue);
 }
 
+/**
+ * iris_queue_try_pop_many:
+ * @queue: An #IrisQueue
+ * @items: an array with room for @max_items pointers
+ * @max_items: the most items to pop
+ *
+ * Pops up to @max_items items off the queue without blocking, storing them
+ * in @items in the order iris_queue_try_pop() would have returned them.
+ * Like iris_queue_push_many(), implementations try to do this with a single
+ * synchronization, so a consumer of a deep queue can take a batch of work
+ * for the price of one item.
+ *
+ * Return value: the number of items stored in @items, which is 0 if @queue
+ *               was empty.
+ */
+guint
+iris_queue_try_pop_many (IrisQueue *queue,
+                         gpointer  *items,
+                         guint      max_items)
+{
+	return IRIS_QUEUE_GET_CLASS (queue)->try_pop_many (queue, items, max_items);
+}
+
 /**
  * iris_queue_timed_pop:
  * @queue: An #IrisQueue
@@ -388,6 +441,36 @@ iris_queue_real_push (IrisQueue *queue,
 	return is_open;
 }
 
+static guint
+iris_queue_real_push_many (IrisQueue *queue,
+                           gpointer  *items,
+                           guint      n_items)
+{
+	guint i;
+
+	g_return_val_if_fail (items != NULL || n_items == 0, 0);
+
+	/* Subclasses that only override push() get the simple fallback */
+	if (queue->priv->q == NULL) {
+		for (i = 0; i < n_items; i++)
+			if (!iris_queue_push (queue, items[i]))
+				break;
+		return i;
+	}
+
+	g_async_queue_lock (queue->priv->q);
+
+	if (G_LIKELY (g_atomic_int_get (&queue->priv->open))) {
+		for (i = 0; i < n_items; i++)
+			g_async_queue_push_unlocked (queue->priv->q, items[i]);
+	} else
+		i = 0;
+
+	g_async_queue_unlock (queue->priv->q);
+
+	return i;
+}
+
 static gpointer
 iris_queue_real_pop (IrisQueue *queue)
 {
@@ -425,6 +508,43 @@ iris_queue_real_try_pop (IrisQueue *queue)
 	return item;
 }
 
+static guint
+iris_queue_real_try_pop_many (IrisQueue *queue,
+                              gpointer  *items,
+                              guint      max_items)
+{
+	gpointer item;
+	guint    n_items = 0;
+
+	g_return_val_if_fail (items != NULL || max_items == 0, 0);
+
+	/* Subclasses that only override try_pop() get the simple fallback */
+	if (queue->priv->q == NULL) {
+		while (n_items < max_items &&
+		       (item = iris_queue_try_pop (queue)) != NULL)
+			items[n_items++] = item;
+		return n_items;
+	}
+
+	g_async_queue_lock (queue->priv->q);
+
+	while (n_items < max_items) {
+		item = g_async_queue_try_pop_unlocked (queue->priv->q);
+
+		if (g_atomic_int_get (&queue->priv->open) == FALSE)
+			item = handle_close_token_ul (queue, item);
+
+		if (item == NULL)
+			break;
+
+		items[n_items++] = item;
+	}
+
+	g_async_queue_unlock (queue->priv->q);
+
+	return n_items;
+}
+
 static gpointer
 iris_queue_real_timed_pop (IrisQueue *queue,
                            GTimeVal  *timeout)
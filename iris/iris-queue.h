@@ -51,8 +51,14 @@ struct _IrisQueueClass
 
 	gboolean (*push)               (IrisQueue *queue,
 	                                gpointer   data);
+	guint    (*push_many)          (IrisQueue *queue,
+	                                gpointer  *items,
+	                                guint      n_items);
 	gpointer (*pop)                (IrisQueue *queue);
 	gpointer (*try_pop)            (IrisQueue *queue);
+	guint    (*try_pop_many)       (IrisQueue *queue,
+	                                gpointer  *items,
+	                                guint      max_items);
 	gpointer (*timed_pop)          (IrisQueue *queue,
 	                                GTimeVal  *timeout);
 	gpointer (*try_pop_or_close)   (IrisQueue *queue);
@@ -69,8 +75,14 @@ IrisQueue * iris_queue_new                (void);
 
 gboolean    iris_queue_push               (IrisQueue *queue,
                                            gpointer   data);
+guint       iris_queue_push_many          (IrisQueue *queue,
+                                           gpointer  *items,
+                                           guint      n_items);
 gpointer    iris_queue_pop                (IrisQueue *queue);
 gpointer    iris_queue_try_pop            (IrisQueue *queue);
+guint       iris_queue_try_pop_many       (IrisQueue *queue,
+                                           gpointer  *items,
+                                           guint      max_items);
 gpointer    iris_queue_timed_pop          (IrisQueue *queue,
                                            GTimeVal  *timeout);
 gpointer    iris_queue_try_pop_or_close   (IrisQueue *queue);
@@ -101,6 +101,11 @@ struct _IrisReceiverPrivate
 	gint           max_active; /* The maximum number of receives that
 	                            * we can process concurrently.
 	                            */
+
+	volatile IrisPriority
+	               priority;   /* Priority our workers are queued at on
+	                            * the scheduler.
+	                            */
 };
 
 struct _IrisReceiverClass
@@ -24,6 +24,8 @@
 #include "iris-receiver.h"
 #include "iris-receiver-private.h"
 #include "iris-port.h"
+#include "iris-thread-cache.h"
+#include "iris-trace-private.h"
 
 /**
  * SECTION:iris-receiver
@@ -84,7 +86,7 @@ iris_receiver_worker_destroy_cb (gpointer data)
 		if (g_atomic_int_dec_and_test (&worker->receiver->priv->active)) { };
 
 	iris_message_unref (worker->message);
-	g_slice_free (IrisWorkerData, worker);
+	iris_thread_cache_free (worker);
 }
 
 static void
@@ -106,7 +108,9 @@ iris_receiver_worker (gpointer data)
 	worker->executed = TRUE;
 
 	/* Execute the callback */
+	IRIS_TRACE (IRIS_TRACE_MESSAGE_BEGIN, worker->message, worker->receiver, 0);
 	priv->callback (worker->message, priv->data);
+	IRIS_TRACE (IRIS_TRACE_MESSAGE_END, worker->message, worker->receiver, 0);
 
 	/* Decrement before we notify the arbiter so it will always notice if
 	 * priv->active==0 and call iris_receiver_resume(). We could be even more
@@ -161,8 +165,11 @@ iris_receiver_deliver_real (IrisReceiver *receiver,
 		 * there's no need.
 		 */
 		if (!priv->persistent && execute)
-			if (!g_atomic_int_compare_and_exchange (&priv->completed, FALSE, TRUE))
+			if (!g_atomic_int_compare_and_exchange (&priv->completed, FALSE, TRUE)) {
+				/* Lost the race for our one message; the port keeps this one */
 				execute = FALSE;
+				status = IRIS_DELIVERY_REMOVE;
+			}
 
 		if (execute)
 			g_atomic_int_inc (&priv->active);
@@ -233,15 +240,16 @@ _post_decision:
 		if (!priv->persistent)
 			status = IRIS_DELIVERY_ACCEPTED_REMOVE;
 
-		worker = g_slice_new0 (IrisWorkerData);
+		worker = iris_thread_cache_new0 (IrisWorkerData);
 		worker->receiver = receiver;
 		worker->executed = FALSE;
 		worker->message = iris_message_ref_sink (message);
 
-		iris_scheduler_queue (priv->scheduler,
-		                      iris_receiver_worker,
-		                      worker,
-		                      iris_receiver_worker_destroy_cb);
+		iris_scheduler_queue_full (priv->scheduler,
+		                           iris_receiver_worker,
+		                           worker,
+		                           iris_receiver_worker_destroy_cb,
+		                           g_atomic_int_get ((gint *)&priv->priority));
 	}
 
 	return status;
@@ -401,6 +409,7 @@ iris_receiver_init (IrisReceiver *receiver)
 	g_static_rec_mutex_init (&receiver->priv->mutex);
 	g_static_rec_mutex_init (&receiver->priv->destroy_mutex);
 	receiver->priv->persistent = TRUE;
+	receiver->priv->priority = IRIS_PRIORITY_NORMAL;
 }
 
 /*
@@ -417,8 +426,14 @@ IrisDeliveryStatus
 iris_receiver_deliver (IrisReceiver *receiver,
                        IrisMessage  *message)
 {
+	IrisDeliveryStatus status;
+
 	g_return_val_if_fail (IRIS_IS_RECEIVER (receiver), IRIS_DELIVERY_REMOVE);
-	return IRIS_RECEIVER_GET_CLASS (receiver)->deliver (receiver, message);
+
+	status = IRIS_RECEIVER_GET_CLASS (receiver)->deliver (receiver, message);
+	IRIS_TRACE (IRIS_TRACE_MESSAGE_DELIVER, message, receiver, status);
+
+	return status;
 }
 
 /*
@@ -559,6 +574,41 @@ iris_receiver_destroy (IrisReceiver *receiver,
 	g_object_unref (receiver);
 }
 
+/**
+ * iris_receiver_set_priority:
+ * @receiver: An #IrisReceiver
+ * @priority: An #IrisPriority
+ *
+ * Sets the priority at which @receiver queues its message handler on its
+ * scheduler. The default is %IRIS_PRIORITY_NORMAL. Messages that are
+ * already queued keep the priority they were queued with.
+ */
+void
+iris_receiver_set_priority (IrisReceiver *receiver,
+                            IrisPriority  priority)
+{
+	g_return_if_fail (IRIS_IS_RECEIVER (receiver));
+	g_return_if_fail (priority >= 0 && priority < IRIS_N_PRIORITIES);
+
+	g_atomic_int_set ((gint *)&receiver->priv->priority, priority);
+}
+
+/**
+ * iris_receiver_get_priority:
+ * @receiver: An #IrisReceiver
+ *
+ * Retrieves the priority set with iris_receiver_set_priority().
+ *
+ * Return value: the #IrisPriority of @receiver's work items.
+ */
+IrisPriority
+iris_receiver_get_priority (IrisReceiver *receiver)
+{
+	g_return_val_if_fail (IRIS_IS_RECEIVER (receiver), IRIS_PRIORITY_NORMAL);
+
+	return g_atomic_int_get ((gint *)&receiver->priv->priority);
+}
+
 /*
  * iris_receiver_has_arbiter:
  * @receiver: An #IrisReceiver
@@ -0,0 +1,76 @@
+/* iris-ring-queue-private.h
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __IRIS_RING_QUEUE_PRIVATE_H__
+#define __IRIS_RING_QUEUE_PRIVATE_H__
+
+#include <glib.h>
+
+#include "iris-ring-queue.h"
+#include "iris-util.h"
+
+G_BEGIN_DECLS
+
+typedef struct
+{
+	/* Position the slot is ready for. A pusher at position 'pos' waits for
+	 * 'pos', a popper for 'pos + 1'.
+	 */
+	volatile gint     sequence;
+	gpointer volatile data;
+} IrisRingQueueCell;
+
+struct _IrisRingQueuePrivate
+{
+	IrisRingQueueCell *cells;
+	guint              mask;          /* capacity - 1                   */
+	IrisRingQueueMode  mode;
+
+	gchar              pad1[IRIS_CACHE_LINE_SIZE];
+
+	volatile gint      enqueue_pos;   /* Only ever increase, wrapping   */
+
+	gchar              pad2[IRIS_CACHE_LINE_SIZE];
+
+	volatile gint      dequeue_pos;
+
+	gchar              pad3[IRIS_CACHE_LINE_SIZE];
+
+	/* Pushes in progress, so close() can wait for them to land, as in
+	 * #IrisPriorityQueue.
+	 */
+	volatile gint      open;
+	volatile gint      pushers;
+
+	/* Eventcounts for poppers waiting for an item and pushers waiting for
+	 * room. The other side only touches a seq when its waiters is non-zero.
+	 */
+	volatile gint      pop_waiters;
+	volatile gint      pop_seq;
+	volatile gint      push_waiters;
+	volatile gint      push_seq;
+	GMutex            *wait_mutex;    /* Only used where there is no futex */
+	GCond             *pop_cond;
+	GCond             *push_cond;
+};
+
+G_END_DECLS
+
+#endif /* __IRIS_RING_QUEUE_PRIVATE_H__ */
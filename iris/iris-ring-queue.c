@@ -0,0 +1,899 @@
+/* iris-ring-queue.c
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#include "iris-ring-queue.h"
+#include "iris-ring-queue-private.h"
+#include "iris-util.h"
+
+/**
+ * SECTION:iris-ring-queue
+ * @title: IrisRingQueue
+ * @short_description: A bounded lock-free queue
+ * @see_also: #IrisQueue, #IrisLFQueue
+ *
+ * #IrisRingQueue is a queue with room for a fixed number of items, for
+ * when a producer that runs ahead of its consumers should be held back
+ * rather than allowed to use up all the memory. Any number of threads
+ * can push and pop at once.
+ *
+ * The items are kept in an array whose size is a power of two, and each
+ * slot has a sequence number saying whether it is ready to be pushed to
+ * or popped from on the current lap around the array. Pushing and
+ * popping an item each take one compare-and-exchange on the position of
+ * their own end of the queue, so pushers and poppers do not get in each
+ * other's way.
+ *
+ * What happens when the queue is full depends on its #IrisRingQueueMode:
+ * iris_queue_push() either waits for room or fails straight away. Either
+ * way iris_ring_queue_try_push() never waits and
+ * iris_ring_queue_timed_push() waits for a limited time. Closing the queue
+ * wakes any pushers that are waiting, and their pushes fail.
+ *
+ * The blocking pops spin for a short while, then yield, and finally sleep
+ * until an item is pushed, and waiting pushers do the same. Neither side
+ * pays for a wake-up unless somebody is actually sleeping.
+ */
+
+/* Number of times a blocking push or pop retries before yielding the CPU,
+ * and then the number of times it yields before going to sleep.
+ */
+#define RING_QUEUE_SPIN_COUNT  64
+#define RING_QUEUE_YIELD_COUNT 4
+
+/* Positions wrap around, so they are compared by their signed distance */
+#define POS_DIFF(a,b) ((gint)((guint)(a) - (guint)(b)))
+#define POS_ADD(a,n)  ((gint)((guint)(a) + (guint)(n)))
+
+enum
+{
+	PROP_0,
+	PROP_CAPACITY
+};
+
+G_DEFINE_TYPE (IrisRingQueue, iris_ring_queue, IRIS_TYPE_QUEUE)
+
+static gboolean iris_ring_queue_real_push               (IrisQueue *queue,
+                                                         gpointer   data);
+static guint    iris_ring_queue_real_push_many          (IrisQueue *queue,
+                                                         gpointer  *items,
+                                                         guint      n_items);
+static gpointer iris_ring_queue_real_pop                (IrisQueue *queue);
+static gpointer iris_ring_queue_real_try_pop            (IrisQueue *queue);
+static guint    iris_ring_queue_real_try_pop_many       (IrisQueue *queue,
+                                                         gpointer  *items,
+                                                         guint      max_items);
+static gpointer iris_ring_queue_real_timed_pop          (IrisQueue *queue,
+                                                         GTimeVal  *timeout);
+static gpointer iris_ring_queue_real_try_pop_or_close   (IrisQueue *queue);
+static gpointer iris_ring_queue_real_timed_pop_or_close (IrisQueue *queue,
+                                                         GTimeVal  *timeout);
+static void     iris_ring_queue_real_close              (IrisQueue *queue);
+static guint    iris_ring_queue_real_get_length         (IrisQueue *queue);
+static gboolean iris_ring_queue_real_is_closed          (IrisQueue *queue);
+
+static void
+iris_ring_queue_finalize (GObject *object)
+{
+	IrisRingQueuePrivate *priv;
+
+	priv = IRIS_RING_QUEUE (object)->priv;
+
+	g_free (priv->cells);
+
+#ifndef LINUX
+	g_mutex_free (priv->wait_mutex);
+	g_cond_free (priv->pop_cond);
+	g_cond_free (priv->push_cond);
+#endif
+
+	G_OBJECT_CLASS (iris_ring_queue_parent_class)->finalize (object);
+}
+
+static void
+iris_ring_queue_set_property (GObject      *object,
+                              guint         prop_id,
+                              const GValue *value,
+                              GParamSpec   *pspec)
+{
+	IrisRingQueuePrivate *priv;
+	guint                 capacity,
+	                      i;
+
+	priv = IRIS_RING_QUEUE (object)->priv;
+
+	switch (prop_id) {
+		/* Construct-only property */
+		case PROP_CAPACITY:
+			g_warn_if_fail (priv->cells == NULL);
+
+			for (capacity = 2; capacity < g_value_get_uint (value); capacity <<= 1);
+
+			priv->cells = g_new (IrisRingQueueCell, capacity);
+			priv->mask = capacity - 1;
+
+			for (i = 0; i < capacity; i++) {
+				priv->cells[i].sequence = i;
+				priv->cells[i].data = NULL;
+			}
+			break;
+
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+static void
+iris_ring_queue_get_property (GObject    *object,
+                              guint       prop_id,
+                              GValue     *value,
+                              GParamSpec *pspec)
+{
+	switch (prop_id) {
+		/* Construct-only property */
+		case PROP_CAPACITY:
+			g_value_set_uint (value,
+			                  iris_ring_queue_get_capacity (IRIS_RING_QUEUE (object)));
+			break;
+
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+static void
+iris_ring_queue_class_init (IrisRingQueueClass *klass)
+{
+	GObjectClass   *object_class;
+	IrisQueueClass *queue_class;
+
+	object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = iris_ring_queue_finalize;
+	object_class->set_property = iris_ring_queue_set_property;
+	object_class->get_property = iris_ring_queue_get_property;
+
+	/**
+	 * IrisRingQueue:capacity:
+	 *
+	 * The number of items the queue has room for. It is rounded up to a
+	 * power of two.
+	 */
+	g_object_class_install_property
+	  (object_class,
+	   PROP_CAPACITY,
+	   g_param_spec_uint ("capacity",
+	                      "Capacity",
+	                      "Number of items the queue has room for",
+	                      1, 1 << 30, IRIS_RING_QUEUE_DEFAULT_CAPACITY,
+	                      G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_NAME |
+	                      G_PARAM_READWRITE));
+
+	g_type_class_add_private (object_class, sizeof (IrisRingQueuePrivate));
+
+	queue_class = IRIS_QUEUE_CLASS (klass);
+	queue_class->push = iris_ring_queue_real_push;
+	queue_class->push_many = iris_ring_queue_real_push_many;
+	queue_class->pop = iris_ring_queue_real_pop;
+	queue_class->try_pop = iris_ring_queue_real_try_pop;
+	queue_class->try_pop_many = iris_ring_queue_real_try_pop_many;
+	queue_class->timed_pop = iris_ring_queue_real_timed_pop;
+	queue_class->try_pop_or_close = iris_ring_queue_real_try_pop_or_close;
+	queue_class->timed_pop_or_close = iris_ring_queue_real_timed_pop_or_close;
+	queue_class->close = iris_ring_queue_real_close;
+	queue_class->get_length = iris_ring_queue_real_get_length;
+	queue_class->is_closed = iris_ring_queue_real_is_closed;
+}
+
+static void
+iris_ring_queue_init (IrisRingQueue *queue)
+{
+	IrisRingQueuePrivate *priv;
+
+	priv = queue->priv = G_TYPE_INSTANCE_GET_PRIVATE (queue,
+	                                                  IRIS_TYPE_RING_QUEUE,
+	                                                  IrisRingQueuePrivate);
+
+	/* The cells are allocated when the capacity is set */
+	priv->cells = NULL;
+	priv->mask = 0;
+	priv->mode = IRIS_RING_QUEUE_BLOCK;
+
+	priv->enqueue_pos = 0;
+	priv->dequeue_pos = 0;
+
+	priv->open = TRUE;
+	priv->pushers = 0;
+
+	priv->pop_waiters = 0;
+	priv->pop_seq = 0;
+	priv->push_waiters = 0;
+	priv->push_seq = 0;
+
+#ifdef LINUX
+	priv->wait_mutex = NULL;
+	priv->pop_cond = NULL;
+	priv->push_cond = NULL;
+#else
+	priv->wait_mutex = g_mutex_new ();
+	priv->pop_cond = g_cond_new ();
+	priv->push_cond = g_cond_new ();
+#endif
+}
+
+/**
+ * iris_ring_queue_new:
+ * @capacity: the number of items the queue has room for
+ *
+ * Creates a new #IrisRingQueue with room for at least @capacity items,
+ * whose iris_queue_push() waits for room when it is full.
+ *
+ * Return value: the newly created #IrisRingQueue.
+ */
+IrisQueue*
+iris_ring_queue_new (guint capacity)
+{
+	return iris_ring_queue_new_full (capacity, IRIS_RING_QUEUE_BLOCK);
+}
+
+/**
+ * iris_ring_queue_new_full:
+ * @capacity: the number of items the queue has room for
+ * @mode: what iris_queue_push() does when the queue is full
+ *
+ * Creates a new #IrisRingQueue with room for at least @capacity items.
+ * @capacity is rounded up to a power of two.
+ *
+ * Return value: the newly created #IrisRingQueue.
+ */
+IrisQueue*
+iris_ring_queue_new_full (guint             capacity,
+                          IrisRingQueueMode mode)
+{
+	IrisRingQueue *queue;
+
+	g_return_val_if_fail (capacity > 0 && capacity <= 1 << 30, NULL);
+
+	queue = g_object_new (IRIS_TYPE_RING_QUEUE, "capacity", capacity, NULL);
+	queue->priv->mode = mode;
+
+	return IRIS_QUEUE (queue);
+}
+
+/* Sleep until *@seq_addr moves on from @seq, or @usec microseconds pass if
+ * @usec is not negative.
+ */
+static void
+iris_ring_queue_wait (IrisRingQueuePrivate *priv,
+                      volatile gint        *seq_addr,
+                      GCond                *cond,
+                      gint                  seq,
+                      glong                 usec)
+{
+#ifdef LINUX
+	iris_futex_wait (seq_addr, seq, usec);
+#else
+	GTimeVal tv;
+
+	g_mutex_lock (priv->wait_mutex);
+
+	if (usec >= 0) {
+		g_get_current_time (&tv);
+		g_time_val_add (&tv, usec);
+	}
+
+	if (g_atomic_int_get (seq_addr) == seq) {
+		if (usec >= 0)
+			g_cond_timed_wait (cond, priv->wait_mutex, &tv);
+		else
+			g_cond_wait (cond, priv->wait_mutex);
+	}
+
+	g_mutex_unlock (priv->wait_mutex);
+#endif
+}
+
+/* Wake one thread sleeping on @seq_addr, or all of them if @all is %TRUE. */
+static void
+iris_ring_queue_wake (IrisRingQueuePrivate *priv,
+                      volatile gint        *seq_addr,
+                      GCond                *cond,
+                      gboolean              all)
+{
+#ifdef LINUX
+	g_atomic_int_inc (seq_addr);
+	iris_futex_wake (seq_addr, all ? G_MAXINT : 1);
+#else
+	g_mutex_lock (priv->wait_mutex);
+	g_atomic_int_inc (seq_addr);
+	if (all)
+		g_cond_broadcast (cond);
+	else
+		g_cond_signal (cond);
+	g_mutex_unlock (priv->wait_mutex);
+#endif
+}
+
+/* Checks whether anybody is sleeping on the other side. The
+ * compare-and-exchange is a full barrier, so either a waiter sees the
+ * change we just made to a cell when it rechecks the queue, or we see it
+ * registered here.
+ */
+static inline gboolean
+iris_ring_queue_has_waiters (volatile gint *waiters)
+{
+	return !g_atomic_int_compare_and_exchange (waiters, 0, 0);
+}
+
+/* Claims the slot at the tail and stores @data in it, or returns %FALSE if
+ * the queue is full.
+ */
+static gboolean
+iris_ring_queue_enqueue (IrisRingQueuePrivate *priv,
+                         gpointer              data)
+{
+	IrisRingQueueCell *cell;
+	gint               pos,
+	                   diff;
+
+	pos = g_atomic_int_get (&priv->enqueue_pos);
+
+	for (;;) {
+		cell = &priv->cells[(guint)pos & priv->mask];
+		diff = POS_DIFF (g_atomic_int_get (&cell->sequence), pos);
+
+		if (diff == 0) {
+			if (g_atomic_int_compare_and_exchange (&priv->enqueue_pos,
+			                                       pos, POS_ADD (pos, 1)))
+				break;
+		}
+		else if (diff < 0)
+			/* The item from the last lap has not been popped yet */
+			return FALSE;
+
+		pos = g_atomic_int_get (&priv->enqueue_pos);
+	}
+
+	cell->data = data;
+	g_atomic_int_set (&cell->sequence, POS_ADD (pos, 1));
+
+	return TRUE;
+}
+
+/* Claims the slot at the head and takes its item, or returns %NULL if the
+ * queue is empty.
+ */
+static gpointer
+iris_ring_queue_dequeue (IrisRingQueuePrivate *priv)
+{
+	IrisRingQueueCell *cell;
+	gpointer           data;
+	gint               pos,
+	                   diff;
+
+	pos = g_atomic_int_get (&priv->dequeue_pos);
+
+	for (;;) {
+		cell = &priv->cells[(guint)pos & priv->mask];
+		diff = POS_DIFF (g_atomic_int_get (&cell->sequence), POS_ADD (pos, 1));
+
+		if (diff == 0) {
+			if (g_atomic_int_compare_and_exchange (&priv->dequeue_pos,
+			                                       pos, POS_ADD (pos, 1)))
+				break;
+		}
+		else if (diff < 0)
+			/* Nothing has been pushed here on this lap yet */
+			return NULL;
+
+		pos = g_atomic_int_get (&priv->dequeue_pos);
+	}
+
+	data = cell->data;
+	cell->data = NULL;
+
+	/* Ready for the push one lap on */
+	g_atomic_int_set (&cell->sequence, POS_ADD (pos, priv->mask + 1));
+
+	return data;
+}
+
+/* Claims up to @max_items filled slots at the head with a single
+ * compare-and-swap, and takes their items. Returns how many it took.
+ */
+static guint
+iris_ring_queue_dequeue_many (IrisRingQueuePrivate *priv,
+                              gpointer             *items,
+                              guint                 max_items)
+{
+	IrisRingQueueCell *cell;
+	gint               pos,
+	                   diff;
+	guint              n_items,
+	                   i;
+
+	pos = g_atomic_int_get (&priv->dequeue_pos);
+
+	for (;;) {
+		/* Count the run of slots already filled on this lap. Only whoever
+		 * moves dequeue_pos past a slot can empty it, so they stay filled
+		 * if our swap succeeds.
+		 */
+		for (n_items = 0; n_items < max_items; n_items++) {
+			cell = &priv->cells[(guint)POS_ADD (pos, n_items) & priv->mask];
+			diff = POS_DIFF (g_atomic_int_get (&cell->sequence),
+			                 POS_ADD (pos, n_items + 1));
+			if (diff != 0)
+				break;
+		}
+
+		if (n_items > 0) {
+			if (g_atomic_int_compare_and_exchange (&priv->dequeue_pos,
+			                                       pos, POS_ADD (pos, n_items)))
+				break;
+		}
+		else if (diff < 0)
+			return 0;
+
+		pos = g_atomic_int_get (&priv->dequeue_pos);
+	}
+
+	for (i = 0; i < n_items; i++) {
+		cell = &priv->cells[(guint)POS_ADD (pos, i) & priv->mask];
+		items[i] = cell->data;
+		cell->data = NULL;
+		g_atomic_int_set (&cell->sequence, POS_ADD (pos, i + priv->mask + 1));
+	}
+
+	return n_items;
+}
+
+/* Pushes @data if the queue is open and has room. Registering as a pusher
+ * before checking 'open' lets close() wait for us to land, so an item can
+ * never arrive after a queue closed empty.
+ */
+static gboolean
+iris_ring_queue_push_once (IrisRingQueuePrivate *priv,
+                           gpointer              data)
+{
+	gboolean pushed = FALSE;
+
+	g_atomic_int_inc (&priv->pushers);
+
+	if (G_LIKELY (g_atomic_int_get (&priv->open)))
+		pushed = iris_ring_queue_enqueue (priv, data);
+
+	g_atomic_int_add (&priv->pushers, -1);
+
+	return pushed;
+}
+
+/* Pushes @data without waking poppers. If the queue is full and @block is
+ * %TRUE, waits for room until @timeout if it is not %NULL, or for ever
+ * otherwise. Fails if the queue is or becomes closed.
+ */
+static gboolean
+iris_ring_queue_wait_push (IrisRingQueue *queue,
+                           gpointer       data,
+                           gboolean       block,
+                           GTimeVal      *timeout)
+{
+	IrisRingQueuePrivate *priv;
+	gboolean              pushed;
+	gint                  spin_count = 0;
+	gint                  seq;
+	glong                 usec = -1;
+
+	priv = queue->priv;
+
+	while (!(pushed = iris_ring_queue_push_once (priv, data))) {
+		if (!block || !g_atomic_int_get (&priv->open))
+			return FALSE;
+
+		if (timeout != NULL) {
+			usec = g_time_val_usec_until (timeout);
+			if (usec <= 0)
+				return FALSE;
+		}
+
+		if (spin_count < RING_QUEUE_SPIN_COUNT + RING_QUEUE_YIELD_COUNT) {
+			if (spin_count >= RING_QUEUE_SPIN_COUNT)
+				g_thread_yield ();
+			spin_count++;
+			continue;
+		}
+
+		/* Register before the final try, so a concurrent pop cannot
+		 * make room between the try and the sleep without waking us.
+		 */
+		g_atomic_int_inc (&priv->push_waiters);
+		seq = g_atomic_int_get (&priv->push_seq);
+
+		if (!(pushed = iris_ring_queue_push_once (priv, data)) &&
+		    g_atomic_int_get (&priv->open))
+			iris_ring_queue_wait (priv, &priv->push_seq, priv->push_cond,
+			                      seq, usec);
+
+		g_atomic_int_add (&priv->push_waiters, -1);
+
+		if (pushed)
+			break;
+	}
+
+	return TRUE;
+}
+
+/* Pops an item, and lets a pusher waiting for room know there is some */
+static gpointer
+iris_ring_queue_pop_once (IrisRingQueuePrivate *priv)
+{
+	gpointer item;
+
+	item = iris_ring_queue_dequeue (priv);
+
+	if (item != NULL && G_UNLIKELY (iris_ring_queue_has_waiters (&priv->push_waiters)))
+		iris_ring_queue_wake (priv, &priv->push_seq, priv->push_cond, FALSE);
+
+	return item;
+}
+
+/* Pops an item, sleeping until one is pushed, the queue is closed or
+ * @timeout passes. A %NULL @timeout waits for ever.
+ */
+static gpointer
+iris_ring_queue_wait_pop (IrisRingQueue *queue,
+                          GTimeVal      *timeout)
+{
+	IrisRingQueuePrivate *priv;
+	gpointer              item;
+	gint                  spin_count = 0;
+	gint                  seq;
+	glong                 usec = -1;
+
+	priv = queue->priv;
+
+	while (!(item = iris_ring_queue_pop_once (priv))) {
+		/* Once closed no more items can arrive, so whatever is left is
+		 * all there is.
+		 */
+		if (!g_atomic_int_get (&priv->open))
+			return iris_ring_queue_pop_once (priv);
+
+		if (timeout != NULL) {
+			usec = g_time_val_usec_until (timeout);
+			if (usec <= 0)
+				return NULL;
+		}
+
+		if (spin_count < RING_QUEUE_SPIN_COUNT + RING_QUEUE_YIELD_COUNT) {
+			if (spin_count >= RING_QUEUE_SPIN_COUNT)
+				g_thread_yield ();
+			spin_count++;
+			continue;
+		}
+
+		g_atomic_int_inc (&priv->pop_waiters);
+		seq = g_atomic_int_get (&priv->pop_seq);
+
+		if (!(item = iris_ring_queue_pop_once (priv)) &&
+		    g_atomic_int_get (&priv->open))
+			iris_ring_queue_wait (priv, &priv->pop_seq, priv->pop_cond,
+			                      seq, usec);
+
+		g_atomic_int_add (&priv->pop_waiters, -1);
+
+		if (item)
+			break;
+	}
+
+	return item;
+}
+
+/* Closes the queue if @item is %NULL. Any item that landed while we were
+ * closing is returned, but the queue stays closed: another thread may
+ * already have seen it closed, so reopening it is not safe. Whatever is
+ * still queued can be popped from a closed queue, so nothing is lost.
+ */
+static gpointer
+iris_ring_queue_close_if_empty (IrisQueue *queue,
+                                gpointer   item)
+{
+	IrisRingQueuePrivate *priv;
+
+	if (item != NULL)
+		return item;
+
+	priv = IRIS_RING_QUEUE (queue)->priv;
+
+	if (!g_atomic_int_compare_and_exchange (&priv->open, TRUE, FALSE))
+		return iris_ring_queue_pop_once (priv);
+
+	iris_ring_queue_real_close (queue);
+
+	return iris_ring_queue_pop_once (priv);
+}
+
+/**
+ * iris_ring_queue_try_push:
+ * @queue: An #IrisRingQueue
+ * @data: a pointer to store that is not %NULL
+ *
+ * Pushes @data onto the queue if it is open and has room, without waiting
+ * whatever the mode of @queue.
+ *
+ * Return value: %TRUE if @data was pushed, %FALSE if @queue is full or
+ *               closed.
+ */
+gboolean
+iris_ring_queue_try_push (IrisRingQueue *queue,
+                          gpointer       data)
+{
+	IrisRingQueuePrivate *priv;
+
+	g_return_val_if_fail (IRIS_IS_RING_QUEUE (queue), FALSE);
+	g_return_val_if_fail (data != NULL, FALSE);
+
+	priv = queue->priv;
+
+	if (!iris_ring_queue_push_once (priv, data))
+		return FALSE;
+
+	if (G_UNLIKELY (iris_ring_queue_has_waiters (&priv->pop_waiters)))
+		iris_ring_queue_wake (priv, &priv->pop_seq, priv->pop_cond, FALSE);
+
+	return TRUE;
+}
+
+/**
+ * iris_ring_queue_timed_push:
+ * @queue: An #IrisRingQueue
+ * @data: a pointer to store that is not %NULL
+ * @timeout: the absolute timeout for the push
+ *
+ * Pushes @data onto the queue, waiting until @timeout for room if it is
+ * full, whatever the mode of @queue.
+ *
+ * Return value: %TRUE if @data was pushed, %FALSE if @timeout passed or
+ *               @queue is or became closed.
+ */
+gboolean
+iris_ring_queue_timed_push (IrisRingQueue *queue,
+                            gpointer       data,
+                            GTimeVal      *timeout)
+{
+	IrisRingQueuePrivate *priv;
+
+	g_return_val_if_fail (IRIS_IS_RING_QUEUE (queue), FALSE);
+	g_return_val_if_fail (data != NULL, FALSE);
+	g_return_val_if_fail (timeout != NULL, FALSE);
+
+	priv = queue->priv;
+
+	if (!iris_ring_queue_wait_push (queue, data, TRUE, timeout))
+		return FALSE;
+
+	if (G_UNLIKELY (iris_ring_queue_has_waiters (&priv->pop_waiters)))
+		iris_ring_queue_wake (priv, &priv->pop_seq, priv->pop_cond, FALSE);
+
+	return TRUE;
+}
+
+/**
+ * iris_ring_queue_get_capacity:
+ * @queue: An #IrisRingQueue
+ *
+ * Retrieves the number of items @queue has room for, which is the
+ * capacity it was created with rounded up to a power of two.
+ *
+ * Return value: the capacity of @queue
+ */
+guint
+iris_ring_queue_get_capacity (IrisRingQueue *queue)
+{
+	g_return_val_if_fail (IRIS_IS_RING_QUEUE (queue), 0);
+
+	return queue->priv->mask + 1;
+}
+
+/**
+ * iris_ring_queue_get_mode:
+ * @queue: An #IrisRingQueue
+ *
+ * Retrieves what iris_queue_push() does when @queue is full.
+ *
+ * Return value: the #IrisRingQueueMode of @queue
+ */
+IrisRingQueueMode
+iris_ring_queue_get_mode (IrisRingQueue *queue)
+{
+	g_return_val_if_fail (IRIS_IS_RING_QUEUE (queue), IRIS_RING_QUEUE_BLOCK);
+
+	return queue->priv->mode;
+}
+
+static gboolean
+iris_ring_queue_real_push (IrisQueue *queue,
+                           gpointer   data)
+{
+	IrisRingQueuePrivate *priv;
+
+	g_return_val_if_fail (data != NULL, FALSE);
+
+	priv = IRIS_RING_QUEUE (queue)->priv;
+
+	if (!iris_ring_queue_wait_push (IRIS_RING_QUEUE (queue), data,
+	                                priv->mode == IRIS_RING_QUEUE_BLOCK,
+	                                NULL))
+		return FALSE;
+
+	if (G_UNLIKELY (iris_ring_queue_has_waiters (&priv->pop_waiters)))
+		iris_ring_queue_wake (priv, &priv->pop_seq, priv->pop_cond, FALSE);
+
+	return TRUE;
+}
+
+static guint
+iris_ring_queue_real_push_many (IrisQueue *queue,
+                                gpointer  *items,
+                                guint      n_items)
+{
+	IrisRingQueuePrivate *priv;
+	gboolean              block;
+	guint                 i;
+
+	g_return_val_if_fail (items != NULL || n_items == 0, 0);
+
+	priv = IRIS_RING_QUEUE (queue)->priv;
+	block = priv->mode == IRIS_RING_QUEUE_BLOCK;
+
+	for (i = 0; i < n_items; i++) {
+		if (iris_ring_queue_push_once (priv, items[i]))
+			continue;
+
+		if (!block || !g_atomic_int_get (&priv->open))
+			break;
+
+		/* Full, so let poppers at what we have pushed so far before
+		 * waiting for them to make room.
+		 */
+		if (i > 0 && iris_ring_queue_has_waiters (&priv->pop_waiters))
+			iris_ring_queue_wake (priv, &priv->pop_seq, priv->pop_cond, TRUE);
+
+		if (!iris_ring_queue_wait_push (IRIS_RING_QUEUE (queue),
+		                                items[i], TRUE, NULL))
+			break;
+	}
+
+	/* One wake-up for the whole batch, and it may as well be for everyone */
+	if (i > 0 && iris_ring_queue_has_waiters (&priv->pop_waiters))
+		iris_ring_queue_wake (priv, &priv->pop_seq, priv->pop_cond, TRUE);
+
+	return i;
+}
+
+static gpointer
+iris_ring_queue_real_pop (IrisQueue *queue)
+{
+	return iris_ring_queue_wait_pop (IRIS_RING_QUEUE (queue), NULL);
+}
+
+static gpointer
+iris_ring_queue_real_try_pop (IrisQueue *queue)
+{
+	return iris_ring_queue_pop_once (IRIS_RING_QUEUE (queue)->priv);
+}
+
+static guint
+iris_ring_queue_real_try_pop_many (IrisQueue *queue,
+                                   gpointer  *items,
+                                   guint      max_items)
+{
+	IrisRingQueuePrivate *priv;
+	guint                 n_items;
+
+	g_return_val_if_fail (items != NULL || max_items == 0, 0);
+
+	if (max_items == 0)
+		return 0;
+
+	priv = IRIS_RING_QUEUE (queue)->priv;
+
+	n_items = iris_ring_queue_dequeue_many (priv, items, max_items);
+
+	/* Room for several pushers, so wake them all */
+	if (n_items > 0 && G_UNLIKELY (iris_ring_queue_has_waiters (&priv->push_waiters)))
+		iris_ring_queue_wake (priv, &priv->push_seq, priv->push_cond,
+		                      n_items > 1);
+
+	return n_items;
+}
+
+static gpointer
+iris_ring_queue_real_timed_pop (IrisQueue *queue,
+                                GTimeVal  *timeout)
+{
+	g_return_val_if_fail (timeout != NULL, NULL);
+
+	return iris_ring_queue_wait_pop (IRIS_RING_QUEUE (queue), timeout);
+}
+
+static gpointer
+iris_ring_queue_real_try_pop_or_close (IrisQueue *queue)
+{
+	gpointer item;
+
+	item = iris_ring_queue_pop_once (IRIS_RING_QUEUE (queue)->priv);
+
+	return iris_ring_queue_close_if_empty (queue, item);
+}
+
+static gpointer
+iris_ring_queue_real_timed_pop_or_close (IrisQueue *queue,
+                                         GTimeVal  *timeout)
+{
+	gpointer item;
+
+	g_return_val_if_fail (timeout != NULL, NULL);
+
+	item = iris_ring_queue_wait_pop (IRIS_RING_QUEUE (queue), timeout);
+
+	return iris_ring_queue_close_if_empty (queue, item);
+}
+
+static void
+iris_ring_queue_real_close (IrisQueue *queue)
+{
+	IrisRingQueuePrivate *priv;
+
+	priv = IRIS_RING_QUEUE (queue)->priv;
+
+	g_atomic_int_compare_and_exchange (&priv->open, TRUE, FALSE);
+
+	/* Let pushes that saw the queue open finish landing */
+	while (g_atomic_int_get (&priv->pushers) > 0)
+		g_thread_yield ();
+
+	/* Poppers find the queue closed, pushers waiting for room give up */
+	iris_ring_queue_wake (priv, &priv->pop_seq, priv->pop_cond, TRUE);
+	iris_ring_queue_wake (priv, &priv->push_seq, priv->push_cond, TRUE);
+}
+
+static guint
+iris_ring_queue_real_get_length (IrisQueue *queue)
+{
+	IrisRingQueuePrivate *priv;
+	gint                  length;
+
+	priv = IRIS_RING_QUEUE (queue)->priv;
+
+	/* Read the head first, so a pop in between makes us high rather than
+	 * negative.
+	 */
+	length = g_atomic_int_get (&priv->dequeue_pos);
+	length = POS_DIFF (g_atomic_int_get (&priv->enqueue_pos), length);
+
+	return CLAMP (length, 0, (gint)priv->mask + 1);
+}
+
+static gboolean
+iris_ring_queue_real_is_closed (IrisQueue *queue)
+{
+	return !g_atomic_int_get (&IRIS_RING_QUEUE (queue)->priv->open);
+}
@@ -0,0 +1,88 @@
+/* iris-ring-queue.h
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __IRIS_RING_QUEUE_H__
+#define __IRIS_RING_QUEUE_H__
+
+#include "iris-queue.h"
+
+G_BEGIN_DECLS
+
+#define IRIS_TYPE_RING_QUEUE            (iris_ring_queue_get_type ())
+#define IRIS_RING_QUEUE(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), IRIS_TYPE_RING_QUEUE, IrisRingQueue))
+#define IRIS_RING_QUEUE_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), IRIS_TYPE_RING_QUEUE, IrisRingQueue const))
+#define IRIS_RING_QUEUE_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  IRIS_TYPE_RING_QUEUE, IrisRingQueueClass))
+#define IRIS_IS_RING_QUEUE(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), IRIS_TYPE_RING_QUEUE))
+#define IRIS_IS_RING_QUEUE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  IRIS_TYPE_RING_QUEUE))
+#define IRIS_RING_QUEUE_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  IRIS_TYPE_RING_QUEUE, IrisRingQueueClass))
+
+typedef struct _IrisRingQueue        IrisRingQueue;
+typedef struct _IrisRingQueueClass   IrisRingQueueClass;
+typedef struct _IrisRingQueuePrivate IrisRingQueuePrivate;
+
+/**
+ * IrisRingQueueMode:
+ * @IRIS_RING_QUEUE_BLOCK: iris_queue_push() waits for room when the queue
+ *                         is full
+ * @IRIS_RING_QUEUE_FAIL: iris_queue_push() returns %FALSE straight away
+ *                        when the queue is full
+ *
+ * What iris_queue_push() and iris_queue_push_many() do when an
+ * #IrisRingQueue is full.
+ */
+typedef enum
+{
+	IRIS_RING_QUEUE_BLOCK,
+	IRIS_RING_QUEUE_FAIL
+} IrisRingQueueMode;
+
+/* Used by g_object_new (IRIS_TYPE_RING_QUEUE, NULL) */
+#define IRIS_RING_QUEUE_DEFAULT_CAPACITY 1024
+
+struct _IrisRingQueue
+{
+	IrisQueue parent;
+
+	/*< private >*/
+	IrisRingQueuePrivate *priv;
+};
+
+struct _IrisRingQueueClass
+{
+	IrisQueueClass parent_class;
+};
+
+GType             iris_ring_queue_get_type     (void) G_GNUC_CONST;
+IrisQueue*        iris_ring_queue_new          (guint              capacity);
+IrisQueue*        iris_ring_queue_new_full     (guint              capacity,
+                                                IrisRingQueueMode  mode);
+
+gboolean          iris_ring_queue_try_push     (IrisRingQueue     *queue,
+                                                gpointer           data);
+gboolean          iris_ring_queue_timed_push   (IrisRingQueue     *queue,
+                                                gpointer           data,
+                                                GTimeVal          *timeout);
+
+guint             iris_ring_queue_get_capacity (IrisRingQueue     *queue);
+IrisRingQueueMode iris_ring_queue_get_mode     (IrisRingQueue     *queue);
+
+G_END_DECLS
+
+#endif /* __IRIS_RING_QUEUE_H__ */
@@ -28,6 +28,27 @@ void     iris_scheduler_manager_yield   (IrisThread *thread);
 /* Returns TRUE if thread may stop, FALSE if it is still needed */
 gboolean iris_scheduler_manager_destroy (IrisThread *thread);
 
+/* Changes the load controller of a scheduler that is already prepared */
+void     iris_scheduler_manager_set_load_controller (IrisScheduler      *scheduler,
+                                                     IrisLoadController *controller);
+
+/* Starts sampling a scheduler again after it was idle */
+void     iris_scheduler_manager_wake_watch (IrisScheduler *scheduler);
+
+/* Creates a timeout in the manager's timer wheel */
+IrisTimeout* iris_scheduler_manager_add_timeout (IrisScheduler  *scheduler,
+                                                 IrisCallback    callback,
+                                                 gpointer        data,
+                                                 GDestroyNotify  notify,
+                                                 guint           interval,
+                                                 gboolean        periodic);
+
+/* Picks a thread to work on the queue of a blocked thread */
+IrisThread* iris_scheduler_manager_lend (IrisThread *thread);
+
+/* Joins and frees a thread that has stopped after being retired */
+void     iris_thread_free               (IrisThread *thread);
+
 G_END_DECLS
 
 #endif /* __IRIS_SCHEDULER_MANAGER_PRIVATE_H__ */
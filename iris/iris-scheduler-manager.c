@@ -22,6 +22,11 @@
 
 #include "iris-debug.h"
 #include "iris-scheduler-manager.h"
+#include "iris-scheduler-manager-private.h"
+#include "iris-scheduler-private.h"
+#include "iris-timer-wheel.h"
+#include "iris-topology.h"
+#include "iris-util.h"
 
 /**
  * SECTION:iris-scheduler-manager
@@ -31,14 +36,116 @@
  * The scheduler manager helps provide dynamic thread-management for
  * schedulers.  It also has some helpers for debugging complex threading
  * scenarios.
+ *
+ * Threads of schedulers that have been restricted to a set of CPUs with
+ * iris_scheduler_set_cpus() are handed out one CPU at a time, choosing the
+ * CPU in the set with the fewest Iris threads on it, so that several
+ * schedulers sharing CPUs still spread their threads over all of the cores.
+ * Idle threads that were last bound to the chosen CPU are reused first.
+ *
+ * Threads that have been idle for longer than the idle timeout (see
+ * iris_scheduler_manager_set_idle_timeout()) are retired: they exit and
+ * their resources are freed, except that a warm pool of
+ * iris_scheduler_manager_set_min_spare_threads() idle threads is kept
+ * around for later bursts of work. The total number of threads can be
+ * capped with iris_scheduler_manager_set_max_threads().
+ *
+ * Once a scheduler has been prepared, a monitor thread samples the depth of
+ * each of its queues and how much work its threads have completed, at the
+ * interval set on the scheduler's #IrisLoadController. The controller
+ * decides from this how many threads the scheduler should have, and the
+ * manager adds transient threads or takes them away to match.
+ *
+ * When the number of threads is capped, the threads are shared out between
+ * the schedulers by weighted fair share. Each scheduler is guaranteed its
+ * minimum threads, and the rest of the pool is divided in proportion to
+ * the share set with iris_scheduler_set_share(), up to each scheduler's
+ * maximum threads, which is a hard cap. A scheduler that wants fewer threads
+ * than its share leaves the rest for the others to use; when it gets busy
+ * again, threads that other schedulers hold beyond their own share are
+ * taken back from them as they finish their queues. This stops a burst of
+ * work on one scheduler from starving the others, such as the control
+ * scheduler. iris_scheduler_manager_get_thread_count() and
+ * iris_scheduler_manager_get_fair_share() report how the threads are split.
+ *
+ * The monitor thread also keeps the timer wheel behind
+ * iris_scheduler_queue_timeout() and iris_scheduler_queue_periodic(), and
+ * queues each timeout's work on its scheduler when it comes due.
+ */
+
+#define DEFAULT_IDLE_TIMEOUT 5000 /* msec */
+
+/* Longest the monitor sleeps for when no controller or timeout wants it
+ * sooner
  */
+#define MONITOR_IDLE_USECS   (10 * G_USEC_PER_SEC)
 
-#define THREAD_KEY ("__iris_threads")
+/* A scheduler with no work is sampled half as often each time, down to
+ * once every 2^MONITOR_MAX_BACKOFF intervals, until work is queued again.
+ * Work queued just as the monitor backs off may wait that long for it.
+ */
+#define MONITOR_MAX_BACKOFF  5
 
+/* A scheduler the monitor thread is keeping an eye on */
 typedef struct
 {
-	GList *free_list;
-	GList *all_list;
+	IrisScheduler      *scheduler;
+	IrisLoadController *controller;   /* Or NULL to leave it alone        */
+
+	gint64              last_sample;  /* When it was last sampled, and    */
+	gint64              next_sample;  /* when it should be next, in usec  */
+
+	gulong              stalled;      /* Usecs the scheduler's global
+	                                   * queue has had work waiting while
+	                                   * none was completed.
+	                                   */
+
+	guint               wanted;       /* Threads the scheduler last asked
+	                                   * for, between its min and max.
+	                                   */
+	guint               entitled;     /* Its fair share of the pool, from
+	                                   * share_out_unlocked().
+	                                   */
+
+	guint               idle_samples; /* Samples in a row that found no
+	                                   * work, up to MONITOR_MAX_BACKOFF.
+	                                   */
+} IrisLoadWatch;
+
+typedef struct
+{
+	GList      *free_list;    /* Idle threads. Each thread keeps its own
+	                           * link in thread->free_link.
+	                           */
+	guint       n_free;
+	GList      *all_list;     /* Every thread, likewise linked from
+	                           * thread->all_link.
+	                           */
+	guint       n_threads;
+
+	IrisThread *retired;      /* The most recently retired thread, which has
+	                           * exited or is about to but has not been
+	                           * joined and freed yet.
+	                           */
+
+	guint       n_created;
+	guint       n_retired;
+
+	guint       n_cpu;
+	guint      *cpu_threads;  /* Number of threads placed on each CPU */
+
+	GList      *watch_list;   /* IrisLoadWatch for each prepared scheduler */
+	GThread    *monitor;      /* Samples the schedulers in watch_list, or
+	                           * NULL until a controller needs it.
+	                           */
+	GMutex     *monitor_mutex;
+	GCond      *monitor_cond; /* Wakes the monitor when a watch changes,
+	                           * or a timeout is added that is due before
+	                           * it was going to wake up.
+	                           */
+	gboolean    monitor_wake;
+
+	IrisTimerWheel *timers;
 } IrisSchedulerManager;
 
 /* Singleton instance of our scheduler manager struct */
@@ -47,57 +154,163 @@ static IrisSchedulerManager *singleton = NULL;
 /* Lock for syncrhonizing intitialization. */
 G_LOCK_DEFINE (singleton);
 
+/* Pool policy. These can be set before the manager is initialized, so they
+ * live outside of the singleton.
+ */
+static volatile gint pool_idle_timeout = DEFAULT_IDLE_TIMEOUT;
+static volatile gint pool_min_spare = 0;
+static volatile gint pool_max_threads = 0;
+
 void
 iris_scheduler_manager_yield (IrisThread *thread)
 {
+	IrisQueue *active;
+
 	/* It's up to the thread to call iris_scheduler_remove_thread() etc. */
 	g_return_if_fail (thread->scheduler == NULL);
 
 	G_LOCK (singleton);
+
+	/* The queue is only let go of with us locked, so the monitor can look
+	 * at it without taking the thread's mutex.
+	 */
+	g_mutex_lock (thread->mutex);
+	active = thread->active;
+	thread->active = NULL;
+	g_mutex_unlock (thread->mutex);
+
+	if (thread->cpu >= 0 && thread->cpu < singleton->n_cpu)
+		singleton->cpu_threads[thread->cpu]--;
+	thread->cpu = -1;
+
 	singleton->free_list = g_list_prepend (singleton->free_list, thread);
+	thread->free_link = singleton->free_list;
+	singleton->n_free++;
+
 	G_UNLOCK (singleton);
+
+	if (active != NULL)
+		g_object_unref (active);
+}
+
+/* Takes the retired thread waiting to be reaped, if any. The caller must
+ * free it with iris_thread_free() once the lock is dropped.
+ */
+static IrisThread*
+take_retired_unlocked (void)
+{
+	IrisThread *thread = singleton->retired;
+	singleton->retired = NULL;
+	return thread;
 }
 
 gboolean
 iris_scheduler_manager_destroy (IrisThread *thread)
 {
-	GList *node;
-	iris_debug_message (IRIS_DEBUG_SCHEDULER, "Destroying thread %lu", (gulong)thread);
+	IrisThread *reap;
 
 	G_LOCK (singleton);
-	/* Search for the thread in the free list; if it's not there, it has been
-	 * repurposed by gen_or_create_thread() after it decided to shut down and
-	 * we need to put it back into action
+
+	/* If the thread is no longer in the free list, it has been repurposed
+	 * by get_or_create_thread() after it decided to shut down and we need
+	 * to put it back into action.
 	 */
-	node = g_list_find (singleton->free_list, thread);
+	if (thread->free_link == NULL) {
+		G_UNLOCK (singleton);
+		return FALSE;
+	}
 
-	if (!node) {
+	/* Keep a warm pool for the next burst of work, and keep everything if
+	 * retiring has been turned off since the thread started waiting.
+	 */
+	if (singleton->n_free <= g_atomic_int_get (&pool_min_spare) ||
+	    g_atomic_int_get (&pool_idle_timeout) == 0) {
 		G_UNLOCK (singleton);
 		return FALSE;
 	}
 
-	singleton->free_list = g_list_remove (singleton->free_list, thread);
+	iris_debug_message (IRIS_DEBUG_SCHEDULER, "Retiring thread %lu", (gulong)thread);
+
+	singleton->free_list = g_list_delete_link (singleton->free_list,
+	                                           thread->free_link);
+	thread->free_link = NULL;
+	singleton->n_free--;
+
+	singleton->all_list = g_list_delete_link (singleton->all_list,
+	                                          thread->all_link);
+	thread->all_link = NULL;
+	singleton->n_threads--;
+	singleton->n_retired++;
+
+	/* A thread can't join itself, so each retiring thread reaps the one
+	 * before it; this way at most one finished thread is left unjoined.
+	 */
+	reap = take_retired_unlocked ();
+	singleton->retired = thread;
+
 	G_UNLOCK (singleton);
 
+	if (reap != NULL)
+		iris_thread_free (reap);
+
 	return TRUE;
 }
 
+/**
+ * choose_cpu_unlocked:
+ * @scheduler: An #IrisScheduler
+ *
+ * Picks the CPU for the next thread of @scheduler: the CPU from its set
+ * with the fewest threads placed on it, or -1 if @scheduler has no set.
+ *
+ * Return value: A CPU number or -1
+ */
+static gint
+choose_cpu_unlocked (IrisScheduler *scheduler)
+{
+	const guint *cpus;
+	guint        n_cpus,
+	             load,
+	             best_load = G_MAXUINT;
+	gint         best = -1;
+	guint        i;
+
+	cpus = iris_scheduler_get_cpus (scheduler, &n_cpus);
+
+	for (i = 0; i < n_cpus; i++) {
+		if (cpus[i] >= singleton->n_cpu)
+			continue;
+
+		load = singleton->cpu_threads[cpus[i]];
+		if (load < best_load) {
+			best = cpus[i];
+			best_load = load;
+		}
+	}
+
+	return best;
+}
+
 /**
  * get_or_create_thread_unlocked:
  * @exclusive: if the thread should try to yield when done processing
+ * @cpu: the CPU the thread should be bound to, or -1
  *
- * Tries to first retreive a thread from the free thread list.  If that
- * fails, then a new thread is created.  If @exclusive, then the thread
- * will stay attached to the scheduler for the life of the scheduler.
+ * Tries to first retreive a thread from the free thread list, preferring
+ * one that is already bound to @cpu.  If that fails, then a new thread is
+ * created.  If @exclusive, then the thread will stay attached to the
+ * scheduler for the life of the scheduler.
  *
  * See iris_thread_manage()
  *
  * Return value: A re-purposed or new IrisThread
  */
 static IrisThread*
-get_or_create_thread_unlocked (gboolean exclusive)
+get_or_create_thread_unlocked (gboolean exclusive,
+                               gint     cpu)
 {
 	IrisThread *thread = NULL;
+	GList      *node;
 
 	if (singleton->free_list) {
 		/* There is a possible race condition where we select a transient thread
@@ -106,20 +319,502 @@ get_or_create_thread_unlocked (gboolean exclusive)
 		 * the thread shutting down is still in the free list and if not, will
 		 * return FALSE to tell the thread to carry on executing.
 		 */
-		thread = singleton->free_list->data;
-		singleton->free_list = g_list_remove (singleton->free_list,
-		                                      thread);
+		for (node = singleton->free_list; node; node = node->next)
+			if (((IrisThread *)node->data)->bound_cpu == cpu)
+				break;
+
+		if (node == NULL)
+			node = singleton->free_list;
+
+		thread = node->data;
+		singleton->free_list = g_list_delete_link (singleton->free_list,
+		                                           node);
+		thread->free_link = NULL;
+		singleton->n_free--;
 	}
 
 	if (!thread) {
+		/* Exclusive threads are needed for the scheduler to work at all, so
+		 * only the extra transient threads count against the maximum.
+		 */
+		if (!exclusive && g_atomic_int_get (&pool_max_threads) > 0 &&
+		    singleton->n_threads >= g_atomic_int_get (&pool_max_threads))
+			return NULL;
+
 		if (!(thread = iris_thread_new (exclusive)))
 			return NULL;
 		singleton->all_list = g_list_prepend (singleton->all_list, thread);
+		thread->all_link = singleton->all_list;
+		singleton->n_threads++;
+		singleton->n_created++;
 	}
 
+	thread->cpu = cpu;
+	if (cpu >= 0)
+		singleton->cpu_threads[cpu]++;
+
+	/* Don't count work done for a previous scheduler */
+	thread->sampled = thread->completed;
+	thread->stalled = 0;
+
 	return thread;
 }
 
+static IrisLoadWatch*
+find_watch_unlocked (IrisScheduler *scheduler)
+{
+	GList *node;
+
+	for (node = singleton->watch_list; node; node = node->next)
+		if (((IrisLoadWatch *)node->data)->scheduler == scheduler)
+			return node->data;
+
+	return NULL;
+}
+
+/**
+ * count_threads_unlocked:
+ * @scheduler: An #IrisScheduler
+ * @n_leaving: return location for the number of threads leaving, or %NULL
+ *
+ * Counts the threads currently working for @scheduler, including any that
+ * have been asked to leave but not finished yet. Threads standing in for a
+ * blocked thread only take its place, so they are not counted.
+ *
+ * Return value: the number of threads
+ */
+static guint
+count_threads_unlocked (IrisScheduler *scheduler,
+                        guint         *n_leaving)
+{
+	IrisThread *thread;
+	IrisQueue  *active;
+	GList      *node;
+	guint       n_threads = 0;
+
+	if (n_leaving != NULL)
+		*n_leaving = 0;
+
+	for (node = singleton->all_list; node; node = node->next) {
+		thread = node->data;
+
+		if (g_atomic_pointer_get (&thread->scheduler) != scheduler ||
+		    thread->lent_to != NULL)
+			continue;
+
+		n_threads++;
+
+		active = g_atomic_pointer_get ((gpointer *)&thread->active);
+		if (n_leaving != NULL && active != NULL && iris_queue_is_closed (active))
+			(*n_leaving)++;
+	}
+
+	return n_threads;
+}
+
+/**
+ * add_threads_unlocked:
+ * @scheduler: An #IrisScheduler
+ * @n_threads: The number of transient threads to add
+ *
+ * Gives @scheduler up to @n_threads more threads, stopping early if the
+ * manager's thread limit is reached.
+ *
+ * Return value: the number of threads added
+ */
+static guint
+add_threads_unlocked (IrisScheduler *scheduler,
+                      guint          n_threads)
+{
+	IrisThread *thread;
+	guint       i;
+
+	for (i = 0; i < n_threads; i++) {
+		thread = get_or_create_thread_unlocked (FALSE,
+		                                        choose_cpu_unlocked (scheduler));
+
+		/* We are at the maximum number of threads */
+		if (thread == NULL)
+			break;
+
+		thread->scheduler = scheduler;
+		iris_scheduler_add_thread (scheduler, thread, FALSE);
+	}
+
+	return i;
+}
+
+/**
+ * remove_threads_unlocked:
+ * @scheduler: An #IrisScheduler
+ * @n_threads: The number of transient threads to remove
+ *
+ * Asks up to @n_threads of the transient threads working for @scheduler to
+ * leave, by closing their queues. Each one finishes the work left in its
+ * queue, removes itself from @scheduler and yields back to the manager.
+ * Exclusive threads are never removed.
+ */
+static void
+remove_threads_unlocked (IrisScheduler *scheduler,
+                         guint          n_threads)
+{
+	IrisThread *thread;
+	IrisQueue  *active;
+	GList      *node;
+
+	for (node = singleton->all_list; node && n_threads > 0; node = node->next) {
+		thread = node->data;
+
+		if (thread->exclusive ||
+		    g_atomic_pointer_get (&thread->scheduler) != scheduler)
+			continue;
+
+		active = g_atomic_pointer_get ((gpointer *)&thread->active);
+		if (active != NULL && !iris_queue_is_closed (active)) {
+			iris_queue_close (active);
+			n_threads--;
+		}
+	}
+}
+
+/**
+ * share_out_unlocked:
+ *
+ * Works out the fair share of the pool for every prepared scheduler. Each
+ * one is entitled to its minimum threads, and the rest of the pool is
+ * handed out a thread at a time to whichever scheduler has the fewest
+ * threads for its share, until each has as many as it wants or the pool is
+ * used up. Schedulers that want less than their share leave the rest to the
+ * others. If there is no limit on the pool, every scheduler is entitled to
+ * as many threads as it wants.
+ */
+static void
+share_out_unlocked (void)
+{
+	IrisLoadWatch *watch,
+	              *best;
+	GList         *node;
+	guint          capacity,
+	               n_used = 0,
+	               share,
+	               best_share = 0;
+
+	capacity = g_atomic_int_get (&pool_max_threads);
+
+	for (node = singleton->watch_list; node; node = node->next) {
+		watch = node->data;
+
+		if (capacity == 0)
+			watch->entitled = watch->wanted;
+		else
+			watch->entitled = iris_scheduler_get_min_threads (watch->scheduler);
+
+		n_used += watch->entitled;
+	}
+
+	if (capacity == 0)
+		return;
+
+	while (n_used < capacity) {
+		best = NULL;
+
+		for (node = singleton->watch_list; node; node = node->next) {
+			watch = node->data;
+
+			if (watch->entitled >= watch->wanted)
+				continue;
+
+			/* Compare entitled / share without dividing */
+			share = iris_scheduler_get_share (watch->scheduler);
+			if (best == NULL ||
+			    (guint64)watch->entitled * best_share <
+			    (guint64)best->entitled * share) {
+				best = watch;
+				best_share = share;
+			}
+		}
+
+		if (best == NULL)
+			break;
+
+		best->entitled++;
+		n_used++;
+	}
+}
+
+/**
+ * reclaim_unlocked:
+ * @needy: the #IrisLoadWatch of a scheduler below its fair share
+ * @n_threads: the number of threads it is short of
+ *
+ * Takes back up to @n_threads from schedulers holding more than their fair
+ * share, so that they go back to the pool for the scheduler of @needy.
+ * Threads that are already leaving count towards this, as they will be
+ * free once they have finished their queues.
+ */
+static void
+reclaim_unlocked (IrisLoadWatch *needy,
+                  guint          n_threads)
+{
+	IrisLoadWatch *watch;
+	GList         *node;
+	guint          held,
+	               n_leaving,
+	               excess;
+
+	for (node = singleton->watch_list; node && n_threads > 0; node = node->next) {
+		watch = node->data;
+
+		if (watch == needy)
+			continue;
+
+		held = count_threads_unlocked (watch->scheduler, &n_leaving);
+		if (held <= watch->entitled)
+			continue;
+
+		excess = MIN (held - watch->entitled, n_threads);
+		n_threads -= excess;
+
+		if (excess > n_leaving) {
+			iris_debug_message (IRIS_DEBUG_SCHEDULER,
+			                    "Scheduler %lu: reclaiming %u threads for %lu",
+			                    (gulong)watch->scheduler, excess - n_leaving,
+			                    (gulong)needy->scheduler);
+			remove_threads_unlocked (watch->scheduler, excess - n_leaving);
+		}
+	}
+}
+
+/**
+ * grow_unlocked:
+ * @watch: An #IrisLoadWatch
+ * @n_threads: the number of threads to add
+ *
+ * Adds @n_threads to the scheduler of @watch, which must be within its fair
+ * share, reclaiming any that the pool can't give it from schedulers that
+ * are over theirs.
+ */
+static void
+grow_unlocked (IrisLoadWatch *watch,
+               guint          n_threads)
+{
+	guint added;
+
+	added = add_threads_unlocked (watch->scheduler, n_threads);
+
+	if (added < n_threads)
+		reclaim_unlocked (watch, n_threads - added);
+}
+
+/**
+ * control_unlocked:
+ * @watch: An #IrisLoadWatch
+ * @now: the current time from iris_get_monotonic_time()
+ *
+ * Samples the load on the scheduler of @watch, then adds or removes
+ * threads as its controller decides. The threads' queues and counters are
+ * read without taking their locks.
+ *
+ * Return value: %TRUE if the scheduler had no work and needs no change
+ */
+static gboolean
+control_unlocked (IrisLoadWatch *watch,
+                  gint64         now)
+{
+	IrisScheduler  *scheduler = watch->scheduler;
+	IrisLoadSample  sample    = { 0, };
+	IrisThread     *thread;
+	IrisQueue      *active;
+	GList          *node;
+	guint           depth,
+	                completed,
+	                n_leaving = 0,
+	                wanted;
+	gboolean        leaving;
+
+	/* Without a monotonic clock, the time of day may still go backwards */
+	sample.interval = MAX (now - watch->last_sample, 0);
+	sample.min_threads = iris_scheduler_get_min_threads (scheduler);
+	sample.max_threads = iris_scheduler_get_max_threads (scheduler);
+
+	for (node = singleton->all_list; node; node = node->next) {
+		thread = node->data;
+
+		if (g_atomic_pointer_get (&thread->scheduler) != scheduler)
+			continue;
+
+		active = g_atomic_pointer_get ((gpointer *)&thread->active);
+		depth = active ? iris_queue_get_length (active) : 0;
+		leaving = active && iris_queue_is_closed (active);
+
+		/* 'completed' only ever grows, so wrapping doesn't matter */
+		completed = g_atomic_int_get ((volatile gint *)&thread->completed);
+		sample.completed += completed - thread->sampled;
+
+		if (depth > 0 && completed == thread->sampled)
+			thread->stalled += sample.interval;
+		else
+			thread->stalled = 0;
+		thread->sampled = completed;
+
+		sample.queued += depth;
+		sample.max_queued = MAX (sample.max_queued, depth);
+		sample.oldest_age = MAX (sample.oldest_age, thread->stalled);
+
+		/* Threads on their way out don't help with the load, and a
+		 * stand-in only takes the place of a blocked thread.
+		 */
+		if (leaving)
+			n_leaving++;
+		else if (thread->lent_to == NULL)
+			sample.n_threads++;
+	}
+
+	/* Work that isn't yet in any thread's queue */
+	if (IRIS_SCHEDULER_GET_CLASS (scheduler)->get_global_length != NULL) {
+		depth = IRIS_SCHEDULER_GET_CLASS (scheduler)->get_global_length (scheduler);
+
+		if (depth > 0 && sample.completed == 0)
+			watch->stalled += sample.interval;
+		else
+			watch->stalled = 0;
+
+		sample.queued += depth;
+		sample.max_queued = MAX (sample.max_queued, depth);
+		sample.oldest_age = MAX (sample.oldest_age, watch->stalled);
+	}
+
+	watch->last_sample = now;
+
+	wanted = iris_load_controller_update (watch->controller, &sample);
+	wanted = CLAMP (wanted, sample.min_threads, MAX (sample.max_threads,
+	                                                 sample.min_threads));
+
+	/* Don't take more than our share while other schedulers want them */
+	watch->wanted = wanted;
+	share_out_unlocked ();
+	wanted = MIN (wanted, watch->entitled);
+
+	/* Threads that are leaving still hold their place in the scheduler
+	 * until they have finished their queues.
+	 */
+	if (wanted + n_leaving > sample.max_threads)
+		wanted = MAX (sample.max_threads, n_leaving) - n_leaving;
+
+	if (wanted > sample.n_threads)
+		grow_unlocked (watch, wanted - sample.n_threads);
+	else if (wanted < sample.n_threads)
+		remove_threads_unlocked (scheduler, sample.n_threads - wanted);
+
+	iris_debug_message (IRIS_DEBUG_SCHEDULER,
+	                    "Scheduler %lu: %u queued, %u done, %u threads"
+	                    " (%u leaving), want %u of %u",
+	                    (gulong)scheduler, sample.queued, sample.completed,
+	                    sample.n_threads, n_leaving, wanted, watch->wanted);
+
+	return sample.queued == 0 && sample.completed == 0 &&
+	       n_leaving == 0 && wanted == sample.n_threads;
+}
+
+static gpointer
+iris_scheduler_manager_monitor (gpointer data)
+{
+	IrisLoadWatch *watch;
+	IrisThread    *reap;
+	IrisTimeout   *expired,
+	              *timer;
+	GList         *node;
+	GTimeVal       timeout;
+	gint64         now,
+	               next,
+	               delay;
+
+	for (;;) {
+		G_LOCK (singleton);
+
+		now = iris_get_monotonic_time ();
+		next = now + MONITOR_IDLE_USECS;
+
+		for (node = singleton->watch_list; node; node = node->next) {
+			watch = node->data;
+
+			if (watch->controller == NULL)
+				continue;
+
+			if (now >= watch->next_sample) {
+				if (!control_unlocked (watch, now))
+					watch->idle_samples = 0;
+				else if (watch->idle_samples < MONITOR_MAX_BACKOFF)
+					watch->idle_samples++;
+
+				g_atomic_int_set (&watch->scheduler->priv->idle,
+				                  watch->idle_samples > 0);
+
+				watch->next_sample = now + ((gint64)1000 *
+				    iris_load_controller_get_interval (watch->controller)
+				    << watch->idle_samples);
+			}
+
+			next = MIN (next, watch->next_sample);
+		}
+
+		reap = take_retired_unlocked ();
+
+		G_UNLOCK (singleton);
+
+		if (reap != NULL)
+			iris_thread_free (reap);
+
+		/* Queueing the work may need to prepare the scheduler, so this is
+		 * done without the manager locked.
+		 */
+		expired = iris_timer_wheel_advance (singleton->timers);
+
+		while (expired != NULL) {
+			timer = expired;
+			expired = timer->next;
+			timer->next = NULL;
+			iris_timeout_dispatch (timer);
+		}
+
+		if ((delay = iris_timer_wheel_get_timeout (singleton->timers)) >= 0)
+			next = MIN (next, iris_get_monotonic_time () + delay * 1000);
+
+		/* Samples are timed on the monotonic clock, so a change to the
+		 * time of day can't make an interval look negative or huge, but
+		 * g_cond_timed_wait() wants the time of day.
+		 */
+		delay = next - iris_get_monotonic_time ();
+		g_get_current_time (&timeout);
+		if (delay > 0)
+			g_time_val_add (&timeout, delay);
+
+		g_mutex_lock (singleton->monitor_mutex);
+		if (!singleton->monitor_wake)
+			g_cond_timed_wait (singleton->monitor_cond,
+			                   singleton->monitor_mutex,
+			                   &timeout);
+		singleton->monitor_wake = FALSE;
+		g_mutex_unlock (singleton->monitor_mutex);
+	}
+
+	return NULL;
+}
+
+/* Starts the monitor if need be, and makes it look at the watches again */
+static void
+wake_monitor_unlocked (void)
+{
+	if (singleton->monitor == NULL)
+		singleton->monitor = g_thread_create (iris_scheduler_manager_monitor,
+		                                      NULL, FALSE, NULL);
+
+	g_mutex_lock (singleton->monitor_mutex);
+	singleton->monitor_wake = TRUE;
+	g_cond_signal (singleton->monitor_cond);
+	g_mutex_unlock (singleton->monitor_mutex);
+}
+
 /**
  * iris_scheduler_manager_init:
  *
@@ -132,6 +827,11 @@ iris_scheduler_manager_init (void)
 	if (G_LIKELY (!singleton)) {
 		iris_debug_init ();
 		singleton = g_slice_new0 (IrisSchedulerManager);
+		singleton->n_cpu = iris_topology_get_n_cpu ();
+		singleton->cpu_threads = g_new0 (guint, singleton->n_cpu);
+		singleton->monitor_mutex = g_mutex_new ();
+		singleton->monitor_cond = g_cond_new ();
+		singleton->timers = iris_timer_wheel_new ();
 	}
 	G_UNLOCK (singleton);
 }
@@ -146,10 +846,13 @@ iris_scheduler_manager_init (void)
 void
 iris_scheduler_manager_prepare (IrisScheduler *scheduler)
 {
-	IrisThread *thread      = NULL;
-	gint        max_threads = 0;
-	gint        min_threads = 0;
-	gint        i;
+	IrisThread         *thread      = NULL;
+	IrisThread         *reap;
+	IrisLoadWatch      *watch;
+	IrisLoadController *controller;
+	gint                max_threads = 0;
+	gint                min_threads = 0;
+	gint                i;
 
 	if (G_UNLIKELY (!singleton))
 		iris_scheduler_manager_init ();
@@ -169,7 +872,8 @@ iris_scheduler_manager_prepare (IrisScheduler *scheduler)
 	G_LOCK (singleton);
 
 	for (i = 0; i < min_threads; i++) {
-		thread = get_or_create_thread_unlocked (TRUE);
+		thread = get_or_create_thread_unlocked (TRUE,
+		                                        choose_cpu_unlocked (scheduler));
 
 		/* Add proper error handling */
 		g_return_if_fail (thread != NULL);
@@ -178,23 +882,177 @@ iris_scheduler_manager_prepare (IrisScheduler *scheduler)
 		iris_scheduler_add_thread (scheduler, thread, TRUE);
 	}
 
-	g_object_set_data (G_OBJECT (scheduler), THREAD_KEY,
-	                   GINT_TO_POINTER (min_threads));
+	/* Start watching the load, so the scheduler can get more threads */
+	controller = iris_scheduler_get_load_controller (scheduler);
+
+	watch = g_slice_new0 (IrisLoadWatch);
+	watch->scheduler = scheduler;
+	watch->controller = controller ? g_object_ref (controller) : NULL;
+	watch->last_sample = iris_get_monotonic_time ();
+	watch->next_sample = watch->last_sample;
+	watch->wanted = min_threads;
+	watch->entitled = min_threads;
+	singleton->watch_list = g_list_prepend (singleton->watch_list, watch);
+
+	if (controller != NULL)
+		wake_monitor_unlocked ();
+
+	reap = take_retired_unlocked ();
 
 	G_UNLOCK (singleton);
+
+	if (reap != NULL)
+		iris_thread_free (reap);
 }
 
 /**
  * iris_scheduler_manager_unprepare:
  * @scheduler: An #IrisScheduler
  *
- * Unprepares a scheduler by removing all of its active threads
- * and resources.  The unused threads can then be repurposed to
+ * Unprepares a scheduler, so that the scheduler manager stops watching
+ * its load. This is called when the scheduler is disposed; its threads
+ * are released by the scheduler itself and can then be repurposed to
  * other schedulers within the system.
  */
 void
 iris_scheduler_manager_unprepare (IrisScheduler *scheduler)
 {
+	IrisLoadWatch *watch;
+
+	if (G_UNLIKELY (!singleton))
+		return;
+
+	G_LOCK (singleton);
+
+	watch = find_watch_unlocked (scheduler);
+
+	if (watch != NULL)
+		singleton->watch_list = g_list_remove (singleton->watch_list, watch);
+
+	G_UNLOCK (singleton);
+
+	if (watch != NULL) {
+		if (watch->controller != NULL)
+			g_object_unref (watch->controller);
+		g_slice_free (IrisLoadWatch, watch);
+	}
+}
+
+/*
+ * iris_scheduler_manager_wake_watch:
+ * @scheduler: A prepared #IrisScheduler
+ *
+ * Tells the monitor that work has been queued on @scheduler after it was
+ * found idle, so that it goes back to sampling it every interval. The idle
+ * time is left out of the next sample.
+ */
+void
+iris_scheduler_manager_wake_watch (IrisScheduler *scheduler)
+{
+	IrisLoadWatch *watch;
+	gint64         now;
+
+	if (G_UNLIKELY (!singleton))
+		return;
+
+	G_LOCK (singleton);
+
+	watch = find_watch_unlocked (scheduler);
+
+	if (watch != NULL && watch->controller != NULL && watch->idle_samples > 0) {
+		now = iris_get_monotonic_time ();
+
+		watch->idle_samples = 0;
+		watch->last_sample = now;
+		watch->next_sample = now + (gint64)1000 *
+		    iris_load_controller_get_interval (watch->controller);
+
+		wake_monitor_unlocked ();
+	}
+
+	G_UNLOCK (singleton);
+}
+
+/*
+ * iris_scheduler_manager_set_load_controller:
+ * @scheduler: A prepared #IrisScheduler
+ * @controller: An #IrisLoadController, or %NULL
+ *
+ * Changes the controller the monitor uses for @scheduler, if it is watching
+ * it. The monitor takes its own reference, so @controller can't go away
+ * while it is in use.
+ */
+void
+iris_scheduler_manager_set_load_controller (IrisScheduler      *scheduler,
+                                            IrisLoadController *controller)
+{
+	IrisLoadWatch      *watch;
+	IrisLoadController *old_controller = NULL;
+
+	/* Schedulers that run without our threads are never watched */
+	if (G_UNLIKELY (!singleton))
+		return;
+
+	G_LOCK (singleton);
+
+	watch = find_watch_unlocked (scheduler);
+
+	if (watch != NULL) {
+		old_controller = watch->controller;
+		watch->controller = controller ? g_object_ref (controller) : NULL;
+		watch->next_sample = iris_get_monotonic_time ();
+
+		if (controller != NULL)
+			wake_monitor_unlocked ();
+	}
+
+	G_UNLOCK (singleton);
+
+	if (old_controller != NULL)
+		g_object_unref (old_controller);
+}
+
+/*
+ * iris_scheduler_manager_add_timeout:
+ * @scheduler: An #IrisScheduler
+ * @callback: An #IrisCallback
+ * @data: data for @callback
+ * @notify: an optional callback to free @data
+ * @interval: the delay or period in milliseconds
+ * @periodic: %TRUE to repeat every @interval
+ *
+ * Puts a new timeout in the timer wheel, starting the monitor thread if
+ * this is the first, and waking it if the timeout is due before it was
+ * going to look at the wheel again.
+ *
+ * Return value: a new #IrisTimeout
+ */
+IrisTimeout*
+iris_scheduler_manager_add_timeout (IrisScheduler  *scheduler,
+                                    IrisCallback    callback,
+                                    gpointer        data,
+                                    GDestroyNotify  notify,
+                                    guint           interval,
+                                    gboolean        periodic)
+{
+	IrisTimeout *timeout;
+	guint64      expires;
+
+	if (G_UNLIKELY (!singleton))
+		iris_scheduler_manager_init ();
+
+	timeout = iris_timeout_new (singleton->timers, scheduler, callback, data,
+	                            notify, interval, periodic);
+
+	expires = iris_timer_wheel_get_time (singleton->timers) + interval;
+
+	if (iris_timer_wheel_add (singleton->timers, timeout, expires)) {
+		G_LOCK (singleton);
+		wake_monitor_unlocked ();
+		G_UNLOCK (singleton);
+	}
+
+	return timeout;
 }
 
 /**
@@ -206,17 +1064,25 @@ iris_scheduler_manager_unprepare (IrisScheduler *scheduler)
  * Request that more workers be added to a scheduler. If @per_quantum
  * is > 0, then it will be used to try to maximize the number of threads
  * that can be added to minimize the time to process the queue.
+ *
+ * Schedulers don't normally need to call this, since the scheduler manager
+ * adds threads as their #IrisLoadController asks. Threads added this way
+ * are still removed again if the controller decides they aren't needed.
+ *
+ * If the pool is capped, @scheduler gets no more than its fair share of it
+ * (see iris_scheduler_set_share()), and threads are taken back from
+ * schedulers using more than theirs.
  */
 void
 iris_scheduler_manager_request (IrisScheduler *scheduler,
                                 guint          per_quantum,
                                 guint          total)
 {
-	IrisThread *thread      = NULL;
-	gint        requested   = 0;
-	guint       n_threads   = 0;
-	guint       max_threads = 0;
-	gint        i;
+	IrisThread    *reap;
+	IrisLoadWatch *watch;
+	gint           requested   = 0;
+	guint          n_threads   = 0;
+	guint          max_threads = 0;
 
 	g_return_if_fail (scheduler != NULL);
 
@@ -233,23 +1099,59 @@ iris_scheduler_manager_request (IrisScheduler *scheduler,
 
 	G_LOCK (singleton);
 
-	n_threads = GPOINTER_TO_INT (
-		g_object_get_data (G_OBJECT (scheduler),
-		                   THREAD_KEY));
+	n_threads = count_threads_unlocked (scheduler, NULL);
 
-	if (n_threads < max_threads) {
-		for (i = n_threads; i < requested; i++) {
-			thread = get_or_create_thread_unlocked (FALSE);
-			thread->scheduler = scheduler;
-			iris_scheduler_add_thread (scheduler, thread, FALSE);
-			n_threads++;
-		}
+	if ((watch = find_watch_unlocked (scheduler)) != NULL) {
+		watch->wanted = MAX (watch->wanted, requested);
+		share_out_unlocked ();
+		requested = MIN (requested, watch->entitled);
+
+		if (n_threads < requested)
+			grow_unlocked (watch, requested - n_threads);
 	}
+	else if (n_threads < requested)
+		add_threads_unlocked (scheduler, requested - n_threads);
+
+	reap = take_retired_unlocked ();
+
+	G_UNLOCK (singleton);
+
+	if (reap != NULL)
+		iris_thread_free (reap);
+}
+
+/*
+ * iris_scheduler_manager_lend:
+ * @thread: An #IrisThread entering a blocking region
+ *
+ * Finds a thread to stand in for @thread on its queue while it blocks,
+ * reusing an idle one if there is one. Stand-ins count against the
+ * manager's thread limit, but not against the scheduler's maximum or its
+ * fair share, as they only take the place of a thread that isn't running.
+ * The stand-in holds a reference on the scheduler until it is given back.
+ *
+ * Return value: An #IrisThread, or %NULL if the thread limit was reached
+ */
+IrisThread*
+iris_scheduler_manager_lend (IrisThread *thread)
+{
+	IrisThread *stand_in;
 
-	g_object_set_data (G_OBJECT (scheduler), THREAD_KEY,
-	                   GINT_TO_POINTER (n_threads));
+	g_return_val_if_fail (thread != NULL, NULL);
+	g_return_val_if_fail (thread->scheduler != NULL, NULL);
+
+	G_LOCK (singleton);
+
+	stand_in = get_or_create_thread_unlocked (FALSE, thread->cpu);
+
+	if (stand_in != NULL) {
+		stand_in->scheduler = g_object_ref (thread->scheduler);
+		stand_in->lent_to = thread;
+	}
 
 	G_UNLOCK (singleton);
+
+	return stand_in;
 }
 
 /**
@@ -268,12 +1170,202 @@ iris_scheduler_manager_get_spare_thread_count ()
 		iris_scheduler_manager_init ();
 
 	G_LOCK (singleton);
-	spare_thread_count = g_list_length (singleton->free_list);
+	spare_thread_count = singleton->n_free;
 	G_UNLOCK (singleton);
 
 	return spare_thread_count;
 }
 
+/**
+ * iris_scheduler_manager_get_created_thread_count:
+ *
+ * Return how many threads the scheduler manager has created in total.
+ *
+ * Return value: number of threads created
+ */
+guint
+iris_scheduler_manager_get_created_thread_count (void)
+{
+	guint count;
+
+	if (G_UNLIKELY (!singleton))
+		iris_scheduler_manager_init ();
+
+	G_LOCK (singleton);
+	count = singleton->n_created;
+	G_UNLOCK (singleton);
+
+	return count;
+}
+
+/**
+ * iris_scheduler_manager_get_retired_thread_count:
+ *
+ * Return how many idle threads the scheduler manager has retired in total.
+ *
+ * Return value: number of threads retired
+ */
+guint
+iris_scheduler_manager_get_retired_thread_count (void)
+{
+	guint count;
+
+	if (G_UNLIKELY (!singleton))
+		iris_scheduler_manager_init ();
+
+	G_LOCK (singleton);
+	count = singleton->n_retired;
+	G_UNLOCK (singleton);
+
+	return count;
+}
+
+/**
+ * iris_scheduler_manager_get_thread_count:
+ * @scheduler: An #IrisScheduler
+ *
+ * Return how many threads are working for @scheduler, including any that
+ * have been asked to leave but are still finishing their queues. Threads
+ * lent to stand in for one in a blocking region are not counted.
+ *
+ * Return value: number of threads used by @scheduler
+ */
+guint
+iris_scheduler_manager_get_thread_count (IrisScheduler *scheduler)
+{
+	guint count;
+
+	g_return_val_if_fail (IRIS_IS_SCHEDULER (scheduler), 0);
+
+	if (G_UNLIKELY (!singleton))
+		return 0;
+
+	G_LOCK (singleton);
+	count = count_threads_unlocked (scheduler, NULL);
+	G_UNLOCK (singleton);
+
+	return count;
+}
+
+/**
+ * iris_scheduler_manager_get_fair_share:
+ * @scheduler: An #IrisScheduler
+ *
+ * Return how many threads @scheduler is entitled to, from its share (see
+ * iris_scheduler_set_share()) and how many threads it and the other
+ * schedulers currently want. If the pool is not capped, this is just how
+ * many threads @scheduler wants.
+ *
+ * Return value: the fair share of @scheduler, or 0 if it is not prepared
+ */
+guint
+iris_scheduler_manager_get_fair_share (IrisScheduler *scheduler)
+{
+	IrisLoadWatch *watch;
+	guint          entitled = 0;
+
+	g_return_val_if_fail (IRIS_IS_SCHEDULER (scheduler), 0);
+
+	if (G_UNLIKELY (!singleton))
+		return 0;
+
+	G_LOCK (singleton);
+
+	if ((watch = find_watch_unlocked (scheduler)) != NULL) {
+		share_out_unlocked ();
+		entitled = watch->entitled;
+	}
+
+	G_UNLOCK (singleton);
+
+	return entitled;
+}
+
+/**
+ * iris_scheduler_manager_set_idle_timeout:
+ * @msec: a timeout in milliseconds, or 0
+ *
+ * Sets how long a thread may sit idle before it is retired. Threads that
+ * are already idle use the new timeout the next time they wake up. If
+ * @msec is 0, idle threads are never retired. The default is 5 seconds.
+ */
+void
+iris_scheduler_manager_set_idle_timeout (guint msec)
+{
+	g_atomic_int_set (&pool_idle_timeout, msec);
+}
+
+/**
+ * iris_scheduler_manager_get_idle_timeout:
+ *
+ * Retrieves the timeout set with iris_scheduler_manager_set_idle_timeout().
+ *
+ * Return value: the idle timeout in milliseconds, or 0 for none
+ */
+guint
+iris_scheduler_manager_get_idle_timeout (void)
+{
+	return g_atomic_int_get (&pool_idle_timeout);
+}
+
+/**
+ * iris_scheduler_manager_set_min_spare_threads:
+ * @n_threads: a number of threads
+ *
+ * Sets how many idle threads are kept ready for new work instead of being
+ * retired. The default is 0.
+ */
+void
+iris_scheduler_manager_set_min_spare_threads (guint n_threads)
+{
+	g_atomic_int_set (&pool_min_spare, n_threads);
+}
+
+/**
+ * iris_scheduler_manager_get_min_spare_threads:
+ *
+ * Retrieves the value set with
+ * iris_scheduler_manager_set_min_spare_threads().
+ *
+ * Return value: the minimum number of spare threads
+ */
+guint
+iris_scheduler_manager_get_min_spare_threads (void)
+{
+	return g_atomic_int_get (&pool_min_spare);
+}
+
+/**
+ * iris_scheduler_manager_set_max_threads:
+ * @n_threads: a number of threads, or 0
+ *
+ * Sets the maximum number of threads the scheduler manager will have alive
+ * at once. Once it is reached, schedulers asking for extra help with
+ * iris_scheduler_manager_request() will not get any more threads until
+ * some are free, and the threads are shared out between the schedulers by
+ * the shares set with iris_scheduler_set_share(). Threads needed to meet
+ * the minimum of a new scheduler are always created. If @n_threads is 0,
+ * which is the default, there is no limit.
+ */
+void
+iris_scheduler_manager_set_max_threads (guint n_threads)
+{
+	g_atomic_int_set (&pool_max_threads, n_threads);
+}
+
+/**
+ * iris_scheduler_manager_get_max_threads:
+ *
+ * Retrieves the value set with iris_scheduler_manager_set_max_threads().
+ *
+ * Return value: the maximum number of threads, or 0 for no limit
+ */
+guint
+iris_scheduler_manager_get_max_threads (void)
+{
+	return g_atomic_int_get (&pool_max_threads);
+}
+
 /**
  * iris_scheduler_manager_print_stat:
  *
@@ -282,7 +1374,8 @@ iris_scheduler_manager_get_spare_thread_count ()
 void
 iris_scheduler_manager_print_stat (void)
 {
-	GList *iter;
+	IrisLoadWatch *watch;
+	GList         *iter;
 
 	g_fprintf (stderr,
 	           "\n    Iris Thread Status\n"
@@ -298,6 +1391,25 @@ iris_scheduler_manager_print_stat (void)
 	for (iter = singleton->all_list; iter; iter = iter->next)
 		iris_thread_print_stat (iter->data);
 
+	share_out_unlocked ();
+
+	g_fprintf (stderr, "\n");
+	for (iter = singleton->watch_list; iter; iter = iter->next) {
+		watch = iter->data;
+		g_fprintf (stderr,
+		           "    Sched 0x%016lx: share %u, %u threads, wants %u,"
+		           " fair share %u\n",
+		           (gulong)watch->scheduler,
+		           iris_scheduler_get_share (watch->scheduler),
+		           count_threads_unlocked (watch->scheduler, NULL),
+		           watch->wanted, watch->entitled);
+	}
+
+	g_fprintf (stderr,
+	           "\n    Threads: %u (%u idle)   Created: %u   Retired: %u\n",
+	           singleton->n_threads, singleton->n_free,
+	           singleton->n_created, singleton->n_retired);
+
 	G_UNLOCK (singleton);
 
 	g_fprintf (stderr, "\n");
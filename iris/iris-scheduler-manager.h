@@ -35,6 +35,18 @@ void iris_scheduler_manager_request                (IrisScheduler *scheduler,
 gint iris_scheduler_manager_get_spare_thread_count ();
 void iris_scheduler_manager_print_stat             (void);
 
+guint iris_scheduler_manager_get_created_thread_count (void);
+guint iris_scheduler_manager_get_retired_thread_count (void);
+guint iris_scheduler_manager_get_thread_count         (IrisScheduler *scheduler);
+guint iris_scheduler_manager_get_fair_share           (IrisScheduler *scheduler);
+
+void  iris_scheduler_manager_set_idle_timeout         (guint msec);
+guint iris_scheduler_manager_get_idle_timeout         (void);
+void  iris_scheduler_manager_set_min_spare_threads    (guint n_threads);
+guint iris_scheduler_manager_get_min_spare_threads    (void);
+void  iris_scheduler_manager_set_max_threads          (guint n_threads);
+guint iris_scheduler_manager_get_max_threads          (void);
+
 G_END_DECLS
 
 #endif /* __IRIS_SCHEDULER_MANAGER_H__ */
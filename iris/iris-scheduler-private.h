@@ -22,9 +22,83 @@
 #define __IRIS_SCHEDULER_PRIVATE_H__
 
 #include "iris-rrobin.h"
+#include "iris-scheduler.h"
+#include "iris-util.h"
 
 G_BEGIN_DECLS
 
+/* Longest a thread queue can get before work with an affinity for it
+ * spills over to the other threads.
+ */
+#define AFFINITY_MAX_LENGTH 32
+
+/* Number of stacks new work is spread over, as a power of two */
+#define WORK_SHARD_BITS 3
+#define WORK_N_SHARDS   (1 << WORK_SHARD_BITS)
+
+typedef struct _IrisThreadStats IrisThreadStats;
+
+/* One of the stacks that new work is pushed onto before it is added to a
+ * scheduler's work list. Each thread always uses the same one, so threads
+ * queueing at once mostly don't share a cache line.
+ */
+typedef struct
+{
+	IrisThreadWork * volatile head;      /* Newest first                  */
+	volatile gint             length;
+
+	gchar                     pad[IRIS_CACHE_LINE_SIZE];
+} IrisWorkShard;
+
+typedef enum
+{
+	IRIS_THREAD_WORK_QUEUED,          /* Waiting in a queue                  */
+	IRIS_THREAD_WORK_HELD,            /* Being looked at by a foreach, which  *
+	                                   * puts it back to QUEUED afterwards   */
+	IRIS_THREAD_WORK_HELD_CANCELLED,  /* Unqueued while held; the foreach    *
+	                                   * calls the notify when it lets go    */
+	IRIS_THREAD_WORK_RUNNING,         /* Claimed by a thread                 */
+	IRIS_THREAD_WORK_CANCELLED,       /* Unqueued and notify called, but     *
+	                                   * still in a queue until popped       */
+	IRIS_THREAD_WORK_FINISHED         /* Out of every queue, and the notify  *
+	                                   * has been called                     */
+} IrisThreadWorkState;
+
+/* The counters of one thread working for a scheduler, which are added up
+ * by iris_scheduler_get_stats(). A block is claimed by a thread when it
+ * starts working for the scheduler and handed back when it stops, and lives
+ * as long as the scheduler, so there are only ever as many as the scheduler
+ * has had threads at once.
+ */
+struct _IrisThreadStats
+{
+	IrisThreadStats       *next;          /* In the scheduler's list       */
+	IrisThread * volatile  owner;         /* Thread counting into us, or   *
+	                                       * NULL if free.                 */
+
+	gchar                  pad1[IRIS_CACHE_LINE_SIZE];
+
+	/* Only written by 'owner' */
+	volatile guint64       executed;
+	volatile guint64       stolen;
+	volatile guint64       failed_steals;
+	volatile guint64       wakeups;
+	volatile guint64       busy_usec;
+	volatile guint64       idle_usec;
+	volatile guint         high_water;
+	guint                  countdown;     /* Work items until the queue    *
+	                                       * length is next sampled.       */
+	gint64                 last;          /* When the owner last finished  *
+	                                       * a work item, in usecs.        */
+
+	gchar                  pad2[IRIS_CACHE_LINE_SIZE];
+
+	/* Counted by thieves */
+	volatile gint          stolen_from;
+
+	gchar                  pad3[IRIS_CACHE_LINE_SIZE];
+};
+
 struct _IrisSchedulerPrivate
 {
 	GMutex      *mutex;        /* Synchronization for setting up the
@@ -52,11 +126,84 @@ struct _IrisSchedulerPrivate
 
 	guint             min_threads;
 	guint             max_threads;
+
+	guint            *cpus;        /* CPUs our threads are bound to, or   */
+	guint             n_cpus;      /* NULL to let them run anywhere.      */
+
+	IrisLoadController *load_controller;
+	                               /* Decides how many threads we need, or
+	                                * NULL to stay at min_threads.
+	                                */
+	volatile gint     idle;        /* Set while the monitor samples us less
+	                                * often for lack of work. Cleared by the
+	                                * next work queued, which wakes it.
+	                                */
+
+	volatile gint     share;       /* Weight of our claim on the thread
+	                                * pool against other schedulers.
+	                                */
+
+	volatile gint     queue_capacity;
+	                               /* Room in each level of a thread
+	                                * queue, or 0 for no limit.
+	                                */
+
+	volatile gint     n_blocked;   /* Threads in a blocking region, and */
+	volatile gint     n_lent;      /* threads lent to stand in for them */
+
+	IrisThreadStats * volatile stats_list;
+	                               /* Counters of every thread that has
+	                                * worked for us, newest first.
+	                                */
+
+	/* Every work item we create, in the order it was queued, so that
+	 * iris_scheduler_foreach() can walk them without touching the queues.
+	 * New work is pushed onto the queueing thread's stack in
+	 * 'work_incoming' without a lock. The rest is only touched with
+	 * 'work_mutex' held, which also decides when finished work can be
+	 * freed.
+	 */
+	IrisWorkShard     work_incoming[WORK_N_SHARDS];
+	GStaticRecMutex   work_mutex;
+	IrisThreadWork   *work_head;
+	IrisThreadWork   *work_tail;
+	volatile gint     work_length;  /* Items in the list after the last   *
+	                                 * compaction.                       */
+
 	volatile gint     has_leader;
 	volatile gint     initialized;
 };
 
-IrisScheduler* iris_scheduler_new         (void);
+IrisScheduler*   iris_scheduler_new            (void);
+
+IrisThreadWork*  iris_scheduler_work_new       (IrisScheduler                *scheduler,
+                                                IrisCallback                  callback,
+                                                gpointer                      data,
+                                                GDestroyNotify                notify,
+                                                IrisPriority                  priority);
+IrisThreadWork** iris_scheduler_work_new_batch (IrisScheduler                *scheduler,
+                                                const IrisSchedulerBatchItem *items,
+                                                guint                         n_items);
+
+guint            iris_scheduler_push_batch     (IrisRRobin                   *rrobin,
+                                                IrisThreadWork              **works,
+                                                guint                         n_works,
+                                                gboolean                     *full);
+
+gpointer         iris_scheduler_get_affinity_queue
+                                               (IrisRRobin                   *rrobin,
+                                                gconstpointer                 key);
+
+gboolean         iris_scheduler_can_help       (IrisScheduler                *scheduler);
+
+IrisThreadStats* iris_scheduler_claim_stats    (IrisScheduler                *scheduler,
+                                                IrisThread                   *thread);
+
+gboolean         iris_thread_run_pending       (IrisThread                   *thread,
+                                                GTimeVal                     *timeout);
+
+gboolean         iris_thread_work_execute      (IrisThreadWork               *thread_work);
+void             iris_thread_work_unref        (IrisThreadWork               *thread_work);
 
 G_END_DECLS
 
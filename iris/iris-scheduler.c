@@ -29,6 +29,7 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "iris-debug.h"
 #include "iris-queue.h"
@@ -36,6 +37,7 @@
 #include "iris-scheduler.h"
 #include "iris-scheduler-private.h"
 #include "iris-scheduler-manager.h"
+#include "iris-scheduler-manager-private.h"
 
 /**
  * SECTION:iris-scheduler
@@ -54,14 +56,26 @@
  * a slow-running task blocking its own cancel message).
  *
  * The workflow of the scheduler is that it receives "min-threads" threads
- * during startup, and then if a "leader" thread, (typically the first thread
- * added) feels it is getting behind, it will ask the scheduler manager for
- * more help.  The scheduler manager will try to first repurpose
- * existing threads, or create new threads if no existing threads are
- * available.  Based on the speed of work performed by the scheduler,
- * the manager will try to appropriate a sufficient number of threads.
- * When destroyed, the scheduler will block until all of its threads have
- * worked through their queues.
+ * during startup, and then the scheduler manager keeps an eye on how much
+ * work is waiting in its queues. The scheduler's #IrisLoadController (see
+ * iris_scheduler_set_load_controller()) decides from this how many threads
+ * it needs, between "min-threads" and "max-threads". The scheduler manager
+ * will try to first repurpose existing threads, or create new threads if no
+ * existing threads are available, and gives the extra threads back when the
+ * load drops. When destroyed, the scheduler will block until all of its
+ * threads have worked through their queues.
+ *
+ * If the scheduler manager's pool of threads is capped (see
+ * iris_scheduler_manager_set_max_threads()), schedulers that all want more
+ * threads than there are get them in proportion to their share, set with
+ * iris_scheduler_set_share(). The control scheduler has a bigger share than
+ * the others by default, so that messages are still handled promptly when
+ * a lot of work is queued.
+ *
+ * Work can also be queued after a delay with iris_scheduler_queue_timeout(),
+ * or repeatedly with iris_scheduler_queue_periodic(). These are kept in a
+ * timer wheel by the scheduler manager, which queues the work on the
+ * scheduler when it comes due.
  *
  * The average user should not need to use the functions here; the #IrisTask
  * and #IrisProcess objects allow a higher-level way to schedule work
@@ -70,6 +84,11 @@
  * All #IrisScheduler methods are safe to call from multiple threads.
  */
 
+/* Share of the thread pool of the default control scheduler, against the
+ * default share of 1 for the rest.
+ */
+#define CONTROL_SCHEDULER_SHARE 4
+
 G_DEFINE_TYPE (IrisScheduler, iris_scheduler, G_TYPE_OBJECT)
 
 G_LOCK_DEFINE (default_work_scheduler);
@@ -89,11 +108,16 @@ volatile static IrisScheduler *default_work_scheduler = NULL,
 IrisScheduler*
 iris_get_default_control_scheduler (void)
 {
+	IrisScheduler *scheduler;
+
 	if (G_UNLIKELY (default_control_scheduler == NULL)) {
 		G_LOCK (default_control_scheduler);
-		if (!g_atomic_pointer_get (&default_control_scheduler))
-			default_control_scheduler = iris_scheduler_new_full
-			                              (1, MAX (2, iris_scheduler_get_n_cpu()));
+		if (!g_atomic_pointer_get (&default_control_scheduler)) {
+			scheduler = iris_scheduler_new_full
+			              (1, MAX (2, iris_scheduler_get_n_cpu()));
+			iris_scheduler_set_share (scheduler, CONTROL_SCHEDULER_SHARE);
+			g_atomic_pointer_set (&default_control_scheduler, scheduler);
+		}
 		G_UNLOCK (default_control_scheduler);
 	}
 	return g_atomic_pointer_get (&default_control_scheduler);
@@ -164,23 +188,97 @@ iris_set_default_work_scheduler (IrisScheduler *new_scheduler)
 		g_object_unref ((gpointer)old_scheduler);
 }
 
+typedef struct {
+	IrisThreadWork *thread_work;
+	gboolean        full;        /* Some queue turned the work away for
+	                              * being full rather than closed. */
+} IrisSchedulerPushClosure;
+
 static gboolean
 iris_scheduler_queue_rrobin_cb (gpointer data,
                                 gpointer user_data)
 {
-	IrisQueue      *queue;
-	IrisThreadWork *thread_work;
+	IrisQueue                *queue;
+	IrisSchedulerPushClosure *closure;
 
 	g_return_val_if_fail (data != NULL, FALSE);
 	g_return_val_if_fail (user_data != NULL, FALSE);
 
 	queue = data;
-	thread_work = user_data;
+	closure = user_data;
 
-	/* If the queue is closed (meaning thread has finished) we will return
-	 * FALSE and the rrobin will call again with another queue
+	/* If the queue is closed (meaning thread has finished) or full we will
+	 * return FALSE and the rrobin will call again with another queue
 	 */
-	return iris_queue_push (queue, thread_work);
+	if (iris_priority_queue_push_full (IRIS_PRIORITY_QUEUE (queue),
+	                                   closure->thread_work,
+	                                   closure->thread_work->priority))
+		return TRUE;
+
+	if (!iris_queue_is_closed (queue))
+		closure->full = TRUE;
+
+	return FALSE;
+}
+
+/* Number of times a queuer finding every thread queue full yields before it
+ * starts sleeping between tries.
+ */
+#define QUEUE_FULL_YIELD_COUNT 16
+#define QUEUE_FULL_SLEEP_USEC  100
+
+/* Called when every thread queue of @scheduler was full, with how many times
+ * that has happened in a row. Returns %FALSE if the caller is one of our
+ * own threads, which must not wait for room since it may be the one that
+ * would make it; it should run the work itself instead. Anyone else waits
+ * a little and returns %TRUE to try again.
+ */
+static gboolean
+iris_scheduler_wait_for_room (IrisScheduler *scheduler,
+                              guint          attempt)
+{
+	IrisThread *thread = iris_thread_get ();
+
+	if (thread != NULL && thread->scheduler == scheduler)
+		return FALSE;
+
+	if (attempt < QUEUE_FULL_YIELD_COUNT)
+		g_thread_yield ();
+	else {
+		/* Another scheduler's thread gets a stand-in meanwhile */
+		iris_thread_enter_blocking ();
+		g_usleep (QUEUE_FULL_SLEEP_USEC);
+		iris_thread_leave_blocking ();
+	}
+
+	return TRUE;
+}
+
+/* Hands @thread_work to the next thread queue that will take it. Thread
+ * queues are only ever full when iris_scheduler_set_queue_capacity() has
+ * been used, and then the caller is held back until there is room.
+ */
+static void
+iris_scheduler_push_work (IrisScheduler  *scheduler,
+                          IrisThreadWork *thread_work)
+{
+	IrisSchedulerPushClosure closure;
+	guint                    attempt = 0;
+
+	closure.thread_work = thread_work;
+	closure.full = FALSE;
+
+	while (!iris_rrobin_apply (scheduler->priv->rrobin,
+	                           iris_scheduler_queue_rrobin_cb,
+	                           &closure) &&
+	       closure.full) {
+		closure.full = FALSE;
+
+		if (!iris_scheduler_wait_for_room (scheduler, attempt++)) {
+			iris_thread_work_execute (thread_work);
+			return;
+		}
+	}
 }
 
 static void
@@ -188,18 +286,289 @@ iris_scheduler_queue_real (IrisScheduler  *scheduler,
                            IrisCallback    func,
                            gpointer        data,
                            GDestroyNotify  destroy_notify)
+{
+	IRIS_SCHEDULER_GET_CLASS (scheduler)->queue_full (scheduler,
+	                                                  func,
+	                                                  data,
+	                                                  destroy_notify,
+	                                                  IRIS_PRIORITY_NORMAL);
+}
+
+static void
+iris_scheduler_queue_full_real (IrisScheduler  *scheduler,
+                                IrisCallback    func,
+                                gpointer        data,
+                                GDestroyNotify  destroy_notify,
+                                IrisPriority    priority)
+{
+	IrisThreadWork *thread_work;
+
+	g_return_if_fail (scheduler != NULL);
+	g_return_if_fail (func != NULL);
+
+	/* Subclasses that don't know about priorities still work, but everything
+	 * they queue is treated the same.
+	 */
+	if (IRIS_SCHEDULER_GET_CLASS (scheduler)->queue != iris_scheduler_queue_real) {
+		IRIS_SCHEDULER_GET_CLASS (scheduler)->queue (scheduler,
+		                                             func,
+		                                             data,
+		                                             destroy_notify);
+		return;
+	}
+
+	thread_work = iris_scheduler_work_new (scheduler, func, data,
+	                                       destroy_notify, priority);
+
+	iris_scheduler_push_work (scheduler, thread_work);
+}
+
+/* Mixes up the bits of @hash, so that nearby values hash far apart */
+static inline guint
+iris_scheduler_mix_hash (guint hash)
+{
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+
+/**
+ * iris_scheduler_get_affinity_queue:
+ * @rrobin: the round robin of thread queues
+ * @key: an affinity key
+ *
+ * Picks the queue in @rrobin that work queued with affinity @key goes to.
+ * Each queue in the round robin is scored by hashing it together with
+ * @key, and the highest score wins (rendezvous hashing). The same key goes
+ * to the same queue for as long as that queue is there; when a thread
+ * joins or leaves the scheduler only the keys that go to, or went to, its
+ * queue move, rather than nearly all of them.
+ *
+ * Return value: a queue from @rrobin, or %NULL if it has none.
+ */
+gpointer
+iris_scheduler_get_affinity_queue (IrisRRobin    *rrobin,
+                                   gconstpointer  key)
+{
+	gpointer queue,
+	         best = NULL;
+	guint    hash,
+	         score,
+	         best_score = 0;
+	gint     i;
+
+	if (g_atomic_int_get (&rrobin->count) == 0)
+		return NULL;
+
+	/* Keys and queues are usually pointers, whose low bits are all the
+	 * same, so they are mixed up before they are combined.
+	 */
+	hash = iris_scheduler_mix_hash ((guint)GPOINTER_TO_SIZE (key));
+
+	for (i = 0; i < rrobin->size; i++) {
+		queue = g_atomic_pointer_get (&rrobin->data [i]);
+		if (queue == NULL)
+			continue;
+
+		score = iris_scheduler_mix_hash (hash ^
+		          iris_scheduler_mix_hash ((guint)GPOINTER_TO_SIZE (queue)));
+
+		if (best == NULL || score > best_score) {
+			best = queue;
+			best_score = score;
+		}
+	}
+
+	return best;
+}
+
+static void
+iris_scheduler_queue_affinity_real (IrisScheduler  *scheduler,
+                                    gconstpointer   key,
+                                    IrisCallback    func,
+                                    gpointer        data,
+                                    GDestroyNotify  destroy_notify)
 {
 	IrisSchedulerPrivate *priv;
 	IrisThreadWork       *thread_work;
+	IrisQueue            *queue = NULL;
 
 	g_return_if_fail (scheduler != NULL);
 	g_return_if_fail (func != NULL);
 
+	/* Subclasses that don't know about affinity still work, their work
+	 * just goes wherever it would otherwise.
+	 */
+	if (IRIS_SCHEDULER_GET_CLASS (scheduler)->queue != iris_scheduler_queue_real) {
+		IRIS_SCHEDULER_GET_CLASS (scheduler)->queue (scheduler,
+		                                             func,
+		                                             data,
+		                                             destroy_notify);
+		return;
+	}
+
 	priv = scheduler->priv;
 
-	thread_work = iris_thread_work_new (func, data, destroy_notify);
+	thread_work = iris_scheduler_work_new (scheduler, func, data,
+	                                       destroy_notify, IRIS_PRIORITY_NORMAL);
+
+	if (G_LIKELY (priv->rrobin != NULL))
+		queue = iris_scheduler_get_affinity_queue (priv->rrobin, key);
+
+	/* If the thread for @key has gone, is leaving, or is too far behind,
+	 * let someone else have it.
+	 */
+	if (queue != NULL &&
+	    iris_queue_get_length (queue) < AFFINITY_MAX_LENGTH &&
+	    iris_priority_queue_push_full (IRIS_PRIORITY_QUEUE (queue),
+	                                   thread_work,
+	                                   IRIS_PRIORITY_NORMAL))
+		return;
+
+	iris_scheduler_push_work (scheduler, thread_work);
+}
+
+/* Least amount of new work that triggers a compaction of the work list */
+#define WORK_COMPACT_MIN 64
+
+/* Smallest number of items handed to one thread queue by a batch. Below this
+ * the cost of the extra round-robin step outweighs spreading the work.
+ */
+#define BATCH_MIN_CHUNK 16
+
+typedef struct {
+	IrisThreadWork **works;
+	guint            n_works;
+	guint            chunk;
+	gboolean         full;
+} IrisSchedulerBatchClosure;
+
+static gboolean
+iris_scheduler_queue_batch_rrobin_cb (gpointer data,
+                                      gpointer user_data)
+{
+	IrisQueue                 *queue   = data;
+	IrisSchedulerBatchClosure *closure = user_data;
+	guint                      wanted,
+	                           pushed;
+
+	wanted = MIN (closure->chunk, closure->n_works);
+	pushed = iris_queue_push_many (queue, (gpointer *)closure->works, wanted);
+
+	closure->works += pushed;
+	closure->n_works -= pushed;
+
+	if (pushed < wanted && !iris_queue_is_closed (queue))
+		closure->full = TRUE;
+
+	/* A closed or full queue takes nothing, so ask for the next one */
+	return pushed > 0;
+}
+
+/**
+ * iris_scheduler_push_batch:
+ * @rrobin: the round robin of thread queues
+ * @works: the work items to push
+ * @n_works: the number of items in @works
+ * @full: a location to store whether a queue was too full to take more
+ *
+ * Splits @works evenly over the queues in @rrobin, so each queue is locked
+ * and woken once, and pushes them in order. This stops early once no queue
+ * will take any more, either because they are all closed or, as stored in
+ * @full, because one of them is full.
+ *
+ * Return value: the number of items pushed from the start of @works.
+ */
+guint
+iris_scheduler_push_batch (IrisRRobin      *rrobin,
+                           IrisThreadWork **works,
+                           guint            n_works,
+                           gboolean        *full)
+{
+	IrisSchedulerBatchClosure closure;
+	guint                     n_queues;
+
+	n_queues = MAX (1, g_atomic_int_get (&rrobin->count));
+
+	closure.works = works;
+	closure.n_works = n_works;
+	closure.chunk = MAX (BATCH_MIN_CHUNK, (n_works + n_queues - 1) / n_queues);
+	closure.full = FALSE;
+
+	while (closure.n_works > 0) {
+		closure.full = FALSE;
+
+		if (!iris_rrobin_apply (rrobin,
+		                        iris_scheduler_queue_batch_rrobin_cb,
+		                        &closure))
+			break;
+	}
+
+	if (full != NULL)
+		*full = closure.full;
+
+	return n_works - closure.n_works;
+}
+
+static void
+iris_scheduler_queue_batch_real (IrisScheduler                *scheduler,
+                                 const IrisSchedulerBatchItem *items,
+                                 guint                         n_items)
+{
+	IrisSchedulerPrivate  *priv;
+	IrisThreadWork       **works,
+	                     **next;
+	guint                  n_works = n_items,
+	                       pushed;
+	guint                  attempt = 0;
+	gboolean               full;
+	guint                  i;
+
+	g_return_if_fail (scheduler != NULL);
+
+	/* Subclasses that only know how to queue one item at a time still work,
+	 * they just don't get the benefit of batching.
+	 */
+	if (IRIS_SCHEDULER_GET_CLASS (scheduler)->queue != iris_scheduler_queue_real) {
+		for (i = 0; i < n_items; i++)
+			IRIS_SCHEDULER_GET_CLASS (scheduler)->queue (scheduler,
+			                                             items[i].callback,
+			                                             items[i].data,
+			                                             items[i].notify);
+		return;
+	}
+
+	priv = scheduler->priv;
+
+	works = next = iris_scheduler_work_new_batch (scheduler, items, n_items);
+
+	while (n_works > 0) {
+		pushed = iris_scheduler_push_batch (priv->rrobin, next, n_works, &full);
+		next += pushed;
+		n_works -= pushed;
+
+		if (n_works == 0 || !full)
+			break;
+
+		/* Every queue is full. One of our own threads gets through the
+		 * batch by running it an item at a time until there is room.
+		 */
+		if (!iris_scheduler_wait_for_room (scheduler, attempt++)) {
+			iris_thread_work_execute (next[0]);
+			next++;
+			n_works--;
+		}
+	}
+
+	/* Every queue was closed, which only happens during finalization */
+	for (i = 0; i < n_works; i++)
+		iris_thread_work_free (next[i]);
 
-	iris_rrobin_apply (priv->rrobin, iris_scheduler_queue_rrobin_cb, thread_work);
+	g_free (works);
 }
 
 static gboolean
@@ -207,68 +576,244 @@ iris_scheduler_unqueue_real (IrisScheduler *scheduler,
                              gpointer       work_item)
 {
 	IrisThreadWork *thread_work = (IrisThreadWork *)work_item;
-	gboolean        work_claimed;
+	GDestroyNotify  notify;
+	gpointer        data;
 
 	g_return_val_if_fail (scheduler != NULL, FALSE);
 	g_return_val_if_fail (work_item != NULL, FALSE);
 
-	g_atomic_int_set (&thread_work->remove, TRUE);
+	/* Once the work has left QUEUED it may be freed at any time, so read
+	 * what we need first.
+	 */
+	notify = thread_work->notify;
+	data = thread_work->data;
+
+	for (;;) {
+		switch (g_atomic_int_get (&thread_work->state)) {
+		case IRIS_THREAD_WORK_QUEUED:
+			if (!g_atomic_int_compare_and_exchange (&thread_work->state,
+			                                        IRIS_THREAD_WORK_QUEUED,
+			                                        IRIS_THREAD_WORK_CANCELLED))
+				break;
+
+			/* The dead item stays in its queue until it is popped, but it
+			 * no longer holds on to its data.
+			 */
+			if (notify != NULL)
+				notify (data);
+			return TRUE;
+
+		case IRIS_THREAD_WORK_HELD:
+			/* We are inside a foreach, which calls the notify once the
+			 * callback returns.
+			 */
+			if (!g_atomic_int_compare_and_exchange (&thread_work->state,
+			                                        IRIS_THREAD_WORK_HELD,
+			                                        IRIS_THREAD_WORK_HELD_CANCELLED))
+				break;
+			return TRUE;
+
+		default:
+			/* Running, finished or already unqueued */
+			return FALSE;
+		}
+	}
+}
 
-	work_claimed = g_atomic_int_compare_and_exchange (&thread_work->taken, FALSE, TRUE);
+/* Moves work added since the last compaction onto the end of the list, and
+ * frees whatever has finished. Called with 'work_mutex' held. Work from
+ * one stack keeps its order, but work queued by different threads since
+ * the last compaction is taken a stack at a time.
+ */
+static void
+iris_scheduler_compact_work (IrisSchedulerPrivate *priv)
+{
+	IrisWorkShard   *shard;
+	IrisThreadWork  *incoming,
+	                *newest,
+	                *reversed,
+	                *thread_work,
+	               **link;
+	gint             length = 0;
+	guint            i;
+
+	for (i = 0; i < WORK_N_SHARDS; i++) {
+		shard = &priv->work_incoming[i];
+
+		if (g_atomic_pointer_get (&shard->head) == NULL)
+			continue;
+
+		do
+			incoming = g_atomic_pointer_get (&shard->head);
+		while (!g_atomic_pointer_compare_and_exchange ((gpointer *)&shard->head,
+		                                               incoming, NULL));
+		g_atomic_int_set (&shard->length, 0);
+
+		/* The incoming stack is newest first */
+		newest = incoming;
+		reversed = NULL;
+		while (incoming != NULL) {
+			thread_work = incoming;
+			incoming = incoming->next;
+			thread_work->next = reversed;
+			reversed = thread_work;
+		}
 
-	if (!work_claimed) {
-		/* Thread has claimed the work; the thread will free the work. */
-		return FALSE;
-	} else {
-		/* Work will be freed when found by a foreach, or by a thread when it
-		 * is popped. Either way we can guarantee the work will not run.
-		 */
-		return TRUE;
+		if (priv->work_tail != NULL)
+			priv->work_tail->next = reversed;
+		else
+			priv->work_head = reversed;
+
+		priv->work_tail = newest;
+	}
+
+	priv->work_tail = NULL;
+	link = &priv->work_head;
+
+	while ((thread_work = *link) != NULL) {
+		if (g_atomic_int_get (&thread_work->state) == IRIS_THREAD_WORK_FINISHED) {
+			*link = thread_work->next;
+			iris_thread_work_unref (thread_work);
+		}
+		else {
+			priv->work_tail = thread_work;
+			link = &thread_work->next;
+			length++;
+		}
 	}
+
+	g_atomic_int_set (&priv->work_length, length);
 }
 
-typedef struct {
-	IrisScheduler            *scheduler;
-	IrisSchedulerForeachFunc  callback;
-	gpointer                  user_data;
-} IrisSchedulerForeachClosure;
+/* Picks the calling thread's stack in 'work_incoming' */
+static IrisWorkShard*
+iris_scheduler_get_work_shard (IrisSchedulerPrivate *priv)
+{
+	guint hash;
 
-static gboolean
-iris_scheduler_foreach_rrobin_cb (IrisRRobin *rrobin,
-                                  gpointer    data,
-                                  gpointer    user_data)
-{
-	IrisQueue                    *queue   = data;
-	IrisSchedulerForeachClosure  *closure = user_data;
-	gboolean continue_flag = TRUE;
-	gint i;
-
-	/* Foreach the queue in a really hacky way. FIXME: be neater!
-	 * And make sure the order of work is preserved!!!
-	 * In particular, avoid calling queue_length() each time! */
-	for (i=0; i<iris_queue_get_length(queue); i++) {
-		IrisThreadWork *thread_work = iris_queue_try_pop (queue);
-		/* By removing the work from the queue, we know now it can't be executed */
-
-		if (!thread_work)
-			break;
+	/* Fibonacci hashing, so threads allocated side by side are spread out */
+	hash = (guint)(GPOINTER_TO_SIZE (g_thread_self ()) >> 4) * 2654435769U;
 
-		continue_flag = closure->callback (closure->scheduler,
-		                                   thread_work,
-		                                   thread_work->callback,
-		                                   thread_work->data,
-		                                   closure->user_data);
+	return &priv->work_incoming[hash >> (32 - WORK_SHARD_BITS)];
+}
 
-		if (g_atomic_int_get (&thread_work->remove) == FALSE)
-			iris_queue_push (queue, thread_work);
-		else
-			iris_thread_work_free (thread_work);
+/* Adds a chain of work, linked through 'next' from oldest to newest, to the
+ * scheduler's work list. The chain is pushed with a single compare-and-swap
+ * onto a stack that is only shared with threads that hash to the same one.
+ */
+static void
+iris_scheduler_add_work (IrisScheduler  *scheduler,
+                         IrisThreadWork *oldest,
+                         IrisThreadWork *newest,
+                         guint           n_works)
+{
+	IrisSchedulerPrivate *priv = scheduler->priv;
+	IrisWorkShard        *shard;
+	IrisThreadWork       *thread_work,
+	                     *prev,
+	                     *head;
+	gint                  n_incoming;
+
+	/* Only the first work after the monitor backed off touches the
+	 * manager, so it looks at our load again straight away.
+	 */
+	if (G_UNLIKELY (g_atomic_int_get (&priv->idle)) &&
+	    g_atomic_int_compare_and_exchange (&priv->idle, TRUE, FALSE))
+		iris_scheduler_manager_wake_watch (scheduler);
+
+	/* The incoming stack is newest first, so turn the chain around */
+	prev = NULL;
+	thread_work = oldest;
+	while (thread_work != NULL) {
+		IrisThreadWork *next = thread_work->next;
+		thread_work->next = prev;
+		prev = thread_work;
+		thread_work = next;
+	}
 
-		if (!continue_flag)
-			break;
+	shard = iris_scheduler_get_work_shard (priv);
+
+	do {
+		head = g_atomic_pointer_get (&shard->head);
+		oldest->next = head;
+	} while (!g_atomic_pointer_compare_and_exchange ((gpointer *)&shard->head,
+	                                                 head, newest));
+
+	/* Compact once there is about as much new work as there was work left
+	 * last time, so the cost per item stays constant. Whoever is already
+	 * compacting or iterating will pick the new work up.
+	 */
+	n_incoming = g_atomic_int_exchange_and_add (&shard->length, n_works) + n_works;
+
+	if (n_incoming >= MAX (WORK_COMPACT_MIN, g_atomic_int_get (&priv->work_length)) / WORK_N_SHARDS &&
+	    g_static_rec_mutex_trylock (&priv->work_mutex)) {
+		iris_scheduler_compact_work (priv);
+		g_static_rec_mutex_unlock (&priv->work_mutex);
+	}
+}
+
+/**
+ * iris_scheduler_work_new:
+ * @scheduler: An #IrisScheduler
+ * @callback: An #IrisCallback
+ * @data: data for @callback
+ * @notify: an optional callback to free @data
+ * @priority: the #IrisPriority of the work
+ *
+ * Creates a new #IrisThreadWork and adds it to the work list of @scheduler,
+ * so that it can be found by iris_scheduler_foreach(). Scheduler
+ * implementations should use this rather than iris_thread_work_new().
+ *
+ * Return value: the new #IrisThreadWork, ready to be queued.
+ */
+IrisThreadWork*
+iris_scheduler_work_new (IrisScheduler  *scheduler,
+                         IrisCallback    callback,
+                         gpointer        data,
+                         GDestroyNotify  notify,
+                         IrisPriority    priority)
+{
+	IrisThreadWork *thread_work;
+
+	thread_work = iris_thread_work_new (callback, data, notify);
+	thread_work->priority = priority;
+	thread_work->ref_count = 2;
+
+	iris_scheduler_add_work (scheduler, thread_work, thread_work, 1);
+
+	return thread_work;
+}
+
+/**
+ * iris_scheduler_work_new_batch:
+ * @scheduler: An #IrisScheduler
+ * @items: an array of #IrisSchedulerBatchItem
+ * @n_items: the number of items in @items
+ *
+ * Like iris_thread_work_new_batch(), but also adds the work to the work list
+ * of @scheduler as for iris_scheduler_work_new().
+ *
+ * Return value: A newly allocated array of @n_items pointers to the new
+ *               work items. Free the array with g_free().
+ */
+IrisThreadWork**
+iris_scheduler_work_new_batch (IrisScheduler                *scheduler,
+                               const IrisSchedulerBatchItem *items,
+                               guint                         n_items)
+{
+	IrisThreadWork **works;
+	guint            i;
+
+	works = iris_thread_work_new_batch (items, n_items);
+
+	for (i = 0; i < n_items; i++) {
+		works[i]->ref_count = 2;
+		works[i]->next = (i + 1 < n_items) ? works[i + 1] : NULL;
 	}
 
-	return continue_flag;
+	iris_scheduler_add_work (scheduler, works[0], works[n_items - 1], n_items);
+
+	return works;
 }
 
 static void
@@ -276,23 +821,56 @@ iris_scheduler_foreach_real (IrisScheduler            *scheduler,
                              IrisSchedulerForeachFunc  callback,
                              gpointer                  user_data)
 {
-	IrisSchedulerPrivate        *priv;
-	IrisSchedulerForeachClosure  closure;
+	IrisSchedulerPrivate *priv;
+	IrisThreadWork       *thread_work;
+	GDestroyNotify        notify;
+	gpointer              data;
+	gboolean              continue_flag = TRUE;
 
 	g_return_if_fail (scheduler != NULL);
 	g_return_if_fail (callback != NULL);
 
 	priv = scheduler->priv;
 
-	closure.scheduler = scheduler;
-	closure.callback  = callback;
-	closure.user_data = user_data;
+	/* Holding the lock stops finished work being freed under us, but
+	 * workers and submitters never wait for it.
+	 */
+	g_static_rec_mutex_lock (&priv->work_mutex);
+
+	iris_scheduler_compact_work (priv);
+
+	for (thread_work = priv->work_head;
+	     thread_work != NULL && continue_flag;
+	     thread_work = thread_work->next)
+	{
+		/* Hold the work so it can't start while the callback looks at it */
+		if (!g_atomic_int_compare_and_exchange (&thread_work->state,
+		                                        IRIS_THREAD_WORK_QUEUED,
+		                                        IRIS_THREAD_WORK_HELD))
+			continue;
+
+		continue_flag = callback (scheduler,
+		                          thread_work,
+		                          thread_work->callback,
+		                          thread_work->data,
+		                          user_data);
+
+		if (!g_atomic_int_compare_and_exchange (&thread_work->state,
+		                                        IRIS_THREAD_WORK_HELD,
+		                                        IRIS_THREAD_WORK_QUEUED))
+		{
+			/* The callback unqueued it */
+			notify = thread_work->notify;
+			data = thread_work->data;
+			g_atomic_int_set (&thread_work->state, IRIS_THREAD_WORK_CANCELLED);
+
+			if (notify != NULL)
+				notify (data);
+		}
+	}
 
-	/* Iterate through each of our queues */
-	iris_rrobin_foreach (priv->rrobin,
-	                     iris_scheduler_foreach_rrobin_cb,
-	                     &closure);
-};
+	g_static_rec_mutex_unlock (&priv->work_mutex);
+}
 
 static gint
 iris_scheduler_get_min_threads_real (IrisScheduler *scheduler)
@@ -320,6 +898,7 @@ iris_scheduler_add_thread_real (IrisScheduler  *scheduler,
 	gboolean              leader;
 	IrisQueue            *queue;
 	gint                  max_threads;
+	guint                 capacity;
 
 	g_return_if_fail (IRIS_IS_SCHEDULER (scheduler));
 
@@ -334,8 +913,14 @@ iris_scheduler_add_thread_real (IrisScheduler  *scheduler,
 		priv->rrobin = iris_rrobin_new (max_threads);
 	}
 
-	/* create the threads queue for the round robin */
-	queue = iris_queue_new ();
+	/* create the threads queue for the round robin, with a level for each
+	 * priority so urgent work doesn't wait behind the backlog.
+	 */
+	capacity = g_atomic_int_get (&priv->queue_capacity);
+	if (capacity > 0)
+		queue = iris_priority_queue_new_bounded (capacity);
+	else
+		queue = iris_priority_queue_new ();
 	thread->user_data = queue;
 
 	/* add the item to the round robin */
@@ -432,11 +1017,23 @@ release_thread (gpointer data,
 	g_object_unref (work_queue);
 }
 
+static void
+iris_scheduler_dispose (GObject *object)
+{
+	/* Stop the scheduler manager sampling us before anything is freed */
+	iris_scheduler_manager_unprepare (IRIS_SCHEDULER (object));
+
+	G_OBJECT_CLASS (iris_scheduler_parent_class)->dispose (object);
+}
+
 static void
 iris_scheduler_finalize (GObject *object)
 {
 	IrisScheduler        *scheduler;
 	IrisSchedulerPrivate *priv;
+	IrisThreadStats      *stats,
+	                     *next;
+	IrisThreadWork       *thread_work;
 
 	scheduler = IRIS_SCHEDULER (object);
 	priv = scheduler->priv;
@@ -455,7 +1052,31 @@ iris_scheduler_finalize (GObject *object)
 	if (priv->rrobin != NULL)
 		iris_rrobin_unref (priv->rrobin);
 
+	/* Free the work that has finished, and let go of the rest. Anything left
+	 * may still be in a queue that outlives us, so it is freed by whoever
+	 * finishes it.
+	 */
+	g_static_rec_mutex_lock (&priv->work_mutex);
+	iris_scheduler_compact_work (priv);
+	while ((thread_work = priv->work_head) != NULL) {
+		priv->work_head = thread_work->next;
+		iris_thread_work_unref (thread_work);
+	}
+	priv->work_tail = NULL;
+	g_static_rec_mutex_unlock (&priv->work_mutex);
+	g_static_rec_mutex_free (&priv->work_mutex);
+
+	/* Our threads have all handed their counters back by now */
+	for (stats = priv->stats_list; stats; stats = next) {
+		next = stats->next;
+		g_free (stats);
+	}
+
 	g_mutex_free (priv->mutex);
+	g_free (priv->cpus);
+
+	if (priv->load_controller != NULL)
+		g_object_unref (priv->load_controller);
 
 	G_OBJECT_CLASS (iris_scheduler_parent_class)->finalize (object);
 }
@@ -466,6 +1087,9 @@ iris_scheduler_class_init (IrisSchedulerClass *klass)
 	GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
 	klass->queue = iris_scheduler_queue_real;
+	klass->queue_full = iris_scheduler_queue_full_real;
+	klass->queue_batch = iris_scheduler_queue_batch_real;
+	klass->queue_affinity = iris_scheduler_queue_affinity_real;
 	klass->unqueue = iris_scheduler_unqueue_real;
 	klass->foreach = iris_scheduler_foreach_real;
 	klass->get_min_threads = iris_scheduler_get_min_threads_real;
@@ -474,6 +1098,7 @@ iris_scheduler_class_init (IrisSchedulerClass *klass)
 	klass->remove_thread = iris_scheduler_remove_thread_real;
 	klass->iterate = iris_scheduler_iterate_real;
 
+	object_class->dispose = iris_scheduler_dispose;
 	object_class->finalize = iris_scheduler_finalize;
 
 	g_type_class_add_private (object_class, sizeof (IrisSchedulerPrivate));
@@ -494,9 +1119,30 @@ iris_scheduler_init (IrisScheduler *scheduler)
 
 	scheduler->priv->thread_list = NULL;
 
+	memset (scheduler->priv->work_incoming, 0,
+	        sizeof (scheduler->priv->work_incoming));
+	g_static_rec_mutex_init (&scheduler->priv->work_mutex);
+	scheduler->priv->work_head = NULL;
+	scheduler->priv->work_tail = NULL;
+	scheduler->priv->work_length = 0;
+
 	scheduler->priv->min_threads = 0;
 	scheduler->priv->max_threads = 0;
 
+	scheduler->priv->cpus = NULL;
+	scheduler->priv->n_cpus = 0;
+
+	scheduler->priv->load_controller = iris_load_controller_new ();
+	scheduler->priv->idle = FALSE;
+
+	scheduler->priv->share = 1;
+	scheduler->priv->queue_capacity = 0;
+
+	scheduler->priv->n_blocked = 0;
+	scheduler->priv->n_lent = 0;
+
+	scheduler->priv->stats_list = NULL;
+
 	/* Actual init happens lazily from iris_scheduler_queue() */
 	scheduler->priv->initialized = FALSE;
 }
@@ -536,6 +1182,263 @@ iris_scheduler_new_full (guint min_threads,
 	return scheduler;
 }
 
+/**
+ * iris_scheduler_new_with_cpus:
+ * @min_threads: The minimum number of threads to allocate
+ * @max_threads: The maximum number of threads to allocate
+ * @cpus: An array of CPU numbers
+ * @n_cpus: The length of @cpus
+ *
+ * Creates a new scheduler like iris_scheduler_new_full(), whose threads are
+ * bound to the CPUs in @cpus. See iris_scheduler_set_cpus().
+ *
+ * Return value: the newly created scheduler instance.
+ */
+IrisScheduler*
+iris_scheduler_new_with_cpus (guint        min_threads,
+                              guint        max_threads,
+                              const guint *cpus,
+                              guint        n_cpus)
+{
+	IrisScheduler *scheduler;
+
+	scheduler = iris_scheduler_new_full (min_threads, max_threads);
+	iris_scheduler_set_cpus (scheduler, cpus, n_cpus);
+
+	return scheduler;
+}
+
+/**
+ * iris_scheduler_set_cpus:
+ * @scheduler: An #IrisScheduler
+ * @cpus: An array of CPU numbers, or %NULL
+ * @n_cpus: The length of @cpus
+ *
+ * Restricts the threads of @scheduler to the CPUs listed in @cpus. The
+ * scheduler manager spreads the threads over these CPUs, preferring the
+ * ones with the fewest Iris threads bound to them already, and each thread
+ * binds itself to its CPU before it starts work. Pass %NULL to let the
+ * threads run on any CPU, which is the default.
+ *
+ * This must be called before any work is queued on @scheduler. Binding is
+ * currently only supported on Linux; elsewhere the threads are placed but
+ * not bound.
+ */
+void
+iris_scheduler_set_cpus (IrisScheduler *scheduler,
+                         const guint   *cpus,
+                         guint          n_cpus)
+{
+	IrisSchedulerPrivate *priv;
+
+	g_return_if_fail (IRIS_IS_SCHEDULER (scheduler));
+	g_return_if_fail (cpus != NULL || n_cpus == 0);
+
+	priv = scheduler->priv;
+
+	g_return_if_fail (!g_atomic_int_get (&priv->initialized));
+
+	g_free (priv->cpus);
+	priv->cpus = n_cpus > 0 ? g_memdup (cpus, n_cpus * sizeof (guint)) : NULL;
+	priv->n_cpus = n_cpus;
+}
+
+/**
+ * iris_scheduler_get_cpus:
+ * @scheduler: An #IrisScheduler
+ * @n_cpus: return location for the number of CPUs
+ *
+ * Retrieves the CPUs set with iris_scheduler_set_cpus().
+ *
+ * Return value: an array of @n_cpus CPU numbers owned by @scheduler, or
+ *               %NULL if its threads may run on any CPU.
+ */
+const guint*
+iris_scheduler_get_cpus (IrisScheduler *scheduler,
+                         guint         *n_cpus)
+{
+	g_return_val_if_fail (IRIS_IS_SCHEDULER (scheduler), NULL);
+	g_return_val_if_fail (n_cpus != NULL, NULL);
+
+	*n_cpus = scheduler->priv->n_cpus;
+	return scheduler->priv->cpus;
+}
+
+/**
+ * iris_scheduler_set_share:
+ * @scheduler: An #IrisScheduler
+ * @share: the weight of @scheduler, at least 1
+ *
+ * Sets how big a share of the scheduler manager's threads @scheduler gets
+ * when there are not enough for every scheduler. Once each scheduler has
+ * its minimum threads, the rest of the pool is divided between the
+ * schedulers that want more in proportion to their shares, so a scheduler
+ * with a share of 2 gets twice as many threads as one with a share of 1.
+ * No scheduler gets more than its maximum threads, and whatever a
+ * scheduler does not need is used by the others until it wants it back.
+ *
+ * The default share is 1. The share only matters when the pool is capped
+ * with iris_scheduler_manager_set_max_threads(). It can be changed at any
+ * time, and is used the next time the threads are shared out.
+ */
+void
+iris_scheduler_set_share (IrisScheduler *scheduler,
+                          guint          share)
+{
+	g_return_if_fail (IRIS_IS_SCHEDULER (scheduler));
+	g_return_if_fail (share > 0);
+
+	g_atomic_int_set (&scheduler->priv->share, share);
+}
+
+/**
+ * iris_scheduler_get_share:
+ * @scheduler: An #IrisScheduler
+ *
+ * Retrieves the share set with iris_scheduler_set_share().
+ *
+ * Return value: the share of @scheduler
+ */
+guint
+iris_scheduler_get_share (IrisScheduler *scheduler)
+{
+	g_return_val_if_fail (IRIS_IS_SCHEDULER (scheduler), 1);
+
+	return g_atomic_int_get (&scheduler->priv->share);
+}
+
+/**
+ * iris_scheduler_set_queue_capacity:
+ * @scheduler: An #IrisScheduler
+ * @capacity: the number of work items each thread queue has room for, or 0
+ *
+ * Bounds the queues of the threads working for @scheduler, so that a
+ * producer queueing work faster than it can be run is held back instead
+ * of using up all the memory. Each thread queue becomes an #IrisRingQueue
+ * with room for @capacity items at each priority.
+ *
+ * When every thread queue is full, iris_scheduler_queue() waits for room
+ * to be made. If it is called from one of @scheduler's own threads the
+ * work is run straight away instead, since that thread might be the one
+ * that would have to make room.
+ *
+ * The default capacity of 0 leaves the queues unbounded. The capacity is
+ * used for the queues of threads that join the scheduler after it is set,
+ * so set it before queueing any work.
+ *
+ * Only #IrisScheduler's own thread queues can be bounded. Subclasses that
+ * give their threads queues of their own, such as #IrisWSScheduler and
+ * #IrisLFScheduler, ignore the capacity, and setting one warns.
+ */
+void
+iris_scheduler_set_queue_capacity (IrisScheduler *scheduler,
+                                   guint          capacity)
+{
+	g_return_if_fail (IRIS_IS_SCHEDULER (scheduler));
+
+	if (capacity > 0 &&
+	    IRIS_SCHEDULER_GET_CLASS (scheduler)->add_thread != iris_scheduler_add_thread_real)
+		g_warning ("%s: %s does not support bounded thread queues",
+		           G_STRFUNC, G_OBJECT_TYPE_NAME (scheduler));
+
+	g_atomic_int_set (&scheduler->priv->queue_capacity, capacity);
+}
+
+/**
+ * iris_scheduler_get_queue_capacity:
+ * @scheduler: An #IrisScheduler
+ *
+ * Retrieves the capacity set with iris_scheduler_set_queue_capacity().
+ *
+ * Return value: the capacity of each thread queue, or 0 if unbounded.
+ */
+guint
+iris_scheduler_get_queue_capacity (IrisScheduler *scheduler)
+{
+	g_return_val_if_fail (IRIS_IS_SCHEDULER (scheduler), 0);
+
+	return g_atomic_int_get (&scheduler->priv->queue_capacity);
+}
+
+/**
+ * iris_scheduler_set_load_controller:
+ * @scheduler: An #IrisScheduler
+ * @controller: An #IrisLoadController, or %NULL
+ *
+ * Sets the #IrisLoadController the scheduler manager uses to decide how
+ * many threads @scheduler needs. Each scheduler starts out with its own
+ * default #IrisLoadController; use this to tune how often the load is
+ * sampled and what latency to aim for, or to use a different policy. A
+ * controller can be shared by several schedulers if it keeps no state of
+ * its own.
+ *
+ * If @controller is %NULL, @scheduler stays at its minimum number of
+ * threads.
+ */
+void
+iris_scheduler_set_load_controller (IrisScheduler      *scheduler,
+                                    IrisLoadController *controller)
+{
+	IrisSchedulerPrivate *priv;
+	IrisLoadController   *old_controller;
+
+	g_return_if_fail (IRIS_IS_SCHEDULER (scheduler));
+	g_return_if_fail (controller == NULL || IRIS_IS_LOAD_CONTROLLER (controller));
+
+	priv = scheduler->priv;
+
+	if (controller != NULL)
+		g_object_ref (controller);
+
+	g_mutex_lock (priv->mutex);
+
+	old_controller = priv->load_controller;
+	priv->load_controller = controller;
+
+	/* Otherwise the scheduler manager will pick it up in prepare */
+	if (g_atomic_int_get (&priv->initialized))
+		iris_scheduler_manager_set_load_controller (scheduler, controller);
+
+	g_mutex_unlock (priv->mutex);
+
+	if (old_controller != NULL)
+		g_object_unref (old_controller);
+}
+
+/**
+ * iris_scheduler_get_load_controller:
+ * @scheduler: An #IrisScheduler
+ *
+ * Retrieves the controller set with iris_scheduler_set_load_controller().
+ *
+ * Return value: the #IrisLoadController of @scheduler, or %NULL.
+ */
+IrisLoadController*
+iris_scheduler_get_load_controller (IrisScheduler *scheduler)
+{
+	g_return_val_if_fail (IRIS_IS_SCHEDULER (scheduler), NULL);
+
+	return scheduler->priv->load_controller;
+}
+
+/* Lazy initialization of the scheduler. By holding off until we
+ * need this, we attempt to reduce our total thread usage.
+ */
+static void
+iris_scheduler_ensure_initialized (IrisScheduler *scheduler)
+{
+	IrisSchedulerPrivate *priv = scheduler->priv;
+
+	if (G_UNLIKELY (!priv->initialized)) {
+		g_mutex_lock (priv->mutex);
+		if (G_LIKELY (!g_atomic_int_get (&priv->initialized))) {
+			iris_scheduler_manager_prepare (scheduler);
+			g_atomic_int_set (&priv->initialized, TRUE);
+		}
+		g_mutex_unlock (priv->mutex);
+	}
+}
+
 /**
  * iris_scheduler_queue:
  * @scheduler: An #IrisScheduler
@@ -564,26 +1467,277 @@ iris_scheduler_queue (IrisScheduler  *scheduler,
                       gpointer        data,
                       GDestroyNotify  destroy_notify)
 {
-	IrisSchedulerPrivate *priv;
+	g_return_if_fail (scheduler != NULL);
+
+	iris_scheduler_ensure_initialized (scheduler);
 
+	IRIS_SCHEDULER_GET_CLASS (scheduler)->queue (scheduler, func, data, destroy_notify);
+}
+
+/**
+ * iris_scheduler_queue_full:
+ * @scheduler: An #IrisScheduler
+ * @func: An #IrisCallback
+ * @data: data for @func
+ * @destroy_notify: an optional callback after execution to free data
+ * @priority: the #IrisPriority of the work item
+ *
+ * Queues a new work item like iris_scheduler_queue(), at the given
+ * @priority. Work at a higher priority is run before any waiting work of a
+ * lower priority, although lower priority work is never starved completely.
+ *
+ * The control messages of #IrisTask and #IrisProcess objects are queued at
+ * %IRIS_PRIORITY_HIGH, so that for example a cancel request does not wait
+ * behind a backlog of work on a shared scheduler.
+ */
+void
+iris_scheduler_queue_full (IrisScheduler  *scheduler,
+                           IrisCallback    func,
+                           gpointer        data,
+                           GDestroyNotify  destroy_notify,
+                           IrisPriority    priority)
+{
 	g_return_if_fail (scheduler != NULL);
+	g_return_if_fail (priority >= 0 && priority < IRIS_N_PRIORITIES);
 
-	priv = scheduler->priv;
+	iris_scheduler_ensure_initialized (scheduler);
 
-	/* Lazy initialization of the scheduler. By holding off until we
-	 * need this, we attempt to reduce our total thread usage.
-	 */
+	IRIS_SCHEDULER_GET_CLASS (scheduler)->queue_full (scheduler,
+	                                                  func,
+	                                                  data,
+	                                                  destroy_notify,
+	                                                  priority);
+}
 
-	if (G_UNLIKELY (!priv->initialized)) {
-		g_mutex_lock (priv->mutex);
-		if (G_LIKELY (!g_atomic_int_get (&priv->initialized))) {
-			iris_scheduler_manager_prepare (scheduler);
-			g_atomic_int_set (&priv->initialized, TRUE);
+/**
+ * iris_scheduler_queue_batch:
+ * @scheduler: An #IrisScheduler
+ * @items: an array of #IrisSchedulerBatchItem
+ * @n_items: the number of items in @items
+ *
+ * Queues @n_items work items at once. This behaves the same as calling
+ * iris_scheduler_queue() for each item in @items, but the work items are
+ * allocated together and handed to the scheduler's threads in chunks, so
+ * the cost per item is much lower when queueing a lot of small items.
+ *
+ * The same caveats about ordering apply as for iris_scheduler_queue().
+ */
+void
+iris_scheduler_queue_batch (IrisScheduler                *scheduler,
+                            const IrisSchedulerBatchItem *items,
+                            guint                         n_items)
+{
+	g_return_if_fail (scheduler != NULL);
+	g_return_if_fail (items != NULL || n_items == 0);
+
+	if (n_items == 0)
+		return;
+
+	iris_scheduler_ensure_initialized (scheduler);
+
+	IRIS_SCHEDULER_GET_CLASS (scheduler)->queue_batch (scheduler, items, n_items);
+}
+
+/**
+ * iris_scheduler_queue_with_affinity:
+ * @scheduler: An #IrisScheduler
+ * @key: an affinity key, such as the #IrisReceiver or #IrisProcess that
+ *   the work belongs to
+ * @func: An #IrisCallback
+ * @data: data for @func
+ * @destroy_notify: an optional callback after execution to free data
+ *
+ * Queues a new work item like iris_scheduler_queue(), but tries to run it on
+ * the same thread as other work queued with the same @key, so that any
+ * state they share stays in that thread's CPU cache.
+ *
+ * This is only a hint. If the thread for @key has a backlog of work, or has
+ * left the scheduler, the work item goes to another thread instead. On an
+ * #IrisWSScheduler the work can also still be stolen by idle threads.
+ */
+void
+iris_scheduler_queue_with_affinity (IrisScheduler  *scheduler,
+                                    gconstpointer   key,
+                                    IrisCallback    func,
+                                    gpointer        data,
+                                    GDestroyNotify  destroy_notify)
+{
+	g_return_if_fail (scheduler != NULL);
+
+	iris_scheduler_ensure_initialized (scheduler);
+
+	IRIS_SCHEDULER_GET_CLASS (scheduler)->queue_affinity (scheduler,
+	                                                      key,
+	                                                      func,
+	                                                      data,
+	                                                      destroy_notify);
+}
+
+/**
+ * iris_scheduler_queue_timeout:
+ * @scheduler: An #IrisScheduler
+ * @func: An #IrisCallback
+ * @data: data for @func
+ * @destroy_notify: an optional callback to free @data once @func has run
+ *                  or the timeout has been cancelled
+ * @msec: the delay in milliseconds
+ *
+ * Queues a new work item on @scheduler after @msec milliseconds have
+ * passed. The delay is kept in the scheduler manager's timer wheel, so
+ * no thread is tied up while waiting, and @func does not run any sooner
+ * than @msec but may run later if @scheduler is busy.
+ *
+ * The returned handle can be passed to iris_timeout_cancel(), which works
+ * in constant time however many timeouts are pending.
+ *
+ * Return value: a new reference to an #IrisTimeout, to be released with
+ *               iris_timeout_unref().
+ */
+IrisTimeout*
+iris_scheduler_queue_timeout (IrisScheduler  *scheduler,
+                              IrisCallback    func,
+                              gpointer        data,
+                              GDestroyNotify  destroy_notify,
+                              guint           msec)
+{
+	g_return_val_if_fail (scheduler != NULL, NULL);
+	g_return_val_if_fail (func != NULL, NULL);
+
+	return iris_scheduler_manager_add_timeout (scheduler, func, data,
+	                                           destroy_notify, msec, FALSE);
+}
+
+/**
+ * iris_scheduler_queue_periodic:
+ * @scheduler: An #IrisScheduler
+ * @func: An #IrisCallback
+ * @data: data for @func
+ * @destroy_notify: an optional callback to free @data once the timeout has
+ *                  been cancelled
+ * @msec: the period in milliseconds
+ *
+ * Queues a work item on @scheduler every @msec milliseconds, starting
+ * @msec milliseconds from now, until the returned handle is passed to
+ * iris_timeout_cancel(). A run is skipped if the previous one is still
+ * waiting or executing when it comes due, so a slow @func never has more
+ * than one item in the scheduler at a time.
+ *
+ * The timeout keeps a reference on @scheduler until it is cancelled.
+ *
+ * Return value: a new reference to an #IrisTimeout, to be released with
+ *               iris_timeout_unref().
+ */
+IrisTimeout*
+iris_scheduler_queue_periodic (IrisScheduler  *scheduler,
+                               IrisCallback    func,
+                               gpointer        data,
+                               GDestroyNotify  destroy_notify,
+                               guint           msec)
+{
+	g_return_val_if_fail (scheduler != NULL, NULL);
+	g_return_val_if_fail (func != NULL, NULL);
+	g_return_val_if_fail (msec > 0, NULL);
+
+	return iris_scheduler_manager_add_timeout (scheduler, func, data,
+	                                           destroy_notify, msec, TRUE);
+}
+
+/* How many iris_scheduler_run_until() calls can be nested on one thread
+ * before it stops running other work and just waits.
+ */
+#define RUN_UNTIL_MAX_DEPTH   8
+
+/* How long a helping thread waits for work before checking its predicate
+ * again, and the longest a thread that cannot help sleeps between checks.
+ */
+#define RUN_UNTIL_POP_TIMEOUT (G_USEC_PER_SEC / 1000)
+#define RUN_UNTIL_MAX_SLEEP   (G_USEC_PER_SEC / 100)
+
+/**
+ * iris_scheduler_can_help:
+ * @scheduler: An #IrisScheduler, or %NULL
+ *
+ * Checks whether iris_scheduler_run_until() called from this thread with
+ * @scheduler would run other work while it waits.
+ *
+ * Return value: %TRUE if the calling thread is one of @scheduler's threads
+ *   (or of any scheduler if @scheduler is %NULL) and is not nested too
+ *   deeply to help.
+ */
+gboolean
+iris_scheduler_can_help (IrisScheduler *scheduler)
+{
+	IrisThread *thread = iris_thread_get ();
+
+	return thread != NULL &&
+	       thread->scheduler != NULL &&
+	       thread->active != NULL &&
+	       (scheduler == NULL || thread->scheduler == scheduler) &&
+	       thread->run_depth < RUN_UNTIL_MAX_DEPTH;
+}
+
+/**
+ * iris_scheduler_run_until:
+ * @scheduler: An #IrisScheduler, or %NULL for whichever scheduler the calling
+ *   thread works for
+ * @predicate: An #IrisSchedulerPredicate
+ * @user_data: data for @predicate
+ *
+ * Waits until @predicate returns %TRUE. If the calling thread is one of the
+ * threads of @scheduler, it runs other work from its queue, or work it can
+ * steal, while it waits. Blocking a worker thread on a #GCond instead ties
+ * it up, and can deadlock a scheduler with few threads if the work being
+ * waited for is queued behind it.
+ *
+ * Work run while waiting can itself call iris_scheduler_run_until(). To keep
+ * the stack bounded, a thread that is already nested too deeply, or that
+ * is not one of @scheduler's threads, just checks @predicate now and then.
+ *
+ * @predicate is called from the calling thread only.
+ */
+void
+iris_scheduler_run_until (IrisScheduler          *scheduler,
+                          IrisSchedulerPredicate  predicate,
+                          gpointer                user_data)
+{
+	IrisThread *thread;
+	GTimeVal    timeout;
+	gulong      sleep_usec = 50;
+	gboolean    help;
+
+	g_return_if_fail (scheduler == NULL || IRIS_IS_SCHEDULER (scheduler));
+	g_return_if_fail (predicate != NULL);
+
+	thread = iris_thread_get ();
+	help = iris_scheduler_can_help (scheduler);
+
+	if (help)
+		thread->run_depth++;
+
+	while (!predicate (user_data)) {
+		if (help) {
+			g_get_current_time (&timeout);
+			g_time_val_add (&timeout, RUN_UNTIL_POP_TIMEOUT);
+
+			if (iris_thread_run_pending (thread, &timeout)) {
+				sleep_usec = 50;
+				continue;
+			}
+
+			/* The pop already waited, unless our queue has closed */
+			if (!iris_queue_is_closed (thread->active))
+				continue;
 		}
-		g_mutex_unlock (priv->mutex);
+
+		/* Nothing to help with, or not allowed to; back off so we don't
+		 * spin on @predicate.
+		 */
+		g_usleep (sleep_usec);
+		sleep_usec = MIN (sleep_usec * 2, RUN_UNTIL_MAX_SLEEP);
 	}
 
-	IRIS_SCHEDULER_GET_CLASS (scheduler)->queue (scheduler, func, data, destroy_notify);
+	if (help)
+		thread->run_depth--;
 }
 
 /**
@@ -597,8 +1751,10 @@ iris_scheduler_queue (IrisScheduler  *scheduler,
  * returns, but may already be in progress, in which case it is up to the
  * caller to wait for it to finish.
  *
- * This function guarantees that the work item will be freed (including calling
- * its destroy notify) but this might not occur immediately.
+ * Unqueueing takes constant time. If it succeeds the destroy notify of the
+ * work is called straight away, or when the #IrisSchedulerForeachFunc returns
+ * if called from inside iris_scheduler_foreach(). The rest of the work item
+ * is freed once its thread has dropped it from its queue.
  *
  * Return value: %TRUE if the attempt to unqueue was successful, %FALSE if the
  *               work ran or is still running.
@@ -630,6 +1786,11 @@ iris_scheduler_unqueue (IrisScheduler  *scheduler,
  *
  * The return value of @callback should be %FALSE to stop the foreach or %TRUE
  * to continue execution.
+ *
+ * The work queued by each thread is visited in the order it was queued,
+ * without taking it out of the scheduler's queues, so the threads carry on
+ * working meanwhile. Work that starts running during the foreach is
+ * skipped.
  */
 void iris_scheduler_foreach (IrisScheduler            *scheduler,
                              IrisSchedulerForeachFunc  callback,
@@ -684,6 +1845,121 @@ iris_scheduler_get_min_threads (IrisScheduler *scheduler)
 	return IRIS_SCHEDULER_GET_CLASS (scheduler)->get_min_threads (scheduler);
 }
 
+/**
+ * iris_scheduler_get_blocked_threads:
+ * @scheduler: An #IrisScheduler
+ *
+ * Retrieves how many threads of @scheduler are inside a blocking region
+ * right now. See iris_thread_enter_blocking().
+ *
+ * Return value: the number of blocked threads
+ */
+guint
+iris_scheduler_get_blocked_threads (IrisScheduler *scheduler)
+{
+	g_return_val_if_fail (IRIS_IS_SCHEDULER (scheduler), 0);
+
+	return g_atomic_int_get (&scheduler->priv->n_blocked);
+}
+
+/**
+ * iris_scheduler_get_lent_threads:
+ * @scheduler: An #IrisScheduler
+ *
+ * Retrieves how many threads the scheduler manager has lent to @scheduler
+ * to stand in for its blocked threads. This can be less than the number of
+ * blocked threads if the manager's thread limit was reached, and stays
+ * above it briefly while lent threads finish their last work item.
+ *
+ * Return value: the number of lent threads
+ */
+guint
+iris_scheduler_get_lent_threads (IrisScheduler *scheduler)
+{
+	g_return_val_if_fail (IRIS_IS_SCHEDULER (scheduler), 0);
+
+	return g_atomic_int_get (&scheduler->priv->n_lent);
+}
+
+/**
+ * iris_scheduler_get_stats:
+ * @scheduler: An #IrisScheduler
+ * @stats: A location for the counters
+ *
+ * Adds up the counters kept by each thread of @scheduler into @stats. The
+ * threads carry on working while they are read, so the counters are not
+ * taken at quite the same moment, and will not match exactly.
+ *
+ * Threads only ever write to counters of their own, so counting costs
+ * little enough to be always on.
+ */
+void
+iris_scheduler_get_stats (IrisScheduler      *scheduler,
+                          IrisSchedulerStats *stats)
+{
+	IrisThreadStats *thread_stats;
+
+	g_return_if_fail (IRIS_IS_SCHEDULER (scheduler));
+	g_return_if_fail (stats != NULL);
+
+	memset (stats, 0, sizeof (IrisSchedulerStats));
+
+	thread_stats = g_atomic_pointer_get (&scheduler->priv->stats_list);
+
+	for (; thread_stats; thread_stats = thread_stats->next) {
+		if (g_atomic_pointer_get (&thread_stats->owner) != NULL)
+			stats->n_threads ++;
+
+		stats->executed += thread_stats->executed;
+		stats->stolen += thread_stats->stolen;
+		stats->stolen_from += g_atomic_int_get (&thread_stats->stolen_from);
+		stats->failed_steals += thread_stats->failed_steals;
+		stats->wakeups += thread_stats->wakeups;
+		stats->busy_usec += thread_stats->busy_usec;
+		stats->idle_usec += thread_stats->idle_usec;
+		stats->queue_high_water = MAX (stats->queue_high_water,
+		                               thread_stats->high_water);
+	}
+}
+
+/*
+ * iris_scheduler_claim_stats:
+ * @scheduler: An #IrisScheduler
+ * @thread: the calling #IrisThread
+ *
+ * Finds a block of counters for @thread to use while it works for
+ * @scheduler, which it gives back by setting its owner to %NULL before it
+ * stops working for @scheduler.
+ *
+ * Return value: the counters, which belong to @scheduler
+ */
+IrisThreadStats*
+iris_scheduler_claim_stats (IrisScheduler *scheduler,
+                            IrisThread    *thread)
+{
+	IrisSchedulerPrivate *priv;
+	IrisThreadStats      *stats;
+
+	priv = scheduler->priv;
+
+	/* Blocks are never removed from the list, so it can be walked freely */
+	for (stats = g_atomic_pointer_get (&priv->stats_list); stats; stats = stats->next)
+		if (g_atomic_pointer_get (&stats->owner) == NULL &&
+		    g_atomic_pointer_compare_and_exchange ((gpointer*)&stats->owner,
+		                                           NULL, thread))
+			return stats;
+
+	stats = g_new0 (IrisThreadStats, 1);
+	stats->owner = thread;
+
+	do {
+		stats->next = g_atomic_pointer_get (&priv->stats_list);
+	} while (!g_atomic_pointer_compare_and_exchange ((gpointer*)&priv->stats_list,
+	                                                 stats->next, stats));
+
+	return stats;
+}
+
 /**
  * iris_scheduler_add_thread:
  * @scheduler: An #IrisScheduler
@@ -24,6 +24,8 @@
 #include <glib-object.h>
 
 #include "iris-queue.h"
+#include "iris-priority-queue.h"
+#include "iris-load-controller.h"
 
 G_BEGIN_DECLS
 
@@ -59,6 +61,16 @@ typedef struct _IrisSchedulerClass   IrisSchedulerClass;
 typedef struct _IrisSchedulerPrivate IrisSchedulerPrivate;
 typedef struct _IrisThread           IrisThread;
 typedef struct _IrisThreadWork       IrisThreadWork;
+typedef struct _IrisSchedulerBatchItem IrisSchedulerBatchItem;
+typedef struct _IrisSchedulerStats   IrisSchedulerStats;
+
+/**
+ * IrisTimeout:
+ *
+ * An opaque handle on work queued with iris_scheduler_queue_timeout() or
+ * iris_scheduler_queue_periodic(), which can be used to cancel it.
+ */
+typedef struct _IrisTimeout          IrisTimeout;
 
 /**
  * IrisCallback
@@ -68,6 +80,16 @@ typedef struct _IrisThreadWork       IrisThreadWork;
  */
 typedef void   (*IrisCallback)       (gpointer data);
 
+/**
+ * IrisSchedulerPredicate:
+ * @user_data: user data passed to iris_scheduler_run_until()
+ *
+ * Condition checked by iris_scheduler_run_until().
+ *
+ * Return value: %TRUE once the wait is over.
+ */
+typedef gboolean (*IrisSchedulerPredicate) (gpointer user_data);
+
 /**
  * IrisSchedulerForeachFunc:
  * @scheduler: the #IrisScheduler executing the foreach
@@ -81,6 +103,9 @@ typedef void   (*IrisCallback)       (gpointer data);
  * this function will be called for every piece of work in the scheduler's
  * queue, and it is up to the caller to filter for only their items using
  * the information in @callback and @data.
+ *
+ * The work item cannot start running while this function is looking at it,
+ * so @data is safe to inspect. @work_item is only valid until it returns.
  * 
  * Returns: %FALSE to abort the foreach, %TRUE to continue.
  */
@@ -90,6 +115,55 @@ typedef gboolean (*IrisSchedulerForeachFunc) (IrisScheduler *scheduler,
                                               gpointer data,
                                               gpointer user_data);
 
+/**
+ * IrisSchedulerBatchItem:
+ * @callback: An #IrisCallback
+ * @data: data for @callback
+ * @notify: an optional callback to free @data
+ *
+ * A single work item passed to iris_scheduler_queue_batch().
+ */
+struct _IrisSchedulerBatchItem
+{
+	IrisCallback   callback;
+	gpointer       data;
+	GDestroyNotify notify;
+};
+
+/**
+ * IrisSchedulerStats:
+ * @n_threads: the number of threads working for the scheduler right now
+ * @executed: work items run
+ * @stolen: work items a thread took from the queue of another
+ * @stolen_from: work items taken from the queues of the scheduler's threads
+ *   by other threads
+ * @failed_steals: times a thread trying to take an item from another
+ *   thread's queue lost the race for it to the owner or another thief.
+ *   Looking at a queue and finding it empty does not count.
+ * @wakeups: times a waiting thread was woken up to be given work
+ * @busy_usec: microseconds spent running work items
+ * @idle_usec: microseconds spent waiting for work items
+ * @queue_high_water: the longest any thread's queue has been seen. A
+ *   thread only samples the length of its queue once every 16 work items it
+ *   runs, not on every push, so this is a lower bound that can miss short
+ *   peaks.
+ *
+ * Counters of the work done by the threads of a scheduler, filled in by
+ * iris_scheduler_get_stats(). They cover the whole life of the scheduler.
+ */
+struct _IrisSchedulerStats
+{
+	guint   n_threads;
+	guint64 executed;
+	guint64 stolen;
+	guint64 stolen_from;
+	guint64 failed_steals;
+	guint64 wakeups;
+	guint64 busy_usec;
+	guint64 idle_usec;
+	guint   queue_high_water;
+};
+
 struct _IrisScheduler
 {
 	GObject parent;
@@ -111,6 +185,19 @@ struct _IrisSchedulerClass
 	                          IrisCallback    func,
 	                          gpointer        data,
 	                          GDestroyNotify  destroy_notify);
+	void     (*queue_full)   (IrisScheduler  *scheduler,
+	                          IrisCallback    func,
+	                          gpointer        data,
+	                          GDestroyNotify  destroy_notify,
+	                          IrisPriority    priority);
+	void     (*queue_batch)  (IrisScheduler                *scheduler,
+	                          const IrisSchedulerBatchItem *items,
+	                          guint                         n_items);
+	void     (*queue_affinity) (IrisScheduler  *scheduler,
+	                            gconstpointer   key,
+	                            IrisCallback    func,
+	                            gpointer        data,
+	                            GDestroyNotify  destroy_notify);
 	gboolean (*unqueue)      (IrisScheduler  *scheduler,
 	                          gpointer        work_item);
 	void     (*foreach)      (IrisScheduler            *scheduler,
@@ -125,6 +212,8 @@ struct _IrisSchedulerClass
 
 	/* Private */
 	void    (*iterate)       (IrisScheduler  *scheduler);
+
+	guint   (*get_global_length) (IrisScheduler *scheduler);
 };
 
 struct _IrisThread
@@ -148,7 +237,54 @@ struct _IrisThread
 	                                      * from an active scheduler   */
 	GMutex                  *mutex;      /* Mutex for changing thread  *
 	                                      * state. e.g. active queue.  */
-	IrisQueue               *active;     /* Active processing queue, or NULL if idle */
+	IrisQueue               *active;     /* Active processing queue, or *
+	                                      * NULL if idle. Only cleared *
+	                                      * with the scheduler manager *
+	                                      * locked.                    */
+
+	gint                     cpu;        /* CPU the scheduler manager   *
+	                                      * placed us on, or -1 for    *
+	                                      * any. Set with 'scheduler'. */
+	gint                     bound_cpu;  /* CPU the thread is actually *
+	                                      * bound to, -1 for none or   *
+	                                      * -2 if not yet set.         */
+
+	GList                   *free_link;  /* Our link in the scheduler  *
+	                                      * manager's free list, or    *
+	                                      * NULL if we are not idle.   */
+	GList                   *all_link;   /* Our link in the scheduler  *
+	                                      * manager's list of threads, *
+	                                      * or NULL once retired.      */
+
+	volatile guint           completed;  /* Work items run, for the    *
+	                                      * load controller.           */
+	guint                    sampled;    /* 'completed' at the last    *
+	                                      * load sample.               */
+	gulong                   stalled;    /* Usecs our queue has had    *
+	                                      * work but we finished none. */
+
+	struct _IrisThreadCache *cache;      /* Small object cache, or     *
+	                                      * NULL until first used.     */
+
+	guint                    run_depth;  /* Nested calls to            *
+	                                      * iris_scheduler_run_until() */
+
+	guint                    blocking;   /* Nested blocking regions    */
+	gboolean                 blocked;    /* Counted as blocked by our  *
+	                                      * scheduler.                 */
+	IrisThread              *stand_in;   /* Thread lent to work on our *
+	                                      * queue while we block.      */
+	IrisThread              *lent_to;    /* Thread we are standing in  *
+	                                      * for, or NULL.              */
+
+	struct _IrisThreadStats *stats;      /* Counters for the scheduler *
+	                                      * we are working for, or     *
+	                                      * NULL if idle.              */
+
+	gpointer                *batch;      /* Work popped from 'active'  *
+	                                      * in one go, not yet run.    */
+	guint                    batch_pos;
+	guint                    batch_len;
 };
 
 struct _IrisThreadWork
@@ -157,9 +293,26 @@ struct _IrisThreadWork
 	gpointer          data;
 	GDestroyNotify    notify;
 
-	/* FIXME: would be nice to make these flags, but need to stay atomic */
-	volatile gint     taken;
-	volatile gint     remove;
+	/* An IrisThreadWorkState. Whoever moves the work out of QUEUED decides
+	 * whether it runs, so it can be popped from a queue, unqueued or looked
+	 * at by a foreach without any lock.
+	 */
+	volatile gint     state;
+
+	/* Link in the work list of the scheduler that created us, if listed.
+	 * Listed work has two references, one for the work list and one for
+	 * whoever ends up finishing it, and is freed by the last to let go.
+	 * Work that was never listed has none and is freed when it finishes.
+	 */
+	IrisThreadWork   *next;
+	volatile gint     ref_count;
+
+	/* Block this item was allocated in by iris_thread_work_new_batch(),
+	 * or NULL if it was allocated on its own.
+	 */
+	gpointer          batch;
+
+	IrisPriority      priority;
 };
 
 IrisScheduler*  iris_get_default_control_scheduler (void);
@@ -173,16 +326,69 @@ GType           iris_scheduler_get_type        (void) G_GNUC_CONST;
 IrisScheduler*  iris_scheduler_new             (void);
 IrisScheduler*  iris_scheduler_new_full        (guint           min_threads,
                                                 guint           max_threads);
+IrisScheduler*  iris_scheduler_new_with_cpus   (guint           min_threads,
+                                                guint           max_threads,
+                                                const guint    *cpus,
+                                                guint           n_cpus);
+
+void            iris_scheduler_set_cpus        (IrisScheduler  *scheduler,
+                                                const guint    *cpus,
+                                                guint           n_cpus);
+const guint*    iris_scheduler_get_cpus        (IrisScheduler  *scheduler,
+                                                guint          *n_cpus);
 
 gint            iris_scheduler_get_min_threads (IrisScheduler  *scheduler);
 gint            iris_scheduler_get_max_threads (IrisScheduler  *scheduler);
+guint           iris_scheduler_get_blocked_threads (IrisScheduler *scheduler);
+guint           iris_scheduler_get_lent_threads    (IrisScheduler *scheduler);
+void            iris_scheduler_get_stats       (IrisScheduler      *scheduler,
+                                                IrisSchedulerStats *stats);
+
+void            iris_scheduler_set_share       (IrisScheduler  *scheduler,
+                                                guint           share);
+guint           iris_scheduler_get_share       (IrisScheduler  *scheduler);
+void            iris_scheduler_set_queue_capacity (IrisScheduler *scheduler,
+                                                   guint          capacity);
+guint           iris_scheduler_get_queue_capacity (IrisScheduler *scheduler);
+
+void            iris_scheduler_set_load_controller (IrisScheduler      *scheduler,
+                                                    IrisLoadController *controller);
+IrisLoadController*
+                iris_scheduler_get_load_controller (IrisScheduler      *scheduler);
 
 void            iris_scheduler_queue           (IrisScheduler  *scheduler,
                                                 IrisCallback    func,
                                                 gpointer        data,
                                                 GDestroyNotify  destroy_notify);
+void            iris_scheduler_queue_full      (IrisScheduler  *scheduler,
+                                                IrisCallback    func,
+                                                gpointer        data,
+                                                GDestroyNotify  destroy_notify,
+                                                IrisPriority    priority);
+void            iris_scheduler_queue_batch     (IrisScheduler                *scheduler,
+                                                const IrisSchedulerBatchItem *items,
+                                                guint                         n_items);
+void            iris_scheduler_queue_with_affinity
+                                               (IrisScheduler  *scheduler,
+                                                gconstpointer   key,
+                                                IrisCallback    func,
+                                                gpointer        data,
+                                                GDestroyNotify  destroy_notify);
+IrisTimeout*    iris_scheduler_queue_timeout   (IrisScheduler  *scheduler,
+                                                IrisCallback    func,
+                                                gpointer        data,
+                                                GDestroyNotify  destroy_notify,
+                                                guint           msec);
+IrisTimeout*    iris_scheduler_queue_periodic  (IrisScheduler  *scheduler,
+                                                IrisCallback    func,
+                                                gpointer        data,
+                                                GDestroyNotify  destroy_notify,
+                                                guint           msec);
 gboolean        iris_scheduler_unqueue         (IrisScheduler  *scheduler,
                                                 gpointer        work_item);
+void            iris_scheduler_run_until       (IrisScheduler          *scheduler,
+                                                IrisSchedulerPredicate  predicate,
+                                                gpointer                user_data);
 void            iris_scheduler_foreach         (IrisScheduler            *scheduler,
                                                 IrisSchedulerForeachFunc  callback,
                                                 gpointer                  user_data);
@@ -201,15 +407,23 @@ void            iris_thread_manage             (IrisThread *thread,
                                                 gboolean    exclusive,
                                                 gboolean    leader);
 void            iris_thread_shutdown           (IrisThread *thread);
+void            iris_thread_enter_blocking     (void);
+void            iris_thread_leave_blocking     (void);
 void            iris_thread_print_stat         (IrisThread *thread);
 IrisThreadWork* iris_thread_work_new           (IrisCallback    callback,
                                                 gpointer        data,
                                                 GDestroyNotify  destroy_notify);
+IrisThreadWork** iris_thread_work_new_batch    (const IrisSchedulerBatchItem *items,
+                                                guint                         n_items);
 void            iris_thread_work_free          (IrisThreadWork *thread_work);
 void            iris_thread_work_run           (IrisThreadWork *thread_work);
 
 guint           iris_scheduler_get_n_cpu       ();
 
+gboolean        iris_timeout_cancel            (IrisTimeout    *timeout);
+IrisTimeout*    iris_timeout_ref               (IrisTimeout    *timeout);
+void            iris_timeout_unref             (IrisTimeout    *timeout);
+
 G_END_DECLS
 
 #endif /* __IRIS_SCHEDULER_H__ */
@@ -0,0 +1,81 @@
+/* iris-spsc-queue-private.h
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __IRIS_SPSC_QUEUE_PRIVATE_H__
+#define __IRIS_SPSC_QUEUE_PRIVATE_H__
+
+#include <glib.h>
+
+#include "iris-spsc-queue.h"
+#include "iris-util.h"
+
+G_BEGIN_DECLS
+
+/* Number of items in each segment of the queue */
+#define IRIS_SPSC_SEGMENT_SIZE 64
+
+typedef struct _IrisSPSCSegment IrisSPSCSegment;
+
+struct _IrisSPSCSegment
+{
+	IrisSPSCSegment * volatile next;
+	gpointer                   items[IRIS_SPSC_SEGMENT_SIZE];
+};
+
+struct _IrisSPSCQueuePrivate
+{
+	/* Only the consumer touches these, apart from 'popped' which
+	 * get_length() reads.
+	 */
+	IrisSPSCSegment           *head;
+	guint                      head_index;
+	volatile gint              popped;
+
+	gchar                      pad1[IRIS_CACHE_LINE_SIZE];
+
+	/* Only the producer touches these, apart from 'pushed' which the
+	 * consumer reads to see how many items it may take.
+	 */
+	IrisSPSCSegment           *tail;
+	guint                      tail_index;
+	volatile gint              pushed;
+	volatile gint              pushing;     /* So close() can wait for a push */
+
+	gchar                      pad2[IRIS_CACHE_LINE_SIZE];
+
+	/* The last segment the consumer finished with, for the producer to
+	 * reuse. Only the consumer sets it and only the producer clears it.
+	 */
+	IrisSPSCSegment * volatile spare;
+
+	volatile gint              open;
+
+	/* Eventcount for a consumer waiting for an item, as in
+	 * #IrisRingQueue.
+	 */
+	volatile gint              waiters;
+	volatile gint              wait_seq;
+	GMutex                    *wait_mutex;  /* Only used where there is no futex */
+	GCond                     *wait_cond;
+};
+
+G_END_DECLS
+
+#endif /* __IRIS_SPSC_QUEUE_PRIVATE_H__ */
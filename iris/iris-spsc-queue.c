@@ -0,0 +1,555 @@
+/* iris-spsc-queue.c
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#include "iris-spsc-queue.h"
+#include "iris-spsc-queue-private.h"
+#include "iris-util.h"
+
+/**
+ * SECTION:iris-spsc-queue
+ * @title: IrisSPSCQueue
+ * @short_description: A wait-free queue for one producer and one consumer
+ * @see_also: #IrisQueue, #IrisLFQueue, #IrisRingQueue
+ *
+ * #IrisSPSCQueue is an unbounded queue for the common case where items
+ * are passed from exactly one thread to exactly one other, such as between
+ * the stages of a chain of #IrisProcess objects. Only one thread may push
+ * at a time and only one may pop at a time, but the two may run at once.
+ * iris_queue_close(), iris_queue_get_length() and iris_queue_is_closed()
+ * may be called from any thread, while iris_queue_try_pop_or_close() and
+ * iris_queue_timed_pop_or_close() count as pops.
+ *
+ * Items are stored in a list of fixed-size segments. Since each end of the
+ * queue only has one thread working on it there is nothing to contend for:
+ * a pop never writes anything the producer reads, and neither a push nor a
+ * pop ever has to retry. The consumer hands back the last segment it
+ * emptied, so a queue that keeps up with its producer does not allocate.
+ *
+ * The blocking pops spin for a short while, then yield, and finally sleep
+ * until an item is pushed. The producer only pays for a wake-up when the
+ * consumer is actually sleeping.
+ */
+
+/* Number of times a blocking pop retries before yielding the CPU, and then
+ * the number of times it yields before going to sleep.
+ */
+#define SPSC_QUEUE_SPIN_COUNT  64
+#define SPSC_QUEUE_YIELD_COUNT 4
+
+/* The counts wrap around, so they are compared by their signed distance */
+#define COUNT_DIFF(a,b) ((gint)((guint)(a) - (guint)(b)))
+#define COUNT_ADD(a,n)  ((gint)((guint)(a) + (guint)(n)))
+
+G_DEFINE_TYPE (IrisSPSCQueue, iris_spsc_queue, IRIS_TYPE_QUEUE)
+
+static gboolean iris_spsc_queue_real_push               (IrisQueue *queue,
+                                                         gpointer   data);
+static guint    iris_spsc_queue_real_push_many          (IrisQueue *queue,
+                                                         gpointer  *items,
+                                                         guint      n_items);
+static gpointer iris_spsc_queue_real_pop                (IrisQueue *queue);
+static gpointer iris_spsc_queue_real_try_pop            (IrisQueue *queue);
+static guint    iris_spsc_queue_real_try_pop_many       (IrisQueue *queue,
+                                                         gpointer  *items,
+                                                         guint      max_items);
+static gpointer iris_spsc_queue_real_timed_pop          (IrisQueue *queue,
+                                                         GTimeVal  *timeout);
+static gpointer iris_spsc_queue_real_try_pop_or_close   (IrisQueue *queue);
+static gpointer iris_spsc_queue_real_timed_pop_or_close (IrisQueue *queue,
+                                                         GTimeVal  *timeout);
+static void     iris_spsc_queue_real_close              (IrisQueue *queue);
+static guint    iris_spsc_queue_real_get_length         (IrisQueue *queue);
+static gboolean iris_spsc_queue_real_is_closed          (IrisQueue *queue);
+
+static void
+iris_spsc_queue_finalize (GObject *object)
+{
+	IrisSPSCQueuePrivate *priv;
+	IrisSPSCSegment      *segment,
+	                     *next;
+
+	priv = IRIS_SPSC_QUEUE (object)->priv;
+
+	for (segment = priv->head; segment != NULL; segment = next) {
+		next = segment->next;
+		g_slice_free (IrisSPSCSegment, segment);
+	}
+
+	if (priv->spare != NULL)
+		g_slice_free (IrisSPSCSegment, priv->spare);
+
+#ifndef LINUX
+	g_mutex_free (priv->wait_mutex);
+	g_cond_free (priv->wait_cond);
+#endif
+
+	G_OBJECT_CLASS (iris_spsc_queue_parent_class)->finalize (object);
+}
+
+static void
+iris_spsc_queue_class_init (IrisSPSCQueueClass *klass)
+{
+	GObjectClass   *object_class;
+	IrisQueueClass *queue_class;
+
+	object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = iris_spsc_queue_finalize;
+
+	g_type_class_add_private (object_class, sizeof (IrisSPSCQueuePrivate));
+
+	queue_class = IRIS_QUEUE_CLASS (klass);
+	queue_class->push = iris_spsc_queue_real_push;
+	queue_class->push_many = iris_spsc_queue_real_push_many;
+	queue_class->pop = iris_spsc_queue_real_pop;
+	queue_class->try_pop = iris_spsc_queue_real_try_pop;
+	queue_class->try_pop_many = iris_spsc_queue_real_try_pop_many;
+	queue_class->timed_pop = iris_spsc_queue_real_timed_pop;
+	queue_class->try_pop_or_close = iris_spsc_queue_real_try_pop_or_close;
+	queue_class->timed_pop_or_close = iris_spsc_queue_real_timed_pop_or_close;
+	queue_class->close = iris_spsc_queue_real_close;
+	queue_class->get_length = iris_spsc_queue_real_get_length;
+	queue_class->is_closed = iris_spsc_queue_real_is_closed;
+}
+
+static void
+iris_spsc_queue_init (IrisSPSCQueue *queue)
+{
+	IrisSPSCQueuePrivate *priv;
+
+	priv = queue->priv = G_TYPE_INSTANCE_GET_PRIVATE (queue,
+	                                                  IRIS_TYPE_SPSC_QUEUE,
+	                                                  IrisSPSCQueuePrivate);
+
+	/* Both ends start in the same empty segment */
+	priv->head = g_slice_new (IrisSPSCSegment);
+	priv->head->next = NULL;
+	priv->head_index = 0;
+	priv->popped = 0;
+
+	priv->tail = priv->head;
+	priv->tail_index = 0;
+	priv->pushed = 0;
+	priv->pushing = FALSE;
+
+	priv->spare = NULL;
+
+	priv->open = TRUE;
+
+	priv->waiters = 0;
+	priv->wait_seq = 0;
+
+#ifdef LINUX
+	priv->wait_mutex = NULL;
+	priv->wait_cond = NULL;
+#else
+	priv->wait_mutex = g_mutex_new ();
+	priv->wait_cond = g_cond_new ();
+#endif
+}
+
+/**
+ * iris_spsc_queue_new:
+ *
+ * Creates a new #IrisSPSCQueue. Only one thread may push to it at a time,
+ * and only one thread may pop from it at a time.
+ *
+ * Return value: the newly created #IrisSPSCQueue.
+ */
+IrisQueue*
+iris_spsc_queue_new (void)
+{
+	return g_object_new (IRIS_TYPE_SPSC_QUEUE, NULL);
+}
+
+/* Sleep until wait_seq moves on from @seq, or @usec microseconds pass if
+ * @usec is not negative.
+ */
+static void
+iris_spsc_queue_wait (IrisSPSCQueuePrivate *priv,
+                      gint                  seq,
+                      glong                 usec)
+{
+#ifdef LINUX
+	iris_futex_wait (&priv->wait_seq, seq, usec);
+#else
+	GTimeVal tv;
+
+	g_mutex_lock (priv->wait_mutex);
+
+	if (usec >= 0) {
+		g_get_current_time (&tv);
+		g_time_val_add (&tv, usec);
+	}
+
+	if (g_atomic_int_get (&priv->wait_seq) == seq) {
+		if (usec >= 0)
+			g_cond_timed_wait (priv->wait_cond, priv->wait_mutex, &tv);
+		else
+			g_cond_wait (priv->wait_cond, priv->wait_mutex);
+	}
+
+	g_mutex_unlock (priv->wait_mutex);
+#endif
+}
+
+/* Wakes the consumer. Everybody is woken, because a queue being closed may
+ * have more than one thread looking at it.
+ */
+static void
+iris_spsc_queue_wake (IrisSPSCQueuePrivate *priv)
+{
+#ifdef LINUX
+	g_atomic_int_inc (&priv->wait_seq);
+	iris_futex_wake (&priv->wait_seq, G_MAXINT);
+#else
+	g_mutex_lock (priv->wait_mutex);
+	g_atomic_int_inc (&priv->wait_seq);
+	g_cond_broadcast (priv->wait_cond);
+	g_mutex_unlock (priv->wait_mutex);
+#endif
+}
+
+/* Wakes the consumer if it is sleeping. The compare-and-exchange is a full
+ * barrier, so either the consumer sees the count we just published when it
+ * rechecks the queue, or we see it registered here.
+ */
+static inline void
+iris_spsc_queue_wake_waiters (IrisSPSCQueuePrivate *priv)
+{
+	if (G_UNLIKELY (!g_atomic_int_compare_and_exchange (&priv->waiters, 0, 0)))
+		iris_spsc_queue_wake (priv);
+}
+
+/* Producer only: stores @data at the tail, moving on to a new segment if
+ * the current one is full. The item is not visible to the consumer until
+ * 'pushed' is updated.
+ */
+static inline void
+iris_spsc_queue_store (IrisSPSCQueuePrivate *priv,
+                       gpointer              data)
+{
+	IrisSPSCSegment *segment;
+
+	if (G_UNLIKELY (priv->tail_index == IRIS_SPSC_SEGMENT_SIZE)) {
+		segment = g_atomic_pointer_get (&priv->spare);
+
+		if (segment != NULL)
+			g_atomic_pointer_set (&priv->spare, NULL);
+		else
+			segment = g_slice_new (IrisSPSCSegment);
+
+		segment->next = NULL;
+		g_atomic_pointer_set (&priv->tail->next, segment);
+
+		priv->tail = segment;
+		priv->tail_index = 0;
+	}
+
+	priv->tail->items[priv->tail_index++] = data;
+}
+
+/* Consumer only: takes the item at the head, which must have been
+ * published. A segment that has been emptied is handed back to the
+ * producer if it has no spare one already.
+ */
+static inline gpointer
+iris_spsc_queue_take (IrisSPSCQueuePrivate *priv)
+{
+	IrisSPSCSegment *segment;
+
+	if (G_UNLIKELY (priv->head_index == IRIS_SPSC_SEGMENT_SIZE)) {
+		/* The producer linked the next segment before publishing the item
+		 * we are about to take, and will never look at this one again.
+		 */
+		segment = priv->head;
+		priv->head = g_atomic_pointer_get (&segment->next);
+		priv->head_index = 0;
+
+		if (g_atomic_pointer_get (&priv->spare) == NULL)
+			g_atomic_pointer_set (&priv->spare, segment);
+		else
+			g_slice_free (IrisSPSCSegment, segment);
+	}
+
+	return priv->head->items[priv->head_index++];
+}
+
+/* Pushes @n_items items if the queue is open, and publishes them all at
+ * once. Registering as pushing before checking 'open' lets close() wait
+ * for us to land, so an item can never arrive after a queue closed empty.
+ */
+static gboolean
+iris_spsc_queue_push_once (IrisSPSCQueuePrivate *priv,
+                           gpointer             *items,
+                           guint                 n_items)
+{
+	guint i;
+
+	/* Only we write 'pushing', so this always succeeds, but unlike a plain
+	 * store it keeps the load of 'open' from being done before it.
+	 */
+	g_atomic_int_compare_and_exchange (&priv->pushing, FALSE, TRUE);
+
+	if (G_UNLIKELY (!g_atomic_int_get (&priv->open))) {
+		g_atomic_int_set (&priv->pushing, FALSE);
+		return FALSE;
+	}
+
+	for (i = 0; i < n_items; i++)
+		iris_spsc_queue_store (priv, items[i]);
+
+	g_atomic_int_set (&priv->pushed, COUNT_ADD (priv->pushed, n_items));
+	g_atomic_int_set (&priv->pushing, FALSE);
+
+	iris_spsc_queue_wake_waiters (priv);
+
+	return TRUE;
+}
+
+/* Takes up to @max_items items, and returns how many it took */
+static guint
+iris_spsc_queue_pop_once (IrisSPSCQueuePrivate *priv,
+                          gpointer             *items,
+                          guint                 max_items)
+{
+	guint n_items,
+	      i;
+
+	n_items = COUNT_DIFF (g_atomic_int_get (&priv->pushed), priv->popped);
+	n_items = MIN (n_items, max_items);
+
+	for (i = 0; i < n_items; i++)
+		items[i] = iris_spsc_queue_take (priv);
+
+	/* Only get_length() reads this, so it need not be published before we
+	 * look at the items.
+	 */
+	if (n_items > 0)
+		g_atomic_int_set (&priv->popped, COUNT_ADD (priv->popped, n_items));
+
+	return n_items;
+}
+
+/* Pops an item, sleeping until one is pushed, the queue is closed or
+ * @timeout passes. A %NULL @timeout waits for ever.
+ */
+static gpointer
+iris_spsc_queue_wait_pop (IrisSPSCQueue *queue,
+                          GTimeVal      *timeout)
+{
+	IrisSPSCQueuePrivate *priv;
+	gpointer              item = NULL;
+	gint                  spin_count = 0;
+	gint                  seq;
+	glong                 usec = -1;
+	guint                 n_items;
+
+	priv = queue->priv;
+
+	while (!(n_items = iris_spsc_queue_pop_once (priv, &item, 1))) {
+		/* Once closed no more items can arrive, so whatever is left is
+		 * all there is.
+		 */
+		if (!g_atomic_int_get (&priv->open)) {
+			iris_spsc_queue_pop_once (priv, &item, 1);
+			return item;
+		}
+
+		if (timeout != NULL) {
+			usec = g_time_val_usec_until (timeout);
+			if (usec <= 0)
+				return NULL;
+		}
+
+		if (spin_count < SPSC_QUEUE_SPIN_COUNT + SPSC_QUEUE_YIELD_COUNT) {
+			if (spin_count >= SPSC_QUEUE_SPIN_COUNT)
+				g_thread_yield ();
+			spin_count++;
+			continue;
+		}
+
+		/* Register before the final try, so a push cannot land between
+		 * the try and the sleep without waking us.
+		 */
+		g_atomic_int_inc (&priv->waiters);
+		seq = g_atomic_int_get (&priv->wait_seq);
+
+		if (!(n_items = iris_spsc_queue_pop_once (priv, &item, 1)) &&
+		    g_atomic_int_get (&priv->open))
+			iris_spsc_queue_wait (priv, seq, usec);
+
+		g_atomic_int_add (&priv->waiters, -1);
+
+		if (n_items)
+			break;
+	}
+
+	return item;
+}
+
+/* Closes the queue if @item is %NULL. Any item that landed while we were
+ * closing is returned, but the queue stays closed: another thread may
+ * already have seen it closed, so reopening it is not safe. Whatever is
+ * still queued can be popped from a closed queue, so nothing is lost.
+ */
+static gpointer
+iris_spsc_queue_close_if_empty (IrisQueue *queue,
+                                gpointer   item)
+{
+	IrisSPSCQueuePrivate *priv;
+
+	if (item != NULL)
+		return item;
+
+	priv = IRIS_SPSC_QUEUE (queue)->priv;
+
+	if (!g_atomic_int_compare_and_exchange (&priv->open, TRUE, FALSE)) {
+		iris_spsc_queue_pop_once (priv, &item, 1);
+		return item;
+	}
+
+	iris_spsc_queue_real_close (queue);
+
+	iris_spsc_queue_pop_once (priv, &item, 1);
+	return item;
+}
+
+static gboolean
+iris_spsc_queue_real_push (IrisQueue *queue,
+                           gpointer   data)
+{
+	g_return_val_if_fail (data != NULL, FALSE);
+
+	return iris_spsc_queue_push_once (IRIS_SPSC_QUEUE (queue)->priv, &data, 1);
+}
+
+static guint
+iris_spsc_queue_real_push_many (IrisQueue *queue,
+                                gpointer  *items,
+                                guint      n_items)
+{
+	g_return_val_if_fail (items != NULL || n_items == 0, 0);
+
+	if (n_items == 0)
+		return 0;
+
+	if (!iris_spsc_queue_push_once (IRIS_SPSC_QUEUE (queue)->priv, items, n_items))
+		return 0;
+
+	return n_items;
+}
+
+static gpointer
+iris_spsc_queue_real_pop (IrisQueue *queue)
+{
+	return iris_spsc_queue_wait_pop (IRIS_SPSC_QUEUE (queue), NULL);
+}
+
+static gpointer
+iris_spsc_queue_real_try_pop (IrisQueue *queue)
+{
+	gpointer item = NULL;
+
+	iris_spsc_queue_pop_once (IRIS_SPSC_QUEUE (queue)->priv, &item, 1);
+
+	return item;
+}
+
+static guint
+iris_spsc_queue_real_try_pop_many (IrisQueue *queue,
+                                   gpointer  *items,
+                                   guint      max_items)
+{
+	g_return_val_if_fail (items != NULL || max_items == 0, 0);
+
+	return iris_spsc_queue_pop_once (IRIS_SPSC_QUEUE (queue)->priv,
+	                                 items, max_items);
+}
+
+static gpointer
+iris_spsc_queue_real_timed_pop (IrisQueue *queue,
+                                GTimeVal  *timeout)
+{
+	g_return_val_if_fail (timeout != NULL, NULL);
+
+	return iris_spsc_queue_wait_pop (IRIS_SPSC_QUEUE (queue), timeout);
+}
+
+static gpointer
+iris_spsc_queue_real_try_pop_or_close (IrisQueue *queue)
+{
+	gpointer item;
+
+	item = iris_spsc_queue_real_try_pop (queue);
+
+	return iris_spsc_queue_close_if_empty (queue, item);
+}
+
+static gpointer
+iris_spsc_queue_real_timed_pop_or_close (IrisQueue *queue,
+                                         GTimeVal  *timeout)
+{
+	gpointer item;
+
+	g_return_val_if_fail (timeout != NULL, NULL);
+
+	item = iris_spsc_queue_wait_pop (IRIS_SPSC_QUEUE (queue), timeout);
+
+	return iris_spsc_queue_close_if_empty (queue, item);
+}
+
+static void
+iris_spsc_queue_real_close (IrisQueue *queue)
+{
+	IrisSPSCQueuePrivate *priv;
+
+	priv = IRIS_SPSC_QUEUE (queue)->priv;
+
+	g_atomic_int_compare_and_exchange (&priv->open, TRUE, FALSE);
+
+	/* Let a push that saw the queue open finish landing */
+	while (g_atomic_int_get (&priv->pushing))
+		g_thread_yield ();
+
+	iris_spsc_queue_wake (priv);
+}
+
+static guint
+iris_spsc_queue_real_get_length (IrisQueue *queue)
+{
+	IrisSPSCQueuePrivate *priv;
+	gint                  length;
+
+	priv = IRIS_SPSC_QUEUE (queue)->priv;
+
+	/* Read the head first, so a pop in between makes us high rather than
+	 * negative.
+	 */
+	length = g_atomic_int_get (&priv->popped);
+	length = COUNT_DIFF (g_atomic_int_get (&priv->pushed), length);
+
+	return MAX (length, 0);
+}
+
+static gboolean
+iris_spsc_queue_real_is_closed (IrisQueue *queue)
+{
+	return !g_atomic_int_get (&IRIS_SPSC_QUEUE (queue)->priv->open);
+}
@@ -0,0 +1,58 @@
+/* iris-spsc-queue.h
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __IRIS_SPSC_QUEUE_H__
+#define __IRIS_SPSC_QUEUE_H__
+
+#include "iris-queue.h"
+
+G_BEGIN_DECLS
+
+#define IRIS_TYPE_SPSC_QUEUE            (iris_spsc_queue_get_type ())
+#define IRIS_SPSC_QUEUE(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), IRIS_TYPE_SPSC_QUEUE, IrisSPSCQueue))
+#define IRIS_SPSC_QUEUE_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), IRIS_TYPE_SPSC_QUEUE, IrisSPSCQueue const))
+#define IRIS_SPSC_QUEUE_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  IRIS_TYPE_SPSC_QUEUE, IrisSPSCQueueClass))
+#define IRIS_IS_SPSC_QUEUE(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), IRIS_TYPE_SPSC_QUEUE))
+#define IRIS_IS_SPSC_QUEUE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  IRIS_TYPE_SPSC_QUEUE))
+#define IRIS_SPSC_QUEUE_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  IRIS_TYPE_SPSC_QUEUE, IrisSPSCQueueClass))
+
+typedef struct _IrisSPSCQueue        IrisSPSCQueue;
+typedef struct _IrisSPSCQueueClass   IrisSPSCQueueClass;
+typedef struct _IrisSPSCQueuePrivate IrisSPSCQueuePrivate;
+
+struct _IrisSPSCQueue
+{
+	IrisQueue parent;
+
+	/*< private >*/
+	IrisSPSCQueuePrivate *priv;
+};
+
+struct _IrisSPSCQueueClass
+{
+	IrisQueueClass parent_class;
+};
+
+GType      iris_spsc_queue_get_type (void) G_GNUC_CONST;
+IrisQueue* iris_spsc_queue_new      (void);
+
+G_END_DECLS
+
+#endif /* __IRIS_SPSC_QUEUE_H__ */
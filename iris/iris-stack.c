@@ -20,28 +20,24 @@
 
 #include "iris-stack.h"
 #include "iris-stack-private.h"
-#include "gstamppointer.h"
+#include "iris-epoch.h"
 
 /**
  * SECTION:iris-stack
  * @title: IrisStack
  * @short_description: A lock-free stack
  *
- * #IrisStack is a lock-free stack implementation.  It is not currently
- * guaranteed to be fully correct.  This is due to the classical ABA
- * problem with many lock-free data structures.  For more information
- * on ABA, see the wikipedia page at
- * <ulink url="http://en.wikipedia.org/wiki/ABA_problem">ABA_problem</ulink>.
+ * #IrisStack is a lock-free stack implementation.
  *
- * We do try to greatly reduce the potential of this happening.  This is done
- * by aligning the destination of our internal pointers to sizeof(void*)
- * which leaves us the two lower bits to repurpose as a counter stamp.  This
- * makes the pointer different on every compare-and-swap operation allowing
- * us to fail and retry the operation.  As you might have guessed, if the
- * ABA problem happens 4 times within the pre-emption time of the first
- * thread, the problem can still exist.
+ * Lock-free stacks are prone to the classical ABA problem: a pop that is
+ * preempted between reading the top link and swapping it out could succeed
+ * against the same link after it has been popped, reused and pushed again.
+ * For more information on ABA, see the wikipedia page at
+ * <ulink url="http://en.wikipedia.org/wiki/ABA_problem">ABA_problem</ulink>.
  *
- * You can typically solve this with an indirection node.
+ * #IrisStack avoids it by doing its pops inside an epoch section, and by
+ * only reusing popped links once every pop that might have seen them has
+ * finished. See #IrisFreeList.
  */
 
 static void iris_stack_free (IrisStack *stack);
@@ -133,14 +129,12 @@ iris_stack_push (IrisStack *stack,
 	g_return_if_fail (stack != NULL);
 
 	link = iris_free_list_get (stack->free_list);
-
-	link = G_STAMP_POINTER_INCREMENT (link);
-	G_STAMP_POINTER_GET_LINK (link)->data = data;
+	link->data = data;
 
 	do {
-		G_STAMP_POINTER_GET_LINK (link)->next = stack->head->next;
+		link->next = stack->head->next;
 	} while (!g_atomic_pointer_compare_and_exchange ((gpointer*)&stack->head->next,
-	                                                 G_STAMP_POINTER_GET_LINK (link)->next,
+	                                                 link->next,
 	                                                 link));
 }
 
@@ -161,15 +155,22 @@ iris_stack_pop (IrisStack *stack)
 
 	g_return_val_if_fail (stack != NULL, NULL);
 
+	/* link->next is only safe to follow while the link cannot be reused */
+	iris_epoch_enter ();
+
 	do {
 		link = stack->head->next;
-		if (link == NULL)
+		if (link == NULL) {
+			iris_epoch_leave ();
 			return NULL;
+		}
 	} while (!g_atomic_pointer_compare_and_exchange ((gpointer*)&stack->head->next,
 	                                                 link,
-	                                                 G_STAMP_POINTER_GET_LINK (link)->next));
+	                                                 link->next));
+
+	iris_epoch_leave ();
 
-	result = G_STAMP_POINTER_GET_LINK (link)->data;
+	result = link->data;
 	iris_free_list_put (stack->free_list, link);
 
 	return result;
@@ -187,12 +188,9 @@ _try_swap:
 	if (!g_atomic_pointer_compare_and_exchange ((gpointer*)&stack->head, link, NULL))
 		goto _try_swap;
 
-	link = G_STAMP_POINTER_GET_POINTER (link);
-
 	while (link) {
-		tmp = G_STAMP_POINTER_GET_POINTER (link->next);
-		if (link)
-			g_slice_free (IrisLink, link);
+		tmp = link->next;
+		g_slice_free (IrisLink, link);
 		link = tmp;
 	}
 
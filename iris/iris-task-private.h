@@ -77,6 +77,12 @@ typedef struct
 	GClosure *errback;
 } IrisTaskHandler;
 
+typedef struct
+{
+	IrisCallback  callback;
+	gpointer      data;
+} IrisTaskWaiter;
+
 struct _IrisTaskPrivate
 {
 	IrisPort      *port;          /* Message delivery port */
@@ -95,6 +101,10 @@ struct _IrisTaskPrivate
 	                               */
 	GList         *dependencies;  /* Tasks we are depending on. */
 	GList         *observers;     /* Tasks observing our state changes */
+	GList         *waiters;       /* IrisTaskWaiters to call when we
+	                               * finish, guarded by 'mutex'.
+	                               */
+	gboolean       waiters_woken; /* Set once 'waiters' have been called */
 
 	volatile gint  flags;
 	volatile gint  cancel_finished;  /* This can become a normal flag when
@@ -118,5 +128,6 @@ struct _IrisTaskPrivate
 void iris_task_remove_dependency_sync (IrisTask *task, IrisTask *dep);
 void iris_task_progress_callbacks (IrisTask *task);
 void iris_task_notify_observers (IrisTask *task);
+gboolean iris_task_add_waiter (IrisTask *task, IrisCallback callback, gpointer data);
 
 #endif /* __IRIS_TASK_PRIVATE_H__ */
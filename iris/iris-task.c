@@ -26,6 +26,7 @@
 #include "iris-receiver-private.h"
 #include "iris-task.h"
 #include "iris-task-private.h"
+#include "iris-trace-private.h"
 
 /**
  * SECTION:iris-task
@@ -105,7 +106,9 @@
 	} G_STMT_END
 #define FLAG_IS_ON(t,f) ((t->priv->flags & f) != 0)
 #define FLAG_IS_OFF(t,f) ((t->priv->flags & f) == 0)
-#define ENABLE_FLAG(t,f) G_STMT_START{t->priv->flags|=f;}G_STMT_END
+#define ENABLE_FLAG(t,f) G_STMT_START{t->priv->flags|=f;                      \
+                          IRIS_TRACE (IRIS_TRACE_TASK_STATE, t, NULL, f);}    \
+                         G_STMT_END
 #define DISABLE_FLAG(t,f) G_STMT_START{t->priv->flags&=~f;}G_STMT_END
 #define PROGRESS_BLOCKED(t)                          \
           (t->priv->dependencies != NULL &&          \
@@ -770,6 +773,42 @@ iris_task_is_cancelled (IrisTask *task)
 	return FLAG_IS_ON (task, IRIS_TASK_FLAG_CANCELLED);
 }
 
+static gboolean
+iris_task_wait_cb (gpointer data)
+{
+	IrisTask     *task = data;
+	GMainContext *context;
+
+	/* If the callbacks are to be run on a main loop that we are supposed
+	 * to be running, run it or we will never finish.
+	 */
+	context = task->priv->context;
+	if (context != NULL && g_main_context_is_owner (context))
+		g_main_context_iteration (context, FALSE);
+
+	return iris_task_is_finished (task);
+}
+
+/**
+ * iris_task_wait:
+ * @task: An #IrisTask
+ *
+ * Blocks until @task has finished, including running its callbacks or
+ * errbacks. If called from one of the threads of an #IrisScheduler, other
+ * work is run while waiting, so the thread is not lost to the scheduler.
+ * See iris_scheduler_run_until().
+ *
+ * @task must have been run, or be a dependency of a task that has, or this
+ * will never return.
+ */
+void
+iris_task_wait (IrisTask *task)
+{
+	g_return_if_fail (IRIS_IS_TASK (task));
+
+	iris_scheduler_run_until (NULL, iris_task_wait_cb, task);
+}
+
 /**
  * iris_task_get_fatal_error:
  * @task: An #IrisTask
@@ -1104,6 +1143,65 @@ iris_task_notify_observers (IrisTask *task)
 	priv->observers = NULL;
 }
 
+/* Calls @callback with @data once @task has finished, from the thread that
+ * handles its finish message. Returns %FALSE without calling it if @task has
+ * finished already.
+ */
+gboolean
+iris_task_add_waiter (IrisTask     *task,
+                      IrisCallback  callback,
+                      gpointer      data)
+{
+	IrisTaskPrivate *priv;
+	IrisTaskWaiter  *waiter;
+
+	g_return_val_if_fail (IRIS_IS_TASK (task), FALSE);
+	g_return_val_if_fail (callback != NULL, FALSE);
+
+	priv = task->priv;
+
+	g_mutex_lock (priv->mutex);
+
+	if (priv->waiters_woken) {
+		g_mutex_unlock (priv->mutex);
+		return FALSE;
+	}
+
+	waiter = g_slice_new (IrisTaskWaiter);
+	waiter->callback = callback;
+	waiter->data = data;
+	priv->waiters = g_list_prepend (priv->waiters, waiter);
+
+	g_mutex_unlock (priv->mutex);
+
+	return TRUE;
+}
+
+static void
+iris_task_wake_waiters (IrisTask *task)
+{
+	IrisTaskPrivate *priv;
+	IrisTaskWaiter  *waiter;
+	GList           *waiters,
+	                *iter;
+
+	priv = task->priv;
+
+	g_mutex_lock (priv->mutex);
+	waiters = g_list_reverse (priv->waiters);
+	priv->waiters = NULL;
+	priv->waiters_woken = TRUE;
+	g_mutex_unlock (priv->mutex);
+
+	for (iter = waiters; iter; iter = iter->next) {
+		waiter = iter->data;
+		waiter->callback (waiter->data);
+		g_slice_free (IrisTaskWaiter, waiter);
+	}
+
+	g_list_free (waiters);
+}
+
 static void
 iris_task_complete_async_result (IrisTask *task)
 {
@@ -1406,6 +1504,7 @@ handle_finish (IrisTask    *task,
 	#endif
 
 	iris_task_complete_async_result (task);
+	iris_task_wake_waiters (task);
 
 	/* FIXME: this ref is added even when the task is a process with a sink
 	 * process that will have taken this ref ...
@@ -1878,6 +1977,11 @@ iris_task_constructed (GObject *object)
 	                                       NULL);
 
 	iris_arbiter_coordinate (priv->receiver, NULL, NULL);
+
+	/* Control messages such as cancel must not wait behind queued work if
+	 * the control and work schedulers are shared.
+	 */
+	iris_receiver_set_priority (priv->receiver, IRIS_PRIORITY_HIGH);
 }
 
 static void
@@ -1951,6 +2055,7 @@ static void
 iris_task_finalize (GObject *object)
 {
 	IrisTaskPrivate *priv;
+	GList           *iter;
 
 	priv = IRIS_TASK(object)->priv;
 
@@ -1983,6 +2088,14 @@ iris_task_finalize (GObject *object)
 		priv->dependencies = NULL;
 	}
 
+	if (priv->waiters != NULL) {
+		/* We never finished, so nobody is going to be woken */
+		for (iter = priv->waiters; iter; iter = iter->next)
+			g_slice_free (IrisTaskWaiter, iter->data);
+		g_list_free (priv->waiters);
+		priv->waiters = NULL;
+	}
+
 	G_OBJECT_CLASS (iris_task_parent_class)->finalize (object);
 }
 
@@ -2063,6 +2176,8 @@ iris_task_init (IrisTask *task)
 
 	priv->dependencies = NULL;
 	priv->observers = NULL;
+	priv->waiters = NULL;
+	priv->waiters_woken = FALSE;
 
 	priv->flags = 0;
 	priv->cancel_finished = FALSE;
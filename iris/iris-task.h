@@ -235,6 +235,7 @@ gboolean      iris_task_is_finished           (IrisTask            *task);
 gboolean      iris_task_has_succeeded         (IrisTask            *task);
 gboolean      iris_task_has_failed            (IrisTask            *task);
 gboolean      iris_task_is_cancelled          (IrisTask            *task);
+void          iris_task_wait                  (IrisTask            *task);
 
 gboolean      iris_task_get_fatal_error       (IrisTask            *task,
                                                GError             **error);
@@ -0,0 +1,431 @@
+/* iris-thread-cache.c
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "iris-scheduler.h"
+#include "iris-thread-cache.h"
+
+/* Each IrisThread has a cache of the small objects that are allocated for
+ * every message and work item, which are usually freed on a different
+ * thread to the one that allocated them. Objects are carved out of slabs
+ * owned by the allocating thread, in bins of QUANTUM byte steps.
+ *
+ * Freeing on the owning thread puts the object straight back on its bin's
+ * free list. Another Iris thread collects the objects it frees for one
+ * owner into a batch, which is pushed onto the owner's lock-free remote
+ * list with a single compare-and-swap once it is REMOTE_BATCH long, when
+ * the objects belong to a different owner, or when the thread goes idle.
+ * The owner takes the whole remote list back whenever a bin runs dry.
+ *
+ * When a thread exits its cache is orphaned: the remote lists are marked
+ * so that objects still out are counted off instead of pushed, and the
+ * slabs are freed once the last of them comes back.
+ *
+ * Threads that are not Iris threads, and objects too big for the bins, use
+ * GSlice as before.
+ */
+
+#define QUANTUM       16
+#define N_BINS        8     /* Objects of up to 128 bytes are cached */
+#define SLAB_OBJECTS  64
+#define REMOTE_BATCH  32
+
+/* Marks the remote list of a cache whose thread has exited */
+#define ORPHANED      ((gpointer) 1)
+
+/* Free objects are chained through their first word */
+#define NEXT(obj)     (*(gpointer *)(obj))
+
+/* Caches whose thread has exited, waiting for objects to come back */
+static volatile gint n_orphans = 0;
+
+typedef struct _IrisCacheHeader IrisCacheHeader;
+typedef struct _IrisCacheSlab   IrisCacheSlab;
+
+/* Comes before every object. It is two words long, so objects are aligned
+ * the same as GSlice ones.
+ */
+struct _IrisCacheHeader
+{
+	IrisThreadCache *owner;    /* NULL if the object came from GSlice */
+	gsize            size;
+};
+
+struct _IrisCacheSlab
+{
+	IrisCacheSlab   *next;
+	gpointer         padding;
+};
+
+typedef struct
+{
+	gpointer         local;          /* Free objects                     */
+
+	IrisThreadCache *batch_owner;    /* Objects of another cache that we */
+	gpointer         batch_head;     /* have freed, waiting to be sent   */
+	gpointer         batch_tail;     /* back.                            */
+	guint            batch_length;
+} IrisCacheBin;
+
+struct _IrisThreadCache
+{
+	/* Only touched by the owning thread */
+	IrisCacheBin     bins[N_BINS];
+	IrisCacheSlab   *slabs;
+	gint             n_out;          /* Objects handed out, not yet back */
+
+	/* Touched by other threads */
+	volatile gint    ref_count;      /* One for the thread, plus one for
+	                                  * each object out once it has gone.
+	                                  */
+	gpointer volatile remote[N_BINS];
+};
+
+static void
+iris_thread_cache_destroy (IrisThreadCache *cache)
+{
+	IrisCacheSlab *slab;
+
+	while ((slab = cache->slabs) != NULL) {
+		cache->slabs = slab->next;
+		g_free (slab);
+	}
+
+	g_free (cache);
+}
+
+/**
+ * iris_thread_cache_create:
+ *
+ * Creates an empty cache. This is done by an #IrisThread the first time it
+ * allocates or frees through iris_thread_cache_alloc() or
+ * iris_thread_cache_free().
+ *
+ * Return value: a new #IrisThreadCache.
+ */
+IrisThreadCache*
+iris_thread_cache_create (void)
+{
+	IrisThreadCache *cache;
+
+	cache = g_new0 (IrisThreadCache, 1);
+	cache->ref_count = 1;
+
+	return cache;
+}
+
+static void
+iris_thread_cache_add_slab (IrisThreadCache *cache,
+                            guint            index)
+{
+	IrisCacheSlab   *slab;
+	IrisCacheHeader *header;
+	gsize            size,
+	                 stride;
+	gint             i;
+
+	size = (index + 1) * QUANTUM;
+	stride = sizeof (IrisCacheHeader) + size;
+
+	slab = g_malloc (sizeof (IrisCacheSlab) + SLAB_OBJECTS * stride);
+	slab->next = cache->slabs;
+	cache->slabs = slab;
+
+	/* Chain them backwards, so they are handed out in address order */
+	for (i = SLAB_OBJECTS - 1; i >= 0; i--) {
+		header = (IrisCacheHeader *)((guint8 *)(slab + 1) + i * stride);
+		header->owner = cache;
+		header->size = size;
+
+		NEXT (header + 1) = cache->bins[index].local;
+		cache->bins[index].local = header + 1;
+	}
+}
+
+/* Swaps a remote list for @replacement, and returns the objects that were
+ * on it. Each one returned is taken off 'n_out'.
+ */
+static gpointer
+iris_thread_cache_take_remote (IrisThreadCache *cache,
+                               guint            index,
+                               gpointer         replacement)
+{
+	gpointer chain,
+	         obj;
+
+	do
+		chain = g_atomic_pointer_get (&cache->remote[index]);
+	while (!g_atomic_pointer_compare_and_exchange ((gpointer *)&cache->remote[index],
+	                                               chain, replacement));
+
+	for (obj = chain; obj != NULL; obj = NEXT (obj))
+		cache->n_out--;
+
+	return chain;
+}
+
+/* Gives a chain of @n_objects back to @owner. */
+static void
+iris_thread_cache_push_remote (IrisThreadCache *owner,
+                               guint            index,
+                               gpointer         head,
+                               gpointer         tail,
+                               gint             n_objects)
+{
+	gpointer old;
+
+	do {
+		old = g_atomic_pointer_get (&owner->remote[index]);
+
+		if (G_UNLIKELY (old == ORPHANED)) {
+			/* The owner has exited, and the slabs go with the last object */
+			if (g_atomic_int_exchange_and_add (&owner->ref_count,
+			                                   -n_objects) == n_objects) {
+				iris_thread_cache_destroy (owner);
+				g_atomic_int_add (&n_orphans, -1);
+			}
+			return;
+		}
+
+		NEXT (tail) = old;
+	} while (!g_atomic_pointer_compare_and_exchange ((gpointer *)&owner->remote[index],
+	                                                 old, head));
+}
+
+static void
+iris_thread_cache_flush_bin (IrisCacheBin *bin,
+                             guint         index)
+{
+	if (bin->batch_length == 0)
+		return;
+
+	iris_thread_cache_push_remote (bin->batch_owner, index,
+	                               bin->batch_head, bin->batch_tail,
+	                               bin->batch_length);
+
+	bin->batch_owner = NULL;
+	bin->batch_head = NULL;
+	bin->batch_tail = NULL;
+	bin->batch_length = 0;
+}
+
+/**
+ * iris_thread_cache_alloc:
+ * @size: the number of bytes to allocate
+ *
+ * Allocates @size bytes from the cache of the calling #IrisThread, or from
+ * GSlice if the caller is not an Iris thread. Free the memory with
+ * iris_thread_cache_free(), from any thread.
+ *
+ * Return value: the allocated memory.
+ */
+gpointer
+iris_thread_cache_alloc (gsize size)
+{
+	IrisThread      *thread;
+	IrisThreadCache *cache;
+	IrisCacheHeader *header;
+	IrisCacheBin    *bin;
+	gpointer         obj;
+	guint            index;
+
+	index = size > 0 ? (size - 1) / QUANTUM : 0;
+	thread = iris_thread_get ();
+
+	if (G_UNLIKELY (thread == NULL || index >= N_BINS)) {
+		header = g_slice_alloc (sizeof (IrisCacheHeader) + size);
+		header->owner = NULL;
+		header->size = size;
+		return header + 1;
+	}
+
+	if (G_UNLIKELY (thread->cache == NULL))
+		thread->cache = iris_thread_cache_create ();
+
+	cache = thread->cache;
+	bin = &cache->bins[index];
+
+	if (G_UNLIKELY (bin->local == NULL)) {
+		/* Take back everything other threads have freed for us first */
+		bin->local = iris_thread_cache_take_remote (cache, index, NULL);
+
+		if (bin->local == NULL)
+			iris_thread_cache_add_slab (cache, index);
+	}
+
+	obj = bin->local;
+	bin->local = NEXT (obj);
+	cache->n_out++;
+
+	return obj;
+}
+
+/**
+ * iris_thread_cache_alloc0:
+ * @size: the number of bytes to allocate
+ *
+ * Like iris_thread_cache_alloc(), but the memory is zeroed.
+ *
+ * Return value: the allocated memory.
+ */
+gpointer
+iris_thread_cache_alloc0 (gsize size)
+{
+	gpointer mem;
+
+	mem = iris_thread_cache_alloc (size);
+	memset (mem, 0, size);
+
+	return mem;
+}
+
+/**
+ * iris_thread_cache_free:
+ * @mem: memory from iris_thread_cache_alloc()
+ *
+ * Gives @mem back to the cache it came from.
+ */
+void
+iris_thread_cache_free (gpointer mem)
+{
+	IrisThread      *thread;
+	IrisThreadCache *cache,
+	                *owner;
+	IrisCacheHeader *header;
+	IrisCacheBin    *bin;
+	guint            index;
+
+	if (G_UNLIKELY (mem == NULL))
+		return;
+
+	header = (IrisCacheHeader *)mem - 1;
+	owner = header->owner;
+
+	if (G_UNLIKELY (owner == NULL)) {
+		g_slice_free1 (sizeof (IrisCacheHeader) + header->size, header);
+		return;
+	}
+
+	index = header->size / QUANTUM - 1;
+	thread = iris_thread_get ();
+
+	if (G_UNLIKELY (thread == NULL)) {
+		iris_thread_cache_push_remote (owner, index, mem, mem, 1);
+		return;
+	}
+
+	if (G_UNLIKELY (thread->cache == NULL))
+		thread->cache = iris_thread_cache_create ();
+
+	cache = thread->cache;
+	bin = &cache->bins[index];
+
+	if (G_LIKELY (owner == cache)) {
+		NEXT (mem) = bin->local;
+		bin->local = mem;
+		cache->n_out--;
+		return;
+	}
+
+	if (bin->batch_owner != owner) {
+		iris_thread_cache_flush_bin (bin, index);
+		bin->batch_owner = owner;
+		bin->batch_tail = mem;
+	}
+
+	NEXT (mem) = bin->batch_head;
+	bin->batch_head = mem;
+
+	if (++bin->batch_length >= REMOTE_BATCH)
+		iris_thread_cache_flush_bin (bin, index);
+}
+
+/**
+ * iris_thread_cache_flush:
+ * @cache: An #IrisThreadCache
+ *
+ * Sends any objects of other caches that the owner of @cache has freed back
+ * to their owners. Called by the owning thread when it goes idle, so that
+ * they are not held on to.
+ */
+void
+iris_thread_cache_flush (IrisThreadCache *cache)
+{
+	guint index;
+
+	g_return_if_fail (cache != NULL);
+
+	for (index = 0; index < N_BINS; index++)
+		iris_thread_cache_flush_bin (&cache->bins[index], index);
+}
+
+/**
+ * iris_thread_cache_release:
+ * @cache: An #IrisThreadCache
+ *
+ * Called by the owning thread as it exits. @cache is freed once every
+ * object allocated from it has been freed.
+ */
+void
+iris_thread_cache_release (IrisThreadCache *cache)
+{
+	guint index;
+
+	g_return_if_fail (cache != NULL);
+
+	iris_thread_cache_flush (cache);
+
+	/* Hold a reference for everything that is out, before other threads can
+	 * start counting it off.
+	 */
+	g_atomic_int_add (&cache->ref_count, cache->n_out);
+
+	for (index = 0; index < N_BINS; index++) {
+		gint n_out = cache->n_out;
+
+		iris_thread_cache_take_remote (cache, index, ORPHANED);
+		g_atomic_int_add (&cache->ref_count, cache->n_out - n_out);
+	}
+
+	/* Counted before the reference is dropped, as the last object can come
+	 * back on another thread straight after.
+	 */
+	g_atomic_int_inc (&n_orphans);
+
+	if (g_atomic_int_dec_and_test (&cache->ref_count)) {
+		iris_thread_cache_destroy (cache);
+		g_atomic_int_add (&n_orphans, -1);
+	}
+}
+
+/**
+ * iris_thread_cache_get_orphan_count:
+ *
+ * Retrieves the number of caches whose thread has exited, that are still
+ * waiting for objects allocated from them to be freed.
+ *
+ * Return value: the number of orphaned caches
+ */
+guint
+iris_thread_cache_get_orphan_count (void)
+{
+	return g_atomic_int_get (&n_orphans);
+}
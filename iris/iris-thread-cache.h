@@ -0,0 +1,45 @@
+/* iris-thread-cache.h
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __IRIS_THREAD_CACHE_H__
+#define __IRIS_THREAD_CACHE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _IrisThreadCache IrisThreadCache;
+
+#define iris_thread_cache_new(type)  ((type *) iris_thread_cache_alloc (sizeof (type)))
+#define iris_thread_cache_new0(type) ((type *) iris_thread_cache_alloc0 (sizeof (type)))
+
+gpointer         iris_thread_cache_alloc   (gsize            size);
+gpointer         iris_thread_cache_alloc0  (gsize            size);
+void             iris_thread_cache_free    (gpointer         mem);
+
+IrisThreadCache* iris_thread_cache_create  (void);
+void             iris_thread_cache_flush   (IrisThreadCache *cache);
+void             iris_thread_cache_release (IrisThreadCache *cache);
+
+guint            iris_thread_cache_get_orphan_count (void);
+
+G_END_DECLS
+
+#endif /* __IRIS_THREAD_CACHE_H__ */
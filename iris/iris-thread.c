@@ -28,11 +28,20 @@
 #endif
 
 #include "iris-debug.h"
+#include "iris-epoch.h"
+#include "iris-free-list.h"
 #include "iris-message.h"
+#include "iris-priority-queue.h"
 #include "iris-queue.h"
+#include "iris-scheduler-private.h"
 #include "iris-scheduler-manager.h"
 #include "iris-scheduler-manager-private.h"
+#include "iris-thread-cache.h"
+#include "iris-topology.h"
+#include "iris-trace-private.h"
 #include "iris-util.h"
+#include "iris-wsqueue.h"
+#include "iris-wsqueue-private.h"
 
 /**
  * SECTION:iris-thread
@@ -45,9 +54,25 @@
 
 #define MSG_MANAGE            (1)
 #define MSG_SHUTDOWN          (2)
-#define QUANTUM_USECS         (G_USEC_PER_SEC / 1)
+#define MSG_STAND_IN          (3)
+#define MSG_RECLAIM           (4)
 #define POP_WAIT_TIMEOUT      (G_USEC_PER_SEC * 2)
 
+/* How often a stand-in with nothing to do checks whether it has been
+ * given back, or whether the blocked thread's queue has more work.
+ */
+#define STAND_IN_WAIT_TIMEOUT (G_USEC_PER_SEC / 100)
+
+/* How many work items a thread runs between samples of its queue length */
+#define STATS_SAMPLE_INTERVAL (16)
+
+/* A worker takes up to POP_BATCH_SIZE work items at a time, but only from
+ * a queue at least POP_BATCH_THRESHOLD deep, so it never takes work
+ * another thread could have started on straight away.
+ */
+#define POP_BATCH_SIZE        (8)
+#define POP_BATCH_THRESHOLD   (16)
+
 #if LINUX
 __thread IrisThread* my_thread = NULL;
 #elif defined(WIN32)
@@ -58,111 +83,171 @@ static pthread_once_t my_thread_once = PTHREAD_ONCE_INIT;
 static pthread_key_t my_thread;
 #endif
 
-static gboolean
-timeout_elapsed (GTimeVal *start,
-                 GTimeVal *end)
+/* Starts counting into the counters of the scheduler we now work for. We
+ * were woken up to be given the work, so that counts too.
+ */
+static void
+iris_thread_claim_stats (IrisThread *thread)
+{
+	IrisThreadStats *stats;
+
+	stats = iris_scheduler_claim_stats (thread->scheduler, thread);
+	stats->countdown = STATS_SAMPLE_INTERVAL;
+	stats->last = iris_get_monotonic_time ();
+	stats->wakeups ++;
+
+	thread->stats = stats;
+}
+
+/* Gives our counters back. This must be done before we unset
+ * thread->scheduler, after which the scheduler may free them.
+ */
+static void
+iris_thread_release_stats (IrisThread *thread)
+{
+	IrisThreadStats *stats = thread->stats;
+
+	stats->idle_usec += iris_get_monotonic_time () - stats->last;
+
+	thread->stats = NULL;
+	g_atomic_pointer_set (&stats->owner, NULL);
+}
+
+/* Runs a work item popped from @queue, and counts the time spent waiting
+ * for it and running it.
+ */
+static void
+iris_thread_execute (IrisThread     *thread,
+                     IrisQueue      *queue,
+                     IrisThreadWork *thread_work)
+{
+	IrisThreadStats *stats = thread->stats;
+	gint64           start;
+	guint            length;
+
+	start = iris_get_monotonic_time ();
+	stats->idle_usec += start - stats->last;
+
+	if (iris_thread_work_execute (thread_work)) {
+		thread->completed++;
+		stats->executed++;
+	}
+
+	stats->last = iris_get_monotonic_time ();
+	stats->busy_usec += stats->last - start;
+
+	if (--stats->countdown == 0) {
+		stats->countdown = STATS_SAMPLE_INTERVAL;
+
+		length = iris_queue_get_length (queue);
+		if (length > stats->high_water)
+			stats->high_water = length;
+	}
+}
+
+/* Takes the next work item from the batch popped off @queue, popping a
+ * new batch if that one is used up and @queue is deep enough. Returns
+ * %NULL if the caller should pop a single item as usual.
+ */
+static IrisThreadWork*
+iris_thread_next_batched (IrisThread *thread,
+                          IrisQueue  *queue)
+{
+	IrisThreadWork *thread_work;
+
+	if (thread->batch_pos < thread->batch_len) {
+		/* Urgent work queued after we took the batch should not wait
+		 * behind the rest of it. The length is a cheap atomic read, so
+		 * only lock the queue when there is something to take.
+		 */
+		if (IRIS_IS_PRIORITY_QUEUE (queue) &&
+		    iris_priority_queue_get_level_length (
+		      IRIS_PRIORITY_QUEUE (queue), IRIS_PRIORITY_HIGH) > 0 &&
+		    NULL != (thread_work = iris_priority_queue_try_pop_level (
+		                             IRIS_PRIORITY_QUEUE (queue),
+		                             IRIS_PRIORITY_HIGH)))
+			return thread_work;
+
+		return thread->batch[thread->batch_pos++];
+	}
+
+	thread->batch_pos = thread->batch_len = 0;
+
+	/* Only the owner may pop an IrisWSQueue, which is cheap for it, and
+	 * stealing from one already takes several items at a time.
+	 */
+	if (IRIS_IS_WSQUEUE (queue) || iris_queue_is_closed (queue) ||
+	    iris_queue_get_length (queue) < POP_BATCH_THRESHOLD)
+		return NULL;
+
+	thread->batch_len = iris_queue_try_pop_many (queue, thread->batch,
+	                                             POP_BATCH_SIZE);
+	if (thread->batch_len == 0)
+		return NULL;
+
+	thread->batch_pos = 1;
+	return thread->batch[0];
+}
+
+/* Pushes the work left in our batch back onto our queue, so a stand-in can
+ * get at it while we block. Anything that no longer fits is kept.
+ */
+static void
+iris_thread_return_batch (IrisThread *thread)
 {
-	GTimeVal end_by = *start;
-	g_time_val_add (&end_by, QUANTUM_USECS);
-	return (g_time_val_compare (&end_by, end) == 1);
+	IrisThreadWork *thread_work;
+	gboolean        pushed;
+	guint           n_kept = 0;
+
+	while (thread->batch_pos < thread->batch_len) {
+		thread_work = thread->batch[thread->batch_pos++];
+
+		if (IRIS_IS_PRIORITY_QUEUE (thread->active))
+			pushed = iris_priority_queue_push_full (
+			           IRIS_PRIORITY_QUEUE (thread->active),
+			           thread_work, thread_work->priority);
+		else
+			pushed = iris_queue_push (thread->active, thread_work);
+
+		if (!pushed)
+			thread->batch[n_kept++] = thread_work;
+	}
+
+	thread->batch_pos = 0;
+	thread->batch_len = n_kept;
 }
 
 static void
 iris_thread_worker_exclusive (IrisThread  *thread,
-                              IrisQueue   *queue,
-                              gboolean     leader)
+                              IrisQueue   *queue)
 {
-	GTimeVal        tv_now      = {0,0};
-	GTimeVal        tv_req      = {0,0};
 	IrisThreadWork *thread_work = NULL;
-	gint            per_quanta = 0;      /* Completed items within the
-	                                      * last quanta. */
-	guint           queued      = 0;     /* Items left in the queue at */
-	gboolean        has_resized = FALSE;
-	gboolean        remove_work;
 
 	iris_debug (IRIS_DEBUG_THREAD);
 
-	g_get_current_time (&tv_now);
-	g_get_current_time (&tv_req);
-	queued = iris_queue_get_length (queue);
-
-	/* Since our thread is in exclusive mode, we are responsible for
-	 * asking the scheduler manager to add or remove threads based
-	 * on the demand of our work queue.
-	 *
-	 * If the scheduler has maxed out the number of threads it is
-	 * allowed, then we will not ask the scheduler to add more
-	 * threads and rebalance.
+	/* An exclusive thread stays with its scheduler until the scheduler is
+	 * finalized. Whether the scheduler needs more help is decided by the
+	 * scheduler manager, which watches our progress through 'completed'.
 	 */
 
 get_next_item:
 
-	if (G_LIKELY ((thread_work = iris_queue_pop (queue)) != NULL)) {
-		if (!g_atomic_int_compare_and_exchange(&thread_work->taken, FALSE, TRUE)) {
-			remove_work = g_atomic_int_get (&thread_work->remove);
-
-			if (!remove_work)
-				/* We lost a race with another thread (remember a lockfree
-				 * queue may pop the same item twice). 
-				 */
-				goto get_next_item;
-			/* else: We lost a race with iris_scheduler_unqueue() */
-		} else
-			/* We won the race. 'remove' is honoured anyway if we can. */
-			remove_work = g_atomic_int_get (&thread_work->remove);
-
-		if (!remove_work) {
-			iris_thread_work_run (thread_work);
-			per_quanta++;
-		}
+	if (!(thread_work = iris_thread_next_batched (thread, queue)))
+		thread_work = iris_queue_pop (queue);
 
-		iris_thread_work_free (thread_work);
+	if (G_LIKELY (thread_work != NULL)) {
+		iris_thread_execute (thread, queue, thread_work);
 	}
 	else {
 		/* Queue is closed, so scheduler is finalizing. The scheduler will be
 		 * waiting until we set thread->scheduler to NULL.
 		 */
+		iris_thread_release_stats (thread);
 		g_atomic_pointer_set (&thread->scheduler, NULL);
 		iris_scheduler_manager_yield (thread);
 		return;
 	}
 
-	if (remove_work)
-		goto get_next_item;
-
-	if (G_UNLIKELY (!thread->scheduler->maxed && leader)) {
-		g_get_current_time (&tv_now);
-
-		if (G_UNLIKELY (timeout_elapsed (&tv_now, &tv_req))) {
-			/* We check to see if we have a bunch more work to do
-			 * or a potential edge case where we are processing about
-			 * the same speed as the pusher, but it creates enough
-			 * contention where we dont speed up. This is because
-			 * some schedulers will round-robin or steal.  And unless
-			 * we look to add another thread even though we have nothing
-			 * in the queue, we know there are more coming.
-			 */
-			queued = iris_queue_get_length (queue);
-			if (queued == 0 && !has_resized) {
-				queued = per_quanta * 2;
-				has_resized = TRUE;
-			}
-
-			if (per_quanta < queued) {
-				/* make sure we are not maxed before asking */
-				if (!g_atomic_int_get (&thread->scheduler->maxed))
-					iris_scheduler_manager_request (thread->scheduler,
-									per_quanta,
-									queued);
-			}
-
-			per_quanta = 0;
-			tv_req = tv_now;
-			g_time_val_add (&tv_req, QUANTUM_USECS);
-		}
-	}
-
 	goto get_next_item;
 }
 
@@ -172,7 +257,6 @@ iris_thread_worker_transient (IrisThread  *thread,
 {
 	IrisThreadWork *thread_work = NULL;
 	GTimeVal        tv_timeout = {0,0};
-	gboolean        remove_work;
 
 	iris_debug (IRIS_DEBUG_THREAD);
 
@@ -180,30 +264,22 @@ iris_thread_worker_transient (IrisThread  *thread,
 	 * many of the work items as fast as possible.  It is not responsible
 	 * for asking for more helpers, just processing work items.  When done
 	 * processing work items, it will yield itself back to the scheduler
-	 * manager.
+	 * manager. The scheduler manager may also close our queue to take us
+	 * away early if the scheduler no longer needs us.
 	 */
 
 	do {
 		g_get_current_time (&tv_timeout);
 		g_time_val_add (&tv_timeout, POP_WAIT_TIMEOUT);
 
-		thread_work = iris_queue_timed_pop_or_close (queue, &tv_timeout);
-		if (thread_work != NULL) {
-			if (!g_atomic_int_compare_and_exchange(&thread_work->taken, FALSE, TRUE)) {
-				remove_work = g_atomic_int_get (&thread_work->remove);
-
-				if (!remove_work)
-					continue;
-			} else
-				remove_work = g_atomic_int_get (&thread_work->remove);
-
-			if (!remove_work)
-				iris_thread_work_run (thread_work);
-
-			iris_thread_work_free (thread_work);
-		}
+		if (!(thread_work = iris_thread_next_batched (thread, queue)))
+			thread_work = iris_queue_timed_pop_or_close (queue, &tv_timeout);
+		if (thread_work != NULL)
+			iris_thread_execute (thread, queue, thread_work);
 	} while (thread_work != NULL);
 
+	iris_thread_release_stats (thread);
+
 	/* Remove the thread from the scheduler (if it's not already removed us due
 	 * to being in finalization), and yield our thread back to the scheduler manager */
 	if (g_atomic_int_get (&thread->scheduler->in_finalize) == FALSE)
@@ -213,29 +289,115 @@ iris_thread_worker_transient (IrisThread  *thread,
 	iris_scheduler_manager_yield (thread);
 }
 
+static void
+iris_thread_worker_stand_in (IrisThread  *thread,
+                             IrisQueue   *queue)
+{
+	IrisThreadWork *thread_work;
+	IrisMessage    *message = NULL;
+	GTimeVal        tv_timeout = {0,0};
+
+	iris_debug (IRIS_DEBUG_THREAD);
+
+	/* We work through the queue of a thread that is blocked in a blocking
+	 * region, until it comes back and sends us MSG_RECLAIM. Most queues can
+	 * be popped by any thread, but only its owner may pop an IrisWSQueue,
+	 * so those have their own way in.
+	 */
+	while (message == NULL) {
+		g_get_current_time (&tv_timeout);
+		g_time_val_add (&tv_timeout, STAND_IN_WAIT_TIMEOUT);
+
+		if (IRIS_IS_WSQUEUE (queue))
+			thread_work = iris_wsqueue_stand_in_pop (IRIS_WSQUEUE (queue),
+			                                         &tv_timeout);
+		else if (!iris_queue_is_closed (queue))
+			thread_work = iris_queue_timed_pop (queue, &tv_timeout);
+		else
+			thread_work = NULL;
+
+		if (thread_work != NULL)
+			iris_thread_execute (thread, queue, thread_work);
+
+		/* A closed queue doesn't wait for us, so wait here instead */
+		if (thread_work == NULL && !IRIS_IS_WSQUEUE (queue) &&
+		    iris_queue_is_closed (queue))
+			message = g_async_queue_timed_pop (thread->queue, &tv_timeout);
+		else
+			message = g_async_queue_try_pop (thread->queue);
+	}
+
+	/* Nobody else can send us anything until we yield */
+	g_warn_if_fail (message->what == MSG_RECLAIM);
+	iris_message_unref (message);
+}
+
+static void
+iris_thread_bind (IrisThread *thread)
+{
+	/* Move to the CPU our new scheduler wants us on (or off the one our
+	 * last scheduler wanted, if this one doesn't mind).
+	 */
+	if (thread->cpu != thread->bound_cpu) {
+		if (iris_topology_bind_thread (thread->cpu))
+			thread->bound_cpu = thread->cpu;
+		else
+			iris_debug_message (IRIS_DEBUG_THREAD,
+			                    "Could not bind thread %lu to cpu %i",
+			                    (gulong)thread, thread->cpu);
+	}
+}
+
+static void
+iris_thread_handle_stand_in (IrisThread *thread,
+                             IrisQueue  *queue)
+{
+	IrisScheduler *scheduler;
+
+	g_return_if_fail (queue != NULL);
+
+	iris_thread_bind (thread);
+	iris_thread_claim_stats (thread);
+	iris_thread_worker_stand_in (thread, queue);
+
+	/* Give ourselves back, then drop the references the blocked thread and
+	 * the scheduler manager took for us.
+	 */
+	iris_thread_release_stats (thread);
+	scheduler = thread->scheduler;
+	g_atomic_int_add (&scheduler->priv->n_lent, -1);
+	thread->lent_to = NULL;
+	g_atomic_pointer_set (&thread->scheduler, NULL);
+	iris_scheduler_manager_yield (thread);
+
+	g_object_unref (queue);
+	g_object_unref (scheduler);
+}
+
 static void
 iris_thread_handle_manage (IrisThread  *thread,
                            IrisQueue   *queue,
-                           gboolean     exclusive,
-                           gboolean     leader)
+                           gboolean     exclusive)
 {
 	g_return_if_fail (queue != NULL);
 
+	iris_thread_bind (thread);
+
 	g_mutex_lock (thread->mutex);
-	thread->active = g_object_ref (queue);
+	g_atomic_pointer_set ((gpointer *)&thread->active, g_object_ref (queue));
 	g_mutex_unlock (thread->mutex);
 
 	thread->exclusive = exclusive;
 
+	/* Given back by the worker, before it leaves the scheduler */
+	iris_thread_claim_stats (thread);
+
 	if (G_UNLIKELY (exclusive))
-		iris_thread_worker_exclusive (thread, queue, leader);
+		iris_thread_worker_exclusive (thread, queue);
 	else
 		iris_thread_worker_transient (thread, queue);
 
-	g_mutex_lock (thread->mutex);
-	g_object_unref (thread->active);
-	thread->active = NULL;
-	g_mutex_unlock (thread->mutex);
+	/* 'active' was given back by iris_scheduler_manager_yield() */
 }
 
 static void
@@ -248,6 +410,7 @@ iris_thread_worker (IrisThread *thread)
 {
 	IrisMessage *message;
 	GTimeVal     timeout = {0,0};
+	guint        idle_timeout;
 
 	g_return_val_if_fail (thread != NULL, NULL);
 	g_return_val_if_fail (thread->queue != NULL, NULL);
@@ -264,47 +427,66 @@ iris_thread_worker (IrisThread *thread)
 	iris_debug (IRIS_DEBUG_THREAD);
 
 next_message:
-	if (thread->exclusive) {
+	/* We are idle here, so if we do not get any schedulers to work for
+	 * within the idle timeout we can ask to be retired. Send back anything
+	 * other threads allocated that we have freed, and reclaim the links we
+	 * have put back, rather than sit on them.
+	 */
+	if (thread->cache != NULL)
+		iris_thread_cache_flush (thread->cache);
+
+	iris_free_list_flush ();
+	iris_epoch_flush ();
+
+	idle_timeout = iris_scheduler_manager_get_idle_timeout ();
+
+	if (idle_timeout == 0) {
 		message = g_async_queue_pop (thread->queue);
 	}
 	else {
-		/* If we do not get any schedulers to work for within our
-		 * timeout period, we can safely shutdown. */
 		g_get_current_time (&timeout);
-		g_time_val_add (&timeout, G_USEC_PER_SEC * 5);
+		g_time_val_add (&timeout, (glong)idle_timeout * 1000);
 		message = g_async_queue_timed_pop (thread->queue, &timeout);
 
 		if (!message) {
 			/* Make sure that the manager removes us from the free thread list.
 			 * The manager can return FALSE to prevent shutdown if it has
-			 * decided to give us new work.
+			 * decided to give us new work, or wants to keep us spare. Once
+			 * it returns TRUE nobody can send us anything more, and we will
+			 * be joined and freed by the manager after we return.
 			 */
 			if (!iris_scheduler_manager_destroy (thread))
 				goto next_message;
 
-			/* make sure nothing was added while we
-			 * removed ourselves */
-			message = g_async_queue_try_pop (thread->queue);
+			if (thread->cache != NULL) {
+				iris_thread_cache_release (thread->cache);
+				thread->cache = NULL;
+			}
+
+			return NULL;
 		}
 	}
 
-	if (!message)
-		return NULL;
-
 	switch (message->what) {
 	case MSG_MANAGE: {
 		IrisQueue *queue = iris_message_get_pointer (message, "queue");
 		gboolean exclusive = iris_message_get_boolean (message, "exclusive");
-		gboolean leader = iris_message_get_boolean (message, "leader");
 		iris_message_unref (message);
 
-		iris_thread_handle_manage (thread, queue, exclusive, leader);
+		iris_thread_handle_manage (thread, queue, exclusive);
 		break;
 	}
 	case MSG_SHUTDOWN:
 		iris_message_unref (message);
 		iris_thread_handle_shutdown (thread);
 		break;
+	case MSG_STAND_IN: {
+		IrisQueue *queue = iris_message_get_pointer (message, "queue");
+		iris_message_unref (message);
+
+		iris_thread_handle_stand_in (thread, queue);
+		break;
+	}
 	default:
 		g_warn_if_reached ();
 		break;
@@ -366,12 +548,32 @@ iris_thread_new (gboolean exclusive)
 
 	thread = g_slice_new0 (IrisThread);
 	thread->exclusive = exclusive;
+	thread->cpu = -1;
+	/* We inherit the binding of whoever created us, which may be another
+	 * worker, so make sure it is set the first time we are managed.
+	 */
+	thread->bound_cpu = -2;
+	thread->free_link = NULL;
+	thread->all_link = NULL;
+	thread->completed = 0;
+	thread->sampled = 0;
+	thread->stalled = 0;
+	thread->cache = NULL;
+	thread->run_depth = 0;
+	thread->blocking = 0;
+	thread->blocked = FALSE;
+	thread->stand_in = NULL;
+	thread->lent_to = NULL;
+	thread->stats = NULL;
+	thread->batch = g_new (gpointer, POP_BATCH_SIZE);
+	thread->batch_pos = 0;
+	thread->batch_len = 0;
 	thread->queue = g_async_queue_new ();
 	thread->mutex = g_mutex_new ();
 	thread->thread  = g_thread_create_full ((GThreadFunc)iris_thread_worker,
 	                                        thread,
 	                                        0,     /* stack size    */
-	                                        FALSE, /* joinable      */
+	                                        TRUE,  /* joinable      */
 	                                        FALSE, /* system thread */
 	                                        G_THREAD_PRIORITY_NORMAL,
 	                                        NULL);
@@ -380,6 +582,27 @@ iris_thread_new (gboolean exclusive)
 	return thread;
 }
 
+/*
+ * iris_thread_free:
+ * @thread: An #IrisThread
+ *
+ * Waits for a thread retired by the scheduler manager to finish exiting,
+ * then frees it.
+ */
+void
+iris_thread_free (IrisThread *thread)
+{
+	g_return_if_fail (thread != NULL);
+	g_return_if_fail (thread->free_link == NULL);
+
+	g_thread_join (thread->thread);
+
+	g_async_queue_unref (thread->queue);
+	g_mutex_free (thread->mutex);
+	g_free (thread->batch);
+	g_slice_free (IrisThread, thread);
+}
+
 /**
  * iris_thread_get:
  *
@@ -404,7 +627,8 @@ iris_thread_get (void)
  * @thread: An #IrisThread
  * @queue: A #GAsyncQueue
  * @exclusive: Whether the thread should run in exclusive mode
- * @leader: If the thread is responsible for asking for more threads
+ * @leader: Unused. Threads used to ask for help from the scheduler manager
+ *          themselves, but it now watches the load on schedulers directly.
  *
  * Sends a message to the thread asking it to retreive work items from
  * the queue.
@@ -413,9 +637,6 @@ iris_thread_get (void)
  * indefinitely. If it is %FALSE, the thread runs in transient mode - once
  * @queue is empty it will remove itself from the calling scheduler and yield
  * itself back to the scheduler manager.
- *
- * If @leader is %TRUE, then the thread will periodically ask the scheduler
- * manager to ask for more threads.
  */
 void
 iris_thread_manage (IrisThread    *thread,
@@ -433,7 +654,6 @@ iris_thread_manage (IrisThread    *thread,
 	message = iris_message_new_items (MSG_MANAGE,
 	                                  "exclusive", G_TYPE_BOOLEAN, exclusive,
 	                                  "queue", G_TYPE_POINTER, queue,
-	                                  "leader", G_TYPE_BOOLEAN, leader,
 	                                  NULL);
 	iris_message_ref_sink (message);
 	g_async_queue_push (thread->queue, message);
@@ -459,6 +679,96 @@ iris_thread_shutdown (IrisThread *thread)
 	g_async_queue_push (thread->queue, message);
 }
 
+/**
+ * iris_thread_enter_blocking:
+ *
+ * Tells the scheduler that the calling work item is about to block, for
+ * example in read() or a synchronous #GFile call, and will not use the CPU
+ * until the matching iris_thread_leave_blocking().
+ *
+ * Work queued behind a blocked thread would otherwise wait for it, and
+ * the scheduler manager cannot tell a blocked thread from a busy one. So
+ * while the thread is blocked, the scheduler manager lends another thread
+ * to work through its queue, and takes it back when the thread leaves the
+ * blocking region. No thread is lent if the manager's thread limit has been
+ * reached. The number of blocked and lent threads of each scheduler can be
+ * seen with iris_scheduler_get_blocked_threads() and
+ * iris_scheduler_get_lent_threads().
+ *
+ * Blocking regions can be nested; only the outermost one counts. This does
+ * nothing if it is not called from a scheduler's thread.
+ */
+void
+iris_thread_enter_blocking (void)
+{
+	IrisThread  *thread;
+	IrisMessage *message;
+
+	if (!(thread = iris_thread_get ()))
+		return;
+
+	if (thread->blocking++ > 0)
+		return;
+
+	/* Stand-ins have no queue of their own, and aren't given one */
+	if (thread->scheduler == NULL || thread->active == NULL)
+		return;
+
+	thread->blocked = TRUE;
+	g_atomic_int_inc (&thread->scheduler->priv->n_blocked);
+
+	iris_thread_return_batch (thread);
+
+	if (!(thread->stand_in = iris_scheduler_manager_lend (thread)))
+		return;
+
+	g_atomic_int_inc (&thread->scheduler->priv->n_lent);
+
+	iris_debug_message (IRIS_DEBUG_THREAD, "Thread %lu standing in for %lu",
+	                    (gulong)thread->stand_in, (gulong)thread);
+
+	/* The stand-in keeps the queue alive until it is given back */
+	message = iris_message_new_items (MSG_STAND_IN,
+	                                  "queue", G_TYPE_POINTER,
+	                                  g_object_ref (thread->active),
+	                                  NULL);
+	iris_message_ref_sink (message);
+	g_async_queue_push (thread->stand_in->queue, message);
+}
+
+/**
+ * iris_thread_leave_blocking:
+ *
+ * Ends a blocking region started with iris_thread_enter_blocking(). The
+ * thread lent to stand in for the calling thread goes back to the
+ * scheduler manager once it has finished the work item it is running.
+ */
+void
+iris_thread_leave_blocking (void)
+{
+	IrisThread  *thread;
+	IrisMessage *message;
+
+	if (!(thread = iris_thread_get ()))
+		return;
+
+	g_return_if_fail (thread->blocking > 0);
+
+	if (--thread->blocking > 0 || !thread->blocked)
+		return;
+
+	thread->blocked = FALSE;
+	g_atomic_int_add (&thread->scheduler->priv->n_blocked, -1);
+
+	if (thread->stand_in == NULL)
+		return;
+
+	message = iris_message_new (MSG_RECLAIM);
+	iris_message_ref_sink (message);
+	g_async_queue_push (thread->stand_in->queue, message);
+	thread->stand_in = NULL;
+}
+
 /**
  * iris_thread_print_stat:
  * @thread: An #IrisThread
@@ -505,16 +815,78 @@ iris_thread_work_new (IrisCallback   callback,
 {
 	IrisThreadWork *thread_work;
 
-	thread_work = g_slice_new (IrisThreadWork);
+	thread_work = iris_thread_cache_new (IrisThreadWork);
 	thread_work->callback = callback;
 	thread_work->data = data;
 	thread_work->notify = destroy_notify;
-	thread_work->taken = FALSE;
-	thread_work->remove = FALSE;
+	thread_work->state = IRIS_THREAD_WORK_QUEUED;
+	thread_work->next = NULL;
+	thread_work->ref_count = 0;
+	thread_work->batch = NULL;
+	thread_work->priority = IRIS_PRIORITY_NORMAL;
+
+	IRIS_TRACE (IRIS_TRACE_WORK_QUEUE, thread_work, callback, 0);
 
 	return thread_work;
 }
 
+/* A block of work items allocated together by iris_thread_work_new_batch().
+ * The block is freed when the last of its items is freed.
+ */
+typedef struct
+{
+	volatile gint  ref_count;
+	IrisThreadWork work[1];
+} IrisThreadWorkBatch;
+
+/**
+ * iris_thread_work_new_batch:
+ * @items: an array of #IrisSchedulerBatchItem
+ * @n_items: the number of items in @items
+ *
+ * Creates @n_items instances of #IrisThreadWork using a single contiguous
+ * allocation. Each item must still be released with iris_thread_work_free();
+ * the memory is returned once all of them have been.
+ *
+ * Return value: A newly allocated array of @n_items pointers to the new
+ *               work items. Free the array with g_free().
+ */
+IrisThreadWork**
+iris_thread_work_new_batch (const IrisSchedulerBatchItem *items,
+                            guint                         n_items)
+{
+	IrisThreadWorkBatch  *batch;
+	IrisThreadWork      **works;
+	IrisThreadWork       *thread_work;
+	guint                 i;
+
+	g_return_val_if_fail (items != NULL, NULL);
+	g_return_val_if_fail (n_items > 0, NULL);
+
+	batch = g_malloc (sizeof (IrisThreadWorkBatch) +
+	                  (n_items - 1) * sizeof (IrisThreadWork));
+	batch->ref_count = n_items;
+
+	works = g_new (IrisThreadWork*, n_items);
+
+	for (i = 0; i < n_items; i++) {
+		thread_work = &batch->work[i];
+		thread_work->callback = items[i].callback;
+		thread_work->data = items[i].data;
+		thread_work->notify = items[i].notify;
+		thread_work->state = IRIS_THREAD_WORK_QUEUED;
+		thread_work->next = NULL;
+		thread_work->ref_count = 0;
+		thread_work->batch = batch;
+		thread_work->priority = IRIS_PRIORITY_NORMAL;
+		works[i] = thread_work;
+
+		IRIS_TRACE (IRIS_TRACE_WORK_QUEUE, thread_work, items[i].callback, 0);
+	}
+
+	return works;
+}
+
 /**
  * iris_thread_work_run:
  * @thread_work: An #IrisThreadWork
@@ -527,7 +899,89 @@ iris_thread_work_run (IrisThreadWork *thread_work)
 {
 	g_return_if_fail (thread_work != NULL);
 	g_return_if_fail (thread_work->callback != NULL);
+
+	IRIS_TRACE (IRIS_TRACE_WORK_BEGIN, thread_work, thread_work->callback, 0);
 	thread_work->callback (thread_work->data);
+	IRIS_TRACE (IRIS_TRACE_WORK_END, thread_work, NULL, 0);
+}
+
+/**
+ * iris_thread_work_execute:
+ * @thread_work: An #IrisThreadWork that was popped from a queue
+ *
+ * Runs @thread_work unless it has been unqueued, and releases it. A work
+ * item that is being looked at by iris_scheduler_foreach() is waited for.
+ * If @thread_work has already been run by another thread, which can happen
+ * when a lock-free queue pops the same item twice, nothing is done.
+ *
+ * Return value: %TRUE if the work was run.
+ */
+gboolean
+iris_thread_work_execute (IrisThreadWork *thread_work)
+{
+	for (;;) {
+		switch (g_atomic_int_get (&thread_work->state)) {
+		case IRIS_THREAD_WORK_QUEUED:
+			if (!g_atomic_int_compare_and_exchange (&thread_work->state,
+			                                        IRIS_THREAD_WORK_QUEUED,
+			                                        IRIS_THREAD_WORK_RUNNING))
+				break;
+
+			iris_thread_work_run (thread_work);
+			iris_thread_work_free (thread_work);
+			return TRUE;
+
+		case IRIS_THREAD_WORK_HELD:
+		case IRIS_THREAD_WORK_HELD_CANCELLED:
+			/* A foreach callback is deciding whether to unqueue it */
+			g_thread_yield ();
+			break;
+
+		case IRIS_THREAD_WORK_CANCELLED:
+			/* iris_scheduler_unqueue() has called the notify already, we
+			 * only have to say it is out of the queue.
+			 */
+			if (!g_atomic_int_compare_and_exchange (&thread_work->state,
+			                                        IRIS_THREAD_WORK_CANCELLED,
+			                                        IRIS_THREAD_WORK_FINISHED))
+				break;
+
+			iris_thread_work_unref (thread_work);
+			return FALSE;
+
+		default:
+			/* Running or finished, and the other pop owns it */
+			return FALSE;
+		}
+	}
+}
+
+static void
+iris_thread_work_reclaim (IrisThreadWork *thread_work)
+{
+	if (thread_work->batch != NULL) {
+		IrisThreadWorkBatch *batch = thread_work->batch;
+
+		if (g_atomic_int_dec_and_test (&batch->ref_count))
+			g_free (batch);
+	} else
+		iris_thread_cache_free (thread_work);
+}
+
+/**
+ * iris_thread_work_unref:
+ * @thread_work: An #IrisThreadWork
+ *
+ * Drops a reference on @thread_work, returning its memory without calling
+ * its destroy notify once nothing refers to it. Work that is not in a
+ * scheduler's work list has a single owner and is returned at once.
+ */
+void
+iris_thread_work_unref (IrisThreadWork *thread_work)
+{
+	if (g_atomic_int_get (&thread_work->ref_count) == 0 ||
+	    g_atomic_int_dec_and_test (&thread_work->ref_count))
+		iris_thread_work_reclaim (thread_work);
 }
 
 /**
@@ -536,6 +990,10 @@ iris_thread_work_run (IrisThreadWork *thread_work)
  *
  * Frees the resources associated with an #IrisThreadWork. This includes calling
  * the destroy notify function, if one was set.
+ *
+ * If @thread_work was created by a scheduler, the scheduler may still be
+ * able to see it in its work list, so the memory is only returned once the
+ * scheduler has dropped it from the list as well.
  */
 void
 iris_thread_work_free (IrisThreadWork *thread_work)
@@ -545,7 +1003,50 @@ iris_thread_work_free (IrisThreadWork *thread_work)
 	if (thread_work->notify != NULL)
 		thread_work->notify (thread_work->data);
 
-	g_slice_free (IrisThreadWork, thread_work);
+	if (thread_work->ref_count != 0)
+		g_atomic_int_set (&thread_work->state, IRIS_THREAD_WORK_FINISHED);
+
+	iris_thread_work_unref (thread_work);
+}
+
+/**
+ * iris_thread_run_pending:
+ * @thread: the calling #IrisThread
+ * @timeout: when to give up waiting for work
+ *
+ * Runs one work item from the queue @thread is working on, or one it can
+ * steal, waiting until @timeout for one to turn up. This lets a thread
+ * that is waiting for something help out in the meantime.
+ *
+ * Return value: %TRUE if a work item was run, %FALSE if there was none or
+ *   the thread has no queue to take work from.
+ */
+gboolean
+iris_thread_run_pending (IrisThread *thread,
+                         GTimeVal   *timeout)
+{
+	IrisThreadWork *thread_work;
+
+	g_return_val_if_fail (thread != NULL, FALSE);
+	g_return_val_if_fail (thread == iris_thread_get (), FALSE);
+
+	/* What we are waiting for may be in the batch we popped, which is only
+	 * there while we are working on a queue. Urgent work still goes first.
+	 */
+	if (thread->batch_pos < thread->batch_len)
+		thread_work = iris_thread_next_batched (thread, thread->active);
+	else if (thread->active == NULL || iris_queue_is_closed (thread->active))
+		return FALSE;
+	else if (!(thread_work = iris_queue_timed_pop (thread->active, timeout)))
+		return FALSE;
+
+	/* Counted as part of the work item that is waiting */
+	if (iris_thread_work_execute (thread_work)) {
+		thread->completed++;
+		thread->stats->executed++;
+	}
+
+	return TRUE;
 }
 
 /**
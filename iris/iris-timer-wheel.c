@@ -0,0 +1,561 @@
+/* iris-timer-wheel.c
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#include "iris-timer-wheel.h"
+
+/* The timer wheel keeps the timeouts for iris_scheduler_queue_timeout() and
+ * iris_scheduler_queue_periodic(). Time is counted in ticks of one
+ * millisecond. The first level of the wheel has a slot for each of the next
+ * ROOT_SIZE ticks; each level above has LEVEL_SIZE slots which each cover a
+ * whole turn of the level below. Whenever a level comes round to its first
+ * slot, the next slot of the level above is cascaded down into it. Adding
+ * and removing a timeout are O(1), and expiring them costs O(1) per tick
+ * plus the occasional cascade.
+ *
+ * The wheel is driven by the scheduler manager's monitor thread, which calls
+ * iris_timer_wheel_advance() and hands each expired timeout to
+ * iris_timeout_dispatch().
+ */
+
+#define ROOT_BITS   8
+#define ROOT_SIZE   (1 << ROOT_BITS)
+#define ROOT_MASK   (ROOT_SIZE - 1)
+#define LEVEL_BITS  6
+#define LEVEL_SIZE  (1 << LEVEL_BITS)
+#define LEVEL_MASK  (LEVEL_SIZE - 1)
+#define N_LEVELS    3
+
+/* Timeouts further away than this (about 18 hours) are kept in the top
+ * level and cascaded round again until they come within range.
+ */
+#define MAX_DELTA   ((G_GUINT64_CONSTANT (1) << (ROOT_BITS + N_LEVELS * LEVEL_BITS)) - 1)
+
+#define LEVEL_SHIFT(l) (ROOT_BITS + (l) * LEVEL_BITS)
+
+struct _IrisTimerWheel
+{
+	GMutex      *mutex;
+	GTimer      *clock;
+
+	guint64      now;         /* Next tick to expire; all of the ones
+	                           * before it have been.
+	                           */
+	guint64      deadline;    /* Tick the monitor will next advance on */
+	guint        n_timeouts;
+
+	IrisTimeout *root[ROOT_SIZE];
+	IrisTimeout *levels[N_LEVELS][LEVEL_SIZE];
+};
+
+static void
+link_unlocked (IrisTimerWheel *wheel,
+               IrisTimeout    *timeout)
+{
+	IrisTimeout **slot;
+	guint64       expires;
+	guint64       delta;
+	gint          level;
+
+	expires = timeout->expires;
+
+	if (expires < wheel->now)
+		/* Overdue, so expire it on the next tick */
+		slot = &wheel->root[wheel->now & ROOT_MASK];
+	else if ((delta = expires - wheel->now) < ROOT_SIZE)
+		slot = &wheel->root[expires & ROOT_MASK];
+	else {
+		if (delta > MAX_DELTA) {
+			delta = MAX_DELTA;
+			expires = wheel->now + delta;
+		}
+
+		for (level = 0; level < N_LEVELS - 1; level++)
+			if (delta < G_GUINT64_CONSTANT (1) << LEVEL_SHIFT (level + 1))
+				break;
+
+		slot = &wheel->levels[level][(expires >> LEVEL_SHIFT (level))
+		                             & LEVEL_MASK];
+	}
+
+	timeout->next = *slot;
+	if (timeout->next != NULL)
+		timeout->next->pprev = &timeout->next;
+	timeout->pprev = slot;
+	*slot = timeout;
+}
+
+static void
+unlink_unlocked (IrisTimeout *timeout)
+{
+	*timeout->pprev = timeout->next;
+	if (timeout->next != NULL)
+		timeout->next->pprev = timeout->pprev;
+
+	timeout->next = NULL;
+	timeout->pprev = NULL;
+}
+
+/* Moves everything in a slot of @level down to where it belongs now.
+ * Returns the slot's index, so the caller knows whether the level above
+ * has come round too.
+ */
+static guint
+cascade_unlocked (IrisTimerWheel *wheel,
+                  gint            level)
+{
+	IrisTimeout *timeout,
+	            *next;
+	guint        index;
+
+	index = (wheel->now >> LEVEL_SHIFT (level)) & LEVEL_MASK;
+
+	timeout = wheel->levels[level][index];
+	wheel->levels[level][index] = NULL;
+
+	for (; timeout != NULL; timeout = next) {
+		next = timeout->next;
+		link_unlocked (wheel, timeout);
+	}
+
+	return index;
+}
+
+static guint64
+get_time_unlocked (IrisTimerWheel *wheel)
+{
+	return (guint64)(g_timer_elapsed (wheel->clock, NULL) * 1000);
+}
+
+/**
+ * iris_timer_wheel_new:
+ *
+ * Creates a new, empty timer wheel. Its clock starts at zero.
+ *
+ * Return value: the newly created #IrisTimerWheel
+ */
+IrisTimerWheel*
+iris_timer_wheel_new (void)
+{
+	IrisTimerWheel *wheel;
+
+	wheel = g_slice_new0 (IrisTimerWheel);
+	wheel->mutex = g_mutex_new ();
+	wheel->clock = g_timer_new ();
+	wheel->deadline = G_MAXUINT64;
+
+	return wheel;
+}
+
+/**
+ * iris_timer_wheel_free:
+ * @wheel: An #IrisTimerWheel
+ *
+ * Frees @wheel, dropping its references on any timeouts still in it.
+ * They will never run.
+ */
+void
+iris_timer_wheel_free (IrisTimerWheel *wheel)
+{
+	IrisTimeout *timeout;
+	gint         i, j;
+
+	g_return_if_fail (wheel != NULL);
+
+	for (i = 0; i < ROOT_SIZE; i++)
+		while ((timeout = wheel->root[i]) != NULL) {
+			unlink_unlocked (timeout);
+			iris_timeout_unref (timeout);
+		}
+
+	for (i = 0; i < N_LEVELS; i++)
+		for (j = 0; j < LEVEL_SIZE; j++)
+			while ((timeout = wheel->levels[i][j]) != NULL) {
+				unlink_unlocked (timeout);
+				iris_timeout_unref (timeout);
+			}
+
+	g_timer_destroy (wheel->clock);
+	g_mutex_free (wheel->mutex);
+	g_slice_free (IrisTimerWheel, wheel);
+}
+
+/**
+ * iris_timer_wheel_get_time:
+ * @wheel: An #IrisTimerWheel
+ *
+ * Return value: the current time on @wheel's clock, in ticks
+ */
+guint64
+iris_timer_wheel_get_time (IrisTimerWheel *wheel)
+{
+	guint64 now;
+
+	g_mutex_lock (wheel->mutex);
+	now = get_time_unlocked (wheel);
+	g_mutex_unlock (wheel->mutex);
+
+	return now;
+}
+
+/**
+ * iris_timer_wheel_add:
+ * @wheel: An #IrisTimerWheel
+ * @timeout: An #IrisTimeout that isn't in a wheel
+ * @expires: the tick @timeout is due on
+ *
+ * Adds @timeout to @wheel, which takes a reference on it until it expires
+ * or is cancelled. Nothing is done if @timeout has already been cancelled.
+ *
+ * Return value: %TRUE if @timeout is due before the monitor was next going
+ *               to advance @wheel, so it needs waking up.
+ */
+gboolean
+iris_timer_wheel_add (IrisTimerWheel *wheel,
+                      IrisTimeout    *timeout,
+                      guint64         expires)
+{
+	gboolean earlier = FALSE;
+
+	g_mutex_lock (wheel->mutex);
+
+	if (g_atomic_int_get (&timeout->state) != IRIS_TIMEOUT_DONE &&
+	    timeout->pprev == NULL) {
+		timeout->expires = expires;
+		link_unlocked (wheel, timeout);
+		wheel->n_timeouts++;
+		g_atomic_int_inc (&timeout->ref_count);
+
+		if (expires < wheel->deadline) {
+			wheel->deadline = expires;
+			earlier = TRUE;
+		}
+	}
+
+	g_mutex_unlock (wheel->mutex);
+
+	return earlier;
+}
+
+/**
+ * iris_timer_wheel_advance:
+ * @wheel: An #IrisTimerWheel
+ *
+ * Expires every timeout in @wheel whose tick has passed.
+ *
+ * Return value: the expired timeouts, linked through their 'next' field.
+ *               The caller inherits the wheel's reference on each of them.
+ */
+IrisTimeout*
+iris_timer_wheel_advance (IrisTimerWheel *wheel)
+{
+	IrisTimeout  *expired = NULL,
+	            **tail    = &expired,
+	             *timeout;
+	guint64       now;
+	guint         index;
+	gint          level;
+
+	g_mutex_lock (wheel->mutex);
+
+	now = get_time_unlocked (wheel);
+
+	while (wheel->now < now && wheel->n_timeouts > 0) {
+		index = wheel->now & ROOT_MASK;
+
+		if (index == 0)
+			for (level = 0; level < N_LEVELS; level++)
+				if (cascade_unlocked (wheel, level) != 0)
+					break;
+
+		wheel->now++;
+
+		while ((timeout = wheel->root[index]) != NULL) {
+			unlink_unlocked (timeout);
+			wheel->n_timeouts--;
+
+			*tail = timeout;
+			tail = &timeout->next;
+		}
+	}
+
+	/* Nothing can be waiting in the ticks we skipped */
+	if (wheel->n_timeouts == 0)
+		wheel->now = MAX (wheel->now, now);
+
+	g_mutex_unlock (wheel->mutex);
+
+	return expired;
+}
+
+/**
+ * iris_timer_wheel_get_timeout:
+ * @wheel: An #IrisTimerWheel
+ *
+ * Works out when @wheel next needs advancing. This is exact for timeouts in
+ * the first level of the wheel; beyond that the monitor comes back at the
+ * next cascade.
+ *
+ * Return value: milliseconds until iris_timer_wheel_advance() should be
+ *               called again, or -1 if @wheel is empty.
+ */
+gint64
+iris_timer_wheel_get_timeout (IrisTimerWheel *wheel)
+{
+	guint64 tick,
+	        now;
+	gint64  timeout = -1;
+
+	g_mutex_lock (wheel->mutex);
+
+	if (wheel->n_timeouts == 0)
+		wheel->deadline = G_MAXUINT64;
+	else {
+		tick = wheel->now;
+
+		while (wheel->root[tick & ROOT_MASK] == NULL) {
+			tick++;
+			if ((tick & ROOT_MASK) == 0)
+				break;
+		}
+
+		/* A tick can be expired once it has fully passed */
+		now = get_time_unlocked (wheel);
+		timeout = tick + 1 > now ? tick + 1 - now : 0;
+		wheel->deadline = tick;
+	}
+
+	g_mutex_unlock (wheel->mutex);
+
+	return timeout;
+}
+
+/* IrisTimeout */
+
+static void
+iris_timeout_run (gpointer data)
+{
+	IrisTimeout *timeout = data;
+
+	/* We may have been cancelled while waiting in the scheduler's queue */
+	if (!g_atomic_int_compare_and_exchange (&timeout->state,
+	                                        IRIS_TIMEOUT_QUEUED,
+	                                        IRIS_TIMEOUT_RUNNING))
+		return;
+
+	timeout->callback (timeout->data);
+
+	if (timeout->periodic &&
+	    g_atomic_int_compare_and_exchange (&timeout->state,
+	                                       IRIS_TIMEOUT_RUNNING,
+	                                       IRIS_TIMEOUT_PENDING))
+		return;
+
+	/* Either a one-shot timeout has run, or a periodic one was cancelled
+	 * while it ran and left it to us to finish.
+	 */
+	g_atomic_int_set (&timeout->state, IRIS_TIMEOUT_DONE);
+
+	if (timeout->notify != NULL)
+		timeout->notify (timeout->data);
+}
+
+/**
+ * iris_timeout_new:
+ * @wheel: the #IrisTimerWheel the timeout will be kept in
+ * @scheduler: the #IrisScheduler to run @callback on
+ * @callback: An #IrisCallback
+ * @data: data for @callback
+ * @notify: an optional callback to free @data
+ * @interval: the delay or period in milliseconds
+ * @periodic: %TRUE to run @callback every @interval
+ *
+ * Creates a new timeout. It is not due until it is added to @wheel with
+ * iris_timer_wheel_add().
+ *
+ * Return value: the new #IrisTimeout
+ */
+IrisTimeout*
+iris_timeout_new (IrisTimerWheel *wheel,
+                  IrisScheduler  *scheduler,
+                  IrisCallback    callback,
+                  gpointer        data,
+                  GDestroyNotify  notify,
+                  guint           interval,
+                  gboolean        periodic)
+{
+	IrisTimeout *timeout;
+
+	timeout = g_slice_new0 (IrisTimeout);
+	timeout->ref_count = 1;
+	timeout->state = IRIS_TIMEOUT_PENDING;
+	timeout->wheel = wheel;
+	timeout->scheduler = g_object_ref (scheduler);
+	timeout->callback = callback;
+	timeout->data = data;
+	timeout->notify = notify;
+	timeout->interval = interval;
+	timeout->periodic = periodic;
+
+	return timeout;
+}
+
+/**
+ * iris_timeout_dispatch:
+ * @timeout: An #IrisTimeout that has just expired
+ *
+ * Queues @timeout's callback on its scheduler, and puts it back in the
+ * wheel if it is periodic. The caller's reference is consumed.
+ *
+ * A periodic timeout keeps to a fixed rate, but runs that were missed or
+ * that come round while the previous run is still waiting or executing are
+ * skipped rather than piling up in the scheduler.
+ */
+void
+iris_timeout_dispatch (IrisTimeout *timeout)
+{
+	IrisTimerWheel *wheel = timeout->wheel;
+	guint64         expires,
+	                now;
+
+	if (timeout->periodic) {
+		expires = timeout->expires + timeout->interval;
+		now = iris_timer_wheel_get_time (wheel);
+
+		if (expires <= now)
+			expires = now + timeout->interval;
+
+		iris_timer_wheel_add (wheel, timeout, expires);
+	}
+
+	if (g_atomic_int_compare_and_exchange (&timeout->state,
+	                                       IRIS_TIMEOUT_PENDING,
+	                                       IRIS_TIMEOUT_QUEUED))
+		iris_scheduler_queue (timeout->scheduler,
+		                      iris_timeout_run,
+		                      timeout,
+		                      (GDestroyNotify)iris_timeout_unref);
+	else
+		iris_timeout_unref (timeout);
+}
+
+/**
+ * iris_timeout_ref:
+ * @timeout: An #IrisTimeout
+ *
+ * Increases the reference count of @timeout.
+ *
+ * Return value: @timeout
+ */
+IrisTimeout*
+iris_timeout_ref (IrisTimeout *timeout)
+{
+	g_return_val_if_fail (timeout != NULL, NULL);
+
+	g_atomic_int_inc (&timeout->ref_count);
+
+	return timeout;
+}
+
+/**
+ * iris_timeout_unref:
+ * @timeout: An #IrisTimeout
+ *
+ * Decreases the reference count of @timeout. Dropping the handle returned
+ * by iris_scheduler_queue_timeout() does not cancel the timeout; it will
+ * still run when it is due.
+ */
+void
+iris_timeout_unref (IrisTimeout *timeout)
+{
+	g_return_if_fail (timeout != NULL);
+
+	if (g_atomic_int_dec_and_test (&timeout->ref_count)) {
+		g_object_unref (timeout->scheduler);
+		g_slice_free (IrisTimeout, timeout);
+	}
+}
+
+/**
+ * iris_timeout_cancel:
+ * @timeout: An #IrisTimeout
+ *
+ * Cancels @timeout in constant time, whether it is still waiting to become
+ * due or has been queued on its scheduler. A periodic timeout that is
+ * running at the time will not run again. The timeout's notify function is
+ * called once the callback can no longer run. @timeout itself stays valid
+ * until it is unreffed.
+ *
+ * Return value: %TRUE if @timeout was stopped from running (again), or
+ *               %FALSE if it had already finished or been cancelled, or is
+ *               a one-shot timeout that was already running.
+ */
+gboolean
+iris_timeout_cancel (IrisTimeout *timeout)
+{
+	IrisTimerWheel *wheel;
+	gboolean        linked    = FALSE,
+	                cancelled = FALSE,
+	                notify    = FALSE;
+	gint            state;
+
+	g_return_val_if_fail (timeout != NULL, FALSE);
+
+	wheel = timeout->wheel;
+
+	g_mutex_lock (wheel->mutex);
+
+	if (timeout->pprev != NULL) {
+		unlink_unlocked (timeout);
+		wheel->n_timeouts--;
+		linked = TRUE;
+	}
+
+	for (;;) {
+		state = g_atomic_int_get (&timeout->state);
+
+		if (state == IRIS_TIMEOUT_PENDING || state == IRIS_TIMEOUT_QUEUED) {
+			if (g_atomic_int_compare_and_exchange (&timeout->state, state,
+			                                       IRIS_TIMEOUT_DONE)) {
+				cancelled = notify = TRUE;
+				break;
+			}
+		}
+		else if (state == IRIS_TIMEOUT_RUNNING && timeout->periodic) {
+			/* iris_timeout_run() will call the notify when it finishes */
+			if (g_atomic_int_compare_and_exchange (&timeout->state, state,
+			                                       IRIS_TIMEOUT_DONE)) {
+				cancelled = TRUE;
+				break;
+			}
+		}
+		else
+			break;
+	}
+
+	g_mutex_unlock (wheel->mutex);
+
+	if (notify && timeout->notify != NULL)
+		timeout->notify (timeout->data);
+
+	if (linked)
+		iris_timeout_unref (timeout);
+
+	return cancelled;
+}
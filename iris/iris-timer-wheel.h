@@ -0,0 +1,85 @@
+/* iris-timer-wheel.h
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __IRIS_TIMER_WHEEL_H__
+#define __IRIS_TIMER_WHEEL_H__
+
+#include <glib.h>
+
+#include "iris-scheduler.h"
+
+G_BEGIN_DECLS
+
+typedef struct _IrisTimerWheel IrisTimerWheel;
+
+typedef enum
+{
+	IRIS_TIMEOUT_PENDING,   /* Waiting for its time to come            */
+	IRIS_TIMEOUT_QUEUED,    /* Handed to its scheduler, not yet run    */
+	IRIS_TIMEOUT_RUNNING,   /* The callback is executing               */
+	IRIS_TIMEOUT_DONE       /* Finished or cancelled, notify called    */
+} IrisTimeoutState;
+
+struct _IrisTimeout
+{
+	volatile gint    ref_count;
+	volatile gint    state;      /* An IrisTimeoutState; only moves to
+	                              * DONE with the wheel locked.
+	                              */
+
+	IrisTimerWheel  *wheel;
+	IrisScheduler   *scheduler;
+	IrisCallback     callback;
+	gpointer         data;
+	GDestroyNotify   notify;
+
+	guint            interval;   /* Delay or period, in msec            */
+	gboolean         periodic;
+	guint64          expires;    /* Tick the timeout is next due on     */
+
+	/* Links in a wheel slot, owned by the wheel's lock. 'pprev' points at
+	 * whatever points at us so that we can be unlinked in O(1), and is NULL
+	 * while we are not in the wheel.
+	 */
+	IrisTimeout     *next;
+	IrisTimeout    **pprev;
+};
+
+IrisTimerWheel* iris_timer_wheel_new          (void);
+void            iris_timer_wheel_free         (IrisTimerWheel *wheel);
+guint64         iris_timer_wheel_get_time     (IrisTimerWheel *wheel);
+gboolean        iris_timer_wheel_add          (IrisTimerWheel *wheel,
+                                               IrisTimeout    *timeout,
+                                               guint64         expires);
+IrisTimeout*    iris_timer_wheel_advance      (IrisTimerWheel *wheel);
+gint64          iris_timer_wheel_get_timeout  (IrisTimerWheel *wheel);
+
+IrisTimeout*    iris_timeout_new              (IrisTimerWheel *wheel,
+                                               IrisScheduler  *scheduler,
+                                               IrisCallback    callback,
+                                               gpointer        data,
+                                               GDestroyNotify  notify,
+                                               guint           interval,
+                                               gboolean        periodic);
+void            iris_timeout_dispatch         (IrisTimeout    *timeout);
+
+G_END_DECLS
+
+#endif /* __IRIS_TIMER_WHEEL_H__ */
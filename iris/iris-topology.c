@@ -0,0 +1,317 @@
+/* iris-topology.c
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+/* Knowledge of how the CPUs of the machine relate to each other, so that
+ * threads can be pinned to them and work can be kept close to where it was
+ * produced.
+ *
+ * On Linux the layout is read once from /sys/devices/system/cpu. On other
+ * platforms every CPU is treated as equally far away and binding threads
+ * is not supported.
+ */
+
+#ifdef LINUX
+#define _GNU_SOURCE
+#include <sched.h>
+#include <sys/sysinfo.h>
+#endif
+
+#include <stdlib.h>
+
+#include "iris-scheduler.h"
+#include "iris-topology.h"
+
+#define SYSFS_CPU_DIR  "/sys/devices/system/cpu"
+#define SYSFS_NODE_DIR "/sys/devices/system/node"
+
+/* Identifiers of what each CPU shares with others. Caches are identified by
+ * the lowest numbered CPU sharing them. -1 means unknown.
+ */
+typedef struct
+{
+	gint l2;
+	gint l3;
+	gint node;
+	gint package;
+} IrisCpuInfo;
+
+static GOnce        topology_once = G_ONCE_INIT;
+static guint        n_cpu         = 0;
+static IrisCpuInfo *cpu_info      = NULL;
+
+#ifdef LINUX
+/* The CPUs the process was allowed to run on at startup, which unbound
+ * threads are returned to.
+ */
+static cpu_set_t    default_set;
+
+static gint
+read_int_file (const gchar *path)
+{
+	gchar *contents = NULL;
+	gint   result = -1;
+
+	if (g_file_get_contents (path, &contents, NULL, NULL)) {
+		if (g_ascii_isdigit (contents[0]))
+			result = atoi (contents);
+		g_free (contents);
+	}
+
+	return result;
+}
+
+/* Calls @func for each CPU in a sysfs CPU list such as "0-3,8,10-11" */
+static void
+parse_cpu_list (const gchar *list,
+                void       (*func) (gint cpu, gint value),
+                gint         value)
+{
+	gchar *end;
+	glong  first, last, cpu;
+
+	while (g_ascii_isdigit (*list)) {
+		first = last = strtol (list, &end, 10);
+		if (*end == '-')
+			last = strtol (end + 1, &end, 10);
+
+		for (cpu = first; cpu <= last && cpu < n_cpu; cpu++)
+			func (cpu, value);
+
+		if (*end != ',')
+			break;
+		list = end + 1;
+	}
+}
+
+static void
+set_l2 (gint cpu, gint value)
+{
+	cpu_info[cpu].l2 = value;
+}
+
+static void
+set_l3 (gint cpu, gint value)
+{
+	cpu_info[cpu].l3 = value;
+}
+
+static void
+set_node (gint cpu, gint value)
+{
+	cpu_info[cpu].node = value;
+}
+
+static void
+read_caches (gint cpu)
+{
+	gchar *path, *list;
+	gint   index, level;
+
+	for (index = 0; ; index++) {
+		path = g_strdup_printf (SYSFS_CPU_DIR "/cpu%i/cache/index%i/level",
+		                        cpu, index);
+		level = read_int_file (path);
+		g_free (path);
+
+		if (level < 0)
+			break;
+		if (level != 2 && level != 3)
+			continue;
+
+		path = g_strdup_printf (SYSFS_CPU_DIR "/cpu%i/cache/index%i/shared_cpu_list",
+		                        cpu, index);
+		if (g_file_get_contents (path, &list, NULL, NULL)) {
+			/* The first CPU in the list names the cache */
+			if (g_ascii_isdigit (list[0]))
+				parse_cpu_list (list, level == 2 ? set_l2 : set_l3, atoi (list));
+			g_free (list);
+		}
+		g_free (path);
+	}
+}
+
+static void
+read_nodes (void)
+{
+	gchar *path, *list;
+	gint   node;
+
+	/* Node numbers can have gaps, but not usually many */
+	for (node = 0; node < 64; node++) {
+		path = g_strdup_printf (SYSFS_NODE_DIR "/node%i/cpulist", node);
+		if (g_file_get_contents (path, &list, NULL, NULL)) {
+			parse_cpu_list (list, set_node, node);
+			g_free (list);
+		}
+		g_free (path);
+	}
+}
+#endif
+
+static gpointer
+iris_topology_init (gpointer data)
+{
+	guint cpu;
+
+#ifdef LINUX
+	n_cpu = MAX (get_nprocs_conf (), 1);
+	n_cpu = MIN (n_cpu, CPU_SETSIZE);
+#else
+	n_cpu = iris_scheduler_get_n_cpu ();
+#endif
+
+	cpu_info = g_new (IrisCpuInfo, n_cpu);
+
+	for (cpu = 0; cpu < n_cpu; cpu++) {
+		cpu_info[cpu].l2 = -1;
+		cpu_info[cpu].l3 = -1;
+		cpu_info[cpu].node = -1;
+		cpu_info[cpu].package = -1;
+	}
+
+#ifdef LINUX
+	for (cpu = 0; cpu < n_cpu; cpu++) {
+		gchar *path;
+
+		if (cpu_info[cpu].l2 == -1 || cpu_info[cpu].l3 == -1)
+			read_caches (cpu);
+
+		path = g_strdup_printf (SYSFS_CPU_DIR "/cpu%i/topology/physical_package_id",
+		                        cpu);
+		cpu_info[cpu].package = read_int_file (path);
+		g_free (path);
+	}
+
+	read_nodes ();
+
+	if (sched_getaffinity (0, sizeof (default_set), &default_set) != 0) {
+		CPU_ZERO (&default_set);
+		for (cpu = 0; cpu < n_cpu; cpu++)
+			CPU_SET (cpu, &default_set);
+	}
+#endif
+
+	return NULL;
+}
+
+/*
+ * iris_topology_get_n_cpu:
+ *
+ * Retrieves the number of CPUs the machine is configured with, which may be
+ * more than are online. Valid CPU numbers are less than this.
+ *
+ * Return value: the number of CPUs.
+ */
+guint
+iris_topology_get_n_cpu (void)
+{
+	g_once (&topology_once, iris_topology_init, NULL);
+	return n_cpu;
+}
+
+/*
+ * iris_topology_get_distance:
+ * @cpu1: A CPU number
+ * @cpu2: A CPU number
+ *
+ * Works out how closely two CPUs are related. Unknown CPUs, including -1,
+ * are always %IRIS_CPU_DISTANCE_REMOTE.
+ *
+ * Return value: the #IrisCpuDistance between @cpu1 and @cpu2.
+ */
+IrisCpuDistance
+iris_topology_get_distance (gint cpu1,
+                            gint cpu2)
+{
+	IrisCpuInfo *info1, *info2;
+
+	g_once (&topology_once, iris_topology_init, NULL);
+
+	if (cpu1 < 0 || cpu2 < 0 || cpu1 >= n_cpu || cpu2 >= n_cpu)
+		return IRIS_CPU_DISTANCE_REMOTE;
+
+	if (cpu1 == cpu2)
+		return IRIS_CPU_DISTANCE_SAME;
+
+	info1 = &cpu_info[cpu1];
+	info2 = &cpu_info[cpu2];
+
+	if (info1->l2 != -1 && info1->l2 == info2->l2)
+		return IRIS_CPU_DISTANCE_L2;
+	if (info1->l3 != -1 && info1->l3 == info2->l3)
+		return IRIS_CPU_DISTANCE_L3;
+	if (info1->node != -1 && info1->node == info2->node)
+		return IRIS_CPU_DISTANCE_NODE;
+	if (info1->node == -1 && info1->package != -1 &&
+	    info1->package == info2->package)
+		return IRIS_CPU_DISTANCE_NODE;
+
+	return IRIS_CPU_DISTANCE_REMOTE;
+}
+
+/*
+ * iris_topology_get_current_cpu:
+ *
+ * Retrieves the CPU the calling thread is running on. Unless the thread is
+ * bound to a CPU, this is only a hint.
+ *
+ * Return value: a CPU number, or -1 if it is not known.
+ */
+gint
+iris_topology_get_current_cpu (void)
+{
+#ifdef LINUX
+	return sched_getcpu ();
+#else
+	return -1;
+#endif
+}
+
+/*
+ * iris_topology_bind_thread:
+ * @cpu: A CPU number, or -1
+ *
+ * Binds the calling thread to run only on @cpu. If @cpu is -1, any binding
+ * is removed so the thread may run on any CPU the process could run on when
+ * Iris started.
+ *
+ * Return value: %TRUE on success, %FALSE if the binding could not be changed.
+ */
+gboolean
+iris_topology_bind_thread (gint cpu)
+{
+#ifdef LINUX
+	cpu_set_t set;
+
+	g_once (&topology_once, iris_topology_init, NULL);
+
+	g_return_val_if_fail (cpu < (gint)n_cpu, FALSE);
+
+	if (cpu < 0)
+		return sched_setaffinity (0, sizeof (default_set), &default_set) == 0;
+
+	CPU_ZERO (&set);
+	CPU_SET (cpu, &set);
+
+	return sched_setaffinity (0, sizeof (set), &set) == 0;
+#else
+	return cpu < 0;
+#endif
+}
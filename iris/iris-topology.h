@@ -0,0 +1,48 @@
+/* iris-topology.h
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __IRIS_TOPOLOGY_H__
+#define __IRIS_TOPOLOGY_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* How far apart two CPUs are, in terms of what they share. Lower is closer,
+ * so values can be compared directly.
+ */
+typedef enum
+{
+	IRIS_CPU_DISTANCE_SAME = 0,  /* The same CPU                         */
+	IRIS_CPU_DISTANCE_L2,        /* Share an L2 cache                    */
+	IRIS_CPU_DISTANCE_L3,        /* Share an L3 cache                    */
+	IRIS_CPU_DISTANCE_NODE,      /* Same NUMA node or physical package   */
+	IRIS_CPU_DISTANCE_REMOTE     /* Another socket, or we cannot tell    */
+} IrisCpuDistance;
+
+guint           iris_topology_get_n_cpu       (void);
+IrisCpuDistance iris_topology_get_distance    (gint cpu1,
+                                               gint cpu2);
+gint            iris_topology_get_current_cpu (void);
+gboolean        iris_topology_bind_thread     (gint cpu);
+
+G_END_DECLS
+
+#endif /* __IRIS_TOPOLOGY_H__ */
@@ -0,0 +1,63 @@
+/* iris-trace-private.h
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __IRIS_TRACE_PRIVATE_H__
+#define __IRIS_TRACE_PRIVATE_H__
+
+#include <glib.h>
+
+#include "iris-trace.h"
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+	IRIS_TRACE_WORK_QUEUE,        /* id: work item, data: callback       */
+	IRIS_TRACE_WORK_BEGIN,        /* id: work item, data: callback       */
+	IRIS_TRACE_WORK_END,          /* id: work item                       */
+	IRIS_TRACE_STEAL,             /* id: work item, data: victim queue   */
+	IRIS_TRACE_MESSAGE_POST,      /* id: message, data: port             */
+	IRIS_TRACE_MESSAGE_DELIVER,   /* id: message, data: receiver,        *
+	                               * arg: IrisDeliveryStatus            */
+	IRIS_TRACE_MESSAGE_BEGIN,     /* id: message, data: receiver         */
+	IRIS_TRACE_MESSAGE_END,       /* id: message, data: receiver         */
+	IRIS_TRACE_ARBITER_DECISION,  /* id: arbiter, data: receiver,        *
+	                               * arg: IrisReceiveDecision           */
+	IRIS_TRACE_TASK_STATE         /* id: task, arg: IrisTaskFlag set     */
+} IrisTraceEventType;
+
+extern volatile gint iris_trace_running;
+
+/* Costs one load and a branch while tracing is stopped */
+#define IRIS_TRACE(type,id,data,arg)                                    \
+	G_STMT_START {                                                  \
+		if (G_UNLIKELY (iris_trace_running))                    \
+			iris_trace_record ((type), (id), (data), (arg)); \
+	} G_STMT_END
+
+void iris_trace_init   (void);
+void iris_trace_record (IrisTraceEventType  type,
+                        gconstpointer       id,
+                        gconstpointer       data,
+                        guint               arg);
+
+G_END_DECLS
+
+#endif /* __IRIS_TRACE_PRIVATE_H__ */
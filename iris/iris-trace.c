@@ -0,0 +1,490 @@
+/* iris-trace.c
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "iris-arbiter.h"
+#include "iris-arbiter-private.h"
+#include "iris-process.h"
+#include "iris-process-private.h"
+#include "iris-receiver.h"
+#include "iris-receiver-private.h"
+#include "iris-task.h"
+#include "iris-task-private.h"
+#include "iris-trace.h"
+#include "iris-trace-private.h"
+#include "iris-util.h"
+
+/**
+ * SECTION:iris-trace
+ * @title: Tracing
+ * @short_description: Record where work and messages spend their time
+ *
+ * While tracing is running, each thread records what Iris does on its
+ * behalf into a ring buffer of its own: work items being queued, run and
+ * stolen, messages being posted to ports and delivered to receivers,
+ * arbiter decisions and the state changes of tasks. Recording an event
+ * takes no locks, and while tracing is stopped it costs a single test.
+ *
+ * iris_trace_dump() writes the events out in the JSON format read by
+ * Chrome's about:tracing page and by Perfetto, which show the life of
+ * each work item and message as an arrow from where it was queued or
+ * posted to where it was run.
+ *
+ * Setting the environment variable IRIS_TRACE to a file name starts
+ * tracing when Iris is initialised, and dumps the trace to that file when
+ * the program exits.
+ *
+ * Each thread keeps only its most recent 32768 events, so dump soon after
+ * the part of the run you are interested in. The buffer of a thread that
+ * has exited is handed on to the next new thread, so their events show up
+ * under the same thread number.
+ */
+
+/* Must be a power of two */
+#define BUFFER_SIZE (1 << 15)
+
+typedef struct
+{
+	gint64         time;
+	guint16        type;
+	guint16        arg;
+	gconstpointer  id;
+	gconstpointer  data;
+} IrisTraceEvent;
+
+typedef struct _IrisTraceBuffer IrisTraceBuffer;
+
+struct _IrisTraceBuffer
+{
+	IrisTraceBuffer *next;      /* In 'buffers'                            */
+	guint            tid;       /* Our own number for the thread           */
+	gboolean         in_use;    /* Owned by a thread; protected by the     *
+	                             * buffers lock.                           */
+	volatile guint   head;      /* Events ever recorded; only the owner    *
+	                             * writes this.                            */
+	guint            start;     /* Value of 'head' when tracing was last   *
+	                             * started, protected by the buffers lock. *
+	                             * Only later events are dumped.           */
+	IrisTraceEvent   events[BUFFER_SIZE];
+};
+
+volatile gint iris_trace_running = FALSE;
+
+G_LOCK_DEFINE_STATIC (buffers);
+static IrisTraceBuffer *buffers   = NULL;
+static guint            n_buffers = 0;
+
+static gchar           *exit_filename = NULL;
+
+#ifdef LINUX
+static __thread IrisTraceBuffer *my_buffer = NULL;
+#endif
+
+/* Only used to hear about the thread exiting on Linux */
+static GStaticPrivate my_buffer_key = G_STATIC_PRIVATE_INIT;
+
+static void
+iris_trace_release_buffer (gpointer data)
+{
+	IrisTraceBuffer *buffer = data;
+
+	/* The events stay, so they can still be dumped */
+	G_LOCK (buffers);
+	buffer->in_use = FALSE;
+	G_UNLOCK (buffers);
+}
+
+static IrisTraceBuffer*
+iris_trace_get_buffer (void)
+{
+	IrisTraceBuffer *buffer;
+
+#ifdef LINUX
+	buffer = my_buffer;
+#else
+	buffer = g_static_private_get (&my_buffer_key);
+#endif
+
+	if (G_LIKELY (buffer != NULL))
+		return buffer;
+
+	G_LOCK (buffers);
+
+	for (buffer = buffers; buffer; buffer = buffer->next)
+		if (!buffer->in_use)
+			break;
+
+	if (buffer == NULL) {
+		buffer = g_new (IrisTraceBuffer, 1);
+		buffer->head = 0;
+		buffer->start = 0;
+		buffer->tid = ++ n_buffers;
+		buffer->next = buffers;
+		buffers = buffer;
+	}
+
+	buffer->in_use = TRUE;
+
+	G_UNLOCK (buffers);
+
+#ifdef LINUX
+	my_buffer = buffer;
+#endif
+	g_static_private_set (&my_buffer_key, buffer, iris_trace_release_buffer);
+
+	return buffer;
+}
+
+/*
+ * iris_trace_record:
+ * @type: An #IrisTraceEventType
+ * @id: what the event happened to
+ * @data: a related object, see #IrisTraceEventType
+ * @arg: a number describing the event
+ *
+ * Records an event in the calling thread's buffer. Use IRIS_TRACE(), which
+ * only calls this while tracing is running.
+ */
+void
+iris_trace_record (IrisTraceEventType  type,
+                   gconstpointer       id,
+                   gconstpointer       data,
+                   guint               arg)
+{
+	IrisTraceBuffer *buffer;
+	IrisTraceEvent  *event;
+	guint            head;
+
+	buffer = iris_trace_get_buffer ();
+	head = buffer->head;
+
+	event = &buffer->events[head & (BUFFER_SIZE - 1)];
+	event->time = iris_get_monotonic_time ();
+	event->type = type;
+	event->arg = arg;
+	event->id = id;
+	event->data = data;
+
+	/* Publishes the event to iris_trace_dump() */
+	g_atomic_int_set ((volatile gint *)&buffer->head, head + 1);
+}
+
+static void
+iris_trace_dump_at_exit (void)
+{
+	GError *error = NULL;
+
+	iris_trace_stop ();
+
+	if (!iris_trace_dump (exit_filename, &error)) {
+		g_warning ("Could not write trace: %s", error->message);
+		g_error_free (error);
+	}
+}
+
+/*
+ * iris_trace_init:
+ *
+ * Starts tracing if the IRIS_TRACE environment variable names a file to
+ * write the trace to when the program exits.
+ */
+void
+iris_trace_init (void)
+{
+	const gchar *filename;
+
+	G_LOCK (buffers);
+
+	if (exit_filename == NULL && (filename = g_getenv ("IRIS_TRACE"))) {
+		exit_filename = g_strdup (filename);
+		atexit (iris_trace_dump_at_exit);
+		g_atomic_int_set (&iris_trace_running, TRUE);
+	}
+
+	G_UNLOCK (buffers);
+}
+
+/**
+ * iris_trace_start:
+ *
+ * Starts recording events, throwing away any that were recorded before.
+ */
+void
+iris_trace_start (void)
+{
+	IrisTraceBuffer *buffer;
+
+	G_LOCK (buffers);
+
+	/* Only the owner of a buffer moves its head, so rather than reset it,
+	 * which an owner in the middle of recording would undo, we note where
+	 * the new trace starts. An event that was being recorded just as we
+	 * started may still be dumped, which does no harm.
+	 */
+	for (buffer = buffers; buffer; buffer = buffer->next)
+		buffer->start = g_atomic_int_get ((volatile gint *)&buffer->head);
+
+	g_atomic_int_set (&iris_trace_running, TRUE);
+
+	G_UNLOCK (buffers);
+}
+
+/**
+ * iris_trace_stop:
+ *
+ * Stops recording events. The events recorded so far are kept until
+ * tracing is started again.
+ */
+void
+iris_trace_stop (void)
+{
+	g_atomic_int_set (&iris_trace_running, FALSE);
+}
+
+/**
+ * iris_trace_is_running:
+ *
+ * Checks whether events are being recorded.
+ *
+ * Return value: %TRUE if tracing is running.
+ */
+gboolean
+iris_trace_is_running (void)
+{
+	return g_atomic_int_get (&iris_trace_running);
+}
+
+static const gchar*
+delivery_status_name (guint status)
+{
+	switch (status) {
+	case IRIS_DELIVERY_ACCEPTED:        return "accepted";
+	case IRIS_DELIVERY_ACCEPTED_REMOVE: return "accepted-remove";
+	case IRIS_DELIVERY_PAUSE:           return "pause";
+	case IRIS_DELIVERY_REMOVE:          return "remove";
+	default:                            return "unknown";
+	}
+}
+
+static const gchar*
+receive_decision_name (guint decision)
+{
+	switch (decision) {
+	case IRIS_RECEIVE_NOW:   return "now";
+	case IRIS_RECEIVE_LATER: return "later";
+	case IRIS_RECEIVE_NEVER: return "never";
+	default:                 return "unknown";
+	}
+}
+
+static const gchar*
+task_flag_name (guint flag)
+{
+	switch (flag) {
+	case IRIS_TASK_FLAG_STARTED:          return "started";
+	case IRIS_TASK_FLAG_FINISHED:         return "finished";
+	case IRIS_TASK_FLAG_NEED_EXECUTE:     return "need-execute";
+	case IRIS_TASK_FLAG_WORK_ACTIVE:      return "work-active";
+	case IRIS_TASK_FLAG_CALLBACKS_ACTIVE: return "callbacks-active";
+	case IRIS_TASK_FLAG_CANCELLED:        return "cancelled";
+	case IRIS_TASK_FLAG_ASYNC:            return "async";
+	case IRIS_PROCESS_FLAG_OPEN:          return "open";
+	case IRIS_PROCESS_FLAG_HAS_SOURCE:    return "has-source";
+	case IRIS_PROCESS_FLAG_HAS_SINK:      return "has-sink";
+	default:                              return "unknown";
+	}
+}
+
+/* Writes one event as a Chrome trace event, or two where it also starts,
+ * continues or ends an arrow following a work item or message.
+ */
+static void
+iris_trace_write_event (FILE           *file,
+                        guint           pid,
+                        guint           tid,
+                        IrisTraceEvent *event)
+{
+	const gchar *name,
+	            *cat,
+	            *phase,
+	            *flow_phase = NULL;
+	gchar       *args;
+
+	switch (event->type) {
+	case IRIS_TRACE_WORK_QUEUE:
+		name = "queue"; cat = "work"; phase = "i"; flow_phase = "s";
+		args = g_strdup_printf ("\"work\":\"%p\",\"callback\":\"%p\"",
+		                        event->id, event->data);
+		break;
+	case IRIS_TRACE_WORK_BEGIN:
+		name = "run"; cat = "work"; phase = "B"; flow_phase = "f";
+		args = g_strdup_printf ("\"work\":\"%p\",\"callback\":\"%p\"",
+		                        event->id, event->data);
+		break;
+	case IRIS_TRACE_WORK_END:
+		name = "run"; cat = "work"; phase = "E";
+		args = g_strdup_printf ("\"work\":\"%p\"", event->id);
+		break;
+	case IRIS_TRACE_STEAL:
+		name = "steal"; cat = "work"; phase = "i"; flow_phase = "t";
+		args = g_strdup_printf ("\"work\":\"%p\",\"victim\":\"%p\"",
+		                        event->id, event->data);
+		break;
+	case IRIS_TRACE_MESSAGE_POST:
+		name = "post"; cat = "message"; phase = "i"; flow_phase = "s";
+		args = g_strdup_printf ("\"message\":\"%p\",\"port\":\"%p\"",
+		                        event->id, event->data);
+		break;
+	case IRIS_TRACE_MESSAGE_DELIVER:
+		name = "deliver"; cat = "message"; phase = "i"; flow_phase = "t";
+		args = g_strdup_printf ("\"message\":\"%p\",\"receiver\":\"%p\","
+		                        "\"status\":\"%s\"",
+		                        event->id, event->data,
+		                        delivery_status_name (event->arg));
+		break;
+	case IRIS_TRACE_MESSAGE_BEGIN:
+		name = "handle"; cat = "message"; phase = "B"; flow_phase = "f";
+		args = g_strdup_printf ("\"message\":\"%p\",\"receiver\":\"%p\"",
+		                        event->id, event->data);
+		break;
+	case IRIS_TRACE_MESSAGE_END:
+		name = "handle"; cat = "message"; phase = "E";
+		args = g_strdup_printf ("\"message\":\"%p\"", event->id);
+		break;
+	case IRIS_TRACE_ARBITER_DECISION:
+		name = "can-receive"; cat = "arbiter"; phase = "i";
+		args = g_strdup_printf ("\"arbiter\":\"%p\",\"receiver\":\"%p\","
+		                        "\"decision\":\"%s\"",
+		                        event->id, event->data,
+		                        receive_decision_name (event->arg));
+		break;
+	case IRIS_TRACE_TASK_STATE:
+		name = task_flag_name (event->arg); cat = "task"; phase = "i";
+		args = g_strdup_printf ("\"task\":\"%p\"", event->id);
+		break;
+	default:
+		return;
+	}
+
+	fprintf (file,
+	         ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\","
+	         "\"ts\":%" G_GINT64_FORMAT ",\"pid\":%u,\"tid\":%u%s,"
+	         "\"args\":{%s}}",
+	         name, cat, phase, event->time, pid, tid,
+	         phase[0] == 'i' ? ",\"s\":\"t\"" : "",
+	         args);
+
+	/* The arrow ends at the slice that begins at the same time */
+	if (flow_phase != NULL)
+		fprintf (file,
+		         ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\","
+		         "\"id\":\"%p\",\"ts\":%" G_GINT64_FORMAT ","
+		         "\"pid\":%u,\"tid\":%u%s}",
+		         cat, cat, flow_phase, event->id, event->time, pid, tid,
+		         flow_phase[0] == 'f' ? ",\"bp\":\"e\"" : "");
+
+	g_free (args);
+}
+
+/**
+ * iris_trace_dump:
+ * @filename: the file to write to
+ * @error: a location for a #GError, or %NULL
+ *
+ * Writes the events recorded by every thread to @filename, in the Chrome
+ * JSON trace format.
+ *
+ * The trace can be dumped while it is running, but events recorded during
+ * the dump may be missed or half-written; stop it with iris_trace_stop()
+ * first for a clean copy.
+ *
+ * Return value: %TRUE on success, %FALSE if @filename could not be written.
+ */
+gboolean
+iris_trace_dump (const gchar  *filename,
+                 GError      **error)
+{
+	IrisTraceBuffer *buffer;
+	FILE            *file;
+	guint            pid,
+	                 head,
+	                 i;
+	gboolean         success;
+
+	g_return_val_if_fail (filename != NULL, FALSE);
+
+	if (!(file = g_fopen (filename, "w"))) {
+		g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+		             "%s: %s", filename, g_strerror (errno));
+		return FALSE;
+	}
+
+	pid = getpid ();
+
+	fprintf (file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+	               "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,"
+	               "\"args\":{\"name\":\"%s\"}}",
+	         pid, g_get_prgname () ? g_get_prgname () : "iris");
+
+	G_LOCK (buffers);
+
+	for (buffer = buffers; buffer; buffer = buffer->next) {
+		fprintf (file,
+		         ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,"
+		         "\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+		         pid, buffer->tid, buffer->tid);
+
+		head = g_atomic_int_get ((volatile gint *)&buffer->head);
+
+		/* The newest BUFFER_SIZE events since the start, counting in a way
+		 * that survives 'head' wrapping around.
+		 */
+		i = buffer->start;
+		if (head - i > BUFFER_SIZE)
+			i = head - BUFFER_SIZE;
+
+		for (; i != head; i++)
+			iris_trace_write_event (file, pid, buffer->tid,
+			                        &buffer->events[i & (BUFFER_SIZE - 1)]);
+	}
+
+	G_UNLOCK (buffers);
+
+	fprintf (file, "\n]}\n");
+
+	success = !ferror (file);
+
+	if (fclose (file) != 0)
+		success = FALSE;
+
+	if (!success)
+		g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+		             "%s: %s", filename, g_strerror (errno));
+
+	return success;
+}
@@ -0,0 +1,36 @@
+/* iris-trace.h
+ *
+ * Copyright (C) 2011 Sam Thursfield <ssssam@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA
+ * 02110-1301 USA
+ */
+
+#ifndef __IRIS_TRACE_H__
+#define __IRIS_TRACE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void     iris_trace_start      (void);
+void     iris_trace_stop       (void);
+gboolean iris_trace_is_running (void);
+gboolean iris_trace_dump       (const gchar  *filename,
+                                GError      **error);
+
+G_END_DECLS
+
+#endif /* __IRIS_TRACE_H__ */
@@ -20,6 +20,15 @@
 
 #include <glib.h>
 
+#ifdef LINUX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "iris-util.h"
+
 /**
  * g_time_val_compare:
  * @tv1: A pointer to a #GTimeVal
@@ -79,3 +88,57 @@ g_time_val_usec_until (GTimeVal *tv)
 
 	return (seconds * G_USEC_PER_SEC) + usec;
 }
+
+/**
+ * iris_get_monotonic_time:
+ *
+ * Reads a clock that is not changed with the time of day, where there is
+ * one, for timing things that happen across threads.
+ *
+ * Return value: the time in microseconds since an unspecified point.
+ */
+gint64
+iris_get_monotonic_time (void)
+{
+#ifdef LINUX
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+#else
+	GTimeVal tv;
+
+	g_get_current_time (&tv);
+	return (gint64)tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec;
+#endif
+}
+
+#ifdef LINUX
+/* Sleeps until woken by iris_futex_wake() on @addr, or @usec microseconds
+ * pass if @usec is not negative. Returns straight away if *@addr is no
+ * longer @val, which means a wake-up happened since the caller read it.
+ */
+void
+iris_futex_wait (volatile gint *addr,
+                 gint           val,
+                 glong          usec)
+{
+	struct timespec ts;
+
+	if (usec >= 0) {
+		ts.tv_sec = usec / G_USEC_PER_SEC;
+		ts.tv_nsec = (usec % G_USEC_PER_SEC) * 1000;
+	}
+
+	syscall (SYS_futex, addr, FUTEX_WAIT_PRIVATE, val,
+	         usec >= 0 ? &ts : NULL, NULL, 0);
+}
+
+/* Wakes up to @count threads sleeping in iris_futex_wait() on @addr */
+void
+iris_futex_wake (volatile gint *addr,
+                 gint           count)
+{
+	syscall (SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+#endif
@@ -26,4 +26,17 @@
 gint  g_time_val_compare    (GTimeVal *tv1, GTimeVal *tv2);
 glong g_time_val_usec_until (GTimeVal *tv);
 
+gint64 iris_get_monotonic_time (void);
+
+/* Keeps counters written by different threads out of each other's way */
+#define IRIS_CACHE_LINE_SIZE 64
+
+#ifdef LINUX
+void iris_futex_wait (volatile gint *addr,
+                      gint           val,
+                      glong          usec);
+void iris_futex_wake (volatile gint *addr,
+                      gint           count);
+#endif
+
 #endif /* __IRIS_UTIL_H__ */
@@ -23,23 +23,66 @@
 
 #include <glib.h>
 
+#include "iris-link.h"
 #include "iris-queue.h"
 #include "iris-rrobin.h"
+#include "iris-wsqueue.h"
 
 G_BEGIN_DECLS
 
+typedef struct _IrisWSQueueBuffer IrisWSQueueBuffer;
+
+struct _IrisWSQueueBuffer
+{
+	guint              mask;     /* Capacity of the buffer minus one */
+	gpointer           items[1];
+};
+
 struct _IrisWSQueuePrivate
 {
-	IrisQueue     *global;
-	IrisRRobin    *rrobin;
-	gint           mask;
-	GMutex        *mutex;
-	volatile gint  head_idx;
-	volatile gint  tail_idx;
-	gpointer      *items;
-	gulong         length;
+	IrisQueue                  *global;
+	IrisRRobin                 *rrobin;
+
+	volatile guint              top;       /* Index that thieves steal from.
+	                                        * Only ever advanced with a
+	                                        * compare-and-swap.
+	                                        */
+	volatile guint              bottom;    /* Index that the owning thread
+	                                        * pushes to and pops from.
+	                                        */
+	IrisWSQueueBuffer *volatile buffer;    /* Current circular buffer */
+
+	volatile gint               cpu;       /* CPU of the owning thread, or
+	                                        * -1 if unknown.
+	                                        */
+	gboolean                    bound;     /* Is the owner bound to 'cpu', or
+	                                        * is it just where it last was.
+	                                        */
+
+	IrisLink *volatile          inbox;     /* Items pushed by other threads,
+	                                        * newest first, waiting for the
+	                                        * owner to move them onto the
+	                                        * deque.
+	                                        */
+	volatile gint               n_inbox;   /* Rough length of 'inbox' */
+	volatile gint               waiting;   /* Is the owner blocked on the
+	                                        * global queue.
+	                                        */
+
+	struct _IrisThreadStats *volatile owner_stats;
+	                                       /* Counters of the owner, which
+	                                        * thieves count steals from us
+	                                        * into.
+	                                        */
 };
 
+void     iris_wsqueue_set_cpu     (IrisWSQueue *queue,
+                                   gint         cpu);
+gboolean iris_wsqueue_remote_push (IrisWSQueue *queue,
+                                   gpointer     data);
+gpointer iris_wsqueue_stand_in_pop (IrisWSQueue *queue,
+                                    GTimeVal    *timeout);
+
 G_END_DECLS
 
 #endif /* __IRIS_WSQUEUE_PRIVATE_H__ */
@@ -18,26 +18,33 @@
  * 02110-1301 USA
  */
 
-/* This queue was implemented using information I learned from reading Joe Duffy's blog
- * entry on Work Stealing Queues as well as Nir Shavit's research on the subject.
+/* This queue is an implementation of the work-stealing deque described by
+ * David Chase and Yossi Lev in "Dynamic Circular Work-Stealing Deque" with
+ * the memory ordering fixes from Nhat Minh Le et al. in "Correct and
+ * Efficient Work-Stealing for Weak Memory Models".
  *
- * http://www.bluebytesoftware.com/blog/PermaLink,guid,1665653b-b5f3-49b4-8144-cfbc5e8c632b.aspx
+ * The owning thread pushes and pops at the bottom of the deque without any
+ * atomic read-modify-write operations except when racing a thief for the
+ * last item. Thieves take items from the top with a single compare-and-swap.
+ * Neither side ever takes a lock.
+ *
+ * The circular buffer is grown and shrunk by the owning thread only. A thief
+ * may have loaded the old buffer pointer right before it was replaced, so
+ * thieves read the buffer inside an epoch section and the replaced buffer
+ * is retired through iris-epoch.c. It is freed once the thieves that could
+ * have seen it have left, however many others have come along since.
  */
 
 #include <string.h>
-#include <sys/time.h>
-#include <time.h>
-
-#ifdef WIN32
-#include <windows.h>
-#else
-#include <pthread.h>
-#include <sys/errno.h>
-#endif
 
+#include "iris-epoch.h"
+#include "iris-priority-queue.h"
+#include "iris-scheduler-private.h"
+#include "iris-thread-cache.h"
+#include "iris-topology.h"
+#include "iris-trace-private.h"
 #include "iris-wsqueue.h"
 #include "iris-wsqueue-private.h"
-#include "gstamppointer.h"
 
 /**
  * SECTION:iris-wsqueue
@@ -49,6 +56,14 @@
  * retreived from the global queue, it will try to steal from its peers using
  * the #IrisRRobin of peer queues, which should also be #IrisQueue based.
  *
+ * Peers running on CPUs that share a cache or NUMA node with the thief are
+ * stolen from before peers on other sockets, since work taken from a remote
+ * socket brings its data across the interconnect with it.
+ *
+ * The local end of the queue may only be used by the thread that owns it,
+ * while any thread may steal from it using iris_wsqueue_try_steal(). Both
+ * operations are lock-free.
+ *
  * <warning><para>
  * #IrisWSQueue is experimental code and may not run correctly. Do
  * not use it in production!
@@ -59,62 +74,91 @@ static gboolean iris_wsqueue_real_push       (IrisQueue *queue,
                                               gpointer   data);
 static gpointer iris_wsqueue_real_pop        (IrisQueue *queue);
 static gpointer iris_wsqueue_real_try_pop    (IrisQueue *queue);
+static guint    iris_wsqueue_real_try_pop_many
+                                             (IrisQueue *queue,
+                                              gpointer  *items,
+                                              guint      max_items);
 static gpointer iris_wsqueue_real_timed_pop  (IrisQueue *queue,
                                               GTimeVal  *timeout);
+static gpointer iris_wsqueue_real_timed_pop_or_close
+                                             (IrisQueue *queue,
+                                              GTimeVal  *timeout);
 static guint    iris_wsqueue_real_get_length (IrisQueue *queue);
 
 #define WSQUEUE_DEFAULT_SIZE 32
 
+/* The buffer is halved once it is less than 1/WSQUEUE_SHRINK_RATIO full. */
+#define WSQUEUE_SHRINK_RATIO 4
+
+/* The most a thief takes from one victim at once */
+#define WSQUEUE_STEAL_BATCH 16
+
+/* Marks the inbox of a queue whose owner is leaving */
+#define INBOX_CLOSED ((IrisLink *) 1)
+
 struct StealInfo
 {
-	IrisQueue *queue;
-	gpointer   result;
+	IrisQueue       *queue;
+	gpointer         items[WSQUEUE_STEAL_BATCH];
+	guint            n_items;
+	IrisWSQueue     *victim;        /* Who 'items' were stolen from      */
+	gint             cpu;           /* CPU the thief is running on       */
+	IrisCpuDistance  max_distance;  /* Only steal from peers this close  */
 };
 
 G_DEFINE_TYPE (IrisWSQueue, iris_wsqueue, IRIS_TYPE_QUEUE)
 
-#if DARWIN
-static gboolean
-timeout_passed (const struct timespec *timeout)
+static IrisWSQueueBuffer*
+iris_wsqueue_buffer_new (guint size)
 {
-	struct timeval tv;
+	IrisWSQueueBuffer *buffer;
 
-	gettimeofday (&tv, NULL);
+	buffer = g_malloc0 (G_STRUCT_OFFSET (IrisWSQueueBuffer, items)
+	                    + (sizeof (gpointer) * size));
+	buffer->mask = size - 1;
 
-	if (tv.tv_sec > timeout->tv_sec)
-		return TRUE;
-	else if ((tv.tv_sec == timeout->tv_sec) && (tv.tv_usec >= (timeout->tv_nsec / 1000000)))
-		return TRUE;
+	return buffer;
+}
 
-	return FALSE;
+/* Called by the epoch code once no thief can still be reading @data */
+static void
+iris_wsqueue_buffer_reclaim (gpointer data,
+                             gpointer user_data)
+{
+	g_free (data);
 }
 
-static gint
-pthread_mutex_timedlock (pthread_mutex_t       *mutex,
-                         const struct timespec *abs_timeout)
+/* Replaces the current buffer with one of @size slots, copying the items in
+ * the range [@top,@bottom). Must only be called by the owning thread.
+ */
+static IrisWSQueueBuffer*
+iris_wsqueue_resize (IrisWSQueue *queue,
+                     guint        size,
+                     guint        top,
+                     guint        bottom)
 {
-	gint result;
+	IrisWSQueuePrivate *priv;
+	IrisWSQueueBuffer  *old_buffer;
+	IrisWSQueueBuffer  *new_buffer;
+	guint               i;
 
-	do {
-		result = pthread_mutex_trylock (mutex);
-		if (result == EBUSY) {
-			struct timespec ts;
-			ts.tv_sec = 0;
-			ts.tv_nsec = 10000000;
-
-			/* Sleep for 10,000,000 nanoseconds before trying again. */
-			int status = -1;
-			while (status == -1)
-				status = nanosleep (&ts, &ts);
-		}
-		else
-			break;
-	}
-	while (result != 0 && !timeout_passed (abs_timeout));
+	priv = queue->priv;
+	old_buffer = priv->buffer;
+	new_buffer = iris_wsqueue_buffer_new (size);
 
-	return result;
+	for (i = top; i != bottom; i++)
+		new_buffer->items [i & new_buffer->mask] =
+			old_buffer->items [i & old_buffer->mask];
+
+	g_atomic_pointer_set (&priv->buffer, new_buffer);
+
+	/* A thief that loaded the old buffer before the swap above is still
+	 * inside its epoch section, which holds off the free.
+	 */
+	iris_epoch_retire (old_buffer, iris_wsqueue_buffer_reclaim, NULL);
+
+	return new_buffer;
 }
-#endif
 
 static void
 iris_wsqueue_finalize (GObject *object)
@@ -125,7 +169,16 @@ iris_wsqueue_finalize (GObject *object)
 
 	g_object_unref (priv->global);
 	iris_rrobin_unref (priv->rrobin);
-	g_free (priv->items);
+	g_free (priv->buffer);
+
+	if (priv->inbox != INBOX_CLOSED) {
+		IrisLink *link;
+
+		while ((link = priv->inbox) != NULL) {
+			priv->inbox = link->next;
+			iris_thread_cache_free (link);
+		}
+	}
 
 	G_OBJECT_CLASS (iris_wsqueue_parent_class)->finalize (object);
 }
@@ -144,7 +197,9 @@ iris_wsqueue_class_init (IrisWSQueueClass *klass)
 	queue_class->push = iris_wsqueue_real_push;
 	queue_class->pop = iris_wsqueue_real_pop;
 	queue_class->try_pop = iris_wsqueue_real_try_pop;
+	queue_class->try_pop_many = iris_wsqueue_real_try_pop_many;
 	queue_class->timed_pop = iris_wsqueue_real_timed_pop;
+	queue_class->timed_pop_or_close = iris_wsqueue_real_timed_pop_or_close;
 	queue_class->get_length = iris_wsqueue_real_get_length;
 }
 
@@ -155,12 +210,15 @@ iris_wsqueue_init (IrisWSQueue *queue)
 	                                           IRIS_TYPE_WSQUEUE,
 	                                           IrisWSQueuePrivate);
 
-	queue->priv->mask = WSQUEUE_DEFAULT_SIZE - 1;
-	queue->priv->mutex = g_mutex_new ();
-	queue->priv->length = WSQUEUE_DEFAULT_SIZE;
-	queue->priv->items = g_malloc0 (sizeof (gpointer) * WSQUEUE_DEFAULT_SIZE);
-	queue->priv->head_idx = 0;
-	queue->priv->tail_idx = 0;
+	queue->priv->buffer = iris_wsqueue_buffer_new (WSQUEUE_DEFAULT_SIZE);
+	queue->priv->top = 0;
+	queue->priv->bottom = 0;
+	queue->priv->cpu = -1;
+	queue->priv->bound = FALSE;
+	queue->priv->inbox = NULL;
+	queue->priv->n_inbox = 0;
+	queue->priv->waiting = FALSE;
+	queue->priv->owner_stats = NULL;
 }
 
 IrisQueue*
@@ -179,6 +237,20 @@ iris_wsqueue_new (IrisQueue  *global,
 	return IRIS_QUEUE (queue);
 }
 
+/* Tells @queue which CPU its owning thread is bound to, so peers can tell
+ * how close it is when stealing. If @cpu is -1 the owner is unbound, and
+ * the CPU it was last seen on is used instead.
+ */
+void
+iris_wsqueue_set_cpu (IrisWSQueue *queue,
+                      gint         cpu)
+{
+	g_return_if_fail (IRIS_IS_WSQUEUE (queue));
+
+	queue->priv->bound = (cpu >= 0);
+	g_atomic_int_set (&queue->priv->cpu, cpu);
+}
+
 static gboolean
 iris_wsqueue_real_push (IrisQueue *queue,
                         gpointer   data)
@@ -187,6 +259,187 @@ iris_wsqueue_real_push (IrisQueue *queue,
 	return FALSE;
 }
 
+/* Number of items on the deque itself, which thieves can take */
+static guint
+iris_wsqueue_get_deque_length (IrisWSQueue *queue)
+{
+	gint size;
+
+	size = (gint)(g_atomic_int_get ((gint*)&queue->priv->bottom)
+	            - g_atomic_int_get ((gint*)&queue->priv->top));
+
+	return MAX (size, 0);
+}
+
+/* Swaps the inbox for @replacement and returns what was in it, oldest
+ * first. Once the inbox is closed it stays closed and nothing is returned.
+ */
+static IrisLink*
+iris_wsqueue_take_inbox (IrisWSQueue *queue,
+                         IrisLink    *replacement)
+{
+	IrisWSQueuePrivate *priv = queue->priv;
+	IrisLink           *head,
+	                   *link,
+	                   *result = NULL;
+	gint                n_items = 0;
+
+	do {
+		head = g_atomic_pointer_get (&priv->inbox);
+		if (head == INBOX_CLOSED || (head == NULL && replacement == NULL))
+			return NULL;
+	} while (!g_atomic_pointer_compare_and_exchange ((gpointer *)&priv->inbox,
+	                                                 head, replacement));
+
+	while (head != NULL) {
+		link = head;
+		head = link->next;
+		link->next = result;
+		result = link;
+		n_items++;
+	}
+
+	g_atomic_int_add (&priv->n_inbox, -n_items);
+
+	return result;
+}
+
+/* Moves the inbox onto the deque, where the items can be stolen like any
+ * others. Must only be called by the owning thread.
+ */
+static void
+iris_wsqueue_drain_inbox (IrisWSQueue *queue,
+                          IrisLink    *replacement)
+{
+	IrisLink *link,
+	         *next;
+
+	for (link = iris_wsqueue_take_inbox (queue, replacement); link; link = next) {
+		next = link->next;
+		iris_wsqueue_local_push (queue, link->data);
+		iris_thread_cache_free (link);
+	}
+}
+
+/* Blocks on the global queue. Remote pushes see 'waiting' and send their
+ * items to the global queue instead, where they will wake us up.
+ */
+static gpointer
+iris_wsqueue_wait_global (IrisWSQueue *queue,
+                          GTimeVal    *timeout)
+{
+	IrisWSQueuePrivate *priv = queue->priv;
+	gpointer            result;
+
+	/* This must be a full barrier, so that a remote push either sees it or
+	 * has its item drained below.
+	 */
+	g_atomic_int_compare_and_exchange (&priv->waiting, FALSE, TRUE);
+
+	iris_wsqueue_drain_inbox (queue, NULL);
+
+	if (!(result = iris_wsqueue_local_pop (queue))) {
+		if (timeout)
+			result = iris_queue_timed_pop (priv->global, timeout);
+		else
+			result = iris_queue_pop (priv->global);
+
+		if (result != NULL && priv->owner_stats != NULL)
+			priv->owner_stats->wakeups ++;
+	}
+
+	g_atomic_int_set (&priv->waiting, FALSE);
+
+	return result;
+}
+
+/**
+ * iris_wsqueue_remote_push:
+ * @queue: An #IrisWSQueue
+ * @data: a pointer to data
+ *
+ * Pushes an item for the owner of @queue from another thread. The owner
+ * moves it onto its deque the next time it looks for work, after which it
+ * can be stolen as normal.
+ *
+ * Return value: %FALSE if the owner is leaving, in which case @data was not
+ *   pushed. Items pushed while the owner is waiting for work are passed on
+ *   to the global queue so that they do not sit unseen.
+ */
+gboolean
+iris_wsqueue_remote_push (IrisWSQueue *queue,
+                          gpointer     data)
+{
+	IrisWSQueuePrivate *priv;
+	IrisLink           *link,
+	                   *head;
+
+	g_return_val_if_fail (queue != NULL, FALSE);
+
+	priv = queue->priv;
+
+	link = iris_thread_cache_new (IrisLink);
+	link->data = data;
+
+	do {
+		head = g_atomic_pointer_get (&priv->inbox);
+
+		if (G_UNLIKELY (head == INBOX_CLOSED)) {
+			iris_thread_cache_free (link);
+			return FALSE;
+		}
+
+		link->next = head;
+	} while (!g_atomic_pointer_compare_and_exchange ((gpointer *)&priv->inbox,
+	                                                 head, link));
+
+	g_atomic_int_inc (&priv->n_inbox);
+
+	/* The owner may have gone to sleep on the global queue without seeing
+	 * our item, so hand the inbox over to the global queue to wake it.
+	 * Whoever takes the inbox first gets all of it, so nothing is lost or
+	 * run twice.
+	 */
+	if (g_atomic_int_get (&priv->waiting)) {
+		IrisLink *next;
+
+		for (link = iris_wsqueue_take_inbox (queue, NULL); link; link = next) {
+			next = link->next;
+			iris_queue_push (priv->global, link->data);
+			iris_thread_cache_free (link);
+		}
+	}
+
+	return TRUE;
+}
+
+
+static IrisCpuDistance
+iris_wsqueue_get_distance (struct StealInfo *steal,
+                           IrisWSQueue      *neighbor)
+{
+	return iris_topology_get_distance (steal->cpu,
+	                                   g_atomic_int_get (&neighbor->priv->cpu));
+}
+
+/* Finds how close the nearest peer with work waiting is */
+static gboolean
+iris_wsqueue_scan_cb (IrisRRobin *rrobin,
+                      gpointer    data,
+                      gpointer    user_data)
+{
+	struct StealInfo *steal    = user_data;
+	IrisWSQueue      *neighbor = data;
+	IrisCpuDistance   distance;
+
+	if (G_LIKELY (steal->queue != data) &&
+	    iris_wsqueue_get_deque_length (neighbor) > 0) {
+		distance = iris_wsqueue_get_distance (steal, neighbor);
+		steal->max_distance = MIN (steal->max_distance, distance);
+	}
+
+	return steal->max_distance > IRIS_CPU_DISTANCE_SAME;
+}
 
 static gboolean
 iris_wsqueue_pop_cb (IrisRRobin *rrobin,
@@ -196,14 +449,81 @@ iris_wsqueue_pop_cb (IrisRRobin *rrobin,
 	struct StealInfo *steal    = user_data;
 	IrisWSQueue      *neighbor = data;
 
-	if (G_LIKELY (steal->queue != data)) {
-		if ((steal->result = iris_wsqueue_try_steal (neighbor, 0)) != NULL)
+	if (G_LIKELY (steal->queue != data) &&
+	    iris_wsqueue_get_distance (steal, neighbor) <= steal->max_distance) {
+		steal->n_items = iris_wsqueue_try_steal_many (neighbor, steal->items,
+		                                              WSQUEUE_STEAL_BATCH);
+		if (steal->n_items > 0) {
+			steal->victim = neighbor;
 			return FALSE;
+		}
 	}
 
 	return TRUE;
 }
 
+/* Steals up to half the work of one of our peers, nearest first. The
+ * first item is returned and the rest go on our own deque, so one search
+ * feeds us for a while and what we took can be stolen on in turn.
+ */
+static gpointer
+iris_wsqueue_steal (IrisWSQueue *queue)
+{
+	IrisWSQueuePrivate *priv = queue->priv;
+	struct StealInfo    steal;
+	IrisThread         *thread;
+	IrisThreadStats    *stats,
+	                   *victim_stats;
+	guint               i;
+
+	/* An unbound thread can move, so note where we are now. Our own thieves
+	 * use this too.
+	 */
+	if (!priv->bound)
+		g_atomic_int_set (&priv->cpu, iris_topology_get_current_cpu ());
+
+	steal.queue = IRIS_QUEUE (queue);
+	steal.n_items = 0;
+	steal.victim = NULL;
+	steal.cpu = g_atomic_int_get (&priv->cpu);
+	steal.max_distance = IRIS_CPU_DISTANCE_REMOTE + 1;
+
+	/* First see how close the nearest work is, then steal from peers that
+	 * close. Only if they have been emptied in the meantime do we look
+	 * further afield.
+	 */
+	iris_rrobin_foreach (priv->rrobin, iris_wsqueue_scan_cb, &steal);
+
+	if (steal.max_distance > IRIS_CPU_DISTANCE_REMOTE)
+		return NULL;
+
+	iris_rrobin_foreach (priv->rrobin, iris_wsqueue_pop_cb, &steal);
+
+	if (steal.n_items == 0 && steal.max_distance < IRIS_CPU_DISTANCE_REMOTE) {
+		steal.max_distance = IRIS_CPU_DISTANCE_REMOTE;
+		iris_rrobin_foreach (priv->rrobin, iris_wsqueue_pop_cb, &steal);
+	}
+
+	/* Oldest last, so it is the next one we pop */
+	for (i = steal.n_items; i > 1; i--)
+		iris_wsqueue_local_push (queue, steal.items[i - 1]);
+
+	thread = iris_thread_get ();
+	stats = thread != NULL ? thread->stats : NULL;
+
+	if (stats != NULL && steal.n_items > 0) {
+		for (i = 0; i < steal.n_items; i++)
+			IRIS_TRACE (IRIS_TRACE_STEAL, steal.items[i], steal.victim, 0);
+		stats->stolen += steal.n_items;
+
+		victim_stats = g_atomic_pointer_get (&steal.victim->priv->owner_stats);
+		if (victim_stats != NULL)
+			g_atomic_int_add (&victim_stats->stolen_from, steal.n_items);
+	}
+
+	return steal.n_items > 0 ? steal.items[0] : NULL;
+}
+
 static gpointer
 iris_wsqueue_real_pop (IrisQueue *queue)
 {
@@ -217,11 +537,11 @@ iris_wsqueue_real_pop (IrisQueue *queue)
 	g_get_current_time (&tv);
 
 	if (!(result = iris_queue_timed_pop (queue, &tv))) {
-		/* Since only our local thread can push items to our
-		 * queue, we can safely block on the global queue now
-		 * for a result.
+		/* Only our local thread can push items to our deque, and
+		 * remote pushes go to the global queue while we wait, so
+		 * we can safely block on the global queue now for a result.
 		 */
-		result = iris_queue_pop (IRIS_WSQUEUE (queue)->priv->global);
+		result = iris_wsqueue_wait_global (IRIS_WSQUEUE (queue), NULL);
 	}
 
 	return result;
@@ -236,6 +556,56 @@ iris_wsqueue_real_try_pop (IrisQueue *queue)
 	return iris_wsqueue_real_pop (queue);
 }
 
+static guint
+iris_wsqueue_real_try_pop_many (IrisQueue *queue,
+                                gpointer  *items,
+                                guint      max_items)
+{
+	/*
+	 * This code path is to only be hit by the thread that owns the Queue!
+	 */
+
+	IrisWSQueuePrivate *priv;
+	gpointer            item;
+	guint               n_items = 0;
+
+	g_return_val_if_fail (queue != NULL, 0);
+	g_return_val_if_fail (items != NULL || max_items == 0, 0);
+
+	if (max_items == 0)
+		return 0;
+
+	priv = IRIS_WSQUEUE (queue)->priv;
+
+	/* The same order as iris_wsqueue_real_timed_pop(), without waiting */
+	iris_wsqueue_drain_inbox (IRIS_WSQUEUE (queue), NULL);
+
+	if (IRIS_IS_PRIORITY_QUEUE (priv->global) &&
+	    NULL != (item = iris_priority_queue_try_pop_level (
+	                      IRIS_PRIORITY_QUEUE (priv->global),
+	                      IRIS_PRIORITY_HIGH))) {
+		items[0] = item;
+		return 1;
+	}
+
+	while (n_items < max_items &&
+	       NULL != (item = iris_wsqueue_local_pop (IRIS_WSQUEUE (queue))))
+		items[n_items++] = item;
+
+	if (n_items == 0)
+		n_items = iris_queue_try_pop_many (priv->global, items, max_items);
+
+	/* A steal leaves the rest of what it took on our deque */
+	if (n_items == 0 && NULL != (item = iris_wsqueue_steal (IRIS_WSQUEUE (queue)))) {
+		items[n_items++] = item;
+		while (n_items < max_items &&
+		       NULL != (item = iris_wsqueue_local_pop (IRIS_WSQUEUE (queue))))
+			items[n_items++] = item;
+	}
+
+	return n_items;
+}
+
 static gpointer
 iris_wsqueue_real_timed_pop (IrisQueue *queue,
                              GTimeVal  *timeout)
@@ -245,14 +615,18 @@ iris_wsqueue_real_timed_pop (IrisQueue *queue,
 	 */
 
 	IrisWSQueuePrivate *priv;
-	struct StealInfo    steal;
+	IrisThread         *thread;
+	gpointer            result;
 
 	g_return_val_if_fail (queue != NULL, NULL);
 	g_return_val_if_fail (timeout != NULL, NULL);
 
 	priv = IRIS_WSQUEUE (queue)->priv;
-	steal.queue = queue;
-	steal.result = NULL;
+
+	/* Our owner's counters change when it moves to a new scheduler */
+	thread = iris_thread_get ();
+	if (thread != NULL && priv->owner_stats != thread->stats)
+		g_atomic_pointer_set (&priv->owner_stats, thread->stats);
 
 	/* We check 3 different queues to retrieve an item through the
 	 * public pop interface. First we try to pop locally from our
@@ -268,39 +642,72 @@ iris_wsqueue_real_timed_pop (IrisQueue *queue,
 
 	/* Round One */
 
-	if (NULL != (steal.result = iris_wsqueue_local_pop (IRIS_WSQUEUE (queue))))
-		return steal.result;
-	else if (NULL != (steal.result = iris_queue_try_pop (priv->global)))
-		return steal.result;
-
-	iris_rrobin_foreach (priv->rrobin, iris_wsqueue_pop_cb, &steal);
+	iris_wsqueue_drain_inbox (IRIS_WSQUEUE (queue), NULL);
 
-	if (steal.result)
-		return steal.result;
+	/* Urgent work only ever lands on the global queue, and should not wait
+	 * behind whatever we have queued locally.
+	 */
+	if (IRIS_IS_PRIORITY_QUEUE (priv->global) &&
+	    NULL != (result = iris_priority_queue_try_pop_level (
+	                        IRIS_PRIORITY_QUEUE (priv->global),
+	                        IRIS_PRIORITY_HIGH)))
+		return result;
+
+	if (NULL != (result = iris_wsqueue_local_pop (IRIS_WSQUEUE (queue))))
+		return result;
+	else if (NULL != (result = iris_queue_try_pop (priv->global)))
+		return result;
+	else if (NULL != (result = iris_wsqueue_steal (IRIS_WSQUEUE (queue))))
+		return result;
 
 	/* Round Two */
 
-	if (NULL != (steal.result = iris_queue_timed_pop (priv->global, timeout)))
-		return steal.result;
+	if (NULL != (result = iris_wsqueue_wait_global (IRIS_WSQUEUE (queue), timeout)))
+		return result;
 
-	iris_rrobin_foreach (priv->rrobin, iris_wsqueue_pop_cb, &steal);
+	return iris_wsqueue_steal (IRIS_WSQUEUE (queue));
+}
+
+static gpointer
+iris_wsqueue_real_timed_pop_or_close (IrisQueue *queue,
+                                      GTimeVal  *timeout)
+{
+	/*
+	 * This code path is to only be hit by the thread that owns the Queue!
+	 */
+
+	gpointer result;
+
+	g_return_val_if_fail (queue != NULL, NULL);
 
-	return steal.result;
+	/* Once we are closed our thread is leaving, so it only finishes off
+	 * the work it queued itself or was pushed for it, and leaves the rest
+	 * for its peers. Closing the inbox sends any later pushes elsewhere.
+	 */
+	if (iris_queue_is_closed (queue)) {
+		iris_wsqueue_drain_inbox (IRIS_WSQUEUE (queue), INBOX_CLOSED);
+		return iris_wsqueue_local_pop (IRIS_WSQUEUE (queue));
+	}
+
+	if (!(result = iris_wsqueue_real_timed_pop (queue, timeout)))
+		iris_queue_close (queue);
+
+	return result;
 }
 
 static guint
 iris_wsqueue_real_get_length (IrisQueue *queue)
 {
-	IrisWSQueuePrivate *priv;
+	gint n_inbox;
 
 	g_return_val_if_fail (queue != NULL, 0);
 
-	priv = IRIS_WSQUEUE (queue)->priv;
+	/* Includes the items waiting in the inbox, which are ours too */
+	n_inbox = g_atomic_int_get (&IRIS_WSQUEUE (queue)->priv->n_inbox);
 
-	return (priv->tail_idx - priv->head_idx);
+	return iris_wsqueue_get_deque_length (IRIS_WSQUEUE (queue)) + MAX (n_inbox, 0);
 }
 
-
 /**
  * iris_wsqueue_local_push:
  * @queue: An #IrisWSQueue
@@ -316,60 +723,25 @@ iris_wsqueue_local_push (IrisWSQueue *queue,
                          gpointer     data)
 {
 	IrisWSQueuePrivate *priv;
-	gpointer           *old_items;
-	gpointer           *new_items;
-	gint                tail;
-	gint                head;
-	gint                count;
+	IrisWSQueueBuffer  *buffer;
+	guint               bottom;
+	guint               top;
 
 	g_return_if_fail (queue != NULL);
 
 	priv = queue->priv;
-	tail = priv->tail_idx;
+	bottom = priv->bottom;
+	top = g_atomic_int_get ((gint*)&priv->top);
+	buffer = priv->buffer;
 
-	if (tail < (priv->head_idx + priv->mask)) {
-		/* local push fast path */
-		priv->items [tail & priv->mask] = data;
-		g_atomic_int_set (&priv->tail_idx, tail + 1);
-	}
-	else {
-		/* slow path, must resize the array */
-		g_mutex_lock (priv->mutex);
-
-		head = priv->head_idx;
-		count = priv->tail_idx - priv->head_idx;
-		old_items = priv->items;
-
-		if (count >= priv->mask) {
-			/* double the array size */
-			new_items = g_malloc0 (sizeof (gpointer) * (priv->length << 1));
-
-			/* copy the existing items over */
-			memcpy (new_items,
-			        old_items,
-			        priv->length * sizeof (gpointer));
-
-			/* assign the new array */
-			priv->items = new_items;
-			priv->head_idx = 0;
-			priv->tail_idx = tail = count;
-			priv->mask = (priv->mask << 1) | 1;
-			priv->length = priv->length << 1;
-
-			/* FIXME: Free old_items safely (can't really be done)
-			 *   or save the buffer to a list for periodic GC.
-			 *   However, as Shapor mentioned, leaking this will
-			 *   only account for a total of 2x the largest growth
-			 *   which may not be a problem anyway.
-			 */
-			/* g_free (old_items); */
-		}
+	if (G_UNLIKELY ((bottom - top) > buffer->mask))
+		buffer = iris_wsqueue_resize (queue, (buffer->mask + 1) << 1,
+		                              top, bottom);
 
-		priv->items [tail & priv->mask] = data;
-		priv->tail_idx = tail + 1;
+	buffer->items [bottom & buffer->mask] = data;
 
-		g_mutex_unlock (priv->mutex);
-	}
+	/* Publish the item to thieves. */
+	g_atomic_int_set ((gint*)&priv->bottom, bottom + 1);
 }
 
 /**
@@ -385,48 +757,176 @@ gpointer
 iris_wsqueue_local_pop (IrisWSQueue *queue)
 {
 	IrisWSQueuePrivate *priv;
+	IrisWSQueueBuffer  *buffer;
 	gpointer            result = NULL;
-	gint                tail;
+	guint               bottom;
+	guint               top;
+	gint                size;
 
 	g_return_val_if_fail (queue != NULL, NULL);
 
 	priv = queue->priv;
-	tail = priv->tail_idx;
+	bottom = priv->bottom - 1;
+	buffer = priv->buffer;
 
-	if (priv->head_idx >= tail)
+	/* Reserve the bottom slot before looking at top. This needs to be a
+	 * full barrier so that a concurrent thief either sees the new bottom
+	 * or we see its updated top, and a plain store followed by a load is
+	 * not one. Only we write 'bottom', so the swap always succeeds.
+	 */
+	g_atomic_int_compare_and_exchange ((gint*)&priv->bottom,
+	                                   (gint)(bottom + 1), (gint)bottom);
+	top = g_atomic_int_get ((gint*)&priv->top);
+	size = (gint)(bottom - top);
+
+	if (size < 0) {
+		/* queue was empty, restore the bottom */
+		g_atomic_int_set ((gint*)&priv->bottom, bottom + 1);
 		return NULL;
+	}
 
-	tail -= 1;
-	g_atomic_int_set (&priv->tail_idx, tail);
+	result = buffer->items [bottom & buffer->mask];
 
-	if (priv->head_idx <= tail)
-		result = priv->items [tail & priv->mask];
-	else {
-		g_mutex_lock (priv->mutex);
+	if (size > 0) {
+		/* more items remain so no thief can race us for this one */
+		if (G_UNLIKELY (buffer->mask >= WSQUEUE_DEFAULT_SIZE &&
+		                size < (buffer->mask + 1) / WSQUEUE_SHRINK_RATIO))
+			iris_wsqueue_resize (queue, (buffer->mask + 1) >> 1,
+			                     top, bottom);
 
-		if (priv->head_idx <= tail) {
-			/* item is still available */
-			result = priv->items [tail & priv->mask];
-		}
-		else {
-			/* we lost the race, restore the tail */
-			priv->tail_idx = tail + 1;
-			result = NULL;
-		}
-
-		g_mutex_unlock (priv->mutex);
+		return result;
 	}
 
+	/* this is the last item, we need to race any thieves for it */
+	if (!g_atomic_int_compare_and_exchange ((gint*)&priv->top, top, top + 1))
+		result = NULL;
+
+	g_atomic_int_set ((gint*)&priv->bottom, bottom + 1);
+
 	return result;
 }
 
+/**
+ * iris_wsqueue_stand_in_pop:
+ * @queue: An #IrisWSQueue
+ * @timeout: the time to wait for work on the global queue until
+ *
+ * Takes work for a thread standing in for the owner of @queue while the
+ * owner is blocked: first what the owner has queued itself, then work from
+ * the global queue. Items pushed to the owner's inbox are passed on to the
+ * global queue, as they would be if the owner were waiting for work. This
+ * may be called from any thread.
+ *
+ * Return value: A gpointer or %NULL if no items were available in time.
+ */
+gpointer
+iris_wsqueue_stand_in_pop (IrisWSQueue *queue,
+                           GTimeVal    *timeout)
+{
+	IrisLink *link,
+	         *next;
+	gpointer  result;
+
+	g_return_val_if_fail (queue != NULL, NULL);
+
+	if ((result = iris_wsqueue_try_steal (queue, 0)) != NULL)
+		return result;
+
+	for (link = iris_wsqueue_take_inbox (queue, NULL); link; link = next) {
+		next = link->next;
+		iris_queue_push (queue->priv->global, link->data);
+		iris_thread_cache_free (link);
+	}
+
+	return iris_queue_timed_pop (queue->priv->global, timeout);
+}
+
+/* Counts compare-and-swaps on 'top' that a thief lost to the owner or to
+ * another thief, if it is one of our threads.
+ */
+static void
+iris_wsqueue_count_failed_steals (guint n_failed)
+{
+	IrisThread *thread;
+
+	if (n_failed > 0 && (thread = iris_thread_get ()) && thread->stats)
+		thread->stats->failed_steals += n_failed;
+}
+
+/**
+ * iris_wsqueue_try_steal_many:
+ * @queue: An #IrisWSQueue
+ * @items: an array with room for @max_items pointers
+ * @max_items: the most items to steal
+ *
+ * Tries to steal up to half of the items in the #IrisWSQueue, but no more
+ * than @max_items, from the top. Each item is still claimed with its own
+ * compare-and-swap, since the owner pops from the other end without one,
+ * but a thief only has to find a victim once for the whole batch. This may
+ * be called from any thread.
+ *
+ * Return value: the number of items stored in @items.
+ */
+guint
+iris_wsqueue_try_steal_many (IrisWSQueue *queue,
+                             gpointer    *items,
+                             guint        max_items)
+{
+	IrisWSQueuePrivate *priv;
+	IrisWSQueueBuffer  *buffer;
+	guint               n_items = 0,
+	                    n_failed = 0;
+	guint               top;
+	guint               bottom;
+	gint                size;
+
+	g_return_val_if_fail (queue != NULL, 0);
+	g_return_val_if_fail (items != NULL || max_items == 0, 0);
+
+	priv = queue->priv;
+
+	iris_epoch_enter ();
+
+	top = g_atomic_int_get ((gint*)&priv->top);
+	bottom = g_atomic_int_get ((gint*)&priv->bottom);
+	size = (gint)(bottom - top);
+
+	/* Leave the owner the other half */
+	if (size > 0)
+		max_items = MIN (max_items, (guint)(size + 1) / 2);
+
+	while (n_items < max_items) {
+		top = g_atomic_int_get ((gint*)&priv->top);
+		bottom = g_atomic_int_get ((gint*)&priv->bottom);
+
+		if ((gint)(bottom - top) <= 0)
+			break;
+
+		buffer = g_atomic_pointer_get (&priv->buffer);
+		items[n_items] = buffer->items [top & buffer->mask];
+
+		if (g_atomic_int_compare_and_exchange ((gint*)&priv->top,
+		                                       top, top + 1))
+			n_items++;
+		else
+			n_failed++;
+	}
+
+	iris_epoch_leave ();
+
+	iris_wsqueue_count_failed_steals (n_failed);
+
+	return n_items;
+}
+
 /**
  * iris_wsqueue_try_steal:
  * @queue: An #IrisWSQueue
- * @timeout: timeout in millseconds
+ * @timeout: timeout in millseconds. Stealing is lock-free, so this is
+ *   currently ignored.
  *
- * Tries to steal an item from the #IrisWSQueue within the timeout
- * specified.
+ * Tries to steal an item from the top of the #IrisWSQueue. This may be
+ * called from any thread.
  *
  * Return value: A gpointer or %NULL if no items were available.
  */
@@ -435,48 +935,46 @@ iris_wsqueue_try_steal (IrisWSQueue *queue,
                         guint        timeout)
 {
 	IrisWSQueuePrivate *priv;
-	gboolean            taken  = FALSE;
+	IrisWSQueueBuffer  *buffer;
 	gpointer            result = NULL;
-	gint                head;
-
-	#ifdef WIN32
-	DWORD    wait_result;
-	#else
-	GTimeVal tv          = {0,0};
-	#endif
+	guint               top;
+	guint               bottom;
+	guint               n_failed = 0;
 
 	g_return_val_if_fail (queue != NULL, NULL);
 
 	priv = queue->priv;
 
-	/* GMutex does not export timedlock, so for now we will use
-	 * the non-portable pthread call directly.
+	/* Enter before loading the buffer so the owner does not free it out
+	 * from under us after a resize.
 	 */
-	#ifdef WIN32
-	/* pthread_mutex_timedlock returns 0 on success */
-	wait_result = WaitForSingleObject (
-	              (CRITICAL_SECTION *)priv->mutex,
-	              timeout);
-	taken = (wait_result != WAIT_OBJECT_0);
-	#else
-	g_get_current_time (&tv);
-	g_time_val_add (&tv, (G_USEC_PER_SEC / 1000) * timeout);
+	iris_epoch_enter ();
 
-	taken = pthread_mutex_timedlock (
-			(pthread_mutex_t*)priv->mutex,
-			(struct timespec*)&tv);
-	#endif
+	for (;;) {
+		top = g_atomic_int_get ((gint*)&priv->top);
+		bottom = g_atomic_int_get ((gint*)&priv->bottom);
 
-	head = priv->head_idx;
-	g_atomic_int_set (&priv->head_idx, head + 1);
+		if ((gint)(bottom - top) <= 0) {
+			result = NULL;
+			break;
+		}
+
+		buffer = g_atomic_pointer_get (&priv->buffer);
+		result = buffer->items [top & buffer->mask];
+
+		if (g_atomic_int_compare_and_exchange ((gint*)&priv->top,
+		                                       top, top + 1))
+			break;
+
+		/* Another thief or the owner got the item first; try again with
+		 * the next one.
+		 */
+		n_failed++;
+	}
 
-	if (head < priv->tail_idx)
-		result = priv->items [head & priv->mask];
-	else
-		priv->head_idx = head;
+	iris_epoch_leave ();
 
-	if (taken)
-		g_mutex_unlock (priv->mutex);
+	iris_wsqueue_count_failed_steals (n_failed);
 
 	return result;
 }
@@ -56,6 +56,10 @@ IrisQueue*   iris_wsqueue_new        (IrisQueue   *global,
                                       IrisRRobin  *peers);
 gpointer     iris_wsqueue_try_steal  (IrisWSQueue *queue,
                                       guint        timeout);
+guint        iris_wsqueue_try_steal_many
+                                     (IrisWSQueue *queue,
+                                      gpointer    *items,
+                                      guint        max_items);
 void         iris_wsqueue_local_push (IrisWSQueue *queue,
                                       gpointer     data);
 gpointer     iris_wsqueue_local_pop  (IrisWSQueue *queue);
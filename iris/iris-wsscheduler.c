@@ -25,6 +25,7 @@
 #include "iris-scheduler-manager.h"
 #include "iris-wsscheduler.h"
 #include "iris-wsqueue.h"
+#include "iris-wsqueue-private.h"
 
 /**
  * SECTION:iris-wsscheduler
@@ -37,7 +38,9 @@
  *
  * A global queue is used for work items generated from outside the schedulers
  * set of threads.  If a new work-item is created from the schedulers thread,
- * it will be put into a private queue for the running thread.
+ * it will be put into a private queue for the running thread. Work queued
+ * with iris_scheduler_queue_with_affinity() goes to the private queue of the
+ * thread chosen for its key, wherever it comes from.
  *
  * To prevent thread-starvation, if a thread runs out of work items it will
  * try to steal work from other threads.
@@ -70,10 +73,11 @@ struct _IrisWSSchedulerPrivate
 G_DEFINE_TYPE (IrisWSScheduler, iris_wsscheduler, IRIS_TYPE_SCHEDULER)
 
 static void
-iris_wsscheduler_queue_real (IrisScheduler  *scheduler,
-                             IrisCallback    func,
-                             gpointer        data,
-                             GDestroyNotify  destroy_notify)
+iris_wsscheduler_queue_full_real (IrisScheduler  *scheduler,
+                                  IrisCallback    func,
+                                  gpointer        data,
+                                  GDestroyNotify  destroy_notify,
+                                  IrisPriority    priority)
 {
 	IrisWSSchedulerPrivate *priv;
 	IrisThread             *thread;
@@ -85,16 +89,21 @@ iris_wsscheduler_queue_real (IrisScheduler  *scheduler,
 	priv = IRIS_WSSCHEDULER (scheduler)->priv;
 
 	thread = iris_thread_get ();
-	thread_work = iris_thread_work_new (func, data, destroy_notify);
+	thread_work = iris_scheduler_work_new (scheduler, func, data,
+	                                       destroy_notify, priority);
 
 	/* If the current thread is an iris-thread and it is a member of our
 	 * scheduler, then we will queue it to its own lock-free queue.  This
 	 * helps keep cpu cache hits up as well since the local thread will already
 	 * have the associated data hot.  However, we need to make sure the thread
 	 * will take this item sooner so its own work doesn't invalidate cache.
+	 *
+	 * The local queues have no priority levels, so anything other than
+	 * normal priority work goes to the global queue, which does.
 	 */
 
-	if (thread &&
+	if (priority == IRIS_PRIORITY_NORMAL &&
+	    thread &&
 	    thread->scheduler == scheduler &&
 	    iris_thread_is_working (thread))
 	{
@@ -102,76 +111,103 @@ iris_wsscheduler_queue_real (IrisScheduler  *scheduler,
 		return;
 	}
 
-	iris_queue_push (priv->queue, thread_work);
+	iris_priority_queue_push_full (IRIS_PRIORITY_QUEUE (priv->queue),
+	                               thread_work,
+	                               priority);
 }
 
+static void
+iris_wsscheduler_queue_real (IrisScheduler  *scheduler,
+                             IrisCallback    func,
+                             gpointer        data,
+                             GDestroyNotify  destroy_notify)
+{
+	iris_wsscheduler_queue_full_real (scheduler,
+	                                  func,
+	                                  data,
+	                                  destroy_notify,
+	                                  IRIS_PRIORITY_NORMAL);
+}
 
-typedef struct {
-	IrisScheduler            *scheduler;
-	IrisSchedulerForeachFunc  callback;
-	gpointer                  user_data;
-} IrisSchedulerForeachClosure;
-
-static gboolean
-iris_wsscheduler_foreach_rrobin_cb (IrisRRobin *rrobin,
-                                    gpointer    data,
-                                    gpointer    user_data)
+static void
+iris_wsscheduler_queue_affinity_real (IrisScheduler  *scheduler,
+                                      gconstpointer   key,
+                                      IrisCallback    func,
+                                      gpointer        data,
+                                      GDestroyNotify  destroy_notify)
 {
-	IrisQueue                    *queue   = data;
-	IrisSchedulerForeachClosure  *closure = user_data;
-	gboolean continue_flag;
-	gint i;
-
-	/* Foreach the queue in a really hacky way. FIXME: be neater! */
-	for (i=0; i<iris_queue_get_length(queue); i++) {
-		IrisThreadWork *thread_work = iris_queue_try_pop (queue);
-
-		if (!thread_work) break;
-
-		continue_flag = closure->callback (closure->scheduler,
-		                                   thread_work,
-		                                   thread_work->callback,
-		                                   thread_work->data,
-		                                   closure->user_data);
-
-		if (g_atomic_int_get (&thread_work->remove) == FALSE)
-			iris_queue_push (queue, thread_work);
-		else
-			iris_thread_work_free (thread_work);
-
-		if (!continue_flag)
-			break;
+	IrisWSSchedulerPrivate *priv;
+	IrisThread             *thread;
+	IrisThreadWork         *thread_work;
+	IrisQueue              *queue = NULL;
+
+	g_return_if_fail (scheduler != NULL);
+	g_return_if_fail (func != NULL);
+
+	priv = IRIS_WSSCHEDULER (scheduler)->priv;
+
+	thread = iris_thread_get ();
+	thread_work = iris_scheduler_work_new (scheduler, func, data,
+	                                       destroy_notify, IRIS_PRIORITY_NORMAL);
+
+	if (G_LIKELY (priv->rrobin != NULL))
+		queue = iris_scheduler_get_affinity_queue (priv->rrobin, key);
+
+	/* Work for the same key always goes to the same thread's queue while
+	 * that thread keeps up, and only moves elsewhere if it is stolen. If
+	 * the thread is us, we can push it without going through the inbox.
+	 */
+	if (queue != NULL && iris_queue_get_length (queue) < AFFINITY_MAX_LENGTH) {
+		if (thread &&
+		    thread->active == queue &&
+		    iris_thread_is_working (thread))
+		{
+			iris_wsqueue_local_push (IRIS_WSQUEUE (queue), thread_work);
+			return;
+		}
+
+		if (iris_wsqueue_remote_push (IRIS_WSQUEUE (queue), thread_work))
+			return;
 	}
 
-	return continue_flag;
+	iris_priority_queue_push_full (IRIS_PRIORITY_QUEUE (priv->queue),
+	                               thread_work,
+	                               IRIS_PRIORITY_NORMAL);
 }
 
 static void
-iris_wsscheduler_foreach_real (IrisScheduler            *scheduler,
-                               IrisSchedulerForeachFunc  callback,
-                               gpointer                  user_data)
+iris_wsscheduler_queue_batch_real (IrisScheduler                *scheduler,
+                                   const IrisSchedulerBatchItem *items,
+                                   guint                         n_items)
 {
-	IrisWSSchedulerPrivate      *priv;
-	IrisSchedulerForeachClosure  closure;
+	IrisWSSchedulerPrivate  *priv;
+	IrisThread              *thread;
+	IrisThreadWork         **works;
+	guint                    i;
 
 	g_return_if_fail (scheduler != NULL);
-	g_return_if_fail (callback != NULL);
 
 	priv = IRIS_WSSCHEDULER (scheduler)->priv;
 
-	closure.scheduler = scheduler;
-	closure.callback  = callback;
-	closure.user_data = user_data;
-
-	/* Iterate through our queue .. */
-	iris_wsscheduler_foreach_rrobin_cb (NULL, priv->queue, &closure);
+	thread = iris_thread_get ();
+	works = iris_scheduler_work_new_batch (scheduler, items, n_items);
 
-	/* Iterate through each thread's queue */
-	iris_rrobin_foreach (priv->rrobin,
-	                     iris_wsscheduler_foreach_rrobin_cb,
-	                     &closure);
-};
+	/* As with single items, work generated by one of our own threads stays
+	 * on its local deque, where it can be stolen by idle threads.  Anything
+	 * else goes to the global queue under one lock.
+	 */
+	if (thread &&
+	    thread->scheduler == scheduler &&
+	    iris_thread_is_working (thread))
+	{
+		for (i = 0; i < n_items; i++)
+			iris_wsqueue_local_push (IRIS_WSQUEUE (thread->active), works[i]);
+	}
+	else
+		iris_queue_push_many (priv->queue, (gpointer *)works, n_items);
 
+	g_free (works);
+}
 
 static void
 iris_wsscheduler_remove_thread_real (IrisScheduler *scheduler,
@@ -204,8 +240,13 @@ iris_wsscheduler_add_thread_real (IrisScheduler  *scheduler,
 
 	priv = IRIS_WSSCHEDULER (scheduler)->priv;
 
+	/* We are called with the scheduler manager locked, so this is safe */
+	if (G_UNLIKELY (!priv->rrobin))
+		priv->rrobin = iris_rrobin_new (iris_scheduler_get_max_threads (scheduler));
+
 	/* create the threads queue for the round robin */
 	queue = iris_wsqueue_new (priv->queue, priv->rrobin);
+	iris_wsqueue_set_cpu (IRIS_WSQUEUE (queue), thread->cpu);
 	thread->user_data = queue;
 
 	/* add the queue to the round robin */
@@ -224,6 +265,12 @@ error:
 	thread->user_data = NULL;
 }
 
+static guint
+iris_wsscheduler_get_global_length_real (IrisScheduler *scheduler)
+{
+	return iris_queue_get_length (IRIS_WSSCHEDULER (scheduler)->priv->queue);
+}
+
 static void
 iris_wsscheduler_finalize (GObject *object)
 {
@@ -243,9 +290,12 @@ iris_wsscheduler_class_init (IrisWSSchedulerClass *klass)
 	IrisSchedulerClass *sched_class = IRIS_SCHEDULER_CLASS (klass);
 
 	sched_class->queue = iris_wsscheduler_queue_real;
-	sched_class->foreach = iris_wsscheduler_foreach_real;
+	sched_class->queue_full = iris_wsscheduler_queue_full_real;
+	sched_class->queue_batch = iris_wsscheduler_queue_batch_real;
+	sched_class->queue_affinity = iris_wsscheduler_queue_affinity_real;
 	sched_class->add_thread = iris_wsscheduler_add_thread_real;
 	sched_class->remove_thread = iris_wsscheduler_remove_thread_real;
+	sched_class->get_global_length = iris_wsscheduler_get_global_length_real;
 	object_class->finalize = iris_wsscheduler_finalize;
 
 	g_type_class_add_private (object_class, sizeof (IrisWSSchedulerPrivate));
@@ -254,22 +304,18 @@ iris_wsscheduler_class_init (IrisWSSchedulerClass *klass)
 static void
 iris_wsscheduler_init (IrisWSScheduler *scheduler)
 {
-	guint max_threads;
-
 	scheduler->priv = G_TYPE_INSTANCE_GET_PRIVATE (scheduler,
 	                                               IRIS_TYPE_WSSCHEDULER,
 	                                               IrisWSSchedulerPrivate);
 
 	scheduler->priv->mutex = g_mutex_new ();
-	scheduler->priv->queue = iris_queue_new ();
+	scheduler->priv->queue = iris_priority_queue_new ();
 	scheduler->priv->has_leader = FALSE;
 
-	/* FIXME: This is technically broken since it gets modified
-	 *   after we call it.
+	/* The round robin is created along with the first thread, once
+	 * max_threads is known.
 	 */
-
-	max_threads = iris_scheduler_get_max_threads (IRIS_SCHEDULER (scheduler));
-	scheduler->priv->rrobin = iris_rrobin_new (max_threads);
+	scheduler->priv->rrobin = NULL;
 }
 
 /**
@@ -307,3 +353,30 @@ iris_wsscheduler_new_full (guint min_threads,
 
 	return scheduler;
 }
+
+/**
+ * iris_wsscheduler_new_with_cpus:
+ * @min_threads: a #guint containing the minimum number of threads
+ * @max_threads: a #guint containing the maximum number of threads
+ * @cpus: An array of CPU numbers
+ * @n_cpus: The length of @cpus
+ *
+ * Creates a new instance of the work-stealing scheduler whose threads are
+ * bound to the CPUs in @cpus. See iris_scheduler_set_cpus(). Idle threads
+ * prefer to steal from threads that share a cache or NUMA node with them.
+ *
+ * Return value: the newly created #IrisWSScheduler.
+ */
+IrisScheduler*
+iris_wsscheduler_new_with_cpus (guint        min_threads,
+                                guint        max_threads,
+                                const guint *cpus,
+                                guint        n_cpus)
+{
+	IrisScheduler *scheduler;
+
+	scheduler = iris_wsscheduler_new_full (min_threads, max_threads);
+	iris_scheduler_set_cpus (scheduler, cpus, n_cpus);
+
+	return scheduler;
+}
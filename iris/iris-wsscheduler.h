@@ -56,6 +56,11 @@ GType          iris_wsscheduler_get_type (void) G_GNUC_CONST;
 IrisScheduler* iris_wsscheduler_new      (void);
 IrisScheduler* iris_wsscheduler_new_full (guint min_threads,
                                           guint max_threads);
+IrisScheduler* iris_wsscheduler_new_with_cpus
+                                         (guint        min_threads,
+                                          guint        max_threads,
+                                          const guint *cpus,
+                                          guint        n_cpus);
 
 G_END_DECLS
 
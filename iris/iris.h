@@ -26,6 +26,9 @@
 /* basic data structures */
 #include "iris-queue.h"
 #include "iris-lfqueue.h"
+#include "iris-priority-queue.h"
+#include "iris-ring-queue.h"
+#include "iris-spsc-queue.h"
 #include "iris-wsqueue.h"
 #include "iris-rrobin.h"
 #include "iris-stack.h"
@@ -33,9 +36,11 @@
 /* scheduler subsystem */
 #include "iris-scheduler.h"
 #include "iris-gmainscheduler.h"
+#include "iris-ioscheduler.h"
 #include "iris-lfscheduler.h"
 #include "iris-wsscheduler.h"
 #include "iris-scheduler-manager.h"
+#include "iris-load-controller.h"
 
 /* message passing and arbitration */
 #include "iris-message.h"
@@ -50,9 +55,12 @@
 #include "iris-service.h"
 #include "iris-task.h"
 #include "iris-process.h"
+#include "iris-coroutine.h"
+#include "iris-parallel.h"
 
 /* monitoring */
 #include "iris-progress-monitor.h"
+#include "iris-trace.h"
 
 /* global API methods */
 void iris_init (void);
@@ -0,0 +1,260 @@
+#include <iris.h>
+
+#define N_MESSAGES   100
+#define N_COROUTINES 10000
+
+static IrisCoroutine *
+run_coroutine (IrisCoroutineFunc  func,
+               gpointer           user_data,
+               IrisScheduler     *scheduler)
+{
+	IrisCoroutine *coroutine;
+
+	coroutine = iris_coroutine_new_full (func, user_data, NULL,
+	                                     NULL, scheduler, NULL);
+	g_object_ref (coroutine);
+	iris_task_run (IRIS_TASK (coroutine));
+
+	return coroutine;
+}
+
+static void
+set_flag_cb (IrisCoroutine *coroutine,
+             gpointer       user_data)
+{
+	g_assert (iris_coroutine_get_current () == coroutine);
+
+	g_atomic_int_set ((gint *)user_data, TRUE);
+}
+
+/* The body runs, and the coroutine finishes like a task */
+static void
+test1 (void)
+{
+	IrisCoroutine *coroutine;
+	gint           flag = FALSE;
+
+	g_assert (iris_coroutine_get_current () == NULL);
+
+	coroutine = run_coroutine (set_flag_cb, &flag, NULL);
+	iris_task_wait (IRIS_TASK (coroutine));
+
+	g_assert (flag == TRUE);
+	g_assert (iris_task_is_finished (IRIS_TASK (coroutine)));
+	g_assert (iris_task_has_succeeded (IRIS_TASK (coroutine)));
+
+	g_object_unref (coroutine);
+}
+
+typedef struct
+{
+	IrisScheduler *scheduler;
+	gint           value;
+	gboolean       seen;
+} AwaitTest;
+
+static void
+set_value_cb (IrisTask *task,
+              gpointer  user_data)
+{
+	AwaitTest *test = user_data;
+
+	g_usleep (10000);
+	test->value = 42;
+}
+
+static void
+await_cb (IrisCoroutine *coroutine,
+          gpointer       user_data)
+{
+	AwaitTest *test = user_data;
+	IrisTask  *task;
+
+	task = iris_task_new_full (set_value_cb, test, NULL, FALSE,
+	                           NULL, test->scheduler, NULL);
+	g_object_ref (task);
+	iris_task_run (task);
+
+	iris_coroutine_await (task);
+	test->seen = (test->value == 42);
+
+	/* Once it has finished, awaiting it again returns straight away */
+	iris_coroutine_await (task);
+
+	g_object_unref (task);
+}
+
+/* A coroutine can wait for a task that needs its own thread, on a scheduler
+ * with only the one thread.
+ */
+static void
+test2 (void)
+{
+	IrisCoroutine *coroutine;
+	AwaitTest      test = { NULL, 0, FALSE };
+
+	test.scheduler = iris_scheduler_new_full (1, 1);
+
+	coroutine = run_coroutine (await_cb, &test, test.scheduler);
+	iris_task_wait (IRIS_TASK (coroutine));
+
+	g_assert (test.seen);
+
+	g_object_unref (coroutine);
+	g_object_unref (test.scheduler);
+}
+
+typedef struct
+{
+	IrisPort *port;
+	gint      received;
+	gboolean  in_order;
+} PortTest;
+
+static void
+await_port_cb (IrisCoroutine *coroutine,
+               gpointer       user_data)
+{
+	PortTest    *test = user_data;
+	IrisMessage *message;
+	gint         i;
+
+	test->in_order = TRUE;
+
+	for (i = 0; i < N_MESSAGES; i++) {
+		message = iris_coroutine_await_port (test->port);
+
+		if (message->what != i)
+			test->in_order = FALSE;
+		test->received ++;
+
+		iris_message_unref (message);
+	}
+}
+
+/* Messages arrive in order, whether they were posted before or after the
+ * coroutine started waiting.
+ */
+static void
+test3 (void)
+{
+	IrisScheduler *scheduler;
+	IrisCoroutine *coroutine;
+	PortTest       test = { NULL, 0, FALSE };
+	gint           i;
+
+	scheduler = iris_wsscheduler_new_full (2, 2);
+	test.port = iris_port_new ();
+
+	for (i = 0; i < N_MESSAGES / 2; i++)
+		iris_port_post (test.port, iris_message_new (i));
+
+	coroutine = run_coroutine (await_port_cb, &test, scheduler);
+
+	for (; i < N_MESSAGES; i++)
+		iris_port_post (test.port, iris_message_new (i));
+
+	iris_task_wait (IRIS_TASK (coroutine));
+
+	g_assert_cmpint (test.received, ==, N_MESSAGES);
+	g_assert (test.in_order);
+	g_assert (!iris_port_has_receiver (test.port));
+
+	g_object_unref (coroutine);
+	g_object_unref (test.port);
+	g_object_unref (scheduler);
+}
+
+static volatile gint n_finished;
+
+static void
+wait_one_cb (IrisCoroutine *coroutine,
+             gpointer       user_data)
+{
+	IrisMessage *message;
+
+	message = iris_coroutine_await_port (user_data);
+	iris_message_unref (message);
+
+	g_atomic_int_inc (&n_finished);
+}
+
+static void
+run_many (gint n_coroutines)
+{
+	IrisScheduler  *scheduler;
+	IrisCoroutine **coroutines;
+	IrisPort      **ports;
+	gint            i;
+
+	scheduler = iris_wsscheduler_new_full (2, 2);
+	coroutines = g_new (IrisCoroutine *, n_coroutines);
+	ports = g_new (IrisPort *, n_coroutines);
+
+	n_finished = 0;
+
+	for (i = 0; i < n_coroutines; i++) {
+		ports [i] = iris_port_new ();
+		coroutines [i] = run_coroutine (wait_one_cb, ports [i], scheduler);
+	}
+
+	/* Every one of them is waiting at once, on two threads */
+	for (i = 0; i < n_coroutines; i++)
+		iris_port_post (ports [i], iris_message_new (i));
+
+	for (i = 0; i < n_coroutines; i++) {
+		iris_task_wait (IRIS_TASK (coroutines [i]));
+		g_object_unref (coroutines [i]);
+		g_object_unref (ports [i]);
+	}
+
+	g_assert_cmpint (n_finished, ==, n_coroutines);
+
+	g_free (coroutines);
+	g_free (ports);
+	g_object_unref (scheduler);
+}
+
+/* Many more coroutines can wait than there are threads */
+static void
+test4 (void)
+{
+	run_many (N_COROUTINES);
+}
+
+/* Rate of coroutines started, suspended and resumed. Only run with
+ * -m perf.
+ */
+static void
+test5 (void)
+{
+	GTimer  *timer;
+	gdouble  rate;
+
+	timer = g_timer_new ();
+	run_many (10 * N_COROUTINES);
+	rate = 10 * N_COROUTINES / g_timer_elapsed (timer, NULL);
+
+	g_test_maximized_result (rate, "%.0f coroutines/sec", rate);
+
+	g_timer_destroy (timer);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+	g_type_init ();
+	g_test_init (&argc, &argv, NULL);
+	g_thread_init (NULL);
+
+	g_test_add_func ("/coroutine/run1", test1);
+	g_test_add_func ("/coroutine/await1", test2);
+	g_test_add_func ("/coroutine/await_port1", test3);
+	g_test_add_func ("/coroutine/many1", test4);
+
+	if (g_test_perf ())
+		g_test_add_func ("/coroutine/throughput1", test5);
+
+	return g_test_run ();
+}
@@ -0,0 +1,268 @@
+#include <iris.h>
+#include <iris/iris-epoch.h>
+#include <iris/iris-free-list.h>
+
+#define N_THREADS 4      /* Of pushers, and again of poppers */
+#define N_ITEMS   20000  /* Pushed by each pusher            */
+
+static void
+count_cb (gpointer data,
+          gpointer user_data)
+{
+	g_atomic_int_inc ((volatile gint *)user_data);
+}
+
+/* retire: test retired memory is reclaimed once nobody is inside */
+static void
+test1 (void)
+{
+	volatile gint counter = 0;
+	gint          i;
+
+	for (i = 0; i < 10; i++)
+		iris_epoch_retire (&i, count_cb, (gpointer)&counter);
+
+	iris_epoch_flush ();
+	g_assert_cmpint (counter, ==, 10);
+}
+
+/* nested: test nothing retired inside a section is reclaimed before the
+ * outermost section is left.
+ */
+static void
+test2 (void)
+{
+	volatile gint counter = 0;
+	gint          i;
+
+	iris_epoch_enter ();
+	iris_epoch_enter ();
+
+	iris_epoch_retire (&i, count_cb, (gpointer)&counter);
+
+	iris_epoch_leave ();
+	iris_epoch_flush ();
+	g_assert_cmpint (counter, ==, 0);
+
+	iris_epoch_leave ();
+	iris_epoch_flush ();
+	g_assert_cmpint (counter, ==, 1);
+}
+
+typedef struct
+{
+	IrisQueue     *queue;
+	IrisStack     *stack;
+	volatile gint  next_seed;
+	volatile gint  popped;
+	volatile gint  seen[N_THREADS * N_ITEMS + 1];
+} StressTest;
+
+/* Gives up the CPU at random points, so threads get preempted in the
+ * middle of each other's operations as often as possible.
+ */
+static void
+maybe_preempt (GRand *rand)
+{
+	switch (g_rand_int_range (rand, 0, 64)) {
+	case 0:
+		g_usleep (g_rand_int_range (rand, 1, 50));
+		break;
+	case 1:
+	case 2:
+	case 3:
+		g_thread_yield ();
+		break;
+	default:
+		break;
+	}
+}
+
+static gpointer
+stress_pusher (gpointer data)
+{
+	StressTest *test = data;
+	GRand      *rand;
+	gint        id, i;
+
+	id = g_atomic_int_exchange_and_add (&test->next_seed, 1);
+	rand = g_rand_new_with_seed (id);
+
+	for (i = 1; i <= N_ITEMS; i++) {
+		gpointer item = GINT_TO_POINTER ((id % N_THREADS) * N_ITEMS + i);
+
+		if (test->queue)
+			iris_queue_push (test->queue, item);
+		else
+			iris_stack_push (test->stack, item);
+
+		maybe_preempt (rand);
+	}
+
+	g_rand_free (rand);
+	return NULL;
+}
+
+static gpointer
+stress_popper (gpointer data)
+{
+	StressTest *test = data;
+	GRand      *rand;
+	gpointer    item;
+
+	rand = g_rand_new_with_seed (g_atomic_int_exchange_and_add (&test->next_seed, 1));
+
+	while (g_atomic_int_get (&test->popped) < N_THREADS * N_ITEMS) {
+		if (test->queue)
+			item = iris_queue_try_pop (test->queue);
+		else
+			item = iris_stack_pop (test->stack);
+
+		if (item) {
+			g_atomic_int_inc (&test->seen[GPOINTER_TO_INT (item)]);
+			g_atomic_int_inc (&test->popped);
+		}
+
+		maybe_preempt (rand);
+	}
+
+	g_rand_free (rand);
+	return NULL;
+}
+
+static void
+run_stress_test (StressTest *test)
+{
+	GThread *threads[N_THREADS * 2];
+	gint     i;
+
+	test->next_seed = 0;
+	test->popped = 0;
+	for (i = 0; i <= N_THREADS * N_ITEMS; i++)
+		test->seen[i] = 0;
+
+	/* Pushers take the first N_THREADS seeds, so their ids are 0..N-1 */
+	for (i = 0; i < N_THREADS; i++)
+		threads[i] = g_thread_create (stress_pusher, test, TRUE, NULL);
+	while (g_atomic_int_get (&test->next_seed) < N_THREADS)
+		g_thread_yield ();
+	for (i = N_THREADS; i < N_THREADS * 2; i++)
+		threads[i] = g_thread_create (stress_popper, test, TRUE, NULL);
+
+	for (i = 0; i < N_THREADS * 2; i++)
+		g_thread_join (threads[i]);
+
+	/* Every item came out exactly once */
+	g_assert_cmpint (test->seen[0], ==, 0);
+	for (i = 1; i <= N_THREADS * N_ITEMS; i++)
+		g_assert_cmpint (test->seen[i], ==, 1);
+}
+
+/* lfqueue-stress: test pushes and pops from many threads at once, with
+ * random preemption, neither lose nor duplicate items.
+ */
+static void
+test3 (void)
+{
+	StressTest *test = g_new0 (StressTest, 1);
+
+	test->queue = iris_lfqueue_new ();
+	run_stress_test (test);
+
+	g_assert (iris_queue_try_pop (test->queue) == NULL);
+	g_assert_cmpint (iris_queue_get_length (test->queue), ==, 0);
+
+	g_object_unref (test->queue);
+	g_free (test);
+}
+
+/* stack-stress: as lfqueue-stress, for #IrisStack */
+static void
+test4 (void)
+{
+	StressTest *test = g_new0 (StressTest, 1);
+
+	test->stack = iris_stack_new ();
+	run_stress_test (test);
+
+	g_assert (iris_stack_pop (test->stack) == NULL);
+
+	iris_stack_unref (test->stack);
+	g_free (test);
+}
+
+typedef struct
+{
+	IrisFreeList  *free_list;
+	volatile gint  next_seed;
+} FreeListTest;
+
+static gpointer
+free_list_worker (gpointer data)
+{
+	FreeListTest *test = data;
+	IrisLink     *links[8];
+	GRand        *rand;
+	gint          i, j;
+
+	rand = g_rand_new_with_seed (g_atomic_int_exchange_and_add (&test->next_seed, 1));
+
+	for (i = 0; i < N_ITEMS / 8; i++) {
+		/* A link handed to two threads at once would fail here */
+		for (j = 0; j < 8; j++) {
+			links[j] = iris_free_list_get (test->free_list);
+			g_assert (links[j]->data == NULL);
+			links[j]->data = links;
+			maybe_preempt (rand);
+		}
+
+		for (j = 0; j < 8; j++) {
+			g_assert (links[j]->data == links);
+			links[j]->data = NULL;
+			iris_free_list_put (test->free_list, links[j]);
+			maybe_preempt (rand);
+		}
+	}
+
+	/* Give back what this thread is still holding */
+	iris_epoch_flush ();
+
+	g_rand_free (rand);
+	return NULL;
+}
+
+/* free-list-stress: test no link is handed out twice while it is in use */
+static void
+test5 (void)
+{
+	FreeListTest  test;
+	GThread      *threads[N_THREADS * 2];
+	gint          i;
+
+	test.free_list = iris_free_list_new ();
+	test.next_seed = 0;
+
+	for (i = 0; i < N_THREADS * 2; i++)
+		threads[i] = g_thread_create (free_list_worker, &test, TRUE, NULL);
+	for (i = 0; i < N_THREADS * 2; i++)
+		g_thread_join (threads[i]);
+
+	iris_free_list_free (test.free_list);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+	g_type_init ();
+	g_test_init (&argc, &argv, NULL);
+	g_thread_init (NULL);
+
+	g_test_add_func ("/epoch/retire", test1);
+	g_test_add_func ("/epoch/nested", test2);
+	g_test_add_func ("/epoch/lfqueue-stress", test3);
+	g_test_add_func ("/epoch/stack-stress", test4);
+	g_test_add_func ("/epoch/free-list-stress", test5);
+
+	return g_test_run ();
+}
@@ -1,4 +1,5 @@
 #include <iris.h>
+#include <iris/iris-epoch.h>
 #include <iris/iris-free-list.h>
 
 static void
@@ -6,8 +7,9 @@ test1 (void)
 {
 	IrisFreeList *free_list = iris_free_list_new ();
 	g_assert (free_list != NULL);
-	g_assert (free_list->head != NULL);
-	g_assert (free_list->head->next == NULL);
+	g_assert (free_list->depot == NULL);
+	g_assert_cmpint (iris_free_list_get_max_free (free_list), ==,
+	                 IRIS_FREE_LIST_DEFAULT_MAX_FREE);
 }
 
 static void
@@ -38,8 +40,80 @@ test4 (void)
 {
 	IrisFreeList *free_list = iris_free_list_new ();
 	g_assert (free_list != NULL);
-	g_assert (free_list->head != NULL);
-	g_assert (free_list->head->next == NULL);
+	g_assert (free_list->depot == NULL);
+	g_assert_cmpint (iris_free_list_get_max_free (free_list), ==,
+	                 IRIS_FREE_LIST_DEFAULT_MAX_FREE);
+	iris_free_list_free (free_list);
+}
+
+/* max_free: test the depot keeps no more links than it is allowed, and
+ * lowering the limit frees the surplus.
+ */
+static void
+test5 (void)
+{
+	IrisFreeList *free_list;
+	IrisLink     *links[1000];
+	IrisLink     *link;
+	gint          i;
+
+	free_list = iris_free_list_new ();
+	iris_free_list_set_max_free (free_list, 4 * IRIS_FREE_LIST_MAGAZINE_SIZE);
+
+	for (i = 0; i < 1000; i++)
+		links [i] = iris_free_list_get (free_list);
+	for (i = 0; i < 1000; i++)
+		iris_free_list_put (free_list, links [i]);
+
+	/* Reclaim them, as nobody else can be looking */
+	iris_epoch_flush ();
+	g_assert_cmpint (free_list->depot_size, ==, 4);
+
+	/* Links come back cleared */
+	link = iris_free_list_get (free_list);
+	g_assert (link->data == NULL && link->next == NULL);
+	iris_free_list_put (free_list, link);
+
+	iris_free_list_set_max_free (free_list, IRIS_FREE_LIST_MAGAZINE_SIZE + 1);
+	g_assert_cmpint (free_list->depot_size, ==, 1);
+
+	iris_free_list_set_max_free (free_list, 0);
+	g_assert_cmpint (free_list->depot_size, ==, 0);
+	g_assert (free_list->depot == NULL);
+
+	iris_epoch_flush ();
+	iris_free_list_free (free_list);
+}
+
+/* flush: test links put back short of a magazine are reclaimed, and give
+ * up their reference on the list, once the thread flushes.
+ */
+static void
+test6 (void)
+{
+	IrisFreeList *free_list;
+	IrisLink     *links[3];
+	IrisLink     *link;
+	gint          i;
+
+	free_list = iris_free_list_new ();
+
+	for (i = 0; i < 3; i++)
+		links [i] = iris_free_list_get (free_list);
+	for (i = 0; i < 3; i++)
+		iris_free_list_put (free_list, links [i]);
+
+	g_assert_cmpint (free_list->ref_count, ==, 2);
+
+	iris_free_list_flush ();
+	iris_epoch_flush ();
+	g_assert_cmpint (free_list->ref_count, ==, 1);
+
+	/* They are handed out again */
+	link = iris_free_list_get (free_list);
+	g_assert (link == links [0] || link == links [1] || link == links [2]);
+	iris_free_list_put (free_list, link);
+
 	iris_free_list_free (free_list);
 }
 
@@ -55,6 +129,8 @@ main (int   argc,
 	g_test_add_func ("/freelist/get", test2);
 	g_test_add_func ("/freelist/put", test3);
 	g_test_add_func ("/freelist/free", test4);
+	g_test_add_func ("/freelist/max_free", test5);
+	g_test_add_func ("/freelist/flush", test6);
 
 	return g_test_run ();
 }
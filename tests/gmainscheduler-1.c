@@ -35,6 +35,44 @@ test2 (void)
 	g_main_loop_run (main_loop);
 }
 
+static void
+test3_cb (gpointer data)
+{
+	gint *counter = data;
+	(*counter) ++;
+}
+
+static void
+test3 (void)
+{
+	IrisScheduler          *scheduler;
+	GMainContext           *context;
+	GMainLoop              *main_loop;
+	IrisSchedulerBatchItem  items[33];
+	gint                    counter = 0,
+	                        i;
+
+	context = g_main_context_default ();
+	main_loop = g_main_loop_new (context, FALSE);
+	scheduler = iris_gmainscheduler_new (context);
+
+	for (i = 0; i < 32; i++) {
+		items[i].callback = test3_cb;
+		items[i].data = &counter;
+		items[i].notify = NULL;
+	}
+
+	/* Items run in order, so the last one can stop the loop */
+	items[32].callback = test2_cb;
+	items[32].data = main_loop;
+	items[32].notify = NULL;
+
+	iris_scheduler_queue_batch (scheduler, items, 33);
+	g_main_loop_run (main_loop);
+
+	g_assert_cmpint (counter, ==, 32);
+}
+
 gint
 main (int   argc,
       char *argv[])
@@ -45,6 +83,7 @@ main (int   argc,
 
 	g_test_add_func ("/gmainscheduler/new", test1);
 	g_test_add_func ("/gmainscheduler/queue", test2);
+	g_test_add_func ("/gmainscheduler/queue_batch", test3);
 
 	return g_test_run ();
 }
@@ -0,0 +1,336 @@
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <iris.h>
+
+#define BIG_SIZE (1024 * 1024)
+
+/* Waits up to a second for *counter to reach value */
+static gboolean
+wait_for_count (volatile gint *counter,
+                gint           value)
+{
+	gint i;
+
+	for (i = 0; i < 1000; i++) {
+		if (g_atomic_int_get (counter) >= value)
+			return TRUE;
+		g_usleep (1000);
+	}
+
+	return FALSE;
+}
+
+static gint64
+get_task_result (IrisTask *task)
+{
+	GValue value = { 0, };
+	gint64 result;
+
+	iris_task_get_result (task, &value);
+	result = g_value_get_int64 (&value);
+	g_value_unset (&value);
+
+	return result;
+}
+
+typedef struct
+{
+	volatile gint n_ready;
+	gint          fd;
+	GIOCondition  condition;
+	gint          n_read;
+} WatchTest;
+
+static void
+ready_cb (IrisMessage *message,
+          gpointer     user_data)
+{
+	WatchTest *test = user_data;
+	gchar      buffer[16];
+	gssize     n;
+
+	g_assert_cmpint (message->what, ==, IRIS_IO_MESSAGE_READY);
+
+	test->fd = iris_message_get_int (message, "fd");
+	test->condition = iris_message_get_int (message, "condition");
+
+	/* Empty the pipe, so the watch can be rearmed */
+	while ((n = read (test->fd, buffer, sizeof (buffer))) > 0)
+		test->n_read += n;
+
+	g_atomic_int_inc (&test->n_ready);
+}
+
+/* A watch posts to its port once, and again each time it is rearmed,
+ * until it is removed.
+ */
+static void
+test1 (void)
+{
+	IrisScheduler *scheduler;
+	IrisPort      *port;
+	IrisIOWatch   *watch;
+	WatchTest      test = { 0, -1, 0, 0 };
+	gint           fds[2];
+
+	g_assert (pipe (fds) == 0);
+	g_assert (fcntl (fds[0], F_SETFL, O_NONBLOCK) == 0);
+
+	scheduler = iris_ioscheduler_new_full (1, 2);
+	port = iris_port_new ();
+	iris_arbiter_receive (scheduler, port, ready_cb, &test, NULL);
+
+	watch = iris_io_watch_fd_full (scheduler, fds[0], G_IO_IN, port);
+	g_assert (watch != NULL);
+
+	/* Nothing to read yet */
+	g_usleep (10000);
+	g_assert_cmpint (test.n_ready, ==, 0);
+
+	g_assert (write (fds[1], "a", 1) == 1);
+	g_assert (wait_for_count (&test.n_ready, 1));
+	g_assert_cmpint (test.fd, ==, fds[0]);
+	g_assert (test.condition & G_IO_IN);
+	g_assert_cmpint (test.n_read, ==, 1);
+
+	/* Disarmed until rearmed */
+	g_assert (write (fds[1], "b", 1) == 1);
+	g_usleep (10000);
+	g_assert_cmpint (test.n_ready, ==, 1);
+
+	iris_io_watch_rearm (watch);
+	g_assert (wait_for_count (&test.n_ready, 2));
+	g_assert_cmpint (test.n_read, ==, 2);
+
+	/* Removed, it does not fire even when rearmed */
+	iris_io_watch_remove (watch);
+	iris_io_watch_rearm (watch);
+	g_assert (write (fds[1], "c", 1) == 1);
+	g_usleep (10000);
+	g_assert_cmpint (test.n_ready, ==, 2);
+
+	iris_io_watch_unref (watch);
+
+	close (fds[0]);
+	close (fds[1]);
+	g_object_unref (port);
+	g_object_unref (scheduler);
+}
+
+/* A hangup is reported even when only G_IO_IN is asked for */
+static void
+test2 (void)
+{
+	IrisScheduler *scheduler;
+	IrisPort      *port;
+	IrisIOWatch   *watch;
+	WatchTest      test = { 0, -1, 0, 0 };
+	gint           fds[2];
+
+	g_assert (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	g_assert (fcntl (fds[0], F_SETFL, O_NONBLOCK) == 0);
+
+	scheduler = iris_ioscheduler_new_full (1, 2);
+	port = iris_port_new ();
+	iris_arbiter_receive (scheduler, port, ready_cb, &test, NULL);
+
+	watch = iris_io_watch_fd_full (scheduler, fds[0], G_IO_IN, port);
+
+	close (fds[1]);
+	g_assert (wait_for_count (&test.n_ready, 1));
+	g_assert (test.condition & G_IO_HUP);
+
+	iris_io_watch_remove (watch);
+	iris_io_watch_unref (watch);
+
+	close (fds[0]);
+	g_object_unref (port);
+	g_object_unref (scheduler);
+}
+
+/* A read task waits for data on the reactor, and a write task completes it */
+static void
+test3 (void)
+{
+	IrisScheduler *scheduler;
+	IrisTask      *read_task,
+	              *write_task;
+	gchar          buffer[16] = { 0, };
+	gint           fds[2];
+
+	g_assert (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+	scheduler = iris_ioscheduler_new_full (1, 2);
+
+	read_task = iris_io_read_task_new_full (scheduler, fds[0],
+	                                        buffer, sizeof (buffer));
+	g_object_ref (read_task);
+	iris_task_run (read_task);
+
+	g_usleep (10000);
+	g_assert (!iris_task_is_finished (read_task));
+
+	write_task = iris_io_write_task_new_full (scheduler, fds[1], "hello", 5);
+	g_object_ref (write_task);
+	iris_task_run (write_task);
+
+	iris_task_wait (write_task);
+	g_assert (iris_task_has_succeeded (write_task));
+	g_assert_cmpint (get_task_result (write_task), ==, 5);
+
+	iris_task_wait (read_task);
+	g_assert (iris_task_has_succeeded (read_task));
+	g_assert_cmpint (get_task_result (read_task), ==, 5);
+	g_assert_cmpstr (buffer, ==, "hello");
+
+	g_object_unref (read_task);
+	g_object_unref (write_task);
+
+	close (fds[0]);
+	close (fds[1]);
+	g_object_unref (scheduler);
+}
+
+/* A write larger than the pipe finishes as it is read from the other end */
+static void
+test4 (void)
+{
+	IrisScheduler *scheduler;
+	IrisTask      *read_task,
+	              *write_task;
+	guint8        *in_buffer,
+	              *out_buffer;
+	gint64         n_read,
+	               n;
+	gint           fds[2],
+	               i;
+
+	g_assert (pipe (fds) == 0);
+
+	scheduler = iris_ioscheduler_new_full (1, 2);
+
+	in_buffer = g_malloc (BIG_SIZE);
+	out_buffer = g_malloc (BIG_SIZE);
+	for (i = 0; i < BIG_SIZE; i++)
+		out_buffer[i] = i % 251;
+
+	write_task = iris_io_write_task_new_full (scheduler, fds[1],
+	                                          out_buffer, BIG_SIZE);
+	g_object_ref (write_task);
+	iris_task_run (write_task);
+
+	for (n_read = 0; n_read < BIG_SIZE; n_read += n) {
+		read_task = iris_io_read_task_new_full (scheduler, fds[0],
+		                                        in_buffer + n_read,
+		                                        BIG_SIZE - n_read);
+		g_object_ref (read_task);
+		iris_task_run (read_task);
+		iris_task_wait (read_task);
+
+		g_assert (iris_task_has_succeeded (read_task));
+		n = get_task_result (read_task);
+		g_assert_cmpint (n, >, 0);
+
+		g_object_unref (read_task);
+	}
+
+	iris_task_wait (write_task);
+	g_assert (iris_task_has_succeeded (write_task));
+	g_assert_cmpint (get_task_result (write_task), ==, BIG_SIZE);
+	g_assert (memcmp (in_buffer, out_buffer, BIG_SIZE) == 0);
+
+	g_object_unref (write_task);
+	g_free (in_buffer);
+	g_free (out_buffer);
+
+	close (fds[0]);
+	close (fds[1]);
+	g_object_unref (scheduler);
+}
+
+/* Errors from the system call become the error of the task */
+static void
+test5 (void)
+{
+	IrisTask *task;
+	GError   *error = NULL;
+	gint      fds[2];
+
+	g_assert (pipe (fds) == 0);
+
+	/* The read end of a pipe cannot be written to */
+	task = iris_io_write_task_new (fds[0], "x", 1);
+	g_object_ref (task);
+	iris_task_run (task);
+	iris_task_wait (task);
+
+	g_assert (!iris_task_has_succeeded (task));
+	g_assert (iris_task_get_fatal_error (task, &error));
+	g_assert (error->domain == G_IO_ERROR);
+	g_error_free (error);
+
+	g_object_unref (task);
+
+	close (fds[0]);
+	close (fds[1]);
+}
+
+/* Cancelling a read task that waits on a descriptor which never becomes
+ * readable finishes it.
+ */
+static void
+test6 (void)
+{
+	IrisScheduler *scheduler;
+	IrisTask      *task;
+	gchar          buffer[16];
+	gint           fds[2],
+	               i;
+
+	g_assert (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+	scheduler = iris_ioscheduler_new_full (1, 2);
+
+	task = iris_io_read_task_new_full (scheduler, fds[0],
+	                                   buffer, sizeof (buffer));
+	g_object_ref (task);
+	iris_task_run (task);
+
+	g_usleep (10000);
+	g_assert (!iris_task_is_finished (task));
+
+	iris_task_cancel (task);
+
+	for (i = 0; i < 500 && !iris_task_is_finished (task); i++)
+		g_usleep (10000);
+
+	g_assert (iris_task_is_finished (task));
+	g_assert (iris_task_is_cancelled (task));
+
+	g_object_unref (task);
+
+	close (fds[0]);
+	close (fds[1]);
+	g_object_unref (scheduler);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+	g_type_init ();
+	g_test_init (&argc, &argv, NULL);
+	g_thread_init (NULL);
+
+	g_test_add_func ("/ioscheduler/watch1", test1);
+	g_test_add_func ("/ioscheduler/hangup1", test2);
+	g_test_add_func ("/ioscheduler/read-write1", test3);
+	g_test_add_func ("/ioscheduler/read-write2", test4);
+	g_test_add_func ("/ioscheduler/error1", test5);
+	g_test_add_func ("/ioscheduler/cancel1", test6);
+
+	return g_test_run ();
+}
@@ -67,12 +67,93 @@ test6 (void)
 	g_assert (iris_queue_get_length (queue) == 0);
 }
 
+static void
+test7 (void)
+{
+	IrisQueue *queue = iris_lfqueue_new ();
+	GTimeVal   tv;
+
+	g_get_current_time (&tv);
+	g_time_val_add (&tv, G_USEC_PER_SEC / 20);
+	g_assert (iris_queue_timed_pop (queue, &tv) == NULL);
+
+	g_object_unref (queue);
+}
+
+static gpointer
+test8_pusher (gpointer data)
+{
+	IrisQueue *queue = data;
+	gint       i;
+
+	for (i = 1; i <= 100; i++) {
+		if (i % 10 == 0)
+			g_usleep (G_USEC_PER_SEC / 1000);
+		iris_queue_push (queue, GINT_TO_POINTER (i));
+	}
+
+	return NULL;
+}
+
+static void
+test8 (void)
+{
+	IrisQueue *queue = iris_lfqueue_new ();
+	GThread   *thread;
+	gint       i;
+
+	thread = g_thread_create (test8_pusher, queue, TRUE, NULL);
+
+	for (i = 1; i <= 100; i++)
+		g_assert_cmpint (GPOINTER_TO_INT (iris_queue_pop (queue)), ==, i);
+
+	g_thread_join (thread);
+	g_assert (iris_queue_try_pop (queue) == NULL);
+	g_assert_cmpint (IRIS_LFQUEUE (queue)->priv->waiters, ==, 0);
+
+	g_object_unref (queue);
+}
+
 static void
 test9 (void)
 {
 	g_assert_cmpint (IRIS_TYPE_LFQUEUE, !=, G_TYPE_INVALID);
 }
 
+/* pop_many: test a batch pushed in one go comes out in order, whatever
+ * size of batches it is popped in.
+ */
+static void
+test10 (void)
+{
+	IrisQueue *queue = iris_lfqueue_new ();
+	gpointer   items[20];
+	gint       i, next = 1;
+	guint      n, j;
+
+	for (i = 0; i < 20; i++)
+		items[i] = GINT_TO_POINTER (i + 1);
+
+	g_assert_cmpint (iris_queue_push_many (queue, items, 20), ==, 20);
+	g_assert_cmpint (iris_queue_get_length (queue), ==, 20);
+
+	for (i = 1; (n = iris_queue_try_pop_many (queue, items, i)) > 0; i++) {
+		g_assert_cmpint (n, <=, i);
+		for (j = 0; j < n; j++)
+			g_assert_cmpint (GPOINTER_TO_INT (items[j]), ==, next++);
+	}
+
+	g_assert_cmpint (next, ==, 21);
+	g_assert_cmpint (iris_queue_get_length (queue), ==, 0);
+	g_assert (iris_queue_try_pop (queue) == NULL);
+
+	/* The queue still works once the last link popped is the dummy */
+	iris_queue_push (queue, GINT_TO_POINTER (1));
+	g_assert_cmpint (GPOINTER_TO_INT (iris_queue_try_pop (queue)), ==, 1);
+
+	g_object_unref (queue);
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -87,7 +168,10 @@ main (int   argc,
 	g_test_add_func ("/lfqueue/free", test4);
 	g_test_add_func ("/lfqueue/push_pop_empty", test5);
 	g_test_add_func ("/lfqueue/length", test6);
+	g_test_add_func ("/lfqueue/timed_pop_empty", test7);
+	g_test_add_func ("/lfqueue/blocking_pop", test8);
 	g_test_add_func ("/lfqueue/get_type", test9);
+	g_test_add_func ("/lfqueue/pop_many", test10);
 
 	return g_test_run ();
 }
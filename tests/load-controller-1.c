@@ -0,0 +1,265 @@
+#include <iris.h>
+
+/* Default controller decisions, from made up samples */
+static void
+test_update (void)
+{
+	IrisLoadController *controller;
+	IrisLoadSample      sample = { 0, };
+
+	controller = iris_load_controller_new_full (100, 100);
+	g_assert_cmpint (iris_load_controller_get_interval (controller), ==, 100);
+	g_assert_cmpint (iris_load_controller_get_target_latency (controller), ==, 100);
+
+	sample.min_threads = 1;
+	sample.max_threads = 8;
+	sample.interval = 100000;
+
+	/* Nothing to do: stay at the minimum */
+	sample.n_threads = 1;
+	g_assert_cmpint (iris_load_controller_update (controller, &sample), ==, 1);
+	g_assert_cmpint (iris_load_controller_get_latency (controller), ==, 0);
+
+	/* 100 items queued, 10 done per 100ms: one second of latency. Grow, but
+	 * no more than double at once.
+	 */
+	sample.n_threads = 2;
+	sample.queued = 100;
+	sample.completed = 10;
+	g_assert_cmpint (iris_load_controller_update (controller, &sample), ==, 4);
+	g_assert_cmpint (iris_load_controller_get_latency (controller), ==, 1000000);
+
+	/* Never above the maximum */
+	sample.n_threads = 6;
+	g_assert_cmpint (iris_load_controller_update (controller, &sample), ==, 8);
+
+	/* Work stuck in a queue counts even though nothing was completed */
+	g_object_unref (controller);
+	controller = iris_load_controller_new_full (100, 100);
+
+	sample.n_threads = 2;
+	sample.queued = 1;
+	sample.completed = 0;
+	sample.oldest_age = 500000;
+	g_assert_cmpint (iris_load_controller_update (controller, &sample), >, 2);
+
+	/* Comfortably under the target: give threads back one at a time, once
+	 * the estimate has decayed.
+	 */
+	sample.n_threads = 4;
+	sample.queued = 0;
+	sample.completed = 100;
+	sample.oldest_age = 0;
+	while (iris_load_controller_get_latency (controller) > 10000)
+		iris_load_controller_update (controller, &sample);
+	g_assert_cmpint (iris_load_controller_update (controller, &sample), ==, 3);
+
+	/* Near the target: hold steady */
+	sample.n_threads = 3;
+	sample.queued = 80;
+	sample.completed = 100;
+	g_assert_cmpint (iris_load_controller_update (controller, &sample), ==, 3);
+
+	g_object_unref (controller);
+}
+
+/* A controller that records what the default implementation decides */
+
+typedef struct
+{
+	IrisLoadController parent;
+
+	volatile gint n_threads;    /* Threads wanted at the last sample */
+	volatile gint max_threads;  /* Most threads ever wanted          */
+	volatile gint n_samples;
+	volatile gint n_in_target;  /* Consecutive samples within target */
+} TestController;
+
+typedef struct
+{
+	IrisLoadControllerClass parent_class;
+} TestControllerClass;
+
+static GType test_controller_get_type (void);
+
+G_DEFINE_TYPE (TestController, test_controller, IRIS_TYPE_LOAD_CONTROLLER)
+
+static guint
+test_controller_update (IrisLoadController   *controller,
+                        const IrisLoadSample *sample)
+{
+	TestController *test = (TestController *)controller;
+	guint           wanted;
+
+	wanted = IRIS_LOAD_CONTROLLER_CLASS (test_controller_parent_class)->update
+	           (controller, sample);
+
+	g_atomic_int_set (&test->n_threads, wanted);
+	if (wanted > g_atomic_int_get (&test->max_threads))
+		g_atomic_int_set (&test->max_threads, wanted);
+
+	if (iris_load_controller_get_latency (controller) <=
+	    iris_load_controller_get_target_latency (controller) * 1000)
+		g_atomic_int_inc (&test->n_in_target);
+	else
+		g_atomic_int_set (&test->n_in_target, 0);
+
+	g_atomic_int_inc (&test->n_samples);
+
+	return wanted;
+}
+
+static void
+test_controller_class_init (TestControllerClass *klass)
+{
+	IRIS_LOAD_CONTROLLER_CLASS (klass)->update = test_controller_update;
+}
+
+static void
+test_controller_init (TestController *controller)
+{
+}
+
+static gint work_done;
+
+static void
+work_cb (gpointer data)
+{
+	/* Sleeping rather than spinning, so that extra threads help even on a
+	 * machine with a single core.
+	 */
+	g_usleep (1000);
+	g_atomic_int_inc (&work_done);
+}
+
+/* Queues @per_tick 1ms items every 5ms for up to @usecs, or until @done
+ * returns TRUE.
+ */
+static void
+produce (IrisScheduler  *scheduler,
+         guint           per_tick,
+         gulong          usecs,
+         gboolean      (*done) (TestController *test),
+         TestController *test)
+{
+	GTimer *timer;
+	guint   i;
+
+	timer = g_timer_new ();
+
+	while (g_timer_elapsed (timer, NULL) * G_USEC_PER_SEC < usecs) {
+		for (i = 0; i < per_tick; i++)
+			iris_scheduler_queue (scheduler, work_cb, NULL, NULL);
+
+		if (done != NULL && done (test))
+			break;
+
+		g_usleep (5000);
+	}
+
+	g_timer_destroy (timer);
+}
+
+static gboolean
+grown_and_in_target (TestController *test)
+{
+	return g_atomic_int_get (&test->max_threads) >= 3 &&
+	       g_atomic_int_get (&test->n_in_target) >= 10;
+}
+
+static gboolean
+back_to_minimum (TestController *test)
+{
+	return g_atomic_int_get (&test->n_threads) == 1 &&
+	       g_atomic_int_get (&test->n_samples) > 5;
+}
+
+/* Step the load up and back down again, and check the scheduler follows */
+static void
+test_convergence (gconstpointer user_data)
+{
+	IrisScheduler  *(*scheduler_new) (guint, guint) = user_data;
+	IrisScheduler   *scheduler;
+	TestController  *test;
+
+	work_done = 0;
+
+	test = g_object_new (test_controller_get_type (), NULL);
+	iris_load_controller_set_interval (IRIS_LOAD_CONTROLLER (test), 20);
+	iris_load_controller_set_target_latency (IRIS_LOAD_CONTROLLER (test), 50);
+
+	scheduler = scheduler_new (1, 4);
+	iris_scheduler_set_load_controller (scheduler, IRIS_LOAD_CONTROLLER (test));
+	g_assert (iris_scheduler_get_load_controller (scheduler) ==
+	          IRIS_LOAD_CONTROLLER (test));
+
+	/* Light load, well within what one thread can do */
+	produce (scheduler, 1, G_USEC_PER_SEC / 2, NULL, test);
+	g_assert_cmpint (g_atomic_int_get (&test->n_samples), >, 0);
+	g_assert_cmpint (g_atomic_int_get (&test->max_threads), ==, 1);
+
+	/* Step up to about three threads' worth of work. The scheduler should
+	 * grow, and the latency settle back within the target while the load
+	 * keeps coming.
+	 */
+	produce (scheduler, 15, 10 * G_USEC_PER_SEC, grown_and_in_target, test);
+	g_assert_cmpint (g_atomic_int_get (&test->max_threads), >=, 3);
+	g_assert_cmpint (g_atomic_int_get (&test->n_in_target), >=, 10);
+
+	/* Step back down, and the extra threads should be given back */
+	g_atomic_int_set (&test->n_samples, 0);
+	produce (scheduler, 1, 10 * G_USEC_PER_SEC, back_to_minimum, test);
+	g_assert_cmpint (g_atomic_int_get (&test->n_threads), ==, 1);
+
+	g_object_unref (scheduler);
+	g_object_unref (test);
+}
+
+/* With no controller the scheduler never grows */
+static void
+test_none (void)
+{
+	IrisScheduler *scheduler;
+	guint          created;
+
+	work_done = 0;
+
+	scheduler = iris_scheduler_new_full (1, 4);
+	iris_scheduler_set_load_controller (scheduler, NULL);
+	g_assert (iris_scheduler_get_load_controller (scheduler) == NULL);
+
+	created = iris_scheduler_manager_get_created_thread_count ();
+
+	produce (scheduler, 15, G_USEC_PER_SEC / 2, NULL, NULL);
+
+	/* At most the one exclusive thread was needed */
+	g_assert_cmpint (iris_scheduler_manager_get_created_thread_count (), <=, created + 1);
+
+	while (g_atomic_int_get (&work_done) < 15)
+		g_usleep (1000);
+
+	g_object_unref (scheduler);
+}
+
+gint
+main (int   argc,
+      char *argv[])
+{
+	g_type_init ();
+	g_test_init (&argc, &argv, NULL);
+	g_thread_init (NULL);
+
+	g_test_add_func ("/load-controller/update", test_update);
+	g_test_add_data_func ("/load-controller/convergence",
+	                      iris_scheduler_new_full,
+	                      test_convergence);
+	g_test_add_data_func ("/load-controller/convergence lock-free",
+	                      iris_lfscheduler_new_full,
+	                      test_convergence);
+	g_test_add_data_func ("/load-controller/convergence work-stealing",
+	                      iris_wsscheduler_new_full,
+	                      test_convergence);
+	g_test_add_func ("/load-controller/none", test_none);
+
+	return g_test_run ();
+}
@@ -0,0 +1,254 @@
+#include <string.h>
+#include <iris.h>
+
+#define N_ITEMS 100000
+
+static gint counts [N_ITEMS];
+
+static IrisScheduler *
+scheduler_new (gint kind)
+{
+	if (kind == 0)
+		return iris_scheduler_new_full (4, 4);
+	else
+		return iris_wsscheduler_new_full (4, 4);
+}
+
+static void
+count_cb (gint64   begin,
+          gint64   end,
+          gpointer user_data)
+{
+	gint64 i;
+
+	for (i = begin; i < end; i++)
+		g_atomic_int_inc (&counts [i]);
+}
+
+/* for: test every index is visited exactly once, for each grain size */
+static void
+test1 (void)
+{
+	IrisScheduler *scheduler;
+	gint64         grains [] = { 0, 1, 7, 1000, N_ITEMS * 2 };
+	guint          g;
+	gint           kind,
+	               i;
+
+	for (kind = 0; kind < 2; kind++) {
+		scheduler = scheduler_new (kind);
+
+		for (g = 0; g < G_N_ELEMENTS (grains); g++) {
+			memset (counts, 0, sizeof (counts));
+
+			iris_parallel_for (scheduler, 0, N_ITEMS, grains [g], count_cb, NULL);
+
+			for (i = 0; i < N_ITEMS; i++)
+				g_assert_cmpint (counts [i], ==, 1);
+		}
+
+		g_object_unref (scheduler);
+	}
+}
+
+/* for: test an empty range does nothing */
+static void
+test2 (void)
+{
+	memset (counts, 0, sizeof (counts));
+
+	iris_parallel_for (NULL, 10, 10, 0, count_cb, NULL);
+	iris_parallel_for (NULL, 10, 5, 0, count_cb, NULL);
+
+	g_assert_cmpint (counts [5], ==, 0);
+	g_assert_cmpint (counts [10], ==, 0);
+}
+
+static gpointer
+sum_cb (gint64   begin,
+        gint64   end,
+        gpointer user_data)
+{
+	gint64 *sum = g_new0 (gint64, 1);
+	gint64  i;
+
+	for (i = begin; i < end; i++)
+		*sum += i;
+
+	return sum;
+}
+
+static gpointer
+sum_join_cb (gpointer left,
+             gpointer right,
+             gpointer user_data)
+{
+	*(gint64 *)left += *(gint64 *)right;
+	g_free (right);
+
+	return left;
+}
+
+static gpointer
+string_cb (gint64   begin,
+           gint64   end,
+           gpointer user_data)
+{
+	GString *string = g_string_new (NULL);
+	gint64   i;
+
+	for (i = begin; i < end; i++)
+		g_string_append_c (string, 'a' + i % 26);
+
+	return string;
+}
+
+static gpointer
+string_join_cb (gpointer left,
+                gpointer right,
+                gpointer user_data)
+{
+	g_string_append_len (left, ((GString *)right)->str, ((GString *)right)->len);
+	g_string_free (right, TRUE);
+
+	return left;
+}
+
+/* reduce: test results are combined, and in order */
+static void
+test3 (void)
+{
+	IrisScheduler *scheduler;
+	gint64        *sum;
+	GString       *string;
+	gint           kind,
+	               i;
+
+	for (kind = 0; kind < 2; kind++) {
+		scheduler = scheduler_new (kind);
+
+		sum = iris_parallel_reduce (scheduler, 0, N_ITEMS, 100,
+		                            sum_cb, sum_join_cb, NULL);
+		g_assert_cmpint (*sum, ==, (gint64)N_ITEMS * (N_ITEMS - 1) / 2);
+		g_free (sum);
+
+		string = iris_parallel_reduce (scheduler, 0, 1000, 3,
+		                               string_cb, string_join_cb, NULL);
+		g_assert_cmpint (string->len, ==, 1000);
+		for (i = 0; i < 1000; i++)
+			g_assert (string->str [i] == 'a' + i % 26);
+		g_string_free (string, TRUE);
+
+		g_assert (iris_parallel_reduce (scheduler, 0, 0, 0, sum_cb,
+		                                sum_join_cb, NULL) == NULL);
+
+		g_object_unref (scheduler);
+	}
+}
+
+static void
+nested_cb (gint64   begin,
+           gint64   end,
+           gpointer user_data)
+{
+	gint64 i;
+
+	for (i = begin; i < end; i++)
+		iris_parallel_for (user_data, i * 100, (i + 1) * 100, 10,
+		                   count_cb, NULL);
+}
+
+/* for: test loops can be nested, even on a scheduler with one thread */
+static void
+test4 (void)
+{
+	IrisScheduler *scheduler;
+	gint           i;
+
+	memset (counts, 0, sizeof (counts));
+
+	scheduler = iris_wsscheduler_new_full (1, 1);
+	iris_parallel_for (scheduler, 0, N_ITEMS / 100, 1, nested_cb, scheduler);
+
+	for (i = 0; i < N_ITEMS; i++)
+		g_assert_cmpint (counts [i], ==, 1);
+
+	g_object_unref (scheduler);
+}
+
+/* Throughput of iris_parallel_for() compared with queueing a work item per
+ * index, on an #IrisWSScheduler with a thread per CPU. Only run with -m perf.
+ */
+#define PERF_N_ITEMS 1000000
+
+static volatile gint perf_done;
+
+static void
+perf_item_cb (gpointer data)
+{
+	counts [GPOINTER_TO_INT (data) % N_ITEMS]++;
+	g_atomic_int_inc (&perf_done);
+}
+
+static void
+perf_range_cb (gint64   begin,
+               gint64   end,
+               gpointer user_data)
+{
+	gint64 i;
+
+	for (i = begin; i < end; i++)
+		counts [i % N_ITEMS]++;
+}
+
+static void
+test5 (void)
+{
+	IrisScheduler *scheduler;
+	GTimer        *timer;
+	gdouble        parallel_rate,
+	               queue_rate;
+	gint           n_cpus,
+	               i;
+
+	n_cpus = iris_scheduler_get_max_threads (iris_get_default_work_scheduler ());
+	scheduler = iris_wsscheduler_new_full (n_cpus, n_cpus);
+	timer = g_timer_new ();
+
+	g_timer_start (timer);
+	iris_parallel_for (scheduler, 0, PERF_N_ITEMS, 0, perf_range_cb, NULL);
+	parallel_rate = PERF_N_ITEMS / g_timer_elapsed (timer, NULL);
+
+	perf_done = 0;
+	g_timer_start (timer);
+	for (i = 0; i < PERF_N_ITEMS; i++)
+		iris_scheduler_queue (scheduler, perf_item_cb, GINT_TO_POINTER (i), NULL);
+	while (g_atomic_int_get (&perf_done) < PERF_N_ITEMS)
+		g_usleep (100);
+	queue_rate = PERF_N_ITEMS / g_timer_elapsed (timer, NULL);
+
+	g_test_maximized_result (parallel_rate, "iris_parallel_for: %.0f items/sec", parallel_rate);
+	g_test_maximized_result (queue_rate, "iris_scheduler_queue: %.0f items/sec", queue_rate);
+
+	g_timer_destroy (timer);
+	g_object_unref (scheduler);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+	g_type_init ();
+	g_test_init (&argc, &argv, NULL);
+	g_thread_init (NULL);
+
+	g_test_add_func ("/parallel/for1", test1);
+	g_test_add_func ("/parallel/for_empty1", test2);
+	g_test_add_func ("/parallel/reduce1", test3);
+	g_test_add_func ("/parallel/nested1", test4);
+
+	if (g_test_perf ())
+		g_test_add_func ("/parallel/throughput1", test5);
+
+	return g_test_run ();
+}
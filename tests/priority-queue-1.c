@@ -0,0 +1,245 @@
+#include <iris.h>
+
+static void
+test_new (void)
+{
+	IrisQueue *queue = iris_priority_queue_new ();
+	g_assert (queue != NULL);
+	g_assert (IRIS_IS_PRIORITY_QUEUE (queue));
+	g_assert (iris_queue_try_pop (queue) == NULL);
+	g_assert_cmpint (iris_queue_get_length (queue), ==, 0);
+	g_object_unref (queue);
+}
+
+static void
+test_push_pop (void)
+{
+	gint i;
+
+	IrisQueue *queue = iris_priority_queue_new ();
+	iris_queue_push (queue, &i);
+	g_assert_cmpint (iris_priority_queue_get_level_length
+	                   (IRIS_PRIORITY_QUEUE (queue), IRIS_PRIORITY_NORMAL), ==, 1);
+	g_assert (iris_queue_pop (queue) == &i);
+	g_assert (iris_queue_try_pop (queue) == NULL);
+	g_object_unref (queue);
+}
+
+/* Items come out most urgent level first, in FIFO order within a level */
+static void
+test_ordering (gconstpointer user_data)
+{
+	GType              level_type = GPOINTER_TO_SIZE (user_data);
+	IrisQueue         *queue;
+	IrisPriorityQueue *pqueue;
+	gint               i;
+
+	queue = iris_priority_queue_new_full (level_type);
+	pqueue = IRIS_PRIORITY_QUEUE (queue);
+
+	for (i = 1; i <= 3; i++) {
+		iris_priority_queue_push_full (pqueue, GINT_TO_POINTER (i + 20), IRIS_PRIORITY_LOW);
+		iris_priority_queue_push_full (pqueue, GINT_TO_POINTER (i + 10), IRIS_PRIORITY_NORMAL);
+		iris_priority_queue_push_full (pqueue, GINT_TO_POINTER (i), IRIS_PRIORITY_HIGH);
+	}
+
+	g_assert_cmpint (iris_queue_get_length (queue), ==, 9);
+
+	for (i = 1; i <= 3; i++)
+		g_assert_cmpint (GPOINTER_TO_INT (iris_queue_try_pop (queue)), ==, i);
+	for (i = 1; i <= 3; i++)
+		g_assert_cmpint (GPOINTER_TO_INT (iris_queue_try_pop (queue)), ==, i + 10);
+	for (i = 1; i <= 3; i++)
+		g_assert_cmpint (GPOINTER_TO_INT (iris_queue_pop (queue)), ==, i + 20);
+
+	g_assert (iris_queue_try_pop (queue) == NULL);
+	g_assert_cmpint (iris_queue_get_length (queue), ==, 0);
+
+	g_object_unref (queue);
+}
+
+/* A steady stream of high priority items must not starve the low level */
+static void
+test_aging (void)
+{
+	IrisQueue         *queue;
+	IrisPriorityQueue *pqueue;
+	gpointer           item;
+	gint               i;
+	gboolean           low_served = FALSE;
+
+	queue = iris_priority_queue_new ();
+	pqueue = IRIS_PRIORITY_QUEUE (queue);
+
+	iris_priority_queue_push_full (pqueue, GINT_TO_POINTER (2), IRIS_PRIORITY_LOW);
+
+	for (i = 0; i < 1000 && !low_served; i++) {
+		iris_priority_queue_push_full (pqueue, GINT_TO_POINTER (1), IRIS_PRIORITY_HIGH);
+		item = iris_queue_try_pop (queue);
+		g_assert (item != NULL);
+		if (GPOINTER_TO_INT (item) == 2)
+			low_served = TRUE;
+	}
+
+	g_assert (low_served);
+	g_assert_cmpint (iris_priority_queue_get_level_length (pqueue, IRIS_PRIORITY_LOW), ==, 0);
+
+	while (iris_queue_try_pop (queue) != NULL);
+	g_object_unref (queue);
+}
+
+static void
+test_try_pop_level (void)
+{
+	IrisQueue         *queue;
+	IrisPriorityQueue *pqueue;
+
+	queue = iris_priority_queue_new ();
+	pqueue = IRIS_PRIORITY_QUEUE (queue);
+
+	iris_priority_queue_push_full (pqueue, GINT_TO_POINTER (1), IRIS_PRIORITY_NORMAL);
+	g_assert (iris_priority_queue_try_pop_level (pqueue, IRIS_PRIORITY_HIGH) == NULL);
+
+	iris_priority_queue_push_full (pqueue, GINT_TO_POINTER (2), IRIS_PRIORITY_HIGH);
+	g_assert_cmpint (GPOINTER_TO_INT (iris_priority_queue_try_pop_level
+	                                    (pqueue, IRIS_PRIORITY_HIGH)), ==, 2);
+	g_assert_cmpint (GPOINTER_TO_INT (iris_queue_try_pop (queue)), ==, 1);
+
+	g_object_unref (queue);
+}
+
+/* try_pop_many: test a batch comes from the most urgent level only */
+static void
+test_try_pop_many (void)
+{
+	IrisQueue *queue = iris_priority_queue_new ();
+	gpointer   items[8];
+	gint       i;
+
+	for (i = 1; i <= 3; i++)
+		iris_queue_push (queue, GINT_TO_POINTER (i));
+	for (i = 4; i <= 5; i++)
+		iris_priority_queue_push_full (IRIS_PRIORITY_QUEUE (queue),
+		                               GINT_TO_POINTER (i),
+		                               IRIS_PRIORITY_HIGH);
+
+	g_assert_cmpint (iris_queue_try_pop_many (queue, items, 8), ==, 2);
+	g_assert_cmpint (GPOINTER_TO_INT (items[0]), ==, 4);
+	g_assert_cmpint (GPOINTER_TO_INT (items[1]), ==, 5);
+
+	g_assert_cmpint (iris_queue_try_pop_many (queue, items, 8), ==, 3);
+	for (i = 0; i < 3; i++)
+		g_assert_cmpint (GPOINTER_TO_INT (items[i]), ==, i + 1);
+
+	g_assert_cmpint (iris_queue_get_length (queue), ==, 0);
+	g_assert_cmpint (iris_queue_try_pop_many (queue, items, 8), ==, 0);
+
+	g_object_unref (queue);
+}
+
+static void
+test_closed (void)
+{
+	gpointer ptr;
+	gint     i;
+
+	IrisQueue *queue = iris_priority_queue_new ();
+
+	g_assert (iris_priority_queue_push_full (IRIS_PRIORITY_QUEUE (queue), &i,
+	                                         IRIS_PRIORITY_LOW) == TRUE);
+
+	iris_queue_close (queue);
+	g_assert (iris_queue_is_closed (queue) == TRUE);
+
+	g_assert (iris_priority_queue_push_full (IRIS_PRIORITY_QUEUE (queue), &i,
+	                                         IRIS_PRIORITY_HIGH) == FALSE);
+	g_assert_cmpint (iris_queue_get_length (queue), ==, 1);
+
+	ptr = iris_queue_pop (queue);
+	g_assert (ptr == &i);
+
+	ptr = iris_queue_pop (queue);
+	g_assert (ptr == NULL);
+
+	g_object_unref (queue);
+}
+
+static void
+test_try_pop_or_close (void)
+{
+	gint     i;
+	gpointer ptr;
+
+	IrisQueue *queue = iris_priority_queue_new ();
+
+	iris_queue_push (queue, &i);
+
+	ptr = iris_queue_try_pop_or_close (queue);
+	g_assert (ptr == &i);
+	g_assert (iris_queue_is_closed (queue) == FALSE);
+
+	ptr = iris_queue_try_pop_or_close (queue);
+	g_assert (ptr == NULL);
+	g_assert (iris_queue_is_closed (queue) == TRUE);
+
+	g_object_unref (queue);
+}
+
+static gpointer
+push_later (gpointer data)
+{
+	g_usleep (G_USEC_PER_SEC / 20);
+	iris_priority_queue_push_full (IRIS_PRIORITY_QUEUE (data),
+	                               GINT_TO_POINTER (1),
+	                               IRIS_PRIORITY_LOW);
+	return NULL;
+}
+
+/* A blocked pop must be woken by a push to any level */
+static void
+test_pop_wakeup (void)
+{
+	IrisQueue *queue;
+	GThread   *thread;
+	GTimeVal   timeout;
+	gpointer   item;
+
+	queue = iris_priority_queue_new ();
+
+	thread = g_thread_create (push_later, queue, TRUE, NULL);
+
+	g_get_current_time (&timeout);
+	g_time_val_add (&timeout, G_USEC_PER_SEC * 5);
+
+	item = iris_queue_timed_pop (queue, &timeout);
+	g_assert_cmpint (GPOINTER_TO_INT (item), ==, 1);
+
+	g_thread_join (thread);
+	g_object_unref (queue);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+	g_type_init ();
+	g_test_init (&argc, &argv, NULL);
+	g_thread_init (NULL);
+
+	g_test_add_func ("/priority-queue/new", test_new);
+	g_test_add_func ("/priority-queue/push_pop", test_push_pop);
+	g_test_add_data_func ("/priority-queue/ordering",
+	                      GSIZE_TO_POINTER (IRIS_TYPE_QUEUE),
+	                      test_ordering);
+	g_test_add_data_func ("/priority-queue/ordering lock-free",
+	                      GSIZE_TO_POINTER (IRIS_TYPE_LFQUEUE),
+	                      test_ordering);
+	g_test_add_func ("/priority-queue/aging", test_aging);
+	g_test_add_func ("/priority-queue/try_pop_level()", test_try_pop_level);
+	g_test_add_func ("/priority-queue/try_pop_many()", test_try_pop_many);
+	g_test_add_func ("/priority-queue/pop() closed", test_closed);
+	g_test_add_func ("/priority-queue/try_pop_or_close()", test_try_pop_or_close);
+	g_test_add_func ("/priority-queue/pop() wakeup", test_pop_wakeup);
+
+	return g_test_run ();
+}
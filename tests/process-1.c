@@ -40,6 +40,29 @@ wait_control_messages (IrisProcess *process)
 		g_thread_yield ();
 }
 
+/* Waits until @process knows of at least @total_items, for up to a second */
+static void
+wait_total_items (IrisProcess *process,
+                  gint         total_items)
+{
+	GTimer *timer;
+	gint    processed_items, current_total;
+
+	timer = g_timer_new ();
+
+	while (1) {
+		wait_control_messages (process);
+		iris_process_get_status (process, &processed_items, &current_total);
+
+		if (current_total >= total_items || g_timer_elapsed (timer, NULL) > 1.0)
+			break;
+
+		g_usleep (1000);
+	}
+
+	g_timer_destroy (timer);
+}
+
 static void
 dummy_func (IrisProcess *process,
             IrisMessage *work_item,
@@ -193,6 +216,50 @@ test_simple (void)
 	g_object_unref (process);
 }
 
+/* An open process that runs out of work should park its work function rather
+ * than keep re-queuing it, and be woken up again when more work arrives.
+ */
+static void
+test_idle (void)
+{
+	gint         counter = 0;
+	IrisProcess *process;
+	IrisMessage *work_item;
+	gint         i;
+
+	process = iris_process_new (counter_callback, NULL, NULL);
+	g_object_ref (process);
+
+	iris_process_run (process);
+
+	for (i=0; i < 10; i++) {
+		work_item = iris_message_new (0);
+		iris_message_set_pointer (work_item, "counter", &counter);
+		iris_process_enqueue (process, work_item);
+	}
+
+	while (g_atomic_int_get (&counter) < 10)
+		g_thread_yield ();
+
+	while (g_atomic_int_get (&process->priv->scheduled))
+		g_thread_yield ();
+
+	/* Should stay parked while there is nothing to do */
+	g_usleep (50000);
+	g_assert (g_atomic_int_get (&process->priv->scheduled) == FALSE);
+	g_assert (iris_process_is_finished (process) == FALSE);
+
+	enqueue_counter_work (process, &counter, 10);
+
+	while (! iris_process_is_finished (process))
+		g_thread_yield ();
+
+	g_assert_cmpint (counter, ==, 20);
+	g_assert (iris_process_has_succeeded (process) == TRUE);
+
+	g_object_unref (process);
+}
+
 static void
 test_cancel_creation (void)
 {
@@ -560,6 +627,69 @@ test_chaining_3 (void) {
 		g_thread_yield ();
 };
 
+/* chaining/throughput: time how long items take to pass down a chain of
+ * four processes, which mostly measures the cost of iris_process_forward().
+ */
+#define PERF_N_STAGES 4
+#define PERF_N_ITEMS  100000
+#define PERF_TIMEOUT  60.0 /* sec */
+
+static void
+test_chaining_throughput (void)
+{
+	IrisProcess  *process[PERF_N_STAGES];
+	IrisMessage  *message;
+	GTimer       *timer;
+	gdouble       per_item;
+	gboolean      alive;
+	int           i;
+	volatile int  counter = 0;
+
+	for (i = 0; i < PERF_N_STAGES; i++) {
+		process[i] = iris_process_new (push_next_func, NULL, NULL);
+		g_object_add_weak_pointer (G_OBJECT (process[i]),
+		                           (gpointer *)&process[i]);
+		if (i > 0)
+			iris_process_connect (process[i-1], process[i]);
+	}
+	iris_process_set_func (process[PERF_N_STAGES - 1], counter_callback, NULL, NULL);
+
+	timer = g_timer_new ();
+
+	iris_process_run (process[0]);
+
+	for (i = 0; i < PERF_N_ITEMS; i++) {
+		message = iris_message_new_items
+		            (1, "counter", G_TYPE_POINTER, &counter, NULL);
+		iris_process_enqueue (process[0], message);
+	}
+	iris_process_close (process[0]);
+
+	while (g_atomic_int_get (&counter) < PERF_N_ITEMS &&
+	       g_timer_elapsed (timer, NULL) < PERF_TIMEOUT)
+		g_usleep (100);
+
+	g_assert_cmpint (counter, ==, PERF_N_ITEMS);
+
+	per_item = g_timer_elapsed (timer, NULL) * G_USEC_PER_SEC / PERF_N_ITEMS;
+	g_test_minimized_result (per_item, "%i-stage chain: %.3f usec per item",
+	                         PERF_N_STAGES, per_item);
+
+	/* The chain frees itself once every process has finished */
+	do {
+		alive = FALSE;
+		for (i = 0; i < PERF_N_STAGES; i++)
+			if (process[i] != NULL)
+				alive = TRUE;
+		if (alive)
+			g_usleep (100);
+	} while (alive && g_timer_elapsed (timer, NULL) < PERF_TIMEOUT * 2);
+
+	g_assert (!alive);
+
+	g_timer_destroy (timer);
+}
+
 /* cancel/chain: Cancel a chain and make sure they all exit */
 static void
 test_cancel_chain (gconstpointer user_data) {
@@ -741,9 +871,9 @@ test_output_estimates_basic (void)
 		iris_process_get_status (process[0], &processed_items, &total_items);
 	while (total_items != 100);
 
-	/* Empty message loop to ensure CHAIN_ESTIMATE messages get through */
-	for (i=0; i<3; i++)
-		wait_control_messages (process[i]);
+	/* Estimates are sent from a timeout, so give them time to get through */
+	for (i=1; i<3; i++)
+		wait_total_items (process[i], 100);
 
 	iris_process_get_status (process[1], &processed_items, &total_items);
 	g_assert_cmpint (total_items, ==, 100);
@@ -869,6 +999,7 @@ int main(int argc, char *argv[]) {
 
 	g_test_add_func ("/process/lifecycle", test_lifecycle);
 	g_test_add_func ("/process/simple", test_simple);
+	g_test_add_func ("/process/idle", test_idle);
 	g_test_add_func_repeated ("/process/cancel/creation", 50, test_cancel_creation);
 	g_test_add_func_repeated ("/process/cancel/preparation", 50, test_cancel_preparation);
 	g_test_add_func_repeated ("/process/cancel/execution 1", 50, test_cancel_execution_1);
@@ -901,5 +1032,8 @@ int main(int argc, char *argv[]) {
 	g_test_add_func ("/process/output estimates low", test_output_estimates_low);
 	g_test_add_func_repeated ("/process/output estimates cancel", 50, test_output_estimates_cancel);
 
+	if (g_test_perf ())
+		g_test_add_func ("/process/chaining throughput", test_chaining_throughput);
+
 	return g_test_run();
 }
@@ -157,6 +157,40 @@ test_pop_closed_2 (void)
 
 
 
+/* try_pop_many: test batches come out in order, and a closed queue still
+ * gives up what was left in it.
+ */
+static void
+test_try_pop_many (void)
+{
+	IrisQueue *queue = iris_queue_new ();
+	gpointer   items[10];
+	gint       i;
+
+	g_assert_cmpint (iris_queue_try_pop_many (queue, items, 10), ==, 0);
+
+	for (i = 1; i <= 5; i++)
+		iris_queue_push (queue, GINT_TO_POINTER (i));
+
+	g_assert_cmpint (iris_queue_try_pop_many (queue, items, 3), ==, 3);
+	for (i = 0; i < 3; i++)
+		g_assert_cmpint (GPOINTER_TO_INT (items[i]), ==, i + 1);
+
+	g_assert_cmpint (iris_queue_try_pop_many (queue, items, 10), ==, 2);
+	g_assert_cmpint (GPOINTER_TO_INT (items[0]), ==, 4);
+	g_assert_cmpint (GPOINTER_TO_INT (items[1]), ==, 5);
+	g_assert_cmpint (iris_queue_get_length (queue), ==, 0);
+
+	iris_queue_push (queue, GINT_TO_POINTER (6));
+	iris_queue_close (queue);
+
+	g_assert_cmpint (iris_queue_try_pop_many (queue, items, 10), ==, 1);
+	g_assert_cmpint (GPOINTER_TO_INT (items[0]), ==, 6);
+	g_assert_cmpint (iris_queue_try_pop_many (queue, items, 10), ==, 0);
+
+	g_object_unref (queue);
+}
+
 static void
 test_try_pop_or_close (void)
 {
@@ -227,6 +261,7 @@ main (int   argc,
 
 	g_test_add_func ("/queue/pop() closed 1", test_pop_closed_1);
 	g_test_add_func ("/queue/pop() closed 2", test_pop_closed_2);
+	g_test_add_func ("/queue/try_pop_many()", test_try_pop_many);
 	g_test_add_func ("/queue/try_pop_or_close()", test_try_pop_or_close);
 	g_test_add_func ("/queue/timed_pop_or_close()", test_timed_pop_or_close);
 
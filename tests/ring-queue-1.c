@@ -0,0 +1,342 @@
+#include <iris.h>
+
+static void
+test_new (void)
+{
+	IrisQueue *queue;
+
+	queue = iris_ring_queue_new (100);
+	g_assert (IRIS_IS_RING_QUEUE (queue));
+	g_assert_cmpint (iris_ring_queue_get_capacity (IRIS_RING_QUEUE (queue)), ==, 128);
+	g_assert_cmpint (iris_ring_queue_get_mode (IRIS_RING_QUEUE (queue)), ==,
+	                 IRIS_RING_QUEUE_BLOCK);
+	g_assert (iris_queue_try_pop (queue) == NULL);
+	g_object_unref (queue);
+
+	/* Levels of a priority queue are made this way */
+	queue = g_object_new (IRIS_TYPE_RING_QUEUE, NULL);
+	g_assert_cmpint (iris_ring_queue_get_capacity (IRIS_RING_QUEUE (queue)), ==,
+	                 IRIS_RING_QUEUE_DEFAULT_CAPACITY);
+	g_object_unref (queue);
+}
+
+/* push_pop: test items come out in order, over several laps of the ring */
+static void
+test_push_pop (void)
+{
+	IrisQueue *queue = iris_ring_queue_new (4);
+	gint       lap, i;
+
+	for (lap = 0; lap < 10; lap++) {
+		for (i = 1; i <= 3; i++)
+			g_assert (iris_queue_push (queue, GINT_TO_POINTER (i)));
+		g_assert_cmpint (iris_queue_get_length (queue), ==, 3);
+
+		for (i = 1; i <= 3; i++)
+			g_assert_cmpint (GPOINTER_TO_INT (iris_queue_pop (queue)), ==, i);
+		g_assert_cmpint (iris_queue_get_length (queue), ==, 0);
+	}
+
+	g_assert (iris_queue_try_pop (queue) == NULL);
+	g_object_unref (queue);
+}
+
+/* try_pop_many: test a batch is taken in order across the end of the ring,
+ * and makes room for as many pushes.
+ */
+static void
+test_try_pop_many (void)
+{
+	IrisQueue *queue = iris_ring_queue_new_full (8, IRIS_RING_QUEUE_FAIL);
+	gpointer   items[8];
+	gint       i;
+
+	g_assert_cmpint (iris_queue_try_pop_many (queue, items, 8), ==, 0);
+
+	/* Start the batch near the end of the ring */
+	for (i = 0; i < 6; i++) {
+		g_assert (iris_queue_push (queue, GINT_TO_POINTER (i)));
+		g_assert (iris_queue_try_pop (queue) != NULL);
+	}
+
+	for (i = 1; i <= 8; i++)
+		g_assert (iris_queue_push (queue, GINT_TO_POINTER (i)));
+	g_assert (!iris_queue_push (queue, GINT_TO_POINTER (9)));
+
+	g_assert_cmpint (iris_queue_try_pop_many (queue, items, 5), ==, 5);
+	for (i = 0; i < 5; i++)
+		g_assert_cmpint (GPOINTER_TO_INT (items[i]), ==, i + 1);
+	g_assert_cmpint (iris_queue_get_length (queue), ==, 3);
+
+	for (i = 9; i <= 13; i++)
+		g_assert (iris_queue_push (queue, GINT_TO_POINTER (i)));
+
+	g_assert_cmpint (iris_queue_try_pop_many (queue, items, 8), ==, 8);
+	for (i = 0; i < 8; i++)
+		g_assert_cmpint (GPOINTER_TO_INT (items[i]), ==, i + 6);
+
+	g_object_unref (queue);
+}
+
+/* full: test the ways of pushing onto a full queue */
+static void
+test_full (void)
+{
+	IrisQueue *queue = iris_ring_queue_new_full (4, IRIS_RING_QUEUE_FAIL);
+	gpointer   items[6] = { GINT_TO_POINTER (1), GINT_TO_POINTER (2),
+	                        GINT_TO_POINTER (3), GINT_TO_POINTER (4),
+	                        GINT_TO_POINTER (5), GINT_TO_POINTER (6) };
+	GTimeVal   timeout;
+
+	g_assert_cmpint (iris_queue_push_many (queue, items, 6), ==, 4);
+	g_assert_cmpint (iris_queue_get_length (queue), ==, 4);
+
+	g_assert (!iris_queue_push (queue, items[4]));
+	g_assert (!iris_ring_queue_try_push (IRIS_RING_QUEUE (queue), items[4]));
+
+	g_get_current_time (&timeout);
+	g_time_val_add (&timeout, G_USEC_PER_SEC / 20);
+	g_assert (!iris_ring_queue_timed_push (IRIS_RING_QUEUE (queue), items[4],
+	                                       &timeout));
+
+	g_assert (iris_queue_pop (queue) == items[0]);
+	g_assert (iris_ring_queue_try_push (IRIS_RING_QUEUE (queue), items[4]));
+	g_assert_cmpint (iris_queue_get_length (queue), ==, 4);
+
+	g_object_unref (queue);
+}
+
+static gpointer
+test_blocking_push_pusher (gpointer data)
+{
+	IrisQueue *queue = data;
+	gint       i;
+
+	for (i = 1; i <= 1000; i++)
+		g_assert (iris_queue_push (queue, GINT_TO_POINTER (i)));
+
+	return NULL;
+}
+
+/* blocking_push: test a pusher waits for room rather than losing items */
+static void
+test_blocking_push (void)
+{
+	IrisQueue *queue = iris_ring_queue_new (8);
+	GThread   *thread;
+	gint       i;
+
+	thread = g_thread_create (test_blocking_push_pusher, queue, TRUE, NULL);
+
+	for (i = 1; i <= 1000; i++) {
+		if (i % 100 == 0)
+			g_usleep (G_USEC_PER_SEC / 1000);
+		g_assert_cmpint (GPOINTER_TO_INT (iris_queue_pop (queue)), ==, i);
+	}
+
+	g_thread_join (thread);
+	g_assert (iris_queue_try_pop (queue) == NULL);
+
+	g_object_unref (queue);
+}
+
+typedef struct
+{
+	IrisQueue     *queue;
+	volatile gint  sum;
+} MPMCTest;
+
+static gpointer
+test_mpmc_pusher (gpointer data)
+{
+	MPMCTest *test = data;
+	gint      i;
+
+	for (i = 1; i <= 10000; i++)
+		g_assert (iris_queue_push (test->queue, GINT_TO_POINTER (i)));
+
+	return NULL;
+}
+
+static gpointer
+test_mpmc_popper (gpointer data)
+{
+	MPMCTest *test = data;
+	gpointer  item;
+
+	while ((item = iris_queue_pop (test->queue)) != NULL)
+		g_atomic_int_add (&test->sum, GPOINTER_TO_INT (item));
+
+	return NULL;
+}
+
+/* mpmc: test every item gets through once with several of each at once */
+static void
+test_mpmc (void)
+{
+	MPMCTest  test;
+	GThread  *pushers[4],
+	         *poppers[4];
+	gint      i;
+
+	test.queue = iris_ring_queue_new (16);
+	test.sum = 0;
+
+	for (i = 0; i < 4; i++) {
+		poppers[i] = g_thread_create (test_mpmc_popper, &test, TRUE, NULL);
+		pushers[i] = g_thread_create (test_mpmc_pusher, &test, TRUE, NULL);
+	}
+
+	for (i = 0; i < 4; i++)
+		g_thread_join (pushers[i]);
+
+	/* Poppers drain the queue, then get NULL */
+	iris_queue_close (test.queue);
+
+	for (i = 0; i < 4; i++)
+		g_thread_join (poppers[i]);
+
+	g_assert_cmpint (test.sum, ==, 4 * (10000 * 10001 / 2));
+
+	g_object_unref (test.queue);
+}
+
+static gpointer
+test_close_pusher (gpointer data)
+{
+	return GINT_TO_POINTER (iris_queue_push (data, GINT_TO_POINTER (5)));
+}
+
+/* close: test closing wakes a pusher waiting for room, and pops still get
+ * what was left.
+ */
+static void
+test_close (void)
+{
+	IrisQueue *queue = iris_ring_queue_new (4);
+	GThread   *thread;
+	gint       i;
+
+	for (i = 1; i <= 4; i++)
+		g_assert (iris_queue_push (queue, GINT_TO_POINTER (i)));
+
+	thread = g_thread_create (test_close_pusher, queue, TRUE, NULL);
+	g_usleep (G_USEC_PER_SEC / 20);
+
+	iris_queue_close (queue);
+	g_assert (iris_queue_is_closed (queue));
+	g_assert (!GPOINTER_TO_INT (g_thread_join (thread)));
+
+	g_assert (!iris_queue_push (queue, GINT_TO_POINTER (6)));
+
+	for (i = 1; i <= 4; i++)
+		g_assert_cmpint (GPOINTER_TO_INT (iris_queue_pop (queue)), ==, i);
+	g_assert (iris_queue_pop (queue) == NULL);
+
+	g_object_unref (queue);
+}
+
+static void
+test_try_pop_or_close (void)
+{
+	IrisQueue *queue = iris_ring_queue_new (4);
+	gint       i;
+	GTimeVal   timeout;
+
+	iris_queue_push (queue, &i);
+	g_assert (iris_queue_try_pop_or_close (queue) == &i);
+	g_assert (!iris_queue_is_closed (queue));
+
+	g_assert (iris_queue_try_pop_or_close (queue) == NULL);
+	g_assert (iris_queue_is_closed (queue));
+	g_object_unref (queue);
+
+	queue = iris_ring_queue_new (4);
+	g_get_current_time (&timeout);
+	g_time_val_add (&timeout, G_USEC_PER_SEC / 20);
+
+	g_assert (iris_queue_timed_pop_or_close (queue, &timeout) == NULL);
+	g_assert (iris_queue_is_closed (queue));
+	g_object_unref (queue);
+}
+
+/* priority: test a bounded priority queue turns items away when full */
+static void
+test_priority (void)
+{
+	IrisQueue *queue = iris_priority_queue_new_bounded (2);
+	gint       i;
+
+	g_assert (iris_queue_push (queue, &i));
+	g_assert (iris_queue_push (queue, &i));
+	g_assert (!iris_queue_push (queue, &i));
+	g_assert (!iris_queue_is_closed (queue));
+
+	g_assert (iris_priority_queue_push_full (IRIS_PRIORITY_QUEUE (queue),
+	                                         &i, IRIS_PRIORITY_HIGH));
+
+	/* The urgent item comes first, and there is only room at the normal
+	 * level once one of its own items has gone.
+	 */
+	g_assert (iris_queue_pop (queue) == &i);
+	g_assert (!iris_queue_push (queue, &i));
+	g_assert (iris_queue_pop (queue) == &i);
+	g_assert (iris_queue_push (queue, &i));
+
+	g_object_unref (queue);
+}
+
+static void
+test_scheduler_cb (gpointer data)
+{
+	g_usleep (100);
+	g_atomic_int_inc ((volatile gint *)data);
+}
+
+/* scheduler: test work queued faster than it runs all runs, with the
+ * thread queues bounded.
+ */
+static void
+test_scheduler (void)
+{
+	IrisScheduler *scheduler;
+	volatile gint  counter = 0;
+	gint           i;
+
+	scheduler = iris_scheduler_new_full (1, 2);
+	iris_scheduler_set_queue_capacity (scheduler, 4);
+	g_assert_cmpint (iris_scheduler_get_queue_capacity (scheduler), ==, 4);
+
+	for (i = 0; i < 200; i++)
+		iris_scheduler_queue (scheduler, test_scheduler_cb,
+		                      (gpointer)&counter, NULL);
+
+	for (i = 0; i < 1000 && g_atomic_int_get (&counter) < 200; i++)
+		g_usleep (1000);
+
+	g_assert_cmpint (counter, ==, 200);
+
+	g_object_unref (scheduler);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+	g_type_init ();
+	g_test_init (&argc, &argv, NULL);
+	g_thread_init (NULL);
+
+	g_test_add_func ("/ring-queue/new", test_new);
+	g_test_add_func ("/ring-queue/push_pop", test_push_pop);
+	g_test_add_func ("/ring-queue/try_pop_many", test_try_pop_many);
+	g_test_add_func ("/ring-queue/full", test_full);
+	g_test_add_func ("/ring-queue/blocking_push", test_blocking_push);
+	g_test_add_func ("/ring-queue/mpmc", test_mpmc);
+	g_test_add_func ("/ring-queue/close", test_close);
+	g_test_add_func ("/ring-queue/try_pop_or_close()", test_try_pop_or_close);
+	g_test_add_func ("/ring-queue/priority", test_priority);
+	g_test_add_func ("/ring-queue/scheduler", test_scheduler);
+
+	return g_test_run ();
+}
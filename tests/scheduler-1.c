@@ -1,4 +1,11 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+
 #include <iris.h>
+#include <iris/iris-scheduler-private.h>
+#include <iris/iris-topology.h>
 #include <string.h>
 
 static void
@@ -65,6 +72,468 @@ test_queue (void)
 	}
 }
 
+static gint notify_counter;
+
+static void
+work_notify_cb (gpointer data)
+{
+	g_atomic_int_inc (&notify_counter);
+}
+
+/* queue batch: test all items queued in a batch execute and get freed, for
+ * each scheduler implementation */
+static void
+test_queue_batch (void)
+{
+	IrisScheduler          *scheduler;
+	IrisSchedulerBatchItem  items[WORK_COUNT];
+	gint                    n_threads,
+	                        kind,
+	                        i;
+
+	for (i=0; i<WORK_COUNT; i++) {
+		items[i].callback = work_register_cb;
+		items[i].data = GINT_TO_POINTER (i);
+		items[i].notify = work_notify_cb;
+	}
+
+	for (kind=0; kind<3; kind++) {
+		for (n_threads=1; n_threads<=2; n_threads++) {
+			counter = 0;
+			notify_counter = 0;
+			memset (exec_flag, 0, WORK_COUNT * sizeof(gint));
+
+			if (kind == 0)
+				scheduler = iris_scheduler_new_full (n_threads, n_threads);
+			else if (kind == 1)
+				scheduler = iris_lfscheduler_new_full (n_threads, n_threads);
+			else
+				scheduler = iris_wsscheduler_new_full (n_threads, n_threads);
+
+			iris_scheduler_queue_batch (scheduler, items, WORK_COUNT);
+
+			while (g_atomic_int_get (&notify_counter) < WORK_COUNT)
+				g_usleep (10000);
+
+			g_assert_cmpint (counter, ==, WORK_COUNT);
+			for (i=0; i<WORK_COUNT; i++)
+				g_assert (exec_flag[i]);
+
+			g_object_unref (scheduler);
+		}
+	}
+}
+
+static IrisThread *affinity_thread;
+static gint        affinity_moved;
+
+static void
+work_affinity_cb (gpointer data)
+{
+	if (affinity_thread != NULL && affinity_thread != iris_thread_get ())
+		g_atomic_int_inc (&affinity_moved);
+	affinity_thread = iris_thread_get ();
+
+	work_register_cb (data);
+}
+
+/* queue with affinity: test all items queued with an affinity execute and get
+ * freed, for each scheduler implementation, and that the work for one key
+ * stays on one thread of an #IrisScheduler while it keeps up */
+static void
+test_queue_with_affinity (void)
+{
+	IrisScheduler *scheduler;
+	gint           n_threads,
+	               kind,
+	               i;
+
+	for (kind=0; kind<3; kind++) {
+		for (n_threads=1; n_threads<=4; n_threads++) {
+			counter = 0;
+			notify_counter = 0;
+			memset (exec_flag, 0, WORK_COUNT * sizeof(gint));
+
+			if (kind == 0)
+				scheduler = iris_scheduler_new_full (n_threads, n_threads);
+			else if (kind == 1)
+				scheduler = iris_lfscheduler_new_full (n_threads, n_threads);
+			else
+				scheduler = iris_wsscheduler_new_full (n_threads, n_threads);
+
+			for (i=0; i<WORK_COUNT; i++)
+				iris_scheduler_queue_with_affinity (scheduler,
+				                                    GINT_TO_POINTER (i % 3 + 1),
+				                                    work_register_cb,
+				                                    GINT_TO_POINTER (i),
+				                                    work_notify_cb);
+
+			while (g_atomic_int_get (&notify_counter) < WORK_COUNT)
+				g_usleep (10000);
+
+			g_assert_cmpint (counter, ==, WORK_COUNT);
+			for (i=0; i<WORK_COUNT; i++)
+				g_assert (exec_flag[i]);
+
+			g_object_unref (scheduler);
+		}
+	}
+
+	/* The plain scheduler never moves work between threads, so one item at
+	 * a time for the same key always runs on the same thread.
+	 */
+	counter = 0;
+	affinity_thread = NULL;
+	affinity_moved = 0;
+	scheduler = iris_scheduler_new_full (4, 4);
+
+	for (i=0; i<WORK_COUNT; i++) {
+		iris_scheduler_queue_with_affinity (scheduler, scheduler,
+		                                    work_affinity_cb,
+		                                    GINT_TO_POINTER (i), NULL);
+		while (g_atomic_int_get (&counter) <= i)
+			g_usleep (100);
+	}
+
+	g_assert_cmpint (affinity_moved, ==, 0);
+	g_object_unref (scheduler);
+}
+
+/* affinity queue: test affinity keys only land on queues that are there
+ * when a scheduler has fewer threads than it has room for, and that only
+ * the keys of a queue that leaves or joins are moved */
+static void
+test_affinity_queue (void)
+{
+	IrisRRobin *rrobin;
+	gpointer    queue,
+	            before[WORK_COUNT];
+	gint        n_first = 0,
+	            n_moved = 0,
+	            i;
+
+	rrobin = iris_rrobin_new (8);
+	g_assert (iris_scheduler_get_affinity_queue (rrobin, rrobin) == NULL);
+
+	iris_rrobin_append (rrobin, GINT_TO_POINTER (1));
+	iris_rrobin_append (rrobin, GINT_TO_POINTER (2));
+
+	for (i=0; i<WORK_COUNT; i++) {
+		queue = iris_scheduler_get_affinity_queue (rrobin, &exec_flag[i]);
+		g_assert (queue == GINT_TO_POINTER (1) || queue == GINT_TO_POINTER (2));
+		g_assert (queue == iris_scheduler_get_affinity_queue (rrobin, &exec_flag[i]));
+		if (queue == GINT_TO_POINTER (1))
+			n_first++;
+	}
+
+	/* Both queues get some of the keys */
+	g_assert_cmpint (n_first, >, 0);
+	g_assert_cmpint (n_first, <, WORK_COUNT);
+
+	/* A third queue only takes keys, it doesn't shuffle the others */
+	for (i=0; i<WORK_COUNT; i++)
+		before[i] = iris_scheduler_get_affinity_queue (rrobin, &exec_flag[i]);
+
+	iris_rrobin_append (rrobin, GINT_TO_POINTER (3));
+
+	for (i=0; i<WORK_COUNT; i++) {
+		queue = iris_scheduler_get_affinity_queue (rrobin, &exec_flag[i]);
+		if (queue != before[i]) {
+			g_assert (queue == GINT_TO_POINTER (3));
+			n_moved++;
+		}
+	}
+
+	g_assert_cmpint (n_moved, >, 0);
+	g_assert_cmpint (n_moved, <, WORK_COUNT);
+
+	/* Taking it away again puts them back */
+	iris_rrobin_remove (rrobin, GINT_TO_POINTER (3));
+
+	for (i=0; i<WORK_COUNT; i++)
+		g_assert (iris_scheduler_get_affinity_queue (rrobin, &exec_flag[i]) ==
+		          before[i]);
+
+	/* The first slot is left empty */
+	iris_rrobin_remove (rrobin, GINT_TO_POINTER (1));
+
+	for (i=0; i<WORK_COUNT; i++)
+		g_assert (iris_scheduler_get_affinity_queue (rrobin, &exec_flag[i]) ==
+		          GINT_TO_POINTER (2));
+
+	iris_rrobin_unref (rrobin);
+}
+
+static gint blocker_state,
+            high_order;
+
+static void
+work_blocker_cb (gpointer data)
+{
+	g_atomic_int_set (&blocker_state, 1);
+	while (g_atomic_int_get (&blocker_state) != 2)
+		g_usleep (1000);
+}
+
+static void
+work_high_cb (gpointer data)
+{
+	high_order = g_atomic_int_get (&counter);
+	work_register_cb (data);
+}
+
+/* queue full: test work queued at high priority overtakes normal priority
+ * work that is already waiting, for each scheduler implementation */
+static void
+test_queue_full (void)
+{
+	IrisScheduler *scheduler;
+	gint           kind,
+	               i;
+
+	for (kind=0; kind<3; kind++) {
+		counter = 0;
+		blocker_state = 0;
+		high_order = -1;
+		memset (exec_flag, 0, WORK_COUNT * sizeof(gint));
+
+		if (kind == 0)
+			scheduler = iris_scheduler_new_full (1, 1);
+		else if (kind == 1)
+			scheduler = iris_lfscheduler_new_full (1, 1);
+		else
+			scheduler = iris_wsscheduler_new_full (1, 1);
+
+		/* Hold the only thread so the queue backs up */
+		iris_scheduler_queue (scheduler, work_blocker_cb, NULL, NULL);
+		while (g_atomic_int_get (&blocker_state) != 1)
+			g_usleep (1000);
+
+		for (i=0; i<WORK_COUNT-1; i++)
+			iris_scheduler_queue_full (scheduler, work_register_cb,
+			                           GINT_TO_POINTER (i), NULL,
+			                           i % 2 ? IRIS_PRIORITY_LOW : IRIS_PRIORITY_NORMAL);
+		iris_scheduler_queue_full (scheduler, work_high_cb,
+		                           GINT_TO_POINTER (WORK_COUNT-1), NULL,
+		                           IRIS_PRIORITY_HIGH);
+
+		g_atomic_int_set (&blocker_state, 2);
+
+		while (g_atomic_int_get (&counter) < WORK_COUNT)
+			g_usleep (10000);
+
+		g_assert_cmpint (high_order, ==, 0);
+		for (i=0; i<WORK_COUNT; i++)
+			g_assert (exec_flag[i]);
+
+		g_object_unref (scheduler);
+	}
+}
+
+static gint foreach_next;
+
+static gboolean
+foreach_unqueue_cb (IrisScheduler *scheduler,
+                    gpointer       work_item,
+                    IrisCallback   callback,
+                    gpointer       data,
+                    gpointer       user_data)
+{
+	gint n = GPOINTER_TO_INT (data);
+
+	if (callback != work_register_cb)
+		return TRUE;
+
+	/* Work is visited in the order it was queued */
+	g_assert_cmpint (n, ==, foreach_next);
+	foreach_next++;
+
+	if (n % 2 == 0)
+		g_assert (iris_scheduler_unqueue (scheduler, work_item));
+
+	return TRUE;
+}
+
+static gboolean
+foreach_count_cb (IrisScheduler *scheduler,
+                  gpointer       work_item,
+                  IrisCallback   callback,
+                  gpointer       data,
+                  gpointer       user_data)
+{
+	if (callback == work_register_cb) {
+		g_assert_cmpint (GPOINTER_TO_INT (data) % 2, ==, 1);
+		foreach_next++;
+	}
+
+	return TRUE;
+}
+
+/* foreach: test work is visited in order without being disturbed, and work
+ * unqueued from the callback is released straight away and never runs, for
+ * each scheduler implementation */
+static void
+test_foreach (void)
+{
+	IrisScheduler *scheduler;
+	gint           kind,
+	               i;
+
+	for (kind=0; kind<3; kind++) {
+		counter = 0;
+		notify_counter = 0;
+		blocker_state = 0;
+		foreach_next = 0;
+		memset (exec_flag, 0, WORK_COUNT * sizeof(gint));
+
+		if (kind == 0)
+			scheduler = iris_scheduler_new_full (1, 1);
+		else if (kind == 1)
+			scheduler = iris_lfscheduler_new_full (1, 1);
+		else
+			scheduler = iris_wsscheduler_new_full (1, 1);
+
+		iris_scheduler_queue (scheduler, work_blocker_cb, NULL, NULL);
+		while (g_atomic_int_get (&blocker_state) != 1)
+			g_usleep (1000);
+
+		for (i=0; i<WORK_COUNT; i++)
+			iris_scheduler_queue (scheduler, work_register_cb,
+			                      GINT_TO_POINTER (i), work_notify_cb);
+
+		iris_scheduler_foreach (scheduler, foreach_unqueue_cb, NULL);
+		g_assert_cmpint (foreach_next, ==, WORK_COUNT);
+		g_assert_cmpint (notify_counter, ==, WORK_COUNT / 2);
+
+		/* A second pass only sees the work that is left */
+		foreach_next = 0;
+		iris_scheduler_foreach (scheduler, foreach_count_cb, NULL);
+		g_assert_cmpint (foreach_next, ==, WORK_COUNT / 2);
+
+		g_atomic_int_set (&blocker_state, 2);
+
+		while (g_atomic_int_get (&notify_counter) < WORK_COUNT)
+			g_usleep (10000);
+
+		g_assert_cmpint (counter, ==, WORK_COUNT / 2);
+		for (i=0; i<WORK_COUNT; i++)
+			g_assert (exec_flag[i] == (i % 2 == 1));
+
+		g_object_unref (scheduler);
+	}
+}
+
+static void
+work_cpu_cb (gpointer data)
+{
+	gint *cpus = data;
+
+	cpus[0] = iris_thread_get ()->cpu;
+	cpus[1] = iris_topology_get_current_cpu ();
+	g_atomic_int_inc (&counter);
+}
+
+/* The first CPU we are allowed to run on, which need not be CPU 0 when the
+ * tests are run under taskset or in a cpuset.
+ */
+static guint
+first_allowed_cpu (void)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	guint     cpu;
+
+	if (sched_getaffinity (0, sizeof (set), &set) == 0)
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET (cpu, &set))
+				return cpu;
+#endif
+
+	return 0;
+}
+
+/* cpus: test threads of a scheduler restricted to a CPU are placed and run
+ * there, for each scheduler implementation */
+static void
+test_cpus (void)
+{
+	IrisScheduler *scheduler;
+	const guint   *sched_cpus;
+	guint          cpu = first_allowed_cpu (),
+	               n_cpus;
+	gint           work_cpus[2],
+	               kind;
+
+	for (kind=0; kind<3; kind++) {
+		counter = 0;
+
+		if (kind == 0)
+			scheduler = iris_scheduler_new_with_cpus (1, 1, &cpu, 1);
+		else if (kind == 1)
+			scheduler = iris_lfscheduler_new_with_cpus (1, 1, &cpu, 1);
+		else
+			scheduler = iris_wsscheduler_new_with_cpus (1, 1, &cpu, 1);
+
+		sched_cpus = iris_scheduler_get_cpus (scheduler, &n_cpus);
+		g_assert_cmpint (n_cpus, ==, 1);
+		g_assert_cmpint (sched_cpus[0], ==, cpu);
+
+		iris_scheduler_queue (scheduler, work_cpu_cb, work_cpus, NULL);
+
+		while (g_atomic_int_get (&counter) < 1)
+			g_usleep (1000);
+
+		g_assert_cmpint (work_cpus[0], ==, cpu);
+
+		/* -1 if the platform can't tell us */
+		g_assert (work_cpus[1] == -1 || work_cpus[1] == (gint)cpu);
+
+		g_object_unref (scheduler);
+	}
+}
+
+/* stats: test the counters of each scheduler implementation add up to the
+ * work that was done */
+static void
+test_stats (void)
+{
+	IrisScheduler      *scheduler;
+	IrisSchedulerStats  stats;
+	gint                kind,
+	                    i;
+
+	for (kind=0; kind<3; kind++) {
+		counter = 0;
+
+		if (kind == 0)
+			scheduler = iris_scheduler_new_full (2, 2);
+		else if (kind == 1)
+			scheduler = iris_lfscheduler_new_full (2, 2);
+		else
+			scheduler = iris_wsscheduler_new_full (2, 2);
+
+		iris_scheduler_get_stats (scheduler, &stats);
+		g_assert_cmpint (stats.executed, ==, 0);
+
+		for (i=0; i<WORK_COUNT; i++)
+			iris_scheduler_queue (scheduler, work_register_cb, GINT_TO_POINTER (i), NULL);
+
+		/* Items are counted just after they finish */
+		do {
+			g_usleep (1000);
+			iris_scheduler_get_stats (scheduler, &stats);
+		} while (stats.executed < WORK_COUNT);
+
+		g_assert_cmpint (stats.executed, ==, WORK_COUNT);
+		g_assert_cmpint (stats.n_threads, <=, 2);
+		g_assert_cmpint (stats.wakeups, >=, 1);
+		g_assert_cmpint (stats.busy_usec, >=, WORK_COUNT * 500);
+		g_assert_cmpint (stats.stolen_from, <=, stats.stolen);
+
+		g_object_unref (scheduler);
+	}
+}
+
 /* finalize: test threads are released to the scheduler */
 static void
 test_finalize (void)
@@ -73,6 +542,9 @@ test_finalize (void)
 	int            i, n_threads,
 	               spare_threads;
 
+	/* Don't let spare threads retire while we count them */
+	iris_scheduler_manager_set_idle_timeout (0);
+
 	for (n_threads=1; n_threads<20; n_threads++) {
 		scheduler = iris_scheduler_new_full (n_threads, n_threads);
 
@@ -88,6 +560,8 @@ test_finalize (void)
 		       spare_threads + n_threads)
 			g_thread_yield ();
 	}
+
+	iris_scheduler_manager_set_idle_timeout (5000);
 }
 
 gint
@@ -101,6 +575,13 @@ main (int   argc,
 	g_test_add_func ("/scheduler/default1", test1);
 
 	g_test_add_func ("/scheduler/queue()", test_queue);
+	g_test_add_func ("/scheduler/queue_batch()", test_queue_batch);
+	g_test_add_func ("/scheduler/queue_full()", test_queue_full);
+	g_test_add_func ("/scheduler/queue_with_affinity()", test_queue_with_affinity);
+	g_test_add_func ("/scheduler/affinity_queue", test_affinity_queue);
+	g_test_add_func ("/scheduler/foreach()", test_foreach);
+	g_test_add_func ("/scheduler/cpus", test_cpus);
+	g_test_add_func ("/scheduler/stats", test_stats);
 
 	g_test_add_func ("/scheduler/finalize", test_finalize);
 
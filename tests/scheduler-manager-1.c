@@ -48,6 +48,109 @@ main_context1 (void)
 	g_assert (counter == 100);
 }
 
+static gint work_counter;
+
+static void
+work_cb (gpointer data)
+{
+	g_atomic_int_inc (&work_counter);
+}
+
+/* retire: test idle threads are retired down to the minimum spare count */
+static void
+retire (void)
+{
+	IrisScheduler *scheduler;
+	guint          retired;
+	gint           i;
+
+	iris_scheduler_manager_set_idle_timeout (50);
+	iris_scheduler_manager_set_min_spare_threads (1);
+
+	g_assert_cmpint (iris_scheduler_manager_get_idle_timeout (), ==, 50);
+	g_assert_cmpint (iris_scheduler_manager_get_min_spare_threads (), ==, 1);
+
+	retired = iris_scheduler_manager_get_retired_thread_count ();
+
+	scheduler = iris_scheduler_new_full (3, 3);
+	for (i = 0; i < 10; i++)
+		iris_scheduler_queue (scheduler, work_cb, NULL, NULL);
+
+	while (g_atomic_int_get (&work_counter) < 10)
+		g_usleep (1000);
+
+	g_assert_cmpint (iris_scheduler_manager_get_created_thread_count (), >=, 3);
+
+	g_object_unref (scheduler);
+
+	/* The three threads go back to the pool, then all but one retire */
+	for (i = 0; i < 500; i++) {
+		if (iris_scheduler_manager_get_spare_thread_count () == 1 &&
+		    iris_scheduler_manager_get_retired_thread_count () >= retired + 2)
+			break;
+		g_usleep (10000);
+	}
+
+	g_assert_cmpint (iris_scheduler_manager_get_spare_thread_count (), ==, 1);
+	g_assert_cmpint (iris_scheduler_manager_get_retired_thread_count (), >=, retired + 2);
+
+	iris_scheduler_manager_set_idle_timeout (5000);
+	iris_scheduler_manager_set_min_spare_threads (0);
+}
+
+/* fair_share: test a capped pool is split by share, and threads are taken
+ * back from a scheduler over its share when another wants them.
+ */
+static void
+fair_share (void)
+{
+	IrisScheduler *big,
+	              *small;
+	gint           i;
+
+	iris_scheduler_manager_set_max_threads (4);
+
+	big = iris_scheduler_new_full (1, 4);
+	small = iris_scheduler_new_full (1, 4);
+
+	/* Only our requests change the number of threads */
+	iris_scheduler_set_load_controller (big, NULL);
+	iris_scheduler_set_load_controller (small, NULL);
+
+	iris_scheduler_set_share (big, 3);
+	g_assert_cmpint (iris_scheduler_get_share (big), ==, 3);
+	g_assert_cmpint (iris_scheduler_get_share (small), ==, 1);
+
+	iris_scheduler_queue (big, work_cb, NULL, NULL);
+	iris_scheduler_queue (small, work_cb, NULL, NULL);
+
+	/* While 'big' is quiet, 'small' can use the rest of the pool */
+	iris_scheduler_manager_request (small, 1, 100);
+	g_assert_cmpint (iris_scheduler_manager_get_fair_share (small), ==, 3);
+	g_assert_cmpint (iris_scheduler_manager_get_thread_count (small), ==, 3);
+
+	/* Once 'big' wants them, it gets three shares to one */
+	iris_scheduler_manager_request (big, 1, 100);
+	g_assert_cmpint (iris_scheduler_manager_get_fair_share (big), ==, 3);
+	g_assert_cmpint (iris_scheduler_manager_get_fair_share (small), ==, 1);
+
+	for (i = 0; i < 500; i++) {
+		if (iris_scheduler_manager_get_thread_count (small) == 1)
+			break;
+		g_usleep (10000);
+	}
+
+	g_assert_cmpint (iris_scheduler_manager_get_thread_count (small), ==, 1);
+
+	iris_scheduler_manager_request (big, 1, 100);
+	g_assert_cmpint (iris_scheduler_manager_get_thread_count (big), ==, 3);
+
+	g_object_unref (big);
+	g_object_unref (small);
+
+	iris_scheduler_manager_set_max_threads (0);
+}
+
 gint
 main (int   argc,
       char *argv[])
@@ -56,7 +159,10 @@ main (int   argc,
 	g_test_init (&argc, &argv, NULL);
 	g_thread_init (NULL);
 
+	/* First, so that no other scheduler is holding threads from the pool */
+	g_test_add_func ("/scheduler-manager/fair_share", fair_share);
 	g_test_add_func ("/scheduler-manager/main_context1", main_context1);
+	g_test_add_func ("/scheduler-manager/retire", retire);
 
 	return g_test_run ();
 }
@@ -0,0 +1,184 @@
+#include <iris.h>
+#include <iris/iris-spsc-queue-private.h>
+
+#define N_ITEMS 100000
+
+static void
+test_new (void)
+{
+	IrisQueue *queue;
+
+	queue = iris_spsc_queue_new ();
+	g_assert (IRIS_IS_SPSC_QUEUE (queue));
+	g_assert (iris_queue_try_pop (queue) == NULL);
+	g_assert_cmpint (iris_queue_get_length (queue), ==, 0);
+	g_object_unref (queue);
+}
+
+/* push_pop: test items come out in order, across several segments */
+static void
+test_push_pop (void)
+{
+	IrisQueue *queue = iris_spsc_queue_new ();
+	gint       round, i;
+
+	for (round = 0; round < 4; round++) {
+		for (i = 1; i <= IRIS_SPSC_SEGMENT_SIZE * 3 + 5; i++)
+			g_assert (iris_queue_push (queue, GINT_TO_POINTER (i)));
+		g_assert_cmpint (iris_queue_get_length (queue), ==,
+		                 IRIS_SPSC_SEGMENT_SIZE * 3 + 5);
+
+		for (i = 1; i <= IRIS_SPSC_SEGMENT_SIZE * 3 + 5; i++)
+			g_assert_cmpint (GPOINTER_TO_INT (iris_queue_pop (queue)), ==, i);
+		g_assert_cmpint (iris_queue_get_length (queue), ==, 0);
+	}
+
+	g_assert (iris_queue_try_pop (queue) == NULL);
+	g_object_unref (queue);
+}
+
+/* many: test push_many() and try_pop_many() keep the order when a batch
+ * spans two segments.
+ */
+static void
+test_many (void)
+{
+	IrisQueue *queue = iris_spsc_queue_new ();
+	gpointer   items[IRIS_SPSC_SEGMENT_SIZE];
+	gint       i;
+
+	for (i = 0; i < IRIS_SPSC_SEGMENT_SIZE - 3; i++) {
+		g_assert (iris_queue_push (queue, GINT_TO_POINTER (i + 1)));
+		g_assert (iris_queue_try_pop (queue) != NULL);
+	}
+
+	for (i = 0; i < 10; i++)
+		items[i] = GINT_TO_POINTER (i + 1);
+	g_assert_cmpint (iris_queue_push_many (queue, items, 10), ==, 10);
+
+	g_assert_cmpint (iris_queue_try_pop_many (queue, items, 4), ==, 4);
+	for (i = 0; i < 4; i++)
+		g_assert_cmpint (GPOINTER_TO_INT (items[i]), ==, i + 1);
+
+	g_assert_cmpint (iris_queue_try_pop_many (queue, items, 20), ==, 6);
+	for (i = 0; i < 6; i++)
+		g_assert_cmpint (GPOINTER_TO_INT (items[i]), ==, i + 5);
+
+	g_assert_cmpint (iris_queue_try_pop_many (queue, items, 20), ==, 0);
+
+	g_object_unref (queue);
+}
+
+static void
+test_try_pop_or_close (void)
+{
+	IrisQueue *queue = iris_spsc_queue_new ();
+	gint       i;
+	GTimeVal   timeout;
+
+	iris_queue_push (queue, &i);
+	g_assert (iris_queue_try_pop_or_close (queue) == &i);
+	g_assert (!iris_queue_is_closed (queue));
+
+	g_assert (iris_queue_try_pop_or_close (queue) == NULL);
+	g_assert (iris_queue_is_closed (queue));
+	g_assert (!iris_queue_push (queue, &i));
+	g_object_unref (queue);
+
+	queue = iris_spsc_queue_new ();
+	g_get_current_time (&timeout);
+	g_time_val_add (&timeout, G_USEC_PER_SEC / 20);
+
+	g_assert (iris_queue_timed_pop_or_close (queue, &timeout) == NULL);
+	g_assert (iris_queue_is_closed (queue));
+	g_object_unref (queue);
+}
+
+static gpointer
+test_threaded_producer (gpointer data)
+{
+	IrisQueue *queue = data;
+	gpointer   items[3];
+	gint       i;
+
+	for (i = 1; i <= N_ITEMS; ) {
+		if (i % 7 == 0 && i + 3 <= N_ITEMS + 1) {
+			items[0] = GINT_TO_POINTER (i);
+			items[1] = GINT_TO_POINTER (i + 1);
+			items[2] = GINT_TO_POINTER (i + 2);
+			g_assert_cmpint (iris_queue_push_many (queue, items, 3), ==, 3);
+			i += 3;
+		} else
+			g_assert (iris_queue_push (queue, GINT_TO_POINTER (i++)));
+
+		/* Let the consumer catch up and go to sleep now and then */
+		if (i % 10000 == 0)
+			g_usleep (G_USEC_PER_SEC / 1000);
+	}
+
+	iris_queue_close (queue);
+
+	return NULL;
+}
+
+/* threaded: test a producer and a consumer running at once, with the
+ * consumer blocking on an empty queue, see every item once and in order.
+ */
+static void
+test_threaded (void)
+{
+	IrisQueue *queue = iris_spsc_queue_new ();
+	GThread   *thread;
+	gpointer   item;
+	gint       next = 1;
+
+	thread = g_thread_create (test_threaded_producer, queue, TRUE, NULL);
+
+	while ((item = iris_queue_pop (queue)) != NULL)
+		g_assert_cmpint (GPOINTER_TO_INT (item), ==, next++);
+
+	g_assert_cmpint (next, ==, N_ITEMS + 1);
+
+	g_thread_join (thread);
+	g_object_unref (queue);
+}
+
+static gpointer
+test_close_consumer (gpointer data)
+{
+	return iris_queue_pop (data);
+}
+
+/* close: test closing wakes a sleeping consumer */
+static void
+test_close (void)
+{
+	IrisQueue *queue = iris_spsc_queue_new ();
+	GThread   *thread;
+
+	thread = g_thread_create (test_close_consumer, queue, TRUE, NULL);
+	g_usleep (G_USEC_PER_SEC / 20);
+
+	iris_queue_close (queue);
+	g_assert (g_thread_join (thread) == NULL);
+
+	g_object_unref (queue);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+	g_type_init ();
+	g_test_init (&argc, &argv, NULL);
+	g_thread_init (NULL);
+
+	g_test_add_func ("/spsc-queue/new", test_new);
+	g_test_add_func ("/spsc-queue/push_pop", test_push_pop);
+	g_test_add_func ("/spsc-queue/many", test_many);
+	g_test_add_func ("/spsc-queue/try_pop_or_close()", test_try_pop_or_close);
+	g_test_add_func ("/spsc-queue/threaded", test_threaded);
+	g_test_add_func ("/spsc-queue/close", test_close);
+
+	return g_test_run ();
+}
@@ -334,6 +334,67 @@ test_run_with_async_result (void)
 	g_object_unref (scheduler);
 }
 
+static void
+wait_work_cb (IrisTask *task,
+              gpointer  user_data)
+{
+	IRIS_TASK_RETURN_VALUE (task, G_TYPE_INT, 42);
+}
+
+static void
+wait_in_worker_cb (gpointer data)
+{
+	IrisScheduler *scheduler = data;
+	IrisTask      *task;
+	GValue         value = {0,};
+
+	task = iris_task_new_full (wait_work_cb, NULL, NULL, FALSE,
+	                           scheduler, scheduler, NULL);
+	g_object_ref (task);
+	iris_task_run (task);
+
+	/* The task's messages can only run on our own thread, so this would
+	 * never return if we didn't run them while we wait.
+	 */
+	iris_task_wait (task);
+
+	g_assert (iris_task_has_succeeded (task));
+	iris_task_get_result (task, &value);
+	g_assert_cmpint (g_value_get_int (&value), ==, 42);
+	g_value_unset (&value);
+
+	g_object_unref (task);
+	g_object_set_data (G_OBJECT (scheduler), "done", GINT_TO_POINTER (TRUE));
+}
+
+static gboolean
+wait_done_cb (gpointer data)
+{
+	return g_object_get_data (G_OBJECT (data), "done") != NULL;
+}
+
+/* wait: test a task can be waited for from outside a scheduler, and from
+ * inside the only thread of the scheduler that runs it */
+static void
+test_wait (void)
+{
+	IrisScheduler *scheduler = iris_scheduler_new_full (1, 1);
+	IrisTask      *task;
+
+	task = iris_task_new_full (wait_work_cb, NULL, NULL, FALSE,
+	                           scheduler, scheduler, NULL);
+	g_object_ref (task);
+	iris_task_run (task);
+	iris_task_wait (task);
+	g_assert (iris_task_is_finished (task));
+	g_object_unref (task);
+
+	iris_scheduler_queue (scheduler, wait_in_worker_cb, scheduler, NULL);
+	iris_scheduler_run_until (scheduler, wait_done_cb, scheduler);
+
+	g_object_unref (scheduler);
+}
+
 static void
 test18_cb (IrisTask *task,
            gpointer  user_data)
@@ -788,6 +849,7 @@ main (int   argc,
 	g_test_add_func ("/task/run", test_run);
 	g_test_add_func ("/task/run_with_async_result()", test_run_with_async_result);
 	g_test_add_func ("/task/add_callback1", test18);
+	g_test_add_func ("/task/wait", test_wait);
 	g_test_add_func ("/task/callback-errback1", test19);
 	g_test_add_func ("/task/callback-errback2", test20);
 	g_test_add_func ("/task/cancel in execution", test_cancel_execution);
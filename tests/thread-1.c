@@ -6,6 +6,93 @@ test1 (void)
 	g_assert_cmpint (IRIS_TYPE_THREAD, !=, G_TYPE_INVALID);
 }
 
+typedef struct
+{
+	IrisScheduler *scheduler;
+	volatile gint  released;
+	volatile gint  done;
+	guint          n_blocked;
+	guint          n_lent;
+	guint          n_threads;
+} BlockingTest;
+
+static void
+blocking_cb (gpointer data)
+{
+	BlockingTest *test = data;
+
+	iris_thread_enter_blocking ();
+	iris_thread_enter_blocking ();
+
+	/* Stands in for a read() that waits for the work queued after us */
+	while (!g_atomic_int_get (&test->released))
+		g_usleep (1000);
+
+	iris_thread_leave_blocking ();
+	iris_thread_leave_blocking ();
+
+	g_atomic_int_inc (&test->done);
+}
+
+static void
+release_cb (gpointer data)
+{
+	BlockingTest *test = data;
+
+	test->n_blocked = iris_scheduler_get_blocked_threads (test->scheduler);
+	test->n_lent = iris_scheduler_get_lent_threads (test->scheduler);
+	test->n_threads = iris_scheduler_manager_get_thread_count (test->scheduler);
+
+	g_atomic_int_set (&test->released, TRUE);
+	g_atomic_int_inc (&test->done);
+}
+
+/* blocking: test work queued behind a thread in a blocking region is run by
+ * a thread lent in its place, on schedulers with only one thread, and that
+ * the lent thread doesn't count as one of the scheduler's threads.
+ */
+static void
+test2 (void)
+{
+	BlockingTest test;
+	gint         kind,
+	             i;
+
+	/* Outside of a scheduler thread these do nothing */
+	iris_thread_enter_blocking ();
+	iris_thread_leave_blocking ();
+
+	for (kind = 0; kind < 2; kind++) {
+		test.scheduler = kind == 0 ? iris_scheduler_new_full (1, 1)
+		                           : iris_wsscheduler_new_full (1, 1);
+		test.released = FALSE;
+		test.done = 0;
+
+		iris_scheduler_queue (test.scheduler, blocking_cb, &test, NULL);
+		iris_scheduler_queue (test.scheduler, release_cb, &test, NULL);
+
+		for (i = 0; i < 500 && g_atomic_int_get (&test.done) < 2; i++)
+			g_usleep (10000);
+
+		g_assert_cmpint (test.done, ==, 2);
+		g_assert_cmpint (test.n_blocked, ==, 1);
+		g_assert_cmpint (test.n_lent, ==, 1);
+		g_assert_cmpint (test.n_threads, ==, 1);
+
+		/* The lent thread is given back once it sees it is not needed */
+		for (i = 0; i < 500; i++) {
+			if (iris_scheduler_get_lent_threads (test.scheduler) == 0)
+				break;
+			g_usleep (10000);
+		}
+
+		g_assert_cmpint (iris_scheduler_get_blocked_threads (test.scheduler), ==, 0);
+		g_assert_cmpint (iris_scheduler_get_lent_threads (test.scheduler), ==, 0);
+
+		g_object_unref (test.scheduler);
+	}
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -15,6 +102,7 @@ main (int   argc,
 	g_thread_init (NULL);
 
 	g_test_add_func ("/thread/get-type", test1);
+	g_test_add_func ("/thread/blocking", test2);
 
 	return g_test_run ();
 }
@@ -0,0 +1,294 @@
+#include <string.h>
+#include <iris.h>
+#include <iris/iris-thread-cache.h>
+
+#define N_OBJECTS   64
+#define OBJECT_SIZE 48
+#define N_MESSAGES  200000
+
+typedef struct
+{
+	gpointer       objects [N_OBJECTS];
+	volatile gint  done;
+	gboolean       reused;
+} CacheTest;
+
+static void
+run_and_wait (IrisScheduler *scheduler,
+              IrisCallback   callback,
+              CacheTest     *test)
+{
+	test->done = FALSE;
+	iris_scheduler_queue (scheduler, callback, test, NULL);
+
+	while (!g_atomic_int_get (&test->done))
+		g_usleep (1000);
+}
+
+static gboolean
+all_reused (gpointer *objects,
+            gpointer *old_objects)
+{
+	gint i, j;
+
+	for (i = 0; i < N_OBJECTS; i++) {
+		for (j = 0; j < N_OBJECTS; j++)
+			if (objects [i] == old_objects [j])
+				break;
+		if (j == N_OBJECTS)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+alloc_cb (gpointer data)
+{
+	CacheTest *test = data;
+	gpointer   old_objects [N_OBJECTS];
+	gint       i;
+
+	memcpy (old_objects, test->objects, sizeof (old_objects));
+
+	for (i = 0; i < N_OBJECTS; i++) {
+		test->objects [i] = iris_thread_cache_alloc0 (OBJECT_SIZE);
+		g_assert (test->objects [i] != NULL);
+		memset (test->objects [i], 0xaa, OBJECT_SIZE);
+	}
+
+	test->reused = all_reused (test->objects, old_objects);
+
+	g_atomic_int_set (&test->done, TRUE);
+}
+
+static void
+free_cb (gpointer data)
+{
+	CacheTest *test = data;
+	gint       i;
+
+	for (i = 0; i < N_OBJECTS; i++)
+		iris_thread_cache_free (test->objects [i]);
+
+	g_atomic_int_set (&test->done, TRUE);
+}
+
+/* Objects from a thread that is not an Iris thread come from GSlice */
+static void
+test1 (void)
+{
+	gpointer mem;
+
+	mem = iris_thread_cache_alloc0 (OBJECT_SIZE);
+	g_assert (mem != NULL);
+	iris_thread_cache_free (mem);
+
+	mem = iris_thread_cache_alloc (4096);
+	g_assert (mem != NULL);
+	iris_thread_cache_free (mem);
+}
+
+/* Objects freed by their owner are reused by it */
+static void
+test2 (void)
+{
+	IrisScheduler *scheduler;
+	CacheTest      test;
+
+	memset (&test, 0, sizeof (test));
+	scheduler = iris_scheduler_new_full (1, 1);
+
+	run_and_wait (scheduler, alloc_cb, &test);
+	run_and_wait (scheduler, free_cb, &test);
+	run_and_wait (scheduler, alloc_cb, &test);
+	g_assert (test.reused);
+
+	run_and_wait (scheduler, free_cb, &test);
+	g_object_unref (scheduler);
+}
+
+/* Objects freed by another thread go back to their owner */
+static void
+test3 (void)
+{
+	IrisScheduler *owner,
+	              *other;
+	CacheTest      test;
+
+	memset (&test, 0, sizeof (test));
+	owner = iris_scheduler_new_full (1, 1);
+	other = iris_scheduler_new_full (1, 1);
+
+	/* Use up the rest of the owner's free objects first, so that the next
+	 * allocations can only come from what the other thread sends back.
+	 */
+	run_and_wait (owner, alloc_cb, &test);
+	run_and_wait (other, free_cb, &test);
+	run_and_wait (owner, alloc_cb, &test);
+	g_assert (test.reused);
+
+	run_and_wait (other, free_cb, &test);
+	g_object_unref (owner);
+	g_object_unref (other);
+}
+
+/* Objects can be freed from any thread, including after their owner has
+ * exited, and the owner's slabs are freed with the last of them.
+ */
+static void
+test4 (void)
+{
+	IrisScheduler *scheduler;
+	CacheTest      test;
+	guint          orphans;
+	gint           i;
+
+	memset (&test, 0, sizeof (test));
+	orphans = iris_thread_cache_get_orphan_count ();
+	scheduler = iris_scheduler_new_full (1, 1);
+
+	run_and_wait (scheduler, alloc_cb, &test);
+
+	for (i = 0; i < N_OBJECTS / 2; i++)
+		iris_thread_cache_free (test.objects [i]);
+
+	g_object_unref (scheduler);
+
+	/* Retire every idle thread, so the owner exits with objects still out */
+	iris_scheduler_manager_set_min_spare_threads (0);
+	iris_scheduler_manager_set_idle_timeout (10);
+
+	for (i = 0; i < 500; i++) {
+		if (iris_scheduler_manager_get_spare_thread_count () == 0 &&
+		    iris_thread_cache_get_orphan_count () > orphans)
+			break;
+		g_usleep (10000);
+	}
+
+	g_assert_cmpint (iris_scheduler_manager_get_spare_thread_count (), ==, 0);
+	g_assert_cmpint (iris_thread_cache_get_orphan_count (), >, orphans);
+
+	/* The owner's cache is the only one waiting on these */
+	orphans = iris_thread_cache_get_orphan_count ();
+
+	for (i = N_OBJECTS / 2; i < N_OBJECTS - 1; i++)
+		iris_thread_cache_free (test.objects [i]);
+
+	g_assert_cmpint (iris_thread_cache_get_orphan_count (), ==, orphans);
+
+	iris_thread_cache_free (test.objects [i]);
+	g_assert_cmpint (iris_thread_cache_get_orphan_count (), ==, orphans - 1);
+
+	iris_scheduler_manager_set_idle_timeout (5000);
+}
+
+/* Cost of allocating a message on one thread and freeing it on another,
+ * with and without the cache. Only run with -m perf.
+ */
+typedef struct
+{
+	GAsyncQueue   *queue;
+	gboolean       use_cache;
+	volatile gint  done;
+} MessageTest;
+
+static void
+producer_cb (gpointer data)
+{
+	MessageTest *test = data;
+	gpointer     mem;
+	gint         i;
+
+	for (i = 0; i < N_MESSAGES; i++) {
+		if (test->use_cache)
+			mem = iris_thread_cache_alloc0 (OBJECT_SIZE);
+		else
+			mem = g_slice_alloc0 (OBJECT_SIZE);
+		g_async_queue_push (test->queue, mem);
+	}
+}
+
+static void
+consumer_cb (gpointer data)
+{
+	MessageTest *test = data;
+	gpointer     mem;
+	gint         i;
+
+	for (i = 0; i < N_MESSAGES; i++) {
+		mem = g_async_queue_pop (test->queue);
+		if (test->use_cache)
+			iris_thread_cache_free (mem);
+		else
+			g_slice_free1 (OBJECT_SIZE, mem);
+	}
+
+	g_atomic_int_set (&test->done, TRUE);
+}
+
+static gdouble
+run_messages (gboolean use_cache)
+{
+	IrisScheduler *producer,
+	              *consumer;
+	MessageTest    test;
+	GTimer        *timer;
+	gdouble        elapsed;
+
+	test.queue = g_async_queue_new ();
+	test.use_cache = use_cache;
+	test.done = FALSE;
+
+	producer = iris_scheduler_new_full (1, 1);
+	consumer = iris_scheduler_new_full (1, 1);
+
+	timer = g_timer_new ();
+
+	iris_scheduler_queue (consumer, consumer_cb, &test, NULL);
+	iris_scheduler_queue (producer, producer_cb, &test, NULL);
+
+	while (!g_atomic_int_get (&test.done))
+		g_usleep (1000);
+
+	elapsed = g_timer_elapsed (timer, NULL);
+
+	g_timer_destroy (timer);
+	g_object_unref (producer);
+	g_object_unref (consumer);
+	g_async_queue_unref (test.queue);
+
+	return elapsed * 1e9 / N_MESSAGES;
+}
+
+static void
+test5 (void)
+{
+	gdouble slice_cost,
+	        cache_cost;
+
+	slice_cost = run_messages (FALSE);
+	cache_cost = run_messages (TRUE);
+
+	g_test_minimized_result (slice_cost, "GSlice: %.1f ns/message", slice_cost);
+	g_test_minimized_result (cache_cost, "IrisThreadCache: %.1f ns/message", cache_cost);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+	g_type_init ();
+	g_test_init (&argc, &argv, NULL);
+	g_thread_init (NULL);
+
+	g_test_add_func ("/thread-cache/gslice1", test1);
+	g_test_add_func ("/thread-cache/local1", test2);
+	g_test_add_func ("/thread-cache/remote1", test3);
+	g_test_add_func ("/thread-cache/orphan1", test4);
+
+	if (g_test_perf ())
+		g_test_add_func ("/thread-cache/messages1", test5);
+
+	return g_test_run ();
+}
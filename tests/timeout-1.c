@@ -0,0 +1,221 @@
+#include <iris.h>
+
+typedef struct
+{
+	GTimer        *timer;
+	guint          msec;      /* When it was asked to run           */
+	volatile gint  runs;
+	gdouble        ran_at;    /* Seconds after queueing, first run   */
+	volatile gint  notified;
+} TestTimeout;
+
+static void
+timeout_cb (gpointer data)
+{
+	TestTimeout *test = data;
+
+	if (g_atomic_int_get (&test->runs) == 0)
+		test->ran_at = g_timer_elapsed (test->timer, NULL);
+
+	g_atomic_int_inc (&test->runs);
+}
+
+static void
+notify_cb (gpointer data)
+{
+	TestTimeout *test = data;
+
+	g_atomic_int_inc (&test->notified);
+}
+
+static void
+wait_notified (TestTimeout *tests,
+               guint        n_tests)
+{
+	guint i;
+
+	for (i = 0; i < n_tests; i++)
+		while (g_atomic_int_get (&tests[i].notified) == 0)
+			g_usleep (1000);
+}
+
+/* One-shot timeouts run once each, and never early */
+static void
+test_oneshot (void)
+{
+	IrisScheduler *scheduler;
+	IrisTimeout   *timeout;
+	TestTimeout    tests[4];
+	GTimer        *timer;
+	guint          delays[4] = { 0, 10, 30, 300 },
+	               i;
+
+	scheduler = iris_scheduler_new ();
+	timer = g_timer_new ();
+
+	for (i = 0; i < 4; i++) {
+		tests[i].timer = timer;
+		tests[i].msec = delays[i];
+		tests[i].runs = 0;
+		tests[i].notified = 0;
+
+		timeout = iris_scheduler_queue_timeout (scheduler, timeout_cb,
+		                                        &tests[i], notify_cb,
+		                                        delays[i]);
+		g_assert (timeout != NULL);
+		iris_timeout_unref (timeout);
+	}
+
+	wait_notified (tests, 4);
+
+	for (i = 0; i < 4; i++) {
+		g_assert_cmpint (tests[i].runs, ==, 1);
+		g_assert_cmpint (tests[i].notified, ==, 1);
+		g_assert_cmpfloat (tests[i].ran_at * 1000, >=, tests[i].msec);
+	}
+
+	g_timer_destroy (timer);
+	g_object_unref (scheduler);
+}
+
+/* Cancelled timeouts don't run, but are still notified */
+static void
+test_cancel (void)
+{
+	IrisScheduler *scheduler;
+	IrisTimeout   *timeout;
+	TestTimeout    test = { 0, };
+
+	scheduler = iris_scheduler_new ();
+	test.timer = g_timer_new ();
+
+	timeout = iris_scheduler_queue_timeout (scheduler, timeout_cb, &test,
+	                                        notify_cb, 50);
+	g_assert (iris_timeout_cancel (timeout) == TRUE);
+	g_assert_cmpint (test.notified, ==, 1);
+
+	/* A second cancel does nothing */
+	g_assert (iris_timeout_cancel (timeout) == FALSE);
+	iris_timeout_unref (timeout);
+
+	g_usleep (100000);
+	g_assert_cmpint (test.runs, ==, 0);
+	g_assert_cmpint (test.notified, ==, 1);
+
+	/* Nor does cancelling one that has already run */
+	test.notified = 0;
+	timeout = iris_scheduler_queue_timeout (scheduler, timeout_cb, &test,
+	                                        notify_cb, 1);
+	wait_notified (&test, 1);
+	g_assert (iris_timeout_cancel (timeout) == FALSE);
+	iris_timeout_unref (timeout);
+
+	g_assert_cmpint (test.runs, ==, 1);
+	g_assert_cmpint (test.notified, ==, 1);
+
+	g_timer_destroy (test.timer);
+	g_object_unref (scheduler);
+}
+
+/* Periodic timeouts run until they are cancelled */
+static void
+test_periodic (void)
+{
+	IrisScheduler *scheduler;
+	IrisTimeout   *timeout;
+	TestTimeout    test = { 0, };
+	gint           runs;
+
+	scheduler = iris_scheduler_new ();
+	test.timer = g_timer_new ();
+
+	timeout = iris_scheduler_queue_periodic (scheduler, timeout_cb, &test,
+	                                         notify_cb, 10);
+
+	while (g_atomic_int_get (&test.runs) < 5)
+		g_usleep (1000);
+
+	g_assert_cmpfloat (test.ran_at * 1000, >=, 10);
+	g_assert_cmpint (test.notified, ==, 0);
+
+	g_assert (iris_timeout_cancel (timeout) == TRUE);
+	iris_timeout_unref (timeout);
+
+	wait_notified (&test, 1);
+	runs = g_atomic_int_get (&test.runs);
+
+	g_usleep (50000);
+	g_assert_cmpint (g_atomic_int_get (&test.runs), ==, runs);
+	g_assert_cmpint (test.notified, ==, 1);
+
+	g_timer_destroy (test.timer);
+	g_object_unref (scheduler);
+}
+
+/* Lots of timeouts spread over several turns of the wheel, with some
+ * cancelled and some far in the future.
+ */
+static void
+test_many (void)
+{
+	IrisScheduler *scheduler;
+	IrisTimeout   *timeouts[500];
+	TestTimeout    tests[500];
+	GTimer        *timer;
+	guint          i;
+
+	scheduler = iris_scheduler_new ();
+	timer = g_timer_new ();
+
+	for (i = 0; i < 500; i++) {
+		tests[i].timer = timer;
+		tests[i].runs = 0;
+		tests[i].notified = 0;
+
+		if (i % 50 == 0)
+			/* Hours away, in the upper levels of the wheel */
+			tests[i].msec = G_MAXUINT - i;
+		else
+			tests[i].msec = g_random_int_range (0, 700);
+
+		timeouts[i] = iris_scheduler_queue_timeout (scheduler, timeout_cb,
+		                                            &tests[i], notify_cb,
+		                                            tests[i].msec);
+	}
+
+	for (i = 0; i < 500; i += 5)
+		iris_timeout_cancel (timeouts[i]);
+
+	wait_notified (tests, 500);
+
+	for (i = 0; i < 500; i++) {
+		if (i % 5 == 0)
+			g_assert_cmpint (tests[i].runs, ==, 0);
+		else {
+			g_assert_cmpint (tests[i].runs, ==, 1);
+			g_assert_cmpfloat (tests[i].ran_at * 1000, >=, tests[i].msec);
+		}
+
+		g_assert_cmpint (tests[i].notified, ==, 1);
+		iris_timeout_unref (timeouts[i]);
+	}
+
+	g_timer_destroy (timer);
+	g_object_unref (scheduler);
+}
+
+gint
+main (int   argc,
+      char *argv[])
+{
+	g_type_init ();
+	g_test_init (&argc, &argv, NULL);
+	g_thread_init (NULL);
+
+	g_test_add_func ("/timeout/oneshot", test_oneshot);
+	g_test_add_func ("/timeout/cancel", test_cancel);
+	g_test_add_func ("/timeout/periodic", test_periodic);
+	g_test_add_func ("/timeout/many", test_many);
+
+	return g_test_run ();
+}
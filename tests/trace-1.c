@@ -0,0 +1,154 @@
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include <iris.h>
+
+/* Waits up to a second for *counter to reach value */
+static gboolean
+wait_for_count (volatile gint *counter,
+                gint           value)
+{
+	gint i;
+
+	for (i = 0; i < 1000; i++) {
+		if (g_atomic_int_get (counter) >= value)
+			return TRUE;
+		g_usleep (1000);
+	}
+
+	return FALSE;
+}
+
+static void
+work_cb (gpointer data)
+{
+	g_atomic_int_inc ((volatile gint *)data);
+}
+
+static void
+message_cb (IrisMessage *message,
+            gpointer     data)
+{
+	g_atomic_int_inc ((volatile gint *)data);
+}
+
+static gchar *
+dump_to_string (void)
+{
+	GError *error = NULL;
+	gchar  *filename,
+	       *contents;
+	gint    fd;
+
+	fd = g_file_open_tmp ("iris-trace-XXXXXX", &filename, &error);
+	g_assert_no_error (error);
+	close (fd);
+
+	g_assert (iris_trace_dump (filename, &error));
+	g_assert_no_error (error);
+
+	g_assert (g_file_get_contents (filename, &contents, NULL, &error));
+	g_assert_no_error (error);
+
+	g_unlink (filename);
+	g_free (filename);
+
+	return contents;
+}
+
+/* start/stop: test the running state follows start and stop */
+static void
+test1 (void)
+{
+	g_assert (!iris_trace_is_running ());
+
+	iris_trace_start ();
+	g_assert (iris_trace_is_running ());
+
+	iris_trace_stop ();
+	g_assert (!iris_trace_is_running ());
+}
+
+/* dump: test work and messages run while tracing show up in the dump */
+static void
+test2 (void)
+{
+	IrisScheduler *scheduler;
+	IrisPort      *port;
+	volatile gint  n_work = 0,
+	               n_messages = 0;
+	gchar         *contents;
+	gint           i;
+
+	scheduler = iris_scheduler_new_full (1, 2);
+	port = iris_port_new ();
+	iris_arbiter_receive (scheduler, port, message_cb,
+	                      (gpointer)&n_messages, NULL);
+
+	iris_trace_start ();
+
+	for (i = 0; i < 10; i++) {
+		iris_scheduler_queue (scheduler, work_cb, (gpointer)&n_work, NULL);
+		iris_port_post (port, iris_message_new (1));
+	}
+
+	g_assert (wait_for_count (&n_work, 10));
+	g_assert (wait_for_count (&n_messages, 10));
+
+	iris_trace_stop ();
+
+	contents = dump_to_string ();
+
+	g_assert (g_str_has_prefix (contents, "{"));
+	g_assert (strstr (contents, "\"traceEvents\"") != NULL);
+	g_assert (strstr (contents, "\"name\":\"queue\"") != NULL);
+	g_assert (strstr (contents, "\"name\":\"run\"") != NULL);
+	g_assert (strstr (contents, "\"name\":\"post\"") != NULL);
+	g_assert (strstr (contents, "\"name\":\"deliver\"") != NULL);
+	g_assert (strstr (contents, "\"name\":\"handle\"") != NULL);
+
+	g_free (contents);
+	g_object_unref (port);
+	g_object_unref (scheduler);
+}
+
+/* stopped: test nothing is recorded while tracing is stopped */
+static void
+test3 (void)
+{
+	IrisScheduler *scheduler;
+	volatile gint  n_work = 0;
+	gchar         *contents;
+
+	/* Starting throws away what was recorded before */
+	iris_trace_start ();
+	iris_trace_stop ();
+
+	scheduler = iris_scheduler_new_full (1, 2);
+	iris_scheduler_queue (scheduler, work_cb, (gpointer)&n_work, NULL);
+	g_assert (wait_for_count (&n_work, 1));
+
+	contents = dump_to_string ();
+	g_assert (strstr (contents, "\"traceEvents\"") != NULL);
+	g_assert (strstr (contents, "\"name\":\"run\"") == NULL);
+
+	g_free (contents);
+	g_object_unref (scheduler);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+	g_type_init ();
+	g_test_init (&argc, &argv, NULL);
+	g_thread_init (NULL);
+	iris_init ();
+
+	g_test_add_func ("/trace/start-stop1", test1);
+	g_test_add_func ("/trace/dump1", test2);
+	g_test_add_func ("/trace/stopped1", test3);
+
+	return g_test_run ();
+}
@@ -101,12 +101,312 @@ test9 (void)
 	}
 }
 
+/* steal_many: test a thief takes half of what is queued, oldest first, and
+ * one stealing through a pop keeps the rest of its haul for itself.
+ */
+static void
+test14 (void)
+{
+	IrisQueue  *global;
+	IrisQueue  *queue;
+	IrisQueue  *thief;
+	IrisRRobin *rrobin;
+	gpointer    items[16];
+	gint        i;
+
+	global = iris_queue_new ();
+	rrobin = iris_rrobin_new (2);
+	queue = iris_wsqueue_new (global, rrobin);
+	thief = iris_wsqueue_new (global, rrobin);
+	iris_rrobin_append (rrobin, queue);
+	iris_rrobin_append (rrobin, thief);
+
+	for (i = 1; i <= 9; i++)
+		iris_wsqueue_local_push (IRIS_WSQUEUE (queue), GINT_TO_POINTER (i));
+
+	g_assert_cmpint (iris_wsqueue_try_steal_many (IRIS_WSQUEUE (queue), items, 16), ==, 5);
+	for (i = 0; i < 5; i++)
+		g_assert_cmpint (GPOINTER_TO_INT (items[i]), ==, i + 1);
+
+	g_assert_cmpint (iris_wsqueue_try_steal_many (IRIS_WSQUEUE (queue), items, 1), ==, 1);
+	g_assert_cmpint (GPOINTER_TO_INT (items[0]), ==, 6);
+
+	/* 7, 8 and 9 are left; the thief gets 7 and keeps 8 */
+	g_assert_cmpint (GPOINTER_TO_INT (iris_queue_try_pop (thief)), ==, 7);
+	g_assert_cmpint (iris_queue_get_length (thief), ==, 1);
+	g_assert_cmpint (GPOINTER_TO_INT (iris_wsqueue_local_pop (IRIS_WSQUEUE (thief))), ==, 8);
+	g_assert_cmpint (GPOINTER_TO_INT (iris_wsqueue_local_pop (IRIS_WSQUEUE (queue))), ==, 9);
+
+	g_object_unref (queue);
+	g_object_unref (thief);
+	g_object_unref (global);
+	iris_rrobin_unref (rrobin);
+}
+
 static void
 test10 (void)
 {
 	g_assert_cmpint (IRIS_TYPE_WSQUEUE, !=, G_TYPE_INVALID);
 }
 
+static void
+test11 (void)
+{
+	IrisQueue *queue;
+	gint i;
+
+	queue = iris_wsqueue_new (iris_queue_new (), iris_rrobin_new (1));
+	g_assert (queue);
+
+	for (i = 1; i <= 1025; i++)
+		iris_wsqueue_local_push (IRIS_WSQUEUE (queue), GINT_TO_POINTER (i));
+
+	g_assert_cmpint (iris_queue_get_length (queue), ==, 1025);
+	g_assert_cmpint (IRIS_WSQUEUE (queue)->priv->buffer->mask, >=, 1024);
+
+	/* oldest item is stolen first */
+	g_assert_cmpint (GPOINTER_TO_INT (iris_wsqueue_try_steal (IRIS_WSQUEUE (queue), 0)), ==, 1);
+
+	/* newest item is popped first, and the buffer shrinks as it drains */
+	for (i = 1025; i > 1; i--)
+		g_assert_cmpint (GPOINTER_TO_INT (iris_wsqueue_local_pop (IRIS_WSQUEUE (queue))), ==, i);
+
+	g_assert (iris_wsqueue_local_pop (IRIS_WSQUEUE (queue)) == NULL);
+	g_assert (iris_wsqueue_try_steal (IRIS_WSQUEUE (queue), 0) == NULL);
+	g_assert_cmpint (iris_queue_get_length (queue), ==, 0);
+	g_assert_cmpint (IRIS_WSQUEUE (queue)->priv->buffer->mask, <, 1024);
+
+	g_object_unref (queue);
+}
+
+#define STEAL_N_ITEMS   200000
+#define STEAL_N_THIEVES 3
+
+typedef struct
+{
+	IrisQueue     *queue;
+	volatile gint *seen;
+	volatile gint  done;
+	volatile gint  n_items;
+} StealTest;
+
+static gpointer
+steal_thread (gpointer data)
+{
+	StealTest *test = data;
+	gpointer   item;
+
+	while (!g_atomic_int_get (&test->done)) {
+		if ((item = iris_wsqueue_try_steal (IRIS_WSQUEUE (test->queue), 0)) != NULL) {
+			g_atomic_int_inc (&test->seen [GPOINTER_TO_INT (item) - 1]);
+			g_atomic_int_inc (&test->n_items);
+		}
+	}
+
+	return NULL;
+}
+
+static void
+test12 (void)
+{
+	StealTest  test;
+	GThread   *threads [STEAL_N_THIEVES];
+	gpointer   item;
+	gint       i;
+
+	test.queue = iris_wsqueue_new (iris_queue_new (), iris_rrobin_new (1));
+	test.seen = g_new0 (gint, STEAL_N_ITEMS);
+	test.done = FALSE;
+	test.n_items = 0;
+
+	for (i = 0; i < STEAL_N_THIEVES; i++)
+		threads [i] = g_thread_create (steal_thread, &test, TRUE, NULL);
+
+	/* push everything while the thieves are stealing, popping some of it
+	 * back locally so that the owner races the thieves for the bottom.
+	 */
+	for (i = 1; i <= STEAL_N_ITEMS; i++) {
+		iris_wsqueue_local_push (IRIS_WSQUEUE (test.queue), GINT_TO_POINTER (i));
+
+		if ((i % 3) == 0 &&
+		    (item = iris_wsqueue_local_pop (IRIS_WSQUEUE (test.queue))) != NULL) {
+			g_atomic_int_inc (&test.seen [GPOINTER_TO_INT (item) - 1]);
+			g_atomic_int_inc (&test.n_items);
+		}
+	}
+
+	while ((item = iris_wsqueue_local_pop (IRIS_WSQUEUE (test.queue))) != NULL) {
+		g_atomic_int_inc (&test.seen [GPOINTER_TO_INT (item) - 1]);
+		g_atomic_int_inc (&test.n_items);
+	}
+
+	g_atomic_int_set (&test.done, TRUE);
+
+	for (i = 0; i < STEAL_N_THIEVES; i++)
+		g_thread_join (threads [i]);
+
+	g_assert_cmpint (test.n_items, ==, STEAL_N_ITEMS);
+
+	for (i = 0; i < STEAL_N_ITEMS; i++)
+		g_assert_cmpint (test.seen [i], ==, 1);
+
+	g_free ((gpointer)test.seen);
+	g_object_unref (test.queue);
+}
+
+#define LAST_ITEM_N_ROUNDS 50000
+
+static gpointer
+steal_many_thread (gpointer data)
+{
+	StealTest *test = data;
+	gpointer   items[2];
+	guint      n_items, i;
+
+	while (!g_atomic_int_get (&test->done)) {
+		n_items = iris_wsqueue_try_steal_many (IRIS_WSQUEUE (test->queue), items, 2);
+		for (i = 0; i < n_items; i++) {
+			g_atomic_int_inc (&test->seen [GPOINTER_TO_INT (items[i]) - 1]);
+			g_atomic_int_inc (&test->n_items);
+		}
+	}
+
+	return NULL;
+}
+
+/* last_item_race: test the owner popping the only item while thieves try
+ * to steal it never lets both of them have it.
+ */
+static void
+test15 (void)
+{
+	StealTest  test;
+	GThread   *threads [STEAL_N_THIEVES];
+	gpointer   item;
+	gint       i;
+
+	test.queue = iris_wsqueue_new (iris_queue_new (), iris_rrobin_new (1));
+	test.seen = g_new0 (gint, LAST_ITEM_N_ROUNDS);
+	test.done = FALSE;
+	test.n_items = 0;
+
+	for (i = 0; i < STEAL_N_THIEVES; i++)
+		threads [i] = g_thread_create (i % 2 ? steal_many_thread : steal_thread,
+		                               &test, TRUE, NULL);
+
+	for (i = 1; i <= LAST_ITEM_N_ROUNDS; i++) {
+		iris_wsqueue_local_push (IRIS_WSQUEUE (test.queue), GINT_TO_POINTER (i));
+
+		if ((item = iris_wsqueue_local_pop (IRIS_WSQUEUE (test.queue))) != NULL) {
+			g_atomic_int_inc (&test.seen [GPOINTER_TO_INT (item) - 1]);
+			g_atomic_int_inc (&test.n_items);
+		}
+
+		/* If a thief got it, wait for it to be counted */
+		while (g_atomic_int_get (&test.n_items) < i)
+			g_thread_yield ();
+	}
+
+	g_atomic_int_set (&test.done, TRUE);
+
+	for (i = 0; i < STEAL_N_THIEVES; i++)
+		g_thread_join (threads [i]);
+
+	g_assert_cmpint (test.n_items, ==, LAST_ITEM_N_ROUNDS);
+
+	for (i = 0; i < LAST_ITEM_N_ROUNDS; i++)
+		g_assert_cmpint (test.seen [i], ==, 1);
+
+	g_free ((gpointer)test.seen);
+	g_object_unref (test.queue);
+}
+
+/* Throughput of the owner push/pop path racing thieves, compared with the
+ * lock-based #IrisQueue used the same way. Only run with -m perf.
+ */
+static gpointer
+throughput_thread (gpointer data)
+{
+	StealTest *test = data;
+
+	while (!g_atomic_int_get (&test->done)) {
+		if (IRIS_IS_WSQUEUE (test->queue)) {
+			if (iris_wsqueue_try_steal (IRIS_WSQUEUE (test->queue), 0))
+				g_atomic_int_inc (&test->n_items);
+		}
+		else if (iris_queue_try_pop (test->queue))
+			g_atomic_int_inc (&test->n_items);
+	}
+
+	return NULL;
+}
+
+static gdouble
+run_throughput (IrisQueue *queue)
+{
+	StealTest  test;
+	GThread   *threads [STEAL_N_THIEVES];
+	GTimer    *timer;
+	gdouble    elapsed;
+	gint       i;
+
+	test.queue = queue;
+	test.done = FALSE;
+	test.n_items = 0;
+
+	for (i = 0; i < STEAL_N_THIEVES; i++)
+		threads [i] = g_thread_create (throughput_thread, &test, TRUE, NULL);
+
+	timer = g_timer_new ();
+
+	for (i = 1; i <= STEAL_N_ITEMS * 10; i++) {
+		if (IRIS_IS_WSQUEUE (queue)) {
+			iris_wsqueue_local_push (IRIS_WSQUEUE (queue), GINT_TO_POINTER (i));
+			if ((i % 2) == 0 && iris_wsqueue_local_pop (IRIS_WSQUEUE (queue)))
+				g_atomic_int_inc (&test.n_items);
+		}
+		else {
+			iris_queue_push (queue, GINT_TO_POINTER (i));
+			if ((i % 2) == 0 && iris_queue_try_pop (queue))
+				g_atomic_int_inc (&test.n_items);
+		}
+	}
+
+	while (g_atomic_int_get (&test.n_items) < STEAL_N_ITEMS * 10) {
+		if (IRIS_IS_WSQUEUE (queue)) {
+			if (iris_wsqueue_local_pop (IRIS_WSQUEUE (queue)))
+				g_atomic_int_inc (&test.n_items);
+		}
+		else if (iris_queue_try_pop (queue))
+			g_atomic_int_inc (&test.n_items);
+	}
+
+	elapsed = g_timer_elapsed (timer, NULL);
+	g_atomic_int_set (&test.done, TRUE);
+
+	for (i = 0; i < STEAL_N_THIEVES; i++)
+		g_thread_join (threads [i]);
+
+	g_timer_destroy (timer);
+	g_object_unref (queue);
+
+	return (STEAL_N_ITEMS * 10) / elapsed;
+}
+
+static void
+test13 (void)
+{
+	gdouble ws_rate;
+	gdouble locked_rate;
+
+	ws_rate = run_throughput (iris_wsqueue_new (iris_queue_new (),
+	                                            iris_rrobin_new (1)));
+	locked_rate = run_throughput (iris_queue_new ());
+
+	g_test_maximized_result (ws_rate, "IrisWSQueue: %.0f items/sec", ws_rate);
+	g_test_maximized_result (locked_rate, "IrisQueue: %.0f items/sec", locked_rate);
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -123,6 +423,13 @@ main (int   argc,
 	g_test_add_func ("/wsqueue/timed_pop1", test8);
 	g_test_add_func ("/wsqueue/many_push1", test9);
 	g_test_add_func ("/wsqueue/get_type", test10);
+	g_test_add_func ("/wsqueue/grow_shrink1", test11);
+	g_test_add_func ("/wsqueue/steal_race1", test12);
+	g_test_add_func ("/wsqueue/steal_many1", test14);
+	g_test_add_func ("/wsqueue/last_item_race1", test15);
+
+	if (g_test_perf ())
+		g_test_add_func ("/wsqueue/throughput1", test13);
 
 	return g_test_run ();
 }